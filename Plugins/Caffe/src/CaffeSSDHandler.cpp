@@ -1,6 +1,7 @@
 #include "CaffeSSDHandler.hpp"
 #include "CaffeNetHandlerInfo.hpp"
 #include "helpers.hpp"
+#include <NMS.hpp>
 using namespace aq::Caffe;
 
 std::map<int, int> SSDHandler::CanHandleNetwork(const caffe::Net<float>& net) {
@@ -25,6 +26,7 @@ std::map<int, int> SSDHandler::CanHandleNetwork(const caffe::Net<float>& net) {
 
 void SSDHandler::handleOutput(const caffe::Net<float>& net, const std::vector<cv::Rect>& bounding_boxes, mo::ITParam<aq::SyncedMemory>& input_param, const std::vector<aq::DetectedObject2d>& objs) {
     (void)objs;
+    this->input_param = &input_param;
     auto output_blob = net.blob_by_name(output_blob_name);
     if (!output_blob)
         return;
@@ -42,7 +44,10 @@ void SSDHandler::handleOutput(const caffe::Net<float>& net, const std::vector<cv
 
     for (size_t i = 0; i < static_cast<size_t>(num_detections); ++i) {
         if ((detection_threshold.size() == 1 && confidence[static_cast<int>(i)][0] > detection_threshold[0]) || (labels[static_cast<int>(i)][0] < detection_threshold.size() && confidence[static_cast<int>(i)][0] > detection_threshold[static_cast<size_t>(labels[static_cast<int>(i)][0])])) {
-            size_t         num = static_cast<size_t>(roi_num[static_cast<int>(i)][0]);
+            size_t num = static_cast<size_t>(roi_num[static_cast<int>(i)][0]);
+            // The last minibatch of a frame can be partial, the network still holds the full batch
+            if (num >= bounding_boxes.size())
+                continue;
             DetectedObject obj;
             obj.bounding_box.x      = xmin[static_cast<int>(i)][0] * bounding_boxes[num].width + bounding_boxes[num].x;
             obj.bounding_box.y      = ymin[static_cast<int>(i)][0] * bounding_boxes[num].height + bounding_boxes[num].y;
@@ -51,34 +56,49 @@ void SSDHandler::handleOutput(const caffe::Net<float>& net, const std::vector<cv
             obj.timestamp           = input_param.getTimestamp();
             obj.framenumber         = input_param.getFrameNumber();
             obj.id                  = current_id++;
-            // Check all current objects iou value
-            bool append = true;
 
             if (this->labels && labels[static_cast<int>(i)][0] < this->labels->size())
                 obj.classification = Classification((*this->labels)[size_t(labels[static_cast<int>(i)][0])], confidence[static_cast<int>(i)][0], int(labels[static_cast<int>(i)][0]));
             else
                 obj.classification = Classification("", confidence[static_cast<int>(i)][0], int(labels[static_cast<int>(i)][0]));
-
-            for (auto itr = objects.begin(); itr != objects.end(); ++itr) {
-                float iou_val = iou(obj.bounding_box, itr->bounding_box);
-                if (iou_val > overlap_threshold) {
-                    if (obj.classification.confidence > itr->classification.confidence) {
-                        // Current object has higher prediction, replace
-                        *itr = obj;
-                    }
-                    append = false;
-                }
-            }
-            if (append)
-                objects.push_back(obj);
+            objects.push_back(obj);
         }
     }
     begin += output_blob->width() * output_blob->height() * num_detections;
     if (objects.size()) {
         MO_LOG(trace) << "Detected " << objects.size() << " objets in frame " << input_param.getFrameNumber();
     }
+    // Published in endBatch once every minibatch of the frame has been handled
+    detections.insert(detections.end(), objects.begin(), objects.end());
+    num_regions += bounding_boxes.size();
+}
 
-    detections_param.updateData(objects, mo::tag::_param = input_param, _ctx);
+void SSDHandler::startBatch() {
+    current_id  = 0;
+    num_regions = 0;
+    detections.clear();
+}
+
+void SSDHandler::endBatch(boost::optional<mo::Time_t> timestamp) {
+    // Merge overlapping detections across classes, keeping the most confident one
+    nms::Options options;
+    options.iou_threshold = overlap_threshold;
+    options.class_aware   = false;
+    options.prefilter     = detections.size() > 256 ? nms::SortAndSweep : nms::NoPrefilter;
+    nms::suppress(detections, options);
+    if (num_regions > 1) {
+        // Objects cut by a region border are detected partially in one region and fully in its neighbour
+        options.iou_threshold = seam_overlap_threshold;
+        options.metric        = nms::IntersectionOverMinimum;
+        nms::suppress(detections, options);
+    }
+    if (!input_param) {
+        detections_param.emitUpdate(timestamp, _ctx.get());
+        return;
+    }
+    std::vector<DetectedObject> merged;
+    merged.swap(detections);
+    detections_param.updateData(merged, mo::tag::_param = *input_param, _ctx);
 }
 
 MO_REGISTER_CLASS(SSDHandler)
@@ -9,12 +9,18 @@ namespace Caffe {
         MO_DERIVE(SSDHandler, NetHandler)
         PARAM(std::vector<float>, detection_threshold, { 0.75f })
         PARAM(float, overlap_threshold, 0.2f)
+        PARAM(float, seam_overlap_threshold, 0.7f)
+        TOOLTIP(seam_overlap_threshold, "When a frame is processed as several regions, detections whose intersection covers this fraction of the smaller box are merged")
         OUTPUT(std::vector<DetectedObject>, detections, std::vector<DetectedObject>())
         MO_END
-        virtual void startBatch() { current_id = 0; }
+        virtual void startBatch();
         virtual void handleOutput(const caffe::Net<float>& net, const std::vector<cv::Rect>& bounding_boxes,
             mo::ITParam<aq::SyncedMemory>& input_param, const std::vector<DetectedObject2d>& objs);
+        virtual void endBatch(boost::optional<mo::Time_t> timestamp);
         int current_id;
+        size_t num_regions = 0;
+        // Detections are published with the frame number and coordinate system of the network input
+        mo::ITParam<aq::SyncedMemory>* input_param = nullptr;
     };
 }
 }
@@ -61,3 +61,57 @@ bool AddBinary::processImpl()
 }
 
 MO_REGISTER_CLASS(AddBinary)
+
+bool Expression::processImpl()
+{
+    if (!_program || expression != _compiled_expression)
+    {
+        // Only log a bad expression once, not on every frame
+        if (expression == _compiled_expression)
+            return false;
+        _compiled_expression = expression;
+        try
+        {
+            _program = std::make_shared<expr::Program>(expr::Program::compile(expression));
+        }
+        catch (const std::exception& e)
+        {
+            _program.reset();
+            MO_LOG(warning) << "Invalid expression '" << expression << "': " << e.what();
+            return false;
+        }
+        MO_LOG(debug) << "Compiled '" << expression << "' into " << _program->size() << " instructions";
+    }
+    if (_program->usesB())
+    {
+        if (!b)
+        {
+            MO_LOG_EVERY_N(warning, 100) << "Expression uses b but b is not connected";
+            return false;
+        }
+        if (b->getSize() != a->getSize() || b->getChannels() != a->getChannels())
+        {
+            MO_LOG_EVERY_N(warning, 100) << "a and b need the same size and number of channels";
+            return false;
+        }
+    }
+    const int depth = _program->outputDepth(dtype.getValue());
+    const bool host = a->getSyncState() < SyncedMemory::DEVICE_UPDATED &&
+        (!_program->usesB() || b->getSyncState() < SyncedMemory::DEVICE_UPDATED);
+    if (host)
+    {
+        cv::Mat out;
+        _program->apply(a->getMat(stream()), _program->usesB() ? b->getMat(stream()) : cv::Mat(), out, depth);
+        output_param.updateData(out, a_param.getTimestamp(), _ctx.get());
+    }
+    else
+    {
+        cv::cuda::GpuMat out;
+        _program->apply(a->getGpuMat(stream()), _program->usesB() ? b->getGpuMat(stream()) : cv::cuda::GpuMat(), out,
+                        depth, stream());
+        output_param.updateData(out, a_param.getTimestamp(), _ctx.get());
+    }
+    return true;
+}
+
+MO_REGISTER_CLASS(Expression)
@@ -2,6 +2,8 @@
 
 #include <Aquila/nodes/Node.hpp>
 #include <Aquila/types/SyncedMemory.hpp>
+#include "Expression.hpp"
+#include <memory>
 
 namespace aq
 {
@@ -31,5 +33,26 @@ namespace nodes
     protected:
         bool processImpl();
     };
+
+    // Evaluates an elementwise expression of a and b in a single pass, replaces chains such as
+    // Subtract -> Scale -> ConvertTo -> Threshold that would each write out a full image
+    class Expression : public Node
+    {
+    public:
+        MO_DERIVE(Expression, Node)
+            INPUT(SyncedMemory, a, nullptr)
+            OPTIONAL_INPUT(SyncedMemory, b, nullptr)
+            PARAM(std::string, expression, "a")
+            TOOLTIP(expression, "eg clamp((a - 104) * 0.0039, 0, 1) > 0.5, supports + - * / < <= > >= == != abs sqrt min max clamp")
+            ENUM_PARAM(dtype, CV_32F, CV_8U, CV_8S, CV_16U, CV_16S, CV_32S, CV_64F)
+            TOOLTIP(dtype, "Output depth, comparisons always output a CV_8U mask")
+            OUTPUT(SyncedMemory, output, {})
+        MO_END
+    protected:
+        bool processImpl();
+
+        std::shared_ptr<expr::Program> _program;
+        std::string _compiled_expression;
+    };
 }
 }
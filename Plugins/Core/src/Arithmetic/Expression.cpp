@@ -0,0 +1,567 @@
+#include "Expression.hpp"
+#include <Aquila/rcc/external_includes/cv_cudaarithm.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+using namespace aq;
+using namespace aq::expr;
+
+namespace
+{
+    // Elements per tile, every register of the program is one tile of floats
+    const int tile = 1024;
+
+    inline bool isUnary(Op op) { return op >= Neg; }
+    inline bool isComparison(Op op) { return op >= Greater && op <= NotEqual; }
+
+    inline float evaluate(Op op, float a, float b)
+    {
+        switch (op)
+        {
+        case Add: return a + b;
+        case Sub: return a - b;
+        case Mul: return a * b;
+        case Div: return a / b;
+        case Min: return std::min(a, b);
+        case Max: return std::max(a, b);
+        case Greater: return a > b ? 1.0f : 0.0f;
+        case GreaterEqual: return a >= b ? 1.0f : 0.0f;
+        case Less: return a < b ? 1.0f : 0.0f;
+        case LessEqual: return a <= b ? 1.0f : 0.0f;
+        case Equal: return a == b ? 1.0f : 0.0f;
+        case NotEqual: return a != b ? 1.0f : 0.0f;
+        case Neg: return -a;
+        case Abs: return std::abs(a);
+        case Sqrt: return std::sqrt(a);
+        }
+        return 0.0f;
+    }
+
+#if CV_SIMD128
+    inline cv::v_float32x4 evaluate(Op op, const cv::v_float32x4& a, const cv::v_float32x4& b)
+    {
+        const cv::v_float32x4 one  = cv::v_setall_f32(1.0f);
+        const cv::v_float32x4 zero = cv::v_setzero_f32();
+        switch (op)
+        {
+        case Add: return a + b;
+        case Sub: return a - b;
+        case Mul: return a * b;
+        case Div: return a / b;
+        case Min: return cv::v_min(a, b);
+        case Max: return cv::v_max(a, b);
+        case Greater: return cv::v_select(a > b, one, zero);
+        case GreaterEqual: return cv::v_select(a >= b, one, zero);
+        case Less: return cv::v_select(a < b, one, zero);
+        case LessEqual: return cv::v_select(a <= b, one, zero);
+        case Equal: return cv::v_select(a == b, one, zero);
+        case NotEqual: return cv::v_select(a != b, one, zero);
+        case Neg: return zero - a;
+        case Abs: return cv::v_abs(a);
+        case Sqrt: return cv::v_sqrt(a);
+        }
+        return zero;
+    }
+#endif
+
+    // A null operand pointer means the constant is used instead.  The op is a template parameter so
+    // that the switch in evaluate folds away inside the loops.
+    typedef void (*Kernel_t)(const float* a, float ca, const float* b, float cb, float* dst, int n);
+
+    template <int OP>
+    void kernel(const float* a, float ca, const float* b, float cb, float* dst, int n)
+    {
+        const Op op = static_cast<Op>(OP);
+        int      i  = 0;
+#if CV_SIMD128
+        const cv::v_float32x4 vca = cv::v_setall_f32(ca);
+        const cv::v_float32x4 vcb = cv::v_setall_f32(cb);
+        if (a && b)
+        {
+            for (; i + 4 <= n; i += 4)
+                cv::v_store(dst + i, evaluate(op, cv::v_load(a + i), cv::v_load(b + i)));
+        }
+        else if (a)
+        {
+            for (; i + 4 <= n; i += 4)
+                cv::v_store(dst + i, evaluate(op, cv::v_load(a + i), vcb));
+        }
+        else
+        {
+            for (; i + 4 <= n; i += 4)
+                cv::v_store(dst + i, evaluate(op, vca, cv::v_load(b + i)));
+        }
+#endif
+        for (; i < n; ++i)
+            dst[i] = evaluate(op, a ? a[i] : ca, b ? b[i] : cb);
+    }
+
+    const Kernel_t kernels[] = {kernel<Add>, kernel<Sub>, kernel<Mul>, kernel<Div>, kernel<Min>,
+                                kernel<Max>, kernel<Greater>, kernel<GreaterEqual>, kernel<Less>,
+                                kernel<LessEqual>, kernel<Equal>, kernel<NotEqual>, kernel<Neg>,
+                                kernel<Abs>, kernel<Sqrt>};
+
+    typedef void (*Load_t)(const uchar* src, float* dst, int n);
+    typedef void (*Store_t)(const float* src, uchar* dst, int n, float scale);
+
+    template <class T>
+    void load(const uchar* src, float* dst, int n)
+    {
+        const T* ptr = reinterpret_cast<const T*>(src);
+        for (int i = 0; i < n; ++i)
+            dst[i] = static_cast<float>(ptr[i]);
+    }
+
+    template <class T>
+    void store(const float* src, uchar* dst, int n, float scale)
+    {
+        T* ptr = reinterpret_cast<T*>(dst);
+        if (scale == 1.0f)
+        {
+            for (int i = 0; i < n; ++i)
+                ptr[i] = cv::saturate_cast<T>(src[i]);
+        }
+        else
+        {
+            for (int i = 0; i < n; ++i)
+                ptr[i] = cv::saturate_cast<T>(src[i] * scale);
+        }
+    }
+
+    Load_t loadFunc(int depth)
+    {
+        switch (depth)
+        {
+        case CV_8U: return load<uchar>;
+        case CV_8S: return load<schar>;
+        case CV_16U: return load<ushort>;
+        case CV_16S: return load<short>;
+        case CV_32S: return load<int>;
+        case CV_32F: return load<float>;
+        case CV_64F: return load<double>;
+        default: return nullptr;
+        }
+    }
+
+    Store_t storeFunc(int depth)
+    {
+        switch (depth)
+        {
+        case CV_8U: return store<uchar>;
+        case CV_8S: return store<schar>;
+        case CV_16U: return store<ushort>;
+        case CV_16S: return store<short>;
+        case CV_32S: return store<int>;
+        case CV_32F: return store<float>;
+        case CV_64F: return store<double>;
+        default: return nullptr;
+        }
+    }
+
+    class ProgramBody : public cv::ParallelLoopBody
+    {
+    public:
+        ProgramBody(const std::vector<Instruction>& code_, int registers_, int result_, float scale_,
+                    const cv::Mat& a_, const cv::Mat& b_, bool uses_b_, cv::Mat& dst_)
+            : code(code_), registers(registers_), result(result_), scale(scale_), a(a_), b(b_), uses_b(uses_b_),
+              dst(dst_), load_a(loadFunc(a_.depth())), load_b(uses_b_ ? loadFunc(b_.depth()) : nullptr),
+              store_dst(storeFunc(dst_.depth()))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int n_row         = a.cols * a.channels();
+            const int tiles_per_row = (n_row + tile - 1) / tile;
+            cv::AutoBuffer<float>     buffer(static_cast<size_t>(registers) * tile);
+            float*                    base = buffer;
+            std::vector<float*>       write(static_cast<size_t>(registers));
+            std::vector<const float*> read(static_cast<size_t>(registers));
+            for (int r = 0; r < registers; ++r)
+                read[r] = write[r] = base + static_cast<size_t>(r) * tile;
+
+            for (int t = range.start; t < range.end; ++t)
+            {
+                const int y  = t / tiles_per_row;
+                const int x0 = (t % tiles_per_row) * tile;
+                const int n  = std::min(tile, n_row - x0);
+                // Float inputs are read in place, everything else is converted into its register
+                if (a.depth() == CV_32F)
+                    read[Program::InputA] = a.ptr<float>(y) + x0;
+                else
+                    load_a(a.ptr(y) + x0 * a.elemSize1(), write[Program::InputA], n);
+                if (uses_b)
+                {
+                    if (b.depth() == CV_32F)
+                        read[Program::InputB] = b.ptr<float>(y) + x0;
+                    else
+                        load_b(b.ptr(y) + x0 * b.elemSize1(), write[Program::InputB], n);
+                }
+                for (size_t i = 0; i < code.size(); ++i)
+                {
+                    const Instruction& ins = code[i];
+                    const float*       lhs = ins.lhs.isConstant() ? nullptr : read[ins.lhs.reg];
+                    const float*       rhs = ins.rhs.isConstant() ? nullptr : read[ins.rhs.reg];
+                    kernels[ins.op](lhs, ins.lhs.value, rhs, ins.rhs.value, write[ins.dst], n);
+                }
+                store_dst(read[result], dst.ptr(y) + x0 * dst.elemSize1(), n, scale);
+            }
+        }
+
+    private:
+        const std::vector<Instruction>& code;
+        int                             registers;
+        int                             result;
+        float                           scale;
+        const cv::Mat&                  a;
+        const cv::Mat&                  b;
+        bool                            uses_b;
+        cv::Mat&                        dst;
+        Load_t                          load_a;
+        Load_t                          load_b;
+        Store_t                         store_dst;
+    };
+
+    // Recursive descent over
+    //   comparison := additive [('>' | '>=' | '<' | '<=' | '==' | '!=') additive]
+    //   additive   := term {('+' | '-') term}
+    //   term       := unary {('*' | '/') unary}
+    //   unary      := ('-' | '+') unary | primary
+    //   primary    := number | 'a' | 'b' | function '(' comparison {',' comparison} ')' | '(' comparison ')'
+    // emitting code as it goes
+    class Parser
+    {
+    public:
+        Parser(const std::string& text_, Program& program_)
+            : text(text_), program(program_)
+        {
+        }
+
+        Operand parse()
+        {
+            skip();
+            if (pos == text.size())
+                error("empty expression");
+            Operand result = comparison();
+            skip();
+            if (pos != text.size())
+                error("unexpected '" + text.substr(pos, 1) + "'");
+            return result;
+        }
+
+    private:
+        void error(const std::string& msg) const
+        {
+            std::stringstream ss;
+            ss << msg << " at position " << pos;
+            throw std::runtime_error(ss.str());
+        }
+
+        void skip()
+        {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                ++pos;
+        }
+
+        bool accept(const char* token)
+        {
+            skip();
+            const size_t len = std::char_traits<char>::length(token);
+            if (text.compare(pos, len, token) != 0)
+                return false;
+            pos += len;
+            return true;
+        }
+
+        void expect(const char* token)
+        {
+            if (!accept(token))
+                error(std::string("expected '") + token + "'");
+        }
+
+        Operand comparison()
+        {
+            Operand lhs = additive();
+            // Two character operators first so that '>=' isn't read as '>'
+            static const char* tokens[] = {">=", "<=", "==", "!=", ">", "<"};
+            static const Op    ops[]    = {GreaterEqual, LessEqual, Equal, NotEqual, Greater, Less};
+            for (int i = 0; i < 6; ++i)
+            {
+                if (accept(tokens[i]))
+                    return program.emit(ops[i], lhs, additive());
+            }
+            return lhs;
+        }
+
+        Operand additive()
+        {
+            Operand lhs = term();
+            while (true)
+            {
+                if (accept("+"))
+                    lhs = program.emit(Add, lhs, term());
+                else if (accept("-"))
+                    lhs = program.emit(Sub, lhs, term());
+                else
+                    return lhs;
+            }
+        }
+
+        Operand term()
+        {
+            Operand lhs = unary();
+            while (true)
+            {
+                if (accept("*"))
+                    lhs = program.emit(Mul, lhs, unary());
+                else if (accept("/"))
+                    lhs = program.emit(Div, lhs, unary());
+                else
+                    return lhs;
+            }
+        }
+
+        Operand unary()
+        {
+            if (accept("-"))
+                return program.emit(Neg, unary());
+            if (accept("+"))
+                return unary();
+            return primary();
+        }
+
+        Operand primary()
+        {
+            skip();
+            if (accept("("))
+            {
+                Operand result = comparison();
+                expect(")");
+                return result;
+            }
+            if (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '.'))
+            {
+                const char* begin = text.c_str() + pos;
+                char*       end   = nullptr;
+                Operand     result;
+                result.value = std::strtof(begin, &end);
+                if (end == begin)
+                    error("invalid number");
+                pos += end - begin;
+                return result;
+            }
+            const size_t start = pos;
+            while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+                ++pos;
+            const std::string name = text.substr(start, pos - start);
+            if (name.empty())
+                error(pos < text.size() ? "unexpected '" + text.substr(pos, 1) + "'" : "unexpected end of expression");
+            if (name == "a" || name == "b")
+            {
+                Operand result;
+                result.reg = name == "a" ? Program::InputA : Program::InputB;
+                if (name == "b")
+                    program.useB();
+                return result;
+            }
+            if (name != "abs" && name != "sqrt" && name != "min" && name != "max" && name != "clamp")
+            {
+                pos = start;
+                error("unknown identifier '" + name + "'");
+            }
+            expect("(");
+            Operand result;
+            if (name == "abs" || name == "sqrt")
+            {
+                result = program.emit(name == "abs" ? Abs : Sqrt, comparison());
+            }
+            else if (name == "min" || name == "max")
+            {
+                Operand x = comparison();
+                expect(",");
+                result = program.emit(name == "min" ? Min : Max, x, comparison());
+            }
+            else
+            {
+                Operand x = comparison();
+                expect(",");
+                Operand lo = comparison();
+                expect(",");
+                Operand hi = comparison();
+                result     = program.emit(Min, program.emit(Max, x, lo), hi);
+            }
+            expect(")");
+            return result;
+        }
+
+        const std::string& text;
+        Program&           program;
+        size_t             pos = 0;
+    };
+
+    void applyDevice(Op op, cv::InputArray lhs, cv::InputArray rhs, cv::cuda::GpuMat& dst, cv::cuda::Stream& stream)
+    {
+        switch (op)
+        {
+        case Add: cv::cuda::add(lhs, rhs, dst, cv::noArray(), -1, stream); break;
+        case Sub: cv::cuda::subtract(lhs, rhs, dst, cv::noArray(), -1, stream); break;
+        case Mul: cv::cuda::multiply(lhs, rhs, dst, 1, -1, stream); break;
+        case Div: cv::cuda::divide(lhs, rhs, dst, 1, -1, stream); break;
+        case Min: cv::cuda::min(lhs, rhs, dst, stream); break;
+        case Max: cv::cuda::max(lhs, rhs, dst, stream); break;
+        case Neg: cv::cuda::multiply(lhs, cv::Scalar::all(-1), dst, 1, -1, stream); break;
+        case Abs: cv::cuda::abs(lhs, dst, stream); break;
+        case Sqrt: cv::cuda::sqrt(lhs, dst, stream); break;
+        default:
+        {
+            static const int cmp[] = {cv::CMP_GT, cv::CMP_GE, cv::CMP_LT, cv::CMP_LE, cv::CMP_EQ, cv::CMP_NE};
+            cv::cuda::GpuMat mask;
+            cv::cuda::compare(lhs, rhs, mask, cmp[op - Greater], stream);
+            mask.convertTo(dst, CV_MAKE_TYPE(CV_32F, mask.channels()), 1.0 / 255, stream);
+        }
+        }
+    }
+}
+
+Program Program::compile(const std::string& expression)
+{
+    Program program;
+    program.m_in_use.assign(2, true);
+    Parser parser(expression, program);
+    program.m_result = parser.parse();
+    return program;
+}
+
+int Program::allocate()
+{
+    for (size_t i = 2; i < m_in_use.size(); ++i)
+    {
+        if (!m_in_use[i])
+        {
+            m_in_use[i] = true;
+            return static_cast<int>(i);
+        }
+    }
+    m_in_use.push_back(true);
+    return static_cast<int>(m_in_use.size()) - 1;
+}
+
+void Program::release(const Operand& operand)
+{
+    if (operand.reg > InputB)
+        m_in_use[operand.reg] = false;
+}
+
+Operand Program::emit(Op op, const Operand& lhs, const Operand& rhs)
+{
+    const bool unary = isUnary(op);
+    Operand    out;
+    out.mask = isComparison(op);
+    if (lhs.isConstant() && (unary || rhs.isConstant()))
+    {
+        out.value = evaluate(op, lhs.value, rhs.value);
+        return out;
+    }
+    if (!unary && !out.mask)
+    {
+        if ((op == Add || op == Sub) && rhs.isConstant() && rhs.value == 0.0f)
+            return lhs;
+        if (op == Add && lhs.isConstant() && lhs.value == 0.0f)
+            return rhs;
+        if ((op == Mul || op == Div) && rhs.isConstant() && rhs.value == 1.0f)
+            return lhs;
+        if (op == Mul && lhs.isConstant() && lhs.value == 1.0f)
+            return rhs;
+        if (op == Div && rhs.isConstant())
+        {
+            Operand inverse = rhs;
+            inverse.value   = 1.0f / rhs.value;
+            return emit(Mul, lhs, inverse);
+        }
+    }
+    // Operands are consumed, so the destination can reuse one of their registers
+    release(lhs);
+    if (!unary)
+        release(rhs);
+    Instruction ins;
+    ins.op  = op;
+    ins.lhs = lhs;
+    ins.rhs = unary ? Operand() : rhs;
+    ins.dst = allocate();
+    out.reg = ins.dst;
+    m_code.push_back(ins);
+    return out;
+}
+
+void Program::apply(const cv::Mat& a, const cv::Mat& b, cv::Mat& dst, int depth) const
+{
+    CV_Assert(!m_uses_b || (a.size() == b.size() && a.channels() == b.channels()));
+    CV_Assert(loadFunc(a.depth()) != nullptr && storeFunc(depth) != nullptr);
+    const float scale = isMask() ? 255.0f : 1.0f;
+    dst.create(a.size(), CV_MAKE_TYPE(depth, a.channels()));
+    if (m_result.isConstant())
+    {
+        dst.setTo(cv::Scalar::all(m_result.value * scale));
+        return;
+    }
+    // Continuous images are processed as one long row so that tiles don't stop at row ends
+    const bool continuous = a.isContinuous() && dst.isContinuous() && (!m_uses_b || b.isContinuous());
+    const cv::Mat src_a   = continuous ? a.reshape(0, 1) : a;
+    const cv::Mat src_b   = m_uses_b && continuous ? b.reshape(0, 1) : b;
+    cv::Mat       out     = continuous ? dst.reshape(0, 1) : dst;
+    const int tiles = src_a.rows * ((src_a.cols * src_a.channels() + tile - 1) / tile);
+    // Small images aren't worth splitting
+    const int stripes = std::max(1, std::min(cv::getNumThreads() * 4, tiles / 16));
+    cv::parallel_for_(cv::Range(0, tiles),
+                      ProgramBody(m_code, static_cast<int>(m_in_use.size()), m_result.reg, scale, src_a, src_b,
+                                  m_uses_b, out),
+                      stripes);
+}
+
+void Program::apply(const cv::cuda::GpuMat& a, const cv::cuda::GpuMat& b, cv::cuda::GpuMat& dst, int depth,
+                    cv::cuda::Stream& stream) const
+{
+    CV_Assert(!m_uses_b || (a.size() == b.size() && a.channels() == b.channels()));
+    const int    type  = CV_MAKE_TYPE(depth, a.channels());
+    const double scale = isMask() ? 255.0 : 1.0;
+    if (m_result.isConstant())
+    {
+        dst.create(a.size(), type);
+        dst.setTo(cv::Scalar::all(m_result.value * scale), stream);
+        return;
+    }
+    std::vector<cv::cuda::GpuMat> regs(m_in_use.size());
+    const int float_type = CV_MAKE_TYPE(CV_32F, a.channels());
+    if (a.depth() == CV_32F)
+        regs[InputA] = a;
+    else
+        a.convertTo(regs[InputA], float_type, stream);
+    if (m_uses_b)
+    {
+        if (b.depth() == CV_32F)
+            regs[InputB] = b;
+        else
+            b.convertTo(regs[InputB], float_type, stream);
+    }
+    for (size_t i = 0; i < m_code.size(); ++i)
+    {
+        const Instruction& ins = m_code[i];
+        cv::cuda::GpuMat&  out = regs[ins.dst];
+        if (isUnary(ins.op))
+            applyDevice(ins.op, regs[ins.lhs.reg], cv::noArray(), out, stream);
+        else if (ins.lhs.isConstant())
+            applyDevice(ins.op, cv::Scalar::all(ins.lhs.value), regs[ins.rhs.reg], out, stream);
+        else if (ins.rhs.isConstant())
+            applyDevice(ins.op, regs[ins.lhs.reg], cv::Scalar::all(ins.rhs.value), out, stream);
+        else
+            applyDevice(ins.op, regs[ins.lhs.reg], regs[ins.rhs.reg], out, stream);
+    }
+    regs[m_result.reg].convertTo(dst, type, scale, stream);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/core/mat.hpp>
+
+#include <string>
+#include <vector>
+
+namespace aq
+{
+namespace expr
+{
+    // Elementwise expression over up to two images a and b, e.g. "clamp((a - 104) * 0.0039, 0, 1) > 0.5".
+    // Supports + - * /, unary -, comparisons (> >= < <= == !=), abs(x), sqrt(x), min(x, y), max(x, y)
+    // and clamp(x, lo, hi).  Comparisons evaluate to 1 or 0 inside the expression, an expression that
+    // ends in a comparison produces a CV_8U 255 / 0 mask like cv::compare.
+    //
+    // The expression is compiled into a short register program with constants folded.  On the host
+    // the program runs over tiles small enough that every intermediate stays in L1, so the inputs are
+    // read once and only the final result is written.
+    enum Op
+    {
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Min,
+        Max,
+        Greater,
+        GreaterEqual,
+        Less,
+        LessEqual,
+        Equal,
+        NotEqual,
+        Neg,
+        Abs,
+        Sqrt
+    };
+
+    struct Operand
+    {
+        int   reg   = -1; // register index, -1 for a constant
+        float value = 0.0f;
+        bool  mask  = false; // result of a comparison
+        bool isConstant() const { return reg < 0; }
+    };
+
+    struct Instruction
+    {
+        Op      op;
+        int     dst;
+        Operand lhs;
+        Operand rhs; // unused by unary ops
+    };
+
+    class Core_EXPORT Program
+    {
+    public:
+        // Register 0 holds a, register 1 holds b
+        static const int InputA = 0;
+        static const int InputB = 1;
+
+        // Throws std::runtime_error describing the position of a syntax error
+        static Program compile(const std::string& expression);
+
+        bool usesB() const { return m_uses_b; }
+        bool isMask() const { return m_result.mask; }
+        // Output depth given the requested one, masks are always CV_8U
+        int outputDepth(int requested) const { return isMask() ? CV_8U : requested; }
+        size_t size() const { return m_code.size(); }
+
+        // a and b must have the same size and channels, b is ignored unless usesB()
+        void apply(const cv::Mat& a, const cv::Mat& b, cv::Mat& dst, int depth) const;
+        // Device fallback, runs the program one instruction at a time with cudaarithm
+        void apply(const cv::cuda::GpuMat& a, const cv::cuda::GpuMat& b, cv::cuda::GpuMat& dst, int depth,
+                   cv::cuda::Stream& stream) const;
+
+        // Used by the compiler
+        Operand emit(Op op, const Operand& lhs, const Operand& rhs = Operand());
+        void    useB() { m_uses_b = true; }
+
+    private:
+        int  allocate();
+        void release(const Operand& operand);
+
+        std::vector<Instruction> m_code;
+        std::vector<bool>        m_in_use;
+        Operand                  m_result;
+        bool                     m_uses_b = false;
+    };
+}
+}
@@ -0,0 +1,239 @@
+#include "HostHistogram.hpp"
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace aq;
+
+namespace
+{
+    typedef void (*ToFloat_t)(const uchar* src, float* dst, int n);
+
+    template <class T>
+    void toFloat(const uchar* src, float* dst, int n)
+    {
+        const T* ptr = reinterpret_cast<const T*>(src);
+        for (int i = 0; i < n; ++i)
+            dst[i] = static_cast<float>(ptr[i]);
+    }
+
+    ToFloat_t toFloatFunc(int depth)
+    {
+        switch (depth)
+        {
+        case CV_8U: return toFloat<uchar>;
+        case CV_8S: return toFloat<schar>;
+        case CV_16U: return toFloat<ushort>;
+        case CV_16S: return toFloat<short>;
+        case CV_32S: return toFloat<int>;
+        case CV_32F: return toFloat<float>;
+        case CV_64F: return toFloat<double>;
+        default: return nullptr;
+        }
+    }
+
+    // idx[i] = bin of src[i] or -1 when it falls outside of [0, bins) and clamp isn't set
+    void uniformIndices(const float* src, int* idx, int n, float min, float scale, int bins, bool clamp)
+    {
+        int i = 0;
+#if CV_SIMD128
+        const cv::v_float32x4 vmin   = cv::v_setall_f32(min);
+        const cv::v_float32x4 vscale = cv::v_setall_f32(scale);
+        const cv::v_float32x4 vlow   = cv::v_setall_f32(-1.0f);
+        const cv::v_float32x4 vhigh  = cv::v_setall_f32(static_cast<float>(bins));
+        const cv::v_int32x4   vzero  = cv::v_setzero_s32();
+        const cv::v_int32x4   vlast  = cv::v_setall_s32(bins - 1);
+        const cv::v_int32x4   vnone  = cv::v_setall_s32(-1);
+        for (; i + 4 <= n; i += 4)
+        {
+            // Clamp in float first so that huge values can't wrap around in the conversion
+            cv::v_float32x4 f = cv::v_min(cv::v_max((cv::v_load(src + i) - vmin) * vscale, vlow), vhigh);
+            cv::v_int32x4   b = cv::v_floor(f);
+            if (clamp)
+                b = cv::v_min(cv::v_max(b, vzero), vlast);
+            else
+                b = cv::v_select((b < vzero) | (b > vlast), vnone, b);
+            cv::v_store(idx + i, b);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            const float f = std::min(std::max((src[i] - min) * scale, -1.0f), static_cast<float>(bins));
+            int         b = cvFloor(f);
+            if (clamp)
+                b = std::min(std::max(b, 0), bins - 1);
+            else if (b < 0 || b >= bins)
+                b = -1;
+            idx[i] = b;
+        }
+    }
+
+    void rangeIndices(const float* src, int* idx, int n, const std::vector<float>& levels)
+    {
+        const int bins = static_cast<int>(levels.size()) - 1;
+        for (int i = 0; i < n; ++i)
+        {
+            const int b = static_cast<int>(std::upper_bound(levels.begin(), levels.end(), src[i]) - levels.begin()) - 1;
+            idx[i]      = (b >= 0 && b < bins) ? b : -1;
+        }
+    }
+
+    struct Params
+    {
+        int                bins   = 0;
+        float              min    = 0.0f;
+        float              scale  = 1.0f;
+        bool               clamp  = false;
+        bool               direct = false; // 8 bit value is the bin
+        std::vector<float> levels;         // non uniform bins when not empty
+    };
+
+    class BinBody : public cv::ParallelLoopBody
+    {
+    public:
+        BinBody(const cv::Mat& in_, const Params& params_, int stripes_, std::vector<int>& partials_)
+            : in(in_), params(params_), stripes(stripes_), partials(partials_), to_float(toFloatFunc(in_.depth()))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int cn    = in.channels();
+            const int n     = in.cols * cn;
+            const int total = params.bins * cn;
+            std::vector<float> values(params.direct ? 0 : static_cast<size_t>(n));
+            std::vector<int>   idx(params.direct ? 0 : static_cast<size_t>(n));
+            for (int s = range.start; s < range.end; ++s)
+            {
+                int*      hist  = partials.data() + static_cast<size_t>(s) * total;
+                const int begin = static_cast<int>(static_cast<int64>(in.rows) * s / stripes);
+                const int end   = static_cast<int>(static_cast<int64>(in.rows) * (s + 1) / stripes);
+                for (int y = begin; y < end; ++y)
+                {
+                    const uchar* row = in.ptr(y);
+                    if (params.direct)
+                    {
+                        for (int x = 0, i = 0; x < in.cols; ++x)
+                            for (int c = 0; c < cn; ++c, ++i)
+                                ++hist[row[i] * cn + c];
+                        continue;
+                    }
+                    to_float(row, values.data(), n);
+                    if (params.levels.empty())
+                        uniformIndices(values.data(), idx.data(), n, params.min, params.scale, params.bins, params.clamp);
+                    else
+                        rangeIndices(values.data(), idx.data(), n, params.levels);
+                    for (int x = 0, i = 0; x < in.cols; ++x)
+                    {
+                        for (int c = 0; c < cn; ++c, ++i)
+                        {
+                            const int b = idx[i];
+                            if (b >= 0)
+                                ++hist[b * cn + c];
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        const cv::Mat&    in;
+        const Params&     params;
+        int               stripes;
+        std::vector<int>& partials;
+        ToFloat_t         to_float;
+    };
+
+    class ReduceBody : public cv::ParallelLoopBody
+    {
+    public:
+        ReduceBody(const std::vector<int>& partials_, int stripes_, int total_, int* out_)
+            : partials(partials_), stripes(stripes_), total(total_), out(out_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            for (int j = range.start; j < range.end; ++j)
+                out[j] = 0;
+            for (int s = 0; s < stripes; ++s)
+            {
+                const int* hist = partials.data() + static_cast<size_t>(s) * total;
+                for (int j = range.start; j < range.end; ++j)
+                    out[j] += hist[j];
+            }
+        }
+
+    private:
+        const std::vector<int>& partials;
+        int                     stripes;
+        int                     total;
+        int*                    out;
+    };
+
+    void compute(const cv::Mat& in, cv::Mat& hist, const Params& params)
+    {
+        CV_Assert(toFloatFunc(in.depth()) != nullptr && params.bins > 0);
+        const int cn      = in.channels();
+        const int total   = params.bins * cn;
+        // Two stripes per thread for load balancing, small images aren't worth splitting
+        const int max_stripes = static_cast<int>(in.total() / 16384) + 1;
+        const int stripes     = std::max(1, std::min(std::min(in.rows, cv::getNumThreads() * 2), max_stripes));
+        std::vector<int> partials(static_cast<size_t>(stripes) * total, 0);
+        cv::parallel_for_(cv::Range(0, stripes), BinBody(in, params, stripes, partials));
+
+        hist.create(1, params.bins, CV_MAKE_TYPE(CV_32S, cn));
+        if (stripes == 1)
+        {
+            std::copy(partials.begin(), partials.end(), hist.ptr<int>());
+            return;
+        }
+        cv::parallel_for_(cv::Range(0, total), ReduceBody(partials, stripes, total, hist.ptr<int>()),
+                          std::max(1.0, total / 1024.0));
+    }
+}
+
+void aq::hist::uniform(const cv::Mat& in, cv::Mat& hist, int bins, float min, float max, bool clamp)
+{
+    Params params;
+    params.bins   = bins;
+    params.min    = min;
+    params.scale  = max > min ? bins / (max - min) : 0.0f;
+    params.clamp  = clamp;
+    params.direct = in.depth() == CV_8U && bins == 256 && min == 0.0f && max == 256.0f;
+    compute(in, hist, params);
+}
+
+void aq::hist::range(const cv::Mat& in, cv::Mat& hist, const cv::Mat& levels)
+{
+    CV_Assert(levels.total() >= 2 && levels.channels() == 1);
+    cv::Mat levels_f;
+    levels.reshape(1, 1).convertTo(levels_f, CV_32F);
+    const float* l    = levels_f.ptr<float>();
+    const int    n    = levels_f.cols;
+    const float  step = (l[n - 1] - l[0]) / (n - 1);
+    bool         even = step > 0.0f;
+    for (int i = 1; i < n && even; ++i)
+        even = std::abs(l[i] - (l[0] + step * i)) <= 1e-4f * step;
+    if (even)
+    {
+        uniform(in, hist, n - 1, l[0], l[n - 1], false);
+        return;
+    }
+    Params params;
+    params.bins = n - 1;
+    params.levels.assign(l, l + n);
+    compute(in, hist, params);
+}
+
+cv::Mat aq::hist::uniformLevels(int bins, float min, float max)
+{
+    cv::Mat     levels(1, bins, CV_32F);
+    const float step = (max - min) / bins;
+    for (int i = 0; i < bins; ++i)
+        levels.at<float>(i) = min + step * i;
+    return levels;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <opencv2/core/mat.hpp>
+
+namespace aq
+{
+namespace hist
+{
+    // Host histogram engine used when the input of a histogram node lives on the cpu.  Rows are
+    // split into stripes that each bin into a private sub-histogram, the sub-histograms are then
+    // reduced in parallel over the bins.  Output layout matches the cuda nodes, 1 x bins CV_32SC(cn)
+    // with every channel binned independently.
+
+    // Uniform bins over [min, max).  Values outside of the range are dropped, or counted in the
+    // first / last bin when clamp is set.  8 bit input with 256 bins over [0, 256) is binned directly.
+    Core_EXPORT void uniform(const cv::Mat& in, cv::Mat& hist, int bins, float min, float max, bool clamp = false);
+
+    // Bins delimited by ascending levels (1 x N, CV_32F or CV_32S) as cv::cuda::histRange, N - 1 bins.
+    // Evenly spaced levels take the uniform path.
+    Core_EXPORT void range(const cv::Mat& in, cv::Mat& hist, const cv::Mat& levels);
+
+    // Lower edge of each uniform bin, 1 x bins CV_32F
+    Core_EXPORT cv::Mat uniformLevels(int bins, float min, float max);
+}
+}
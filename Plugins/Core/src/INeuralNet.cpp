@@ -1,15 +1,27 @@
 #include "INeuralNet.hpp"
+#include "PyramidCache.hpp"
 #include <opencv2/cudaarithm.hpp>
 #include <opencv2/cudawarping.hpp>
-#ifndef NDEBUG
+#include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
-#endif
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
 
 void aq::nodes::INeuralNet::on_weight_file_modified(mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t,
                                                     const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags){
+    preloadModel();
+}
+
+void aq::nodes::INeuralNet::preloadModel() {
     initNetwork();
 }
 
+std::vector<std::vector<cv::Mat> > aq::nodes::INeuralNet::getNetImageInputHost(int) {
+    return std::vector<std::vector<cv::Mat> >();
+}
+
 void aq::nodes::INeuralNet::preBatch(int batch_size) {
     (void)batch_size;
 }
@@ -19,15 +31,193 @@ void aq::nodes::INeuralNet::postBatch() {
 
 bool aq::nodes::INeuralNet::processImpl() {
     if (initNetwork()) {
+        if (precision_param.modified()) {
+            applyPrecision();
+            precision_param.modified(false);
+        }
         return forwardAll();
     }
     return false;
 }
 
+bool aq::nodes::INeuralNet::setPrecision(quant::Precision precision, const quant::CalibrationTable&) {
+    return precision == quant::Float32;
+}
+
+void aq::nodes::INeuralNet::observeActivations(quant::RangeObserver&) {
+}
+
+cv::Mat aq::nodes::INeuralNet::getNetOutput() {
+    return cv::Mat();
+}
+
+bool aq::nodes::INeuralNet::applyPrecision() {
+    const quant::Precision  requested = static_cast<quant::Precision>(precision.getValue());
+    quant::CalibrationTable table;
+    if (requested == quant::Int8 && !table.load(quant::CalibrationTable::pathFor(weight_file.string()))) {
+        MO_LOG(warning) << "No calibration table for " << weight_file << ", run calibrate first. Using float";
+        setPrecision(quant::Float32, table);
+        return false;
+    }
+    if (!setPrecision(requested, table)) {
+        MO_LOG(warning) << "Backend does not support reduced precision inference, using float";
+        setPrecision(quant::Float32, table);
+        return false;
+    }
+    return true;
+}
+
+bool aq::nodes::INeuralNet::forwardImage(const cv::Mat& image) {
+    auto planes = getNetImageInputHost();
+    if (planes.empty() || planes[0].size() != static_cast<size_t>(image.channels()))
+        return false;
+    cv::Mat float_image;
+    cv::resize(image, float_image, planes[0][0].size(), 0, 0, cv::INTER_LINEAR);
+    float_image.convertTo(float_image, CV_32F);
+    if (channel_mean[0] != 0.0 || channel_mean[1] != 0.0 || channel_mean[2] != 0.0)
+        cv::subtract(float_image, channel_mean, float_image);
+    if (pixel_scale != 1.0f)
+        float_image *= static_cast<double>(pixel_scale);
+    cv::split(float_image, planes[0]);
+    return forwardMinibatch();
+}
+
+namespace {
+std::vector<boost::filesystem::path> listImages(const boost::filesystem::path& dir, int max_images) {
+    std::vector<boost::filesystem::path> files;
+    if (!boost::filesystem::is_directory(dir))
+        return files;
+    for (boost::filesystem::directory_iterator itr(dir), end; itr != end; ++itr) {
+        std::string ext = itr->path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp")
+            files.push_back(itr->path());
+    }
+    std::sort(files.begin(), files.end());
+    if (max_images > 0 && files.size() > static_cast<size_t>(max_images))
+        files.resize(static_cast<size_t>(max_images));
+    return files;
+}
+}
+
+void aq::nodes::INeuralNet::calibrate() {
+    mo::Mutex_t::scoped_lock lock(*_mtx);
+    if (!initNetwork())
+        return;
+    const cv::Scalar_<unsigned int> shape = getNetworkShape();
+    reshapeNetwork(1, shape[1], shape[2], shape[3]);
+
+    // Collect activation ranges with the float model
+    quant::CalibrationTable empty;
+    setPrecision(quant::Float32, empty);
+    quant::RangeObserver observer;
+    size_t               count = 0;
+    for (const auto& file : listImages(calibration_images, max_calibration_images)) {
+        cv::Mat image = cv::imread(file.string());
+        if (image.empty() || !forwardImage(image))
+            continue;
+        observeActivations(observer);
+        ++count;
+    }
+    if (count == 0 || observer.size() == 0) {
+        MO_LOG(warning) << "Unable to calibrate, no usable images in " << calibration_images
+                        << " or the backend has no host inference path";
+        applyPrecision();
+        return;
+    }
+    const quant::CalibrationTable table = observer.table();
+    const std::string             path  = quant::CalibrationTable::pathFor(weight_file.string());
+    if (!table.save(path)) {
+        MO_LOG(warning) << "Unable to write calibration table to " << path;
+    }
+    MO_LOG(info) << "Calibrated " << table.scales.size() << " tensors over " << count << " images, saved to " << path;
+
+    // Accuracy delta of the reduced precision model against float on the held out set
+    quant::Precision requested = static_cast<quant::Precision>(precision.getValue());
+    if (requested == quant::Float32)
+        requested = quant::Int8;
+    double error = 0.0, agreement = 0.0;
+    size_t validated = 0;
+    for (const auto& file : listImages(validation_images, max_calibration_images)) {
+        cv::Mat image = cv::imread(file.string());
+        if (image.empty())
+            continue;
+        setPrecision(quant::Float32, table);
+        if (!forwardImage(image))
+            continue;
+        cv::Mat reference = getNetOutput().clone();
+        if (!setPrecision(requested, table) || !forwardImage(image))
+            break;
+        cv::Mat reduced = getNetOutput();
+        if (reference.empty() || reference.size() != reduced.size())
+            break;
+        const double norm = cv::norm(reference, cv::NORM_L2);
+        error += norm > 0.0 ? cv::norm(reference, reduced, cv::NORM_L2) / norm : 0.0;
+        cv::Point ref_max, red_max;
+        cv::minMaxLoc(reference.reshape(1, 1), nullptr, nullptr, nullptr, &ref_max);
+        cv::minMaxLoc(reduced.reshape(1, 1), nullptr, nullptr, nullptr, &red_max);
+        agreement += ref_max == red_max ? 1.0 : 0.0;
+        ++validated;
+    }
+    if (validated) {
+        quantization_error_param.updateData(static_cast<float>(error / validated));
+        quantization_agreement_param.updateData(static_cast<float>(agreement / validated));
+        MO_LOG(info) << "Over " << validated << " validation images the reduced precision output has a relative error of "
+                     << error / validated << " and the same argmax as float on " << 100.0 * agreement / validated << "%";
+    }
+    applyPrecision();
+}
+
+std::vector<cv::Rect> aq::nodes::INeuralNet::generateTiles(cv::Size image_size, cv::Size tile_size, float overlap) {
+    std::vector<cv::Rect> tiles;
+    tile_size.width  = std::min(tile_size.width, image_size.width);
+    tile_size.height = std::min(tile_size.height, image_size.height);
+    if (tile_size.area() == 0)
+        return tiles;
+    overlap              = std::max(0.0f, std::min(overlap, 0.9f));
+    const int   stride_x = std::max(1, static_cast<int>(tile_size.width * (1.0f - overlap)));
+    const int   stride_y = std::max(1, static_cast<int>(tile_size.height * (1.0f - overlap)));
+    std::vector<int> xs, ys;
+    for (int x = 0;; x += stride_x) {
+        xs.push_back(std::min(x, image_size.width - tile_size.width));
+        if (x + tile_size.width >= image_size.width)
+            break;
+    }
+    for (int y = 0;; y += stride_y) {
+        ys.push_back(std::min(y, image_size.height - tile_size.height));
+        if (y + tile_size.height >= image_size.height)
+            break;
+    }
+    for (int y : ys) {
+        for (int x : xs) {
+            tiles.emplace_back(x, y, tile_size.width, tile_size.height);
+        }
+    }
+    return tiles;
+}
+
 bool aq::nodes::INeuralNet::forwardAll() {
     std::vector<cv::Rect2f> defaultROI;
     auto                    input_image_shape = input->getShape();
     defaultROI.push_back(cv::Rect2f(0, 0, 1.0, 1.0));
+    cv::Scalar_<unsigned int> network_input_shape = getNetworkShape();
+    std::vector<cv::Rect>     pixel_bounding_boxes;
+    const bool                tiled = tile_input && bounding_boxes == nullptr && input_detections == nullptr;
+    if (tiled) {
+        if (_tile_size.area() == 0 || tile_width_param.modified() || tile_height_param.modified()) {
+            _tile_size = cv::Size(tile_width > 0 ? tile_width : static_cast<int>(network_input_shape[3]),
+                tile_height > 0 ? tile_height : static_cast<int>(network_input_shape[2]));
+            tile_width_param.modified(false);
+            tile_height_param.modified(false);
+        }
+        const cv::Size image_size(static_cast<int>(input_image_shape[2]), static_cast<int>(input_image_shape[1]));
+        pixel_bounding_boxes = generateTiles(image_size, _tile_size, tile_overlap);
+        defaultROI.clear();
+        for (const cv::Rect& tile : pixel_bounding_boxes) {
+            defaultROI.emplace_back(float(tile.x) / image_size.width, float(tile.y) / image_size.height,
+                float(tile.width) / image_size.width, float(tile.height) / image_size.height);
+        }
+    }
     if (bounding_boxes == nullptr) {
         bounding_boxes = &defaultROI;
     }
@@ -55,20 +245,18 @@ bool aq::nodes::INeuralNet::forwardAll() {
     input->clone(dbg_img, stream());
     stream().waitForCompletion();
 #endif
-    cv::Scalar_<unsigned int> network_input_shape = getNetworkShape();
     float net_ar = float(network_input_shape[3]) / float(network_input_shape[2]);
-    std::vector<cv::Rect> pixel_bounding_boxes;
-    for (size_t i = 0; i < bounding_boxes->size(); ++i) {
+    for (size_t i = 0; i < bounding_boxes->size() && !tiled; ++i) {
         cv::Rect bb;
         bb.x      = static_cast<int>((*bounding_boxes)[i].x * input_image_shape[2]);
         bb.y      = static_cast<int>((*bounding_boxes)[i].y * input_image_shape[1]);
         bb.width  = static_cast<int>((*bounding_boxes)[i].width * input_image_shape[2]);
         bb.height = static_cast<int>((*bounding_boxes)[i].height * input_image_shape[1]);
-        if (bb.x + bb.width >= input_image_shape[2]) {
-            bb.x -= input_image_shape[2] - bb.width;
+        if (bb.x + bb.width > input_image_shape[2]) {
+            bb.x = input_image_shape[2] - bb.width;
         }
-        if (bb.y + bb.height >= input_image_shape[1]) {
-            bb.y -= input_image_shape[1] - bb.height;
+        if (bb.y + bb.height > input_image_shape[1]) {
+            bb.y = input_image_shape[1] - bb.height;
         }
         bb.x = std::max(0, bb.x);
         bb.y = std::max(0, bb.y);
@@ -77,39 +265,92 @@ bool aq::nodes::INeuralNet::forwardAll() {
             MO_LOG_FIRST_N(warning, 5) << "Neural net aspect ratio (" << net_ar << ") differs from bounding box aspect ratio (" << bb_ar << ")";
         }
         pixel_bounding_boxes.push_back(bb);
+    }
 #ifndef NDEBUG
+    for (const cv::Rect& bb : pixel_bounding_boxes) {
         cv::rectangle(dbg_img, bb, cv::Scalar(0,255,0), 2);
+    }
 #endif
+
+    if (tiled) {
+        // Keep the network at tile resolution and forward the tiles in minibatches
+        const unsigned int batch_size = static_cast<unsigned int>(
+            std::max(1, std::min(static_cast<int>(pixel_bounding_boxes.size()), tile_batch_size)));
+        if (network_input_shape[0] != batch_size || network_input_shape[2] != static_cast<unsigned int>(_tile_size.height)
+            || network_input_shape[3] != static_cast<unsigned int>(_tile_size.width)) {
+            reshapeNetwork(batch_size, network_input_shape[1],
+                static_cast<unsigned int>(_tile_size.height), static_cast<unsigned int>(_tile_size.width));
+        }
+    } else {
+        if (image_scale > 0) {
+            reshapeNetwork(static_cast<unsigned int>(bounding_boxes->size()),
+                static_cast<unsigned int>(input_image_shape[3]),
+                static_cast<unsigned int>(input_image_shape[1] * image_scale),
+                static_cast<unsigned int>(input_image_shape[2] * image_scale));
+        }
+        if (pixel_bounding_boxes.size() != network_input_shape[0] && input_detections == nullptr) {
+            reshapeNetwork(static_cast<unsigned int>(bounding_boxes->size()),
+                network_input_shape[1],
+                network_input_shape[2],
+                network_input_shape[3]);
+        }
     }
 
+    preBatch(static_cast<int>(pixel_bounding_boxes.size()));
 
-    if (image_scale > 0) {
-        reshapeNetwork(static_cast<unsigned int>(bounding_boxes->size()),
-            static_cast<unsigned int>(input_image_shape[3]),
-            static_cast<unsigned int>(input_image_shape[1] * image_scale),
-            static_cast<unsigned int>(input_image_shape[2] * image_scale));
-    }
-    if (pixel_bounding_boxes.size() != network_input_shape[0] && input_detections == nullptr) {
-        reshapeNetwork(static_cast<unsigned int>(bounding_boxes->size()),
-            network_input_shape[1],
-            network_input_shape[2],
-            network_input_shape[3]);
-    }
+    auto forward = [&](size_t start, size_t end) {
+        if (forwardMinibatch()) {
+            std::vector<cv::Rect>         batch_bounding_boxes;
+            std::vector<DetectedObject2d> batch_detections;
+            for (size_t j = start; j < end; ++j) {
+                batch_bounding_boxes.push_back(pixel_bounding_boxes[j]);
+            }
+            if (input_detections != nullptr && bounding_boxes == &defaultROI) {
+                for (size_t j = start; j < end; ++j)
+                    batch_detections.push_back((*input_detections)[j]);
+            }
+            postMiniBatch(batch_bounding_boxes, batch_detections);
+        }
+    };
 
-    cv::cuda::GpuMat float_image;
-    if (input->getDepth() != CV_32F) {
-        input->getGpuMat(stream()).convertTo(float_image, CV_32F, stream());
-    } else {
-        input->clone(float_image, stream());
-    }
-    if (channel_mean[0] != 0.0 || channel_mean[1] != 0.0 || channel_mean[2] != 0.0)
-        cv::cuda::subtract(float_image, channel_mean, float_image, cv::noArray(), -1, stream());
-    if (pixel_scale != 1.0f) {
-        cv::cuda::multiply(float_image, cv::Scalar::all(static_cast<double>(pixel_scale)), float_image, 1.0, -1, stream());
+    // Rois are cut from the shared pyramid level closest to the network input, so that only the pixels
+    // that are fed to the network get converted and normalized instead of the whole frame
+    auto pyramid = _pyramids.get(input_param, *input);
+    const bool normalize_mean = channel_mean[0] != 0.0 || channel_mean[1] != 0.0 || channel_mean[2] != 0.0;
+
+    auto host_input = getNetImageInputHost();
+    if (!host_input.empty()) {
+        // Backend consumes host memory, preprocess on the cpu instead of round tripping through the gpu
+        MO_ASSERT(host_input[0].size() == static_cast<size_t>(input->getChannels()));
+        cv::Size net_input_size = host_input[0][0].size();
+        cv::Mat  roi, resized;
+        for (size_t i = 0; i < pixel_bounding_boxes.size();) {
+            size_t start = i, end = 0;
+            for (size_t j = 0; j < host_input.size() && i < pixel_bounding_boxes.size(); ++j, ++i) {
+                const int level = pyramid->selectLevel(pixel_bounding_boxes[i].size(), net_input_size);
+                pyramid->getMat(level, stream())(pyramid->mapRect(pixel_bounding_boxes[i], level)).convertTo(roi, CV_32F);
+                if (normalize_mean)
+                    cv::subtract(roi, channel_mean, roi);
+                if (pixel_scale != 1.0f)
+                    roi *= static_cast<double>(pixel_scale);
+                if (roi.size() != net_input_size) {
+                    cv::resize(roi, resized, net_input_size, 0, 0, cv::INTER_LINEAR);
+                } else {
+                    resized = roi;
+                }
+                cv::split(resized, host_input[j]);
+                end = start + j + 1;
+            }
+            forward(start, end);
+        }
+        postBatch();
+        if (bounding_boxes == &defaultROI) {
+            bounding_boxes = nullptr;
+        }
+        return true;
     }
 
-    preBatch(static_cast<int>(pixel_bounding_boxes.size()));
-    cv::cuda::GpuMat resized;
+    cv::cuda::GpuMat roi, resized;
     auto             net_input = getNetImageInput();
     MO_ASSERT(net_input.size());
     MO_ASSERT(net_input[0].size() == static_cast<size_t>(input->getChannels()));
@@ -118,26 +359,22 @@ bool aq::nodes::INeuralNet::forwardAll() {
     for (size_t i = 0; i < pixel_bounding_boxes.size();) { // for each roi
         size_t start = i, end = 0;
         for (size_t j = 0; j < net_input.size() && i < pixel_bounding_boxes.size(); ++j, ++i) { // for each image in the mini batch
-            if (pixel_bounding_boxes[i].size() != net_input_size) {
-                cv::cuda::resize(float_image(pixel_bounding_boxes[i]), resized, net_input_size, 0, 0, cv::INTER_LINEAR, stream());
+            const int level = pyramid->selectLevel(pixel_bounding_boxes[i].size(), net_input_size);
+            pyramid->getGpuMat(level, stream())(pyramid->mapRect(pixel_bounding_boxes[i], level)).convertTo(roi, CV_32F, stream());
+            if (normalize_mean)
+                cv::cuda::subtract(roi, channel_mean, roi, cv::noArray(), -1, stream());
+            if (pixel_scale != 1.0f) {
+                cv::cuda::multiply(roi, cv::Scalar::all(static_cast<double>(pixel_scale)), roi, 1.0, -1, stream());
+            }
+            if (roi.size() != net_input_size) {
+                cv::cuda::resize(roi, resized, net_input_size, 0, 0, cv::INTER_LINEAR, stream());
             } else {
-                resized = float_image(pixel_bounding_boxes[i]);
+                resized = roi;
             }
             cv::cuda::split(resized, net_input[j], stream());
             end = start + j + 1;
         }
-        if (forwardMinibatch()) {
-            std::vector<cv::Rect>         batch_bounding_boxes;
-            std::vector<DetectedObject2d> batch_detections;
-            for (size_t j = start; j < end; ++j) {
-                batch_bounding_boxes.push_back(pixel_bounding_boxes[j]);
-            }
-            if (input_detections != nullptr && bounding_boxes == &defaultROI) {
-                for (size_t j = start; j < end; ++j)
-                    batch_detections.push_back((*input_detections)[j]);
-            }
-            postMiniBatch(batch_bounding_boxes, batch_detections);
-        }
+        forward(start, end);
     }
     postBatch();
     if (bounding_boxes == &defaultROI) {
@@ -1,5 +1,7 @@
 #include "Aquila/nodes/IClassifier.hpp"
 #include "CoreExport.hpp"
+#include "PyramidCache.hpp"
+#include "Quantization.hpp"
 #include <Aquila/types/ObjectDetection.hpp>
 #include <Aquila/types/SyncedMemory.hpp>
 namespace aq {
@@ -31,16 +33,44 @@ namespace nodes {
         TOOLTIP(image_scale, "Scale factor for input of network. 1.0 = network is resized to input image size, -1.0 = image is resized to network input size")
 
         PARAM(bool, swap_bgr, true)
+
+        PARAM(bool, tile_input, false)
+        TOOLTIP(tile_input, "Split the input into an overlapping grid of network sized tiles instead of resizing the whole frame, only used when no bounding_boxes or input_detections are connected")
+        PARAM(float, tile_overlap, 0.2f)
+        TOOLTIP(tile_overlap, "Fraction of a tile shared with its neighbours")
+        PARAM(int, tile_width, 0)
+        TOOLTIP(tile_width, "Width of a tile in pixels, 0 = network input width")
+        PARAM(int, tile_height, 0)
+        TOOLTIP(tile_height, "Height of a tile in pixels, 0 = network input height")
+        PARAM(int, tile_batch_size, 8)
+        TOOLTIP(tile_batch_size, "Maximum number of tiles per minibatch, the minibatches of a frame are forwarded one after another")
+
+        ENUM_PARAM(precision, quant::Float32, quant::Float16, quant::Int8)
+        TOOLTIP(precision, "Arithmetic used by cpu backends, Int8 needs a calibration table next to weight_file")
+        PARAM(mo::ReadDirectory, calibration_images, {})
+        TOOLTIP(calibration_images, "Directory of representative frames used by calibrate to collect activation ranges")
+        PARAM(mo::ReadDirectory, validation_images, {})
+        TOOLTIP(validation_images, "Held out frames on which calibrate compares the reduced precision outputs against float")
+        PARAM(int, max_calibration_images, 500)
+        MO_SLOT(void, calibrate)
+        STATUS(float, quantization_error, 0.0f)
+        STATUS(float, quantization_agreement, 1.0f)
         MO_END
 
     protected:
         virtual bool processImpl();
 
         virtual bool initNetwork() = 0;
+        // Called when the weight file changes, backends that share weights through the
+        // ModelRegistry start loading in the background instead of blocking here
+        virtual void preloadModel();
         virtual bool reshapeNetwork(unsigned int num, unsigned int channels, unsigned int height, unsigned int width) = 0;
         virtual cv::Scalar_<unsigned int> getNetworkShape() const = 0;
 
         virtual std::vector<std::vector<cv::cuda::GpuMat> > getNetImageInput(int requested_batch_size = 1) = 0;
+        // Backends that run on the cpu return their input planes here, forwardAll then preprocesses on the
+        // host and skips getNetImageInput.  Empty by default.
+        virtual std::vector<std::vector<cv::Mat> > getNetImageInputHost(int requested_batch_size = 1);
 
         virtual void preBatch(int batch_size);
         virtual void postMiniBatch(const std::vector<cv::Rect>& batch_bb = std::vector<cv::Rect>(),
@@ -50,6 +80,23 @@ namespace nodes {
 
         virtual bool forwardAll();
         virtual bool forwardMinibatch() = 0;
+
+        // Reduced precision support.  setPrecision is called whenever precision or the calibration table
+        // changes and returns false if the backend can't run at that precision, observeActivations
+        // reports the tensors to calibrate after a float forward pass and getNetOutput the raw output
+        // of the last forward pass for validation.
+        virtual bool    setPrecision(quant::Precision precision, const quant::CalibrationTable& table);
+        virtual void    observeActivations(quant::RangeObserver& observer);
+        virtual cv::Mat getNetOutput();
+        bool            applyPrecision();
+        // Forwards a single image through the host input path, used by calibration
+        bool forwardImage(const cv::Mat& image);
+
+        // Overlapping grid of tile_size rects covering image_size, edge tiles are shifted inwards to stay inside the image
+        static std::vector<cv::Rect> generateTiles(cv::Size image_size, cv::Size tile_size, float overlap);
+
+        cv::Size _tile_size;
+        PyramidSources _pyramids;
     };
 }
 }
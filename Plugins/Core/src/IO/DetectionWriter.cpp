@@ -130,6 +130,7 @@ bool IDetectionWriter::processImpl() {
     auto detections = pruneDetections(*this->detections, object_class);
 
     if (detections.size() || skip_empty == false) {
+        _placement.publish();
         cv::Mat h_mat = image->getMat(stream());
         cuda::enqueue_callback([h_mat, this, detections]() {
             this->_write_queue->enqueue(std::make_pair(h_mat, detections));
@@ -143,6 +144,7 @@ void DetectionWriter::writeThread() {
     WriteData_t data;
     mo::setThisThreadName("DetectionWriter");
     while (!boost::this_thread::interruption_requested()) {
+        _placement.follow();
         if (this->_write_queue->try_dequeue(data)) {
             std::stringstream ss;
             ss << output_directory.string();
@@ -179,6 +181,7 @@ void DetectionWriterFolder::nodeInit(bool firstInit) {
             [this]() {
                 std::pair<cv::Mat, std::string> data;
                 while (!boost::this_thread::interruption_requested()) {
+                    _placement.follow();
                     if (_write_queue.try_dequeue(data)) {
                         cv::imwrite(data.second, data.first);
                     }
@@ -228,6 +231,7 @@ struct WritePair {
 };
 
 bool DetectionWriterFolder::processImpl() {
+    _placement.publish();
     if (!_summary_ofs) {
         if (!boost::filesystem::is_directory(root_dir)) {
             boost::filesystem::create_directories(root_dir);
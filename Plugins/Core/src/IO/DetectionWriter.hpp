@@ -5,6 +5,7 @@
 #include "MetaObject/core/detail/ConcurrentQueue.hpp"
 #include "MetaObject/thread/ThreadHandle.hpp"
 #include "MetaObject/thread/ThreadPool.hpp"
+#include "../ThreadPlacement.hpp"
 namespace aq {
 namespace nodes {
     enum Extension {
@@ -37,6 +38,8 @@ namespace nodes {
         void nodeInit(bool firstInit);
         virtual void writeThread() = 0;
         size_t       frame_count   = 0;
+        // The write thread runs where the stream feeding it does
+        PlacementFollower _placement;
     };
 
     class DetectionWriter : public IDetectionWriter {
@@ -72,6 +75,7 @@ namespace nodes {
         int  _frame_count;
         moodycamel::ConcurrentQueue<std::pair<cv::Mat, std::string> > _write_queue;
         boost::thread                              _write_thread;
+        PlacementFollower                          _placement;
         std::vector<int>                           _per_class_count;
         std::shared_ptr<std::ofstream>             _summary_ofs;
         std::shared_ptr<cereal::JSONOutputArchive> _summary_ar;
@@ -21,6 +21,7 @@ void VideoWriter::nodeInit(bool firstInit) {
             std::unique_ptr<std::ofstream> ofs;
             mo::setThisThreadName("VideoWriter");
             while (!boost::this_thread::interruption_requested()) {
+                _placement.follow();
                 WriteData data;
                 if (_write_queue.try_dequeue(data) && h_writer) {
                     mo::scoped_profile profile("Writing video");
@@ -79,6 +80,7 @@ bool VideoWriter::processImpl() {
         d_writer->write(image->getGpuMat(stream()));
     }
     if (h_writer) {
+        _placement.publish();
         cv::Mat   h_img = image->getMat(stream());
         WriteData data;
         data.img = h_img;
@@ -7,6 +7,7 @@
 #include "MetaObject/thread/ThreadHandle.hpp"
 #include "MetaObject/thread/ThreadPool.hpp"
 #include "MetaObject/core/detail/ConcurrentQueue.hpp"
+#include "../ThreadPlacement.hpp"
 RUNTIME_COMPILER_SOURCEDEPENDENCY
 RUNTIME_MODIFIABLE_INCLUDE
 namespace aq
@@ -41,6 +42,7 @@ namespace nodes
             size_t fn;
         };
         moodycamel::ConcurrentQueue<WriteData> _write_queue;
+        PlacementFollower _placement;
     };
 #ifdef HAVE_FFMPEG
     class VideoWriterFFMPEG: public Node
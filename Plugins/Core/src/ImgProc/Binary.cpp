@@ -1,29 +1,263 @@
 #include "Binary.h"
+#include "HostFilters.hpp"
 #include "opencv2/imgproc.hpp"
+#include <opencv2/core/hal/intrin.hpp>
 #include "MetaObject/params/detail/TInputParamPtrImpl.hpp"
 #include "MetaObject/params/detail/TParamPtrImpl.hpp"
 
+#include <limits>
+
 using namespace aq;
 using namespace aq::nodes;
 
+namespace
+{
+    // van Herk / Gil-Werman running min / max.  The padded signal is cut into blocks of k, within a
+    // block g holds prefix and h suffix extrema, and every window [i, i + k) spans at most two
+    // blocks so its extremum is op(h[i], g[i + k - 1]).  Three comparisons per element whatever k is.
+    struct MinOp
+    {
+        template <class T> static T identity() { return std::numeric_limits<T>::max(); }
+        template <class T> static T scalar(T a, T b) { return std::min(a, b); }
+        template <class V> static V vec(const V& a, const V& b) { return cv::v_min(a, b); }
+    };
+
+    struct MaxOp
+    {
+        template <class T> static T identity() { return std::numeric_limits<T>::lowest(); }
+        template <class T> static T scalar(T a, T b) { return std::max(a, b); }
+        template <class V> static V vec(const V& a, const V& b) { return cv::v_max(a, b); }
+    };
+
+#if CV_SIMD128
+    template <class T> struct Simd;
+    template <> struct Simd<uchar> { typedef cv::v_uint8x16 V; };
+    template <> struct Simd<ushort> { typedef cv::v_uint16x8 V; };
+    template <> struct Simd<short> { typedef cv::v_int16x8 V; };
+    template <> struct Simd<float> { typedef cv::v_float32x4 V; };
+#endif
+
+    template <class T, class Op>
+    inline void applyRow(const T* a, const T* b, T* out, int n)
+    {
+        int i = 0;
+#if CV_SIMD128
+        typedef typename Simd<T>::V V;
+        for (; i + V::nlanes <= n; i += V::nlanes)
+            cv::v_store(out + i, Op::vec(cv::v_load(a + i), cv::v_load(b + i)));
+#endif
+        for (; i < n; ++i)
+            out[i] = Op::scalar(a[i], b[i]);
+    }
+
+    // Runs the 1-D filter down the columns, so every step is a whole row of elements at once.  The
+    // image is cut into column tiles that keep the g / h buffers in cache, tiles run in parallel.
+    template <class T, class Op>
+    class VerticalPass : public cv::ParallelLoopBody
+    {
+    public:
+        // Window of k rows starting before rows above the output row
+        VerticalPass(const cv::Mat& src_, cv::Mat& dst_, int k_, int before_, int tile_)
+            : src(src_), dst(dst_), k(k_), before(before_), tile(tile_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int n     = src.rows;
+            const int width = src.cols * src.channels();
+            const int L     = n + k - 1;
+            std::vector<T> g, h, pad;
+            for (int t = range.start; t < range.end; ++t)
+            {
+                const int c0 = t * tile;
+                const int w  = std::min(width, c0 + tile) - c0;
+                g.resize(static_cast<size_t>(L) * w);
+                h.resize(static_cast<size_t>(L) * w);
+                // Border rows never win, same as the default morphology border of OpenCV
+                pad.assign(static_cast<size_t>(w), Op::template identity<T>());
+                auto row = [&](int j) -> const T* {
+                    const int y = j - before;
+                    return (y < 0 || y >= n) ? pad.data() : src.ptr<T>(y) + c0;
+                };
+                for (int j = 0; j < L; ++j)
+                {
+                    T* gj = g.data() + static_cast<size_t>(j) * w;
+                    if (j % k == 0)
+                        std::copy(row(j), row(j) + w, gj);
+                    else
+                        applyRow<T, Op>(gj - w, row(j), gj, w);
+                }
+                for (int j = L - 1; j >= 0; --j)
+                {
+                    T* hj = h.data() + static_cast<size_t>(j) * w;
+                    if (j % k == k - 1 || j == L - 1)
+                        std::copy(row(j), row(j) + w, hj);
+                    else
+                        applyRow<T, Op>(hj + w, row(j), hj, w);
+                }
+                for (int i = 0; i < n; ++i)
+                    applyRow<T, Op>(h.data() + static_cast<size_t>(i) * w, g.data() + static_cast<size_t>(i + k - 1) * w,
+                                    dst.ptr<T>(i) + c0, w);
+            }
+        }
+
+    private:
+        const cv::Mat& src;
+        cv::Mat&       dst;
+        int            k;
+        int            before;
+        int            tile;
+    };
+
+    template <class T, class Op>
+    void verticalPass(const cv::Mat& src, cv::Mat& dst, int k, int before)
+    {
+        dst.create(src.size(), src.type());
+        const int width = src.cols * src.channels();
+        // Size tiles so that both buffers take about 1MB
+        const int bytes = std::max(64, std::min(4096, static_cast<int>((1 << 20) / (2 * (src.rows + k)))));
+        const int tile  = std::max(16, bytes / static_cast<int>(sizeof(T)) / 16 * 16);
+        cv::parallel_for_(cv::Range(0, (width + tile - 1) / tile), VerticalPass<T, Op>(src, dst, k, before, tile));
+    }
+
+    // Rectangle of ksize with the given anchor, rows first, then columns through a transpose
+    template <class T, class Op>
+    void rectFilter(const cv::Mat& src, cv::Mat& dst, cv::Size ksize, cv::Point anchor)
+    {
+        cv::Mat tmp = src;
+        if (ksize.height > 1)
+        {
+            cv::Mat vertical;
+            verticalPass<T, Op>(src, vertical, ksize.height, anchor.y);
+            tmp = vertical;
+        }
+        if (ksize.width > 1)
+        {
+            cv::Mat transposed, filtered;
+            cv::transpose(tmp, transposed);
+            verticalPass<T, Op>(transposed, filtered, ksize.width, anchor.x);
+            cv::transpose(filtered, dst);
+        }
+        else
+        {
+            tmp.copyTo(dst);
+        }
+    }
+
+    template <class T, class Op>
+    void morphFilter(const cv::Mat& src, cv::Mat& dst, int shape, cv::Size ksize, cv::Point anchor)
+    {
+        if (shape == cv::MORPH_RECT)
+        {
+            rectFilter<T, Op>(src, dst, ksize, anchor);
+            return;
+        }
+        // A cross is the union of its vertical and horizontal bar
+        cv::Mat vertical, horizontal;
+        rectFilter<T, Op>(src, vertical, cv::Size(1, ksize.height), cv::Point(0, anchor.y));
+        rectFilter<T, Op>(src, horizontal, cv::Size(ksize.width, 1), cv::Point(anchor.x, 0));
+        dst.create(src.size(), src.type());
+        const int width = src.cols * src.channels();
+        for (int y = 0; y < src.rows; ++y)
+            applyRow<T, Op>(vertical.ptr<T>(y), horizontal.ptr<T>(y), dst.ptr<T>(y), width);
+    }
+
+    template <class Op>
+    bool dispatchFilter(const cv::Mat& src, cv::Mat& dst, int shape, cv::Size ksize, cv::Point anchor)
+    {
+        switch (src.depth())
+        {
+        case CV_8U: morphFilter<uchar, Op>(src, dst, shape, ksize, anchor); return true;
+        case CV_16U: morphFilter<ushort, Op>(src, dst, shape, ksize, anchor); return true;
+        case CV_16S: morphFilter<short, Op>(src, dst, shape, ksize, anchor); return true;
+        case CV_32F: morphFilter<float, Op>(src, dst, shape, ksize, anchor); return true;
+        default: return false;
+        }
+    }
+}
+
+void aq::filters::morphology(const cv::Mat& src, cv::Mat& dst, int op, int shape, int size, cv::Point anchor,
+                             int iterations, const cv::Mat& element)
+{
+    const int depth = src.depth();
+    if ((shape != cv::MORPH_RECT && shape != cv::MORPH_CROSS) || element.size() != cv::Size(size, size)
+        || (depth != CV_8U && depth != CV_16U && depth != CV_16S && depth != CV_32F))
+    {
+        cv::morphologyEx(src, dst, op, element, anchor, iterations);
+        return;
+    }
+    const cv::Size ksize(size, size);
+    if (anchor.x < 0)
+        anchor.x = size / 2;
+    if (anchor.y < 0)
+        anchor.y = size / 2;
+    iterations = std::max(iterations, 1);
+    auto erode = [&](const cv::Mat& in, cv::Mat& out) {
+        out = in;
+        for (int i = 0; i < iterations; ++i)
+        {
+            cv::Mat next;
+            dispatchFilter<MinOp>(out, next, shape, ksize, anchor);
+            out = next;
+        }
+    };
+    auto dilate = [&](const cv::Mat& in, cv::Mat& out) {
+        out = in;
+        for (int i = 0; i < iterations; ++i)
+        {
+            cv::Mat next;
+            dispatchFilter<MaxOp>(out, next, shape, ksize, anchor);
+            out = next;
+        }
+    };
+    cv::Mat tmp, tmp2;
+    switch (op)
+    {
+    case cv::MORPH_ERODE: erode(src, dst); break;
+    case cv::MORPH_DILATE: dilate(src, dst); break;
+    case cv::MORPH_OPEN: erode(src, tmp); dilate(tmp, dst); break;
+    case cv::MORPH_CLOSE: dilate(src, tmp); erode(tmp, dst); break;
+    case cv::MORPH_GRADIENT: dilate(src, tmp); erode(src, tmp2); cv::subtract(tmp, tmp2, dst); break;
+    case cv::MORPH_TOPHAT: erode(src, tmp); dilate(tmp, tmp2); cv::subtract(src, tmp2, dst); break;
+    case cv::MORPH_BLACKHAT: dilate(src, tmp); erode(tmp, tmp2); cv::subtract(tmp2, src, dst); break;
+    default: cv::morphologyEx(src, dst, op, element, anchor, iterations);
+    }
+}
+
 bool MorphologyFilter::processImpl()
 {
     if (input_image)
     {
-        if (structuring_element_type_param.modified() || morphology_type_param.modified() ||
-            anchor_point_param.modified() || iterations_param.modified() ||
-            filter == nullptr)
+        if (structuring_element_type_param.modified() || structuring_element_size_param.modified() ||
+            anchor_point_param.modified() ||
+            structuring_element.size() != ::cv::Size(structuring_element_size, structuring_element_size))
         {
             structuring_element_param.updateData(
                 cv::getStructuringElement(
                     structuring_element_type.currentSelection,
                     ::cv::Size(structuring_element_size, structuring_element_size), anchor_point));
-
+            structuring_element_type_param.modified(false);
+            structuring_element_size_param.modified(false);
+            anchor_point_param.modified(false);
+            filter.release();
+        }
+        if (input_image->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+        {
+            cv::Mat out;
+            filters::morphology(input_image->getMat(stream()), out, morphology_type.currentSelection,
+                structuring_element_type.currentSelection, structuring_element_size, anchor_point, iterations,
+                structuring_element);
+            this->output_param.updateData(out, mo::tag::_param = input_image_param, _ctx.get());
+            return true;
+        }
+        if (morphology_type_param.modified() || anchor_point_param.modified() || iterations_param.modified() ||
+            filter == nullptr)
+        {
             filter = ::cv::cuda::createMorphologyFilter(
-                morphology_type.currentSelection, input_image->getMat(stream()).type(),
+                morphology_type.currentSelection, CV_MAKE_TYPE(input_image->getDepth(), input_image->getChannels()),
                 structuring_element, anchor_point, iterations);
 
-            structuring_element_size_param.modified(false);
             morphology_type_param.modified(false);
             anchor_point_param.modified(false);
             iterations_param.modified(false);
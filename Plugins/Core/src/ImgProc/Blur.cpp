@@ -1,18 +1,298 @@
 #include "Blur.hpp"
+#include "HostFilters.hpp"
 #include <Aquila/rcc/external_includes/cv_cudaimgproc.hpp>
 #include <Aquila/rcc/external_includes/cv_cudaarithm.hpp>
 #include "Aquila/nodes/NodeInfo.hpp"
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <cstring>
 
 using namespace aq;
 using namespace aq::nodes;
 
+namespace
+{
+    // Perreault & Hebert, "Median Filtering in Constant Time".  Every column keeps a histogram of the
+    // 2r + 1 rows around the current row and the kernel histogram slides along the row by adding the
+    // column entering the window and subtracting the one leaving it.  Histograms are split into 16
+    // coarse and 16 x 16 fine bins, the fine bins of the kernel are only brought up to date for the
+    // coarse bin that holds the median.
+    struct ColumnHistogram
+    {
+        uint16_t coarse[16];
+        uint16_t fine[256];
+    };
+
+    inline void add16(uint16_t* dst, const uint16_t* src)
+    {
+#if CV_SIMD128
+        cv::v_store(dst, cv::v_load(dst) + cv::v_load(src));
+        cv::v_store(dst + 8, cv::v_load(dst + 8) + cv::v_load(src + 8));
+#else
+        for (int i = 0; i < 16; ++i)
+            dst[i] += src[i];
+#endif
+    }
+
+    inline void sub16(uint16_t* dst, const uint16_t* src)
+    {
+#if CV_SIMD128
+        cv::v_store(dst, cv::v_load(dst) - cv::v_load(src));
+        cv::v_store(dst + 8, cv::v_load(dst + 8) - cv::v_load(src + 8));
+#else
+        for (int i = 0; i < 16; ++i)
+            dst[i] -= src[i];
+#endif
+    }
+
+    class MedianBody8U : public cv::ParallelLoopBody
+    {
+    public:
+        // padded has r rows / columns of replicated border on every side
+        MedianBody8U(const cv::Mat& padded_, cv::Mat& dst_, int r_, int stripes_)
+            : padded(padded_), dst(dst_), r(r_), stripes(stripes_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int cn = dst.channels();
+            std::vector<ColumnHistogram> columns(static_cast<size_t>(padded.cols) * cn);
+            for (int s = range.start; s < range.end; ++s)
+            {
+                const int y0 = dst.rows * s / stripes;
+                const int y1 = dst.rows * (s + 1) / stripes;
+                if (y0 == y1)
+                    continue;
+                std::memset(columns.data(), 0, columns.size() * sizeof(ColumnHistogram));
+                for (int y = y0; y < y0 + 2 * r + 1; ++y)
+                    updateColumns(columns, padded.ptr<uchar>(y), 1);
+                for (int y = y0; y < y1; ++y)
+                {
+                    if (y > y0)
+                    {
+                        updateColumns(columns, padded.ptr<uchar>(y - 1), -1);
+                        updateColumns(columns, padded.ptr<uchar>(y + 2 * r), 1);
+                    }
+                    filterRow(columns, dst.ptr<uchar>(y));
+                }
+            }
+        }
+
+    private:
+        void updateColumns(std::vector<ColumnHistogram>& columns, const uchar* row, int delta) const
+        {
+            const int n = padded.cols * padded.channels();
+            for (int i = 0; i < n; ++i)
+            {
+                ColumnHistogram& hist = columns[i];
+                hist.coarse[row[i] >> 4] += delta;
+                hist.fine[row[i]] += delta;
+            }
+        }
+
+        void filterRow(const std::vector<ColumnHistogram>& columns, uchar* out) const
+        {
+            const int cn        = dst.channels();
+            const int k         = 2 * r + 1;
+            const int threshold = k * k / 2;
+            CV_DECL_ALIGNED(16) uint16_t coarse[16];
+            CV_DECL_ALIGNED(16) uint16_t fine[256];
+            int last_update[16];
+            for (int c = 0; c < cn; ++c)
+            {
+                std::memset(coarse, 0, sizeof(coarse));
+                std::memset(fine, 0, sizeof(fine));
+                std::fill(last_update, last_update + 16, 0);
+                for (int x = 0; x < k; ++x)
+                    add16(coarse, columns[x * cn + c].coarse);
+                for (int x = 0; x < dst.cols; ++x)
+                {
+                    if (x > 0)
+                    {
+                        add16(coarse, columns[(x + k - 1) * cn + c].coarse);
+                        sub16(coarse, columns[(x - 1) * cn + c].coarse);
+                    }
+                    int sum = 0, b = 0;
+                    for (; b < 15; ++b)
+                    {
+                        if (sum + coarse[b] > threshold)
+                            break;
+                        sum += coarse[b];
+                    }
+                    // Bring the fine histogram of bin b up to date with the window [x, x + k)
+                    uint16_t* f   = fine + 16 * b;
+                    const int end = x + k;
+                    if (last_update[b] <= x)
+                    {
+                        std::memset(f, 0, 16 * sizeof(uint16_t));
+                        for (int col = x; col < end; ++col)
+                            add16(f, columns[col * cn + c].fine + 16 * b);
+                    }
+                    else
+                    {
+                        for (int col = last_update[b]; col < end; ++col)
+                        {
+                            add16(f, columns[col * cn + c].fine + 16 * b);
+                            sub16(f, columns[(col - k) * cn + c].fine + 16 * b);
+                        }
+                    }
+                    last_update[b] = end;
+                    int i = 0;
+                    for (; i < 15; ++i)
+                    {
+                        if (sum + f[i] > threshold)
+                            break;
+                        sum += f[i];
+                    }
+                    out[x * cn + c] = static_cast<uchar>(16 * b + i);
+                }
+            }
+        }
+
+        const cv::Mat& padded;
+        cv::Mat&       dst;
+        int            r;
+        int            stripes;
+    };
+
+    // 16 bit values have too many bins for per column histograms, a two level kernel histogram is
+    // slid along each row instead (Huang), O(r) per pixel
+    class MedianBody16U : public cv::ParallelLoopBody
+    {
+    public:
+        MedianBody16U(const cv::Mat& padded_, cv::Mat& dst_, int r_, int stripes_)
+            : padded(padded_), dst(dst_), r(r_), stripes(stripes_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int cn        = dst.channels();
+            const int k         = 2 * r + 1;
+            const int threshold = k * k / 2;
+            std::vector<int> coarse(256);
+            std::vector<int> fine(65536);
+            for (int s = range.start; s < range.end; ++s)
+            {
+                const int y0 = dst.rows * s / stripes;
+                const int y1 = dst.rows * (s + 1) / stripes;
+                for (int y = y0; y < y1; ++y)
+                {
+                    ushort* out = dst.ptr<ushort>(y);
+                    for (int c = 0; c < cn; ++c)
+                    {
+                        for (int dy = 0; dy < k; ++dy)
+                        {
+                            const ushort* row = padded.ptr<ushort>(y + dy);
+                            for (int x = 0; x < k; ++x)
+                                add(coarse, fine, row[x * cn + c], 1);
+                        }
+                        for (int x = 0; x < dst.cols; ++x)
+                        {
+                            if (x > 0)
+                            {
+                                for (int dy = 0; dy < k; ++dy)
+                                {
+                                    const ushort* row = padded.ptr<ushort>(y + dy);
+                                    add(coarse, fine, row[(x - 1) * cn + c], -1);
+                                    add(coarse, fine, row[(x + k - 1) * cn + c], 1);
+                                }
+                            }
+                            int sum = 0, b = 0;
+                            for (; b < 255; ++b)
+                            {
+                                if (sum + coarse[b] > threshold)
+                                    break;
+                                sum += coarse[b];
+                            }
+                            const int* f = fine.data() + 256 * b;
+                            int        i = 0;
+                            for (; i < 255; ++i)
+                            {
+                                if (sum + f[i] > threshold)
+                                    break;
+                                sum += f[i];
+                            }
+                            out[x * cn + c] = static_cast<ushort>(256 * b + i);
+                        }
+                        // Empty the histograms again by removing the last window, much cheaper than clearing them
+                        for (int dy = 0; dy < k; ++dy)
+                        {
+                            const ushort* row = padded.ptr<ushort>(y + dy);
+                            for (int x = dst.cols - 1; x < dst.cols - 1 + k; ++x)
+                                add(coarse, fine, row[x * cn + c], -1);
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        static void add(std::vector<int>& coarse, std::vector<int>& fine, ushort value, int delta)
+        {
+            coarse[value >> 8] += delta;
+            fine[value] += delta;
+        }
+
+        const cv::Mat& padded;
+        cv::Mat&       dst;
+        int            r;
+        int            stripes;
+    };
+}
+
+bool aq::filters::medianBlur(const cv::Mat& src, cv::Mat& dst, int window_size)
+{
+    window_size = std::max(3, window_size | 1);
+    if (window_size <= 5 && (src.depth() == CV_8U || src.depth() == CV_16U || src.depth() == CV_32F)
+        && src.channels() != 2)
+    {
+        // Sorting networks beat histograms for the small windows
+        cv::medianBlur(src, dst, window_size);
+        return true;
+    }
+    if (src.depth() != CV_8U && src.depth() != CV_16U)
+    {
+        MO_LOG_EVERY_N(warning, 100) << "Host median filter supports 8 and 16 bit inputs for windows larger than 5";
+        return false;
+    }
+    if (window_size > 255)
+    {
+        MO_LOG_EVERY_N(warning, 100) << "Median window size " << window_size << " is limited to 255";
+        window_size = 255;
+    }
+    const int r = window_size / 2;
+    cv::Mat   padded;
+    cv::copyMakeBorder(src, padded, r, r, r, r, cv::BORDER_REPLICATE);
+    dst.create(src.size(), src.type());
+    // Every stripe rebuilds its column histograms, so keep them a few window heights tall
+    const int stripes = std::max(1, std::min(cv::getNumThreads() * 2, src.rows / std::max(window_size * 4, 16)));
+    if (src.depth() == CV_8U)
+        cv::parallel_for_(cv::Range(0, stripes), MedianBody8U(padded, dst, r, stripes));
+    else
+        cv::parallel_for_(cv::Range(0, stripes), MedianBody16U(padded, dst, r, stripes));
+    return true;
+}
+
 bool MedianBlur::processImpl(){
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        cv::Mat output;
+        if(!filters::medianBlur(input->getMat(stream()), output, window_size))
+            return false;
+        output_param.updateData(output, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     if(!_median_filter || window_size_param.modified() || partition_param.modified())
     {
         _median_filter = cv::cuda::createMedianFilter(input->getDepth(), window_size, partition);
+        window_size_param.modified(false);
+        partition_param.modified(false);
     }
     cv::cuda::GpuMat output;
-    if(input->getChannels() != 1 && false)
+    if(input->getChannels() != 1)
     {
         std::vector<cv::cuda::GpuMat> channels;
         cv::cuda::split(input->getGpuMat(stream()), channels, stream());
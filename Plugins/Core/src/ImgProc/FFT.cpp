@@ -1,10 +1,154 @@
 #include "FFT.h"
+#include <algorithm>
 
 
 
 using namespace aq;
 using namespace aq::nodes;
 
+// (-1)^(x + y), or (-1)^x when every row is transformed on its own
+cv::Mat getShiftMat(cv::Size matSize, bool rows_only = false);
+
+namespace
+{
+    // A node rarely sees more than a couple of shapes, keep the most recent few
+    const size_t max_cached_plans = 4;
+
+    int evenOptimalDFTSize(int size)
+    {
+        int optimal = cv::getOptimalDFTSize(size);
+        while (optimal & 1)
+            optimal = cv::getOptimalDFTSize(optimal + 1);
+        return optimal;
+    }
+
+    // Converts src into the top left corner of the plan's input buffer, the padding is zeroed by the
+    // caller whenever the input size changes.  Modulating by (-1)^(x + y) moves the zero frequency by half the
+    // transform size, which for even sizes is the quadrant swap, so it's applied here instead of
+    // as a separate pass over the output.
+    void copyInput(const cv::Mat& src, cv::Mat& dst, bool shift, bool rows_only)
+    {
+        cv::Mat roi = dst(cv::Rect(0, 0, src.cols, src.rows));
+        src.convertTo(roi, roi.type());
+        if (!shift)
+            return;
+        const int cn = roi.channels();
+        for (int y = 0; y < roi.rows; ++y)
+        {
+            float* row = roi.ptr<float>(y);
+            for (int x = (rows_only || (y & 1) == 0) ? 1 : 0; x < roi.cols; x += 2)
+                for (int c = 0; c < cn; ++c)
+                    row[x * cn + c] = -row[x * cn + c];
+        }
+    }
+}
+
+using namespace aq::filters;
+
+DftPlan& Dft::getPlan(cv::Size size, int flags, int src_channels, int dst_channels)
+{
+    for (size_t i = 0; i < m_plans.size(); ++i)
+    {
+        const DftPlan& plan = m_plans[i];
+        if (plan.size == size && plan.flags == flags && plan.src_channels == src_channels && plan.dst_channels == dst_channels)
+        {
+            // Most recently used at the back
+            std::rotate(m_plans.begin() + i, m_plans.begin() + i + 1, m_plans.end());
+            return m_plans.back();
+        }
+    }
+    if (m_plans.size() >= max_cached_plans)
+        m_plans.erase(m_plans.begin());
+    DftPlan plan;
+    plan.size         = size;
+    plan.flags        = flags;
+    plan.src_channels = src_channels;
+    plan.dst_channels = dst_channels;
+    plan.dft          = cv::hal::DFT2D::create(size.width, size.height, CV_32F, src_channels, dst_channels, flags);
+    plan.input        = cv::Mat::zeros(size, CV_32FC(src_channels));
+    m_plans.push_back(plan);
+    return m_plans.back();
+}
+
+cv::Mat Dft::apply(const cv::Mat& in, int flags, bool shift, bool optimized_size)
+{
+    const bool rows = (flags & cv::DFT_ROWS) != 0;
+    cv::Size size = in.size();
+    if (optimized_size)
+        size = cv::Size(cv::getOptimalDFTSize(in.cols), cv::getOptimalDFTSize(in.rows));
+    if (shift)
+    {
+        // The modulation is only an exact quadrant swap for even sizes
+        size.width = optimized_size ? evenOptimalDFTSize(in.cols) : in.cols + (in.cols & 1);
+        if (!rows)
+            size.height = optimized_size ? evenOptimalDFTSize(in.rows) : in.rows + (in.rows & 1);
+    }
+    const int src_channels = in.channels();
+    const int dst_channels = ((flags & cv::DFT_INVERSE) && (flags & cv::DFT_REAL_OUTPUT)) ? 1 : 2;
+    // Real input takes the real to complex transform, output is expanded to full complex like the cuda path
+    if (src_channels == 1 && dst_channels == 2)
+        flags = flags | cv::DFT_COMPLEX_OUTPUT;
+    DftPlan& plan = getPlan(size, flags, src_channels, dst_channels);
+
+    // A smaller image than the last one would leave its pixels in the padding
+    if (plan.input_size != in.size())
+    {
+        plan.input.setTo(cv::Scalar::all(0));
+        plan.input_size = in.size();
+    }
+    copyInput(in, plan.input, shift, rows);
+    // The buffer returned two calls ago has been replaced by the caller since, it's reused unless
+    // someone still holds on to it
+    cv::Mat& output = plan.outputs[plan.next_output];
+    plan.next_output ^= 1;
+    if (output.empty() || !output.u || output.u->refcount > 1)
+        output = cv::Mat(size, CV_32FC(dst_channels));
+    plan.dft->apply(plan.input.data, plan.input.step, output.data, output.step);
+    return output;
+}
+
+bool FFT::processHost()
+{
+    const cv::Mat in = input->getMat(stream());
+    int flags = 0;
+    if (dft_rows)
+        flags = flags | cv::DFT_ROWS;
+    if (dft_scale)
+        flags = flags | cv::DFT_SCALE;
+    if (dft_inverse)
+        flags = flags | cv::DFT_INVERSE;
+    if (dft_real_output)
+        flags = flags | cv::DFT_REAL_OUTPUT;
+    // The plan's other output buffer is reused by the next frame, the output param holds this one
+    const cv::Mat result = _dft.apply(in, flags, shift_spectrum, use_optimized_size);
+    coefficients_param.updateData(result, input_param.getTimestamp(), _ctx.get());
+    if (result.channels() != 2)
+        return true;
+    if (magnitude_param.hasSubscriptions() || phase_param.hasSubscriptions())
+    {
+        cv::Mat planes[2];
+        cv::split(result, planes);
+        if (magnitude_param.hasSubscriptions())
+        {
+            cv::Mat magnitude;
+            cv::magnitude(planes[0], planes[1], magnitude);
+            if (log_scale)
+            {
+                magnitude += cv::Scalar::all(1);
+                cv::log(magnitude, magnitude);
+            }
+            this->magnitude_param.updateData(magnitude, input_param.getTimestamp(), _ctx.get());
+        }
+        if (phase_param.hasSubscriptions())
+        {
+            cv::Mat phase;
+            cv::phase(planes[0], planes[1], phase, false);
+            this->phase_param.updateData(phase, input_param.getTimestamp(), _ctx.get());
+        }
+    }
+    return true;
+}
+
 bool FFT::processImpl()
 {
     cv::cuda::GpuMat padded;
@@ -13,13 +157,24 @@ bool FFT::processImpl()
         MO_LOG(debug) << "Too many channels, can only handle 1 or 2 channel input. Input has " << input->getChannels() << " channels.";
         return false;
     }
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        return processHost();
+    }
+    // Same transform size as the host path so that both give the same spectrum
+    const cv::Size in_size = input->getSize();
+    cv::Size size = in_size;
     if(use_optimized_size)
+        size = cv::Size(cv::getOptimalDFTSize(in_size.width), cv::getOptimalDFTSize(in_size.height));
+    if(shift_spectrum)
+    {
+        size.width = use_optimized_size ? evenOptimalDFTSize(in_size.width) : in_size.width + (in_size.width & 1);
+        if(!dft_rows)
+            size.height = use_optimized_size ? evenOptimalDFTSize(in_size.height) : in_size.height + (in_size.height & 1);
+    }
+    if(size != in_size)
     {
-        int in_rows = input->getSize().height;
-        int in_cols = input->getSize().width;
-        int rows = cv::getOptimalDFTSize(in_rows);
-        int cols = cv::getOptimalDFTSize(in_cols);
-        cv::cuda::copyMakeBorder(input->getGpuMat(stream()), padded, 0, rows - in_rows, 0, cols - in_cols, cv::BORDER_CONSTANT, cv::Scalar::all(0), stream());
+        cv::cuda::copyMakeBorder(input->getGpuMat(stream()), padded, 0, size.height - in_size.height, 0, size.width - in_size.width, cv::BORDER_CONSTANT, cv::Scalar::all(0), stream());
     }else
     {
         padded = input->getGpuMat(stream());
@@ -30,6 +185,18 @@ bool FFT::processImpl()
         padded.convertTo(float_img, CV_MAKETYPE(CV_32F, padded.channels()), stream());
         padded = float_img;
     }
+    if(shift_spectrum)
+    {
+        if(d_shiftMat.size() != padded.size() || d_shiftMat.channels() != padded.channels() || d_shift_rows != dft_rows)
+        {
+            d_shift_rows = dft_rows;
+            std::vector<cv::Mat> channels(padded.channels(), getShiftMat(padded.size(), dft_rows));
+            cv::Mat shift;
+            cv::merge(channels, shift);
+            d_shiftMat.upload(shift, stream());
+        }
+        cv::cuda::multiply(padded, d_shiftMat, padded, 1, -1, stream());
+    }
     int flags = 0;
     if (dft_rows)
         flags = flags | cv::DFT_ROWS;
@@ -40,7 +207,7 @@ bool FFT::processImpl()
     if (dft_real_output)
         flags = flags | cv::DFT_REAL_OUTPUT;
     cv::cuda::GpuMat result;
-    cv::cuda::dft(padded, result, input->getSize(),flags, stream());
+    cv::cuda::dft(padded, result, padded.size(), flags, stream());
     coefficients_param.updateData(result, input_param.getTimestamp(), _ctx.get());
     if(magnitude_param.hasSubscriptions())
     {
@@ -65,14 +232,14 @@ bool FFT::processImpl()
     return true;
 }
 
-cv::Mat getShiftMat(cv::Size matSize)
+cv::Mat getShiftMat(cv::Size matSize, bool rows_only)
 {
     cv::Mat shift(matSize, CV_32F);
     for(int y = 0; y < matSize.height; ++y)
     {
         for(int x = 0; x < matSize.width; ++x)
         {
-            shift.at<float>(y,x) = 1.0 - 2.0 * ((x+y)&1);
+            shift.at<float>(y,x) = 1.0 - 2.0 * ((rows_only ? x : x + y) & 1);
         }
     }
 
@@ -81,6 +248,14 @@ cv::Mat getShiftMat(cv::Size matSize)
 
 bool FFTPreShiftImage::processImpl()
 {
+    if (input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        const cv::Mat in = input->getMat(stream());
+        cv::Mat result(in.size(), CV_MAKETYPE(CV_32F, in.channels()));
+        copyInput(in, result, true, false);
+        output_param.updateData(result, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     if (d_shiftMat.size() != input->getSize())
     {
         d_shiftMat.upload(getShiftMat(input->getSize()), stream());
@@ -93,6 +268,19 @@ bool FFTPreShiftImage::processImpl()
 
 bool FFTPostShift::processImpl()
 {
+    if (input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        const cv::Mat in = input->getMat(stream());
+        if (h_shiftMat.size() != in.size() || h_shiftMat.channels() != in.channels())
+        {
+            std::vector<cv::Mat> channels(in.channels(), getShiftMat(in.size()));
+            cv::merge(channels, h_shiftMat);
+        }
+        cv::Mat result;
+        cv::multiply(h_shiftMat, in, result, 1 / float(in.size().area()), CV_MAKETYPE(CV_32F, in.channels()));
+        output_param.updateData(result, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     if (d_shiftMat.size() != input->getSize())
     {
         d_shiftMat.upload(getShiftMat(input->getSize()), stream());
@@ -103,6 +291,7 @@ bool FFTPostShift::processImpl()
     }
     cv::cuda::GpuMat result;
     cv::cuda::multiply(d_shiftMat, input->getGpuMat(stream()), result, 1 / float(input->getSize().area()), -1, stream());
+    output_param.updateData(result, input_param.getTimestamp(), _ctx.get());
     return true;
 }
 
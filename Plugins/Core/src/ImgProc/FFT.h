@@ -7,11 +7,11 @@
 #include "RuntimeObjectSystem/RuntimeSourceDependency.h"
 RUNTIME_COMPILER_SOURCEDEPENDENCY
 RUNTIME_MODIFIABLE_INCLUDE
+#include "HostFilters.hpp"
 namespace aq
 {
     namespace nodes
     {
-
     class FFT: public Node
     {
     public:
@@ -23,12 +23,19 @@ namespace aq
             PARAM(bool, dft_real_output, false);
             PARAM(bool, log_scale, true);
             PARAM(bool, use_optimized_size, false);
+            PARAM(bool, shift_spectrum, false);
+            TOOLTIP(shift_spectrum, "Move the zero frequency to the center of the output, same as FFTPreShiftImage before the transform");
             OUTPUT(SyncedMemory, magnitude, SyncedMemory());
             OUTPUT(SyncedMemory, phase, SyncedMemory());
             OUTPUT(SyncedMemory, coefficients, SyncedMemory());
         MO_END;
     protected:
         bool processImpl();
+        bool processHost();
+
+        filters::Dft _dft;
+        cv::cuda::GpuMat d_shiftMat;
+        bool d_shift_rows = false;
     };
 
     class FFTPreShiftImage: public Node
@@ -46,6 +53,7 @@ namespace aq
     class FFTPostShift: public Node
     {
         cv::cuda::GpuMat d_shiftMat;
+        cv::Mat h_shiftMat;
     public:
         MO_DERIVE(FFTPostShift, Node);
             INPUT(SyncedMemory, input, nullptr);
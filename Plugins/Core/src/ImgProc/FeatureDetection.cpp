@@ -1,4 +1,6 @@
 #include "FeatureDetection.h"
+#include "HostFeatures.hpp"
+#include "../PyramidCache.hpp"
 #include "MetaObject/params/detail/TInputParamPtrImpl.hpp"
 #include "MetaObject/params/detail/TParamPtrImpl.hpp"
 
@@ -6,8 +8,37 @@ using namespace aq;
 using namespace aq::nodes;
 
 
+namespace
+{
+    // Grey host image of the input, the conversion is shared through the pyramid cache
+    template <class Param>
+    cv::Mat hostGrey(SyncedMemory& input, Param& param, PyramidSources& pyramids, cv::cuda::Stream& stream)
+    {
+        if (input.getChannels() == 1)
+            return input.getMat(stream);
+        return pyramids.get(param, input, 0.5f, ImagePyramid::Grey)->getMat(0, stream);
+    }
+}
+
 bool GoodFeaturesToTrack::processImpl()
 {
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        features::GFTTParams params;
+        params.max_corners = max_corners;
+        params.quality_level = quality_level;
+        params.min_distance = min_distance;
+        params.block_size = block_size;
+        params.use_harris = use_harris;
+        params.harris_k = harris_K;
+        params.uniform = uniform_distribution;
+        cv::Mat corners;
+        features::goodFeaturesToTrack(hostGrey(*input, input_param, pyramids, stream()), mask ? mask->getMat(stream()) : cv::Mat(),
+                                      corners, params);
+        key_points_param.updateData(corners, input_param.getTimestamp(), _ctx.get());
+        num_corners_param.updateData(corners.cols, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     cv::cuda::GpuMat grey;
     if(input->getChannels() != 1)
     {
@@ -44,6 +75,24 @@ bool GoodFeaturesToTrack::processImpl()
 
 bool FastFeatureDetector::processImpl()
 {
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        features::FASTParams params;
+        params.threshold = threshold;
+        params.nonmax = use_nonmax_suppression;
+        params.type = fast_type.getValue();
+        params.max_points = max_points;
+        params.uniform = uniform_distribution;
+        std::vector<cv::KeyPoint> points;
+        features::fast(hostGrey(*input, input_param, pyramids, stream()), mask ? mask->getMat(stream()) : cv::Mat(), points, params);
+        if(!points.empty())
+        {
+            cv::Mat packed;
+            features::packFAST(points, packed);
+            keypoints_param.updateData(packed, input_param.getTimestamp(), _ctx.get());
+        }
+        return true;
+    }
     if(threshold_param.modified() ||
         use_nonmax_suppression_param.modified() ||
         fast_type_param.modified() ||
@@ -80,11 +129,11 @@ bool ORBFeatureDetector::processImpl()
     if(num_features_param.modified() || scale_factor_param.modified() ||
         num_levels_param.modified() || edge_threshold_param.modified() ||
         first_level_param.modified() || WTA_K_param.modified() || score_type_param.modified() ||
-        patch_size_param.modified() || fast_threshold_param.modified() || blur_for_descriptor_param.modified() ||
-        detector == nullptr)
+        patch_size_param.modified() || fast_threshold_param.modified() || blur_for_descriptor_param.modified())
     {
-        detector = cv::cuda::ORB::create(num_features, scale_factor, num_levels, edge_threshold, first_level,
-            WTA_K, score_type.getValue(), patch_size, fast_threshold, blur_for_descriptor);
+        // Rebuilt by whichever path runs next
+        detector.release();
+        h_descriptor.release();
         num_features_param.modified(false);
         scale_factor_param.modified(false);
         num_levels_param.modified(false);
@@ -96,14 +145,33 @@ bool ORBFeatureDetector::processImpl()
         fast_threshold_param.modified(false);
         blur_for_descriptor_param.modified(false);
     }
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        return processHost();
+    }
+    if(detector == nullptr)
+    {
+        detector = cv::cuda::ORB::create(num_features, scale_factor, num_levels, edge_threshold, first_level,
+            WTA_K, score_type.getValue(), patch_size, fast_threshold, blur_for_descriptor);
+    }
     cv::cuda::GpuMat keypoints;
     cv::cuda::GpuMat descriptors;
+    // cv::cuda::ORB needs grey input and builds its scale pyramid internally, the grey conversion
+    // at least is shared with the other nodes working on this frame
+    cv::cuda::GpuMat image;
+    if(input->getChannels() != 1)
+    {
+        image = pyramids.get(input_param, *input, 0.5f, ImagePyramid::Grey)->getGpuMat(0, stream());
+    }else
+    {
+        image = input->getGpuMat(stream());
+    }
     if(mask)
     {
-        detector->detectAndComputeAsync(input->getGpuMat(stream()), mask->getGpuMat(stream()), keypoints, descriptors, false, stream());
+        detector->detectAndComputeAsync(image, mask->getGpuMat(stream()), keypoints, descriptors, false, stream());
     }else
     {
-        detector->detectAndComputeAsync(input->getGpuMat(stream()), cv::noArray(), keypoints, descriptors, false, stream());
+        detector->detectAndComputeAsync(image, cv::noArray(), keypoints, descriptors, false, stream());
     }
     keypoints_param.updateData(keypoints, input_param.getTimestamp(), _ctx.get());
     descriptors_param.updateData(descriptors, input_param.getTimestamp(), _ctx.get());
@@ -113,6 +181,52 @@ bool ORBFeatureDetector::processImpl()
 
 
 
+bool ORBFeatureDetector::processHost()
+{
+    if(scale_factor <= 1.0f)
+    {
+        MO_LOG(warning) << "scale_factor must be larger than 1, got " << scale_factor;
+        return false;
+    }
+    // Detection runs on the shared grey pyramid, cv::ORB then only orients and describes the keypoints.
+    // Octave i of the keypoints is pyramid level i, so cv::ORB must map octaves from level 0 and not from
+    // first_level. first_level and blur_for_descriptor have no host equivalent, the host ORB always blurs.
+    if(!h_descriptor)
+    {
+        h_descriptor = cv::ORB::create(num_features, scale_factor, num_levels, edge_threshold, 0,
+            WTA_K, score_type.getValue(), patch_size, fast_threshold);
+    }
+    std::shared_ptr<ImagePyramid> pyramid = pyramids.get(input_param, *input, 1.0f / scale_factor, ImagePyramid::Grey);
+    std::vector<cv::Mat> levels;
+    std::vector<float> scales;
+    for(int i = 0; i < std::max(num_levels, 1); ++i)
+    {
+        const cv::Size size = pyramid->getSize(i);
+        if(i != 0 && (size.width <= 2 * edge_threshold || size.height <= 2 * edge_threshold))
+            break;
+        levels.push_back(pyramid->getMat(i, stream()));
+        scales.push_back(std::pow(scale_factor, static_cast<float>(i)));
+    }
+    features::ORBParams params;
+    params.num_features = num_features;
+    params.edge_threshold = edge_threshold;
+    params.patch_size = patch_size;
+    params.fast_threshold = fast_threshold;
+    params.score_type = score_type.getValue();
+    params.uniform = uniform_distribution;
+    std::vector<cv::KeyPoint> points;
+    features::detectORB(levels, scales, mask ? mask->getMat(stream()) : cv::Mat(), points, params);
+    cv::Mat descriptors;
+    h_descriptor->compute(levels[0], points, descriptors);
+    cv::Mat packed;
+    features::packORB(points, packed);
+    keypoints_param.updateData(packed, input_param.getTimestamp(), _ctx.get());
+    descriptors_param.updateData(descriptors, input_param.getTimestamp(), _ctx.get());
+    return true;
+}
+
+
+
 bool CornerHarris::processImpl()
 {
     if(block_size_param.modified() || sobel_aperature_size_param.modified() || harris_free_parameter_param.modified() || detector == nullptr)
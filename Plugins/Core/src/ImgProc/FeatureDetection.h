@@ -2,6 +2,7 @@
 #include "src/precompiled.hpp"
 //#include "Aquila/nodes/VideoProc/Tracking.hpp"
 #include "Aquila/rcc/external_includes/cv_cudafeatures2d.hpp"
+#include "../PyramidCache.hpp"
 
 RUNTIME_COMPILER_SOURCEDEPENDENCY
 RUNTIME_MODIFIABLE_INCLUDE
@@ -23,6 +24,8 @@ namespace aq
                 PARAM(int, block_size, 3);
                 PARAM(bool, use_harris, false);
                 RANGED_PARAM(double, harris_K, 0.04, 0.01, 1.0);
+                PARAM(bool, uniform_distribution, false);
+                TOOLTIP(uniform_distribution, "Host only, every tile of the frame first gets its share of max_corners before the rest goes to the strongest corners");
                 INPUT(SyncedMemory, input, nullptr);
                 OPTIONAL_INPUT(SyncedMemory, mask, nullptr);
                 OUTPUT(SyncedMemory, key_points, SyncedMemory());
@@ -31,7 +34,7 @@ namespace aq
         protected:
             bool processImpl();
 
-            
+            PyramidSources pyramids;
         };
 
         class FastFeatureDetector : public Node
@@ -42,6 +45,8 @@ namespace aq
                 PARAM(bool, use_nonmax_suppression, true);
                 ENUM_PARAM(fast_type, cv::cuda::FastFeatureDetector::TYPE_5_8, cv::cuda::FastFeatureDetector::TYPE_7_12, cv::cuda::FastFeatureDetector::TYPE_9_16);
                 PARAM(int, max_points, 5000);
+                PARAM(bool, uniform_distribution, false);
+                TOOLTIP(uniform_distribution, "Host only, every tile of the frame first gets its share of max_points before the rest goes to the strongest points");
                 INPUT(SyncedMemory, input, nullptr);
                 OPTIONAL_INPUT(SyncedMemory, mask, nullptr);
                 OUTPUT(SyncedMemory, keypoints, SyncedMemory());
@@ -49,6 +54,7 @@ namespace aq
             MO_END;
         protected:
             bool processImpl();
+            PyramidSources pyramids;
         };
 
         class ORBFeatureDetector : public Node
@@ -65,6 +71,8 @@ namespace aq
                 PARAM(int, patch_size, 31);
                 PARAM(int, fast_threshold, 20);
                 PARAM(bool, blur_for_descriptor, true);
+                PARAM(bool, uniform_distribution, false);
+                TOOLTIP(uniform_distribution, "Host only, spreads every level's share of num_features over the tiles of the level first");
                 INPUT(SyncedMemory, input, nullptr);
                 OPTIONAL_INPUT(SyncedMemory, mask, nullptr);
                 PROPERTY(cv::Ptr<cv::cuda::ORB>, detector, cv::Ptr<cv::cuda::ORB>());
@@ -73,6 +81,10 @@ namespace aq
             MO_END;
         protected:
             bool processImpl();
+            bool processHost();
+            // Descriptors of the host path, detection runs tiled on the shared pyramid
+            cv::Ptr<cv::ORB> h_descriptor;
+            PyramidSources pyramids;
 
         };
 
@@ -1,4 +1,5 @@
 #include "Histogram.hpp"
+#include "../HostHistogram.hpp"
 #include "opencv2/cudaimgproc.hpp"
 #include "Aquila/nodes/NodeInfo.hpp"
 using namespace aq::nodes;
@@ -12,6 +13,13 @@ bool HistogramRange::processImpl()
         upper_bound_param.modified(false);
         bins_param.modified(false);
     }
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        cv::Mat hist;
+        aq::hist::range(input->getMat(stream()), hist, levels.getMat(stream()));
+        histogram_param.updateData(hist, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     if(input->getChannels() == 1 || input->getChannels() == 4)
     {
         cv::cuda::GpuMat hist;
@@ -45,6 +53,17 @@ void HistogramRange::updateLevels(int type)
 
 bool Histogram::processImpl()
 {
+    if(input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        // Same binning as the cuda kernel, 256 bins for 8 bit input and 1000 bins over [min, max) otherwise
+        cv::Mat hist;
+        if(input->getDepth() == CV_8U)
+            aq::hist::uniform(input->getMat(stream()), hist, 256, 0, 256, true);
+        else
+            aq::hist::uniform(input->getMat(stream()), hist, 1000, min, max, true);
+        histogram_param.updateData(hist, input_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     cv::cuda::GpuMat bins, hist;
     cv::cuda::histogram(input->getGpuMat(stream()), bins, hist, min, max, stream());
     histogram_param.updateData(hist, input_param.getTimestamp(), _ctx.get());
@@ -0,0 +1,504 @@
+#include "HostFeatures.hpp"
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+using namespace aq;
+using namespace aq::features;
+
+namespace
+{
+    // Strongest first, ties broken by position so that the result doesn't depend on the tiling
+    inline bool stronger(const cv::KeyPoint& lhs, const cv::KeyPoint& rhs)
+    {
+        if (lhs.response != rhs.response)
+            return lhs.response > rhs.response;
+        if (lhs.pt.y != rhs.pt.y)
+            return lhs.pt.y < rhs.pt.y;
+        return lhs.pt.x < rhs.pt.x;
+    }
+
+    class TileBody : public cv::ParallelLoopBody
+    {
+    public:
+        TileBody(const cv::Mat& image_, const cv::Mat& mask_, const TileGrid& grid_, const TileDetector& detector_,
+                 std::vector<std::vector<cv::KeyPoint>>& tiles_)
+            : image(image_), mask(mask_), grid(grid_), detector(detector_), tiles(tiles_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                const cv::Rect roi       = grid.roi(i);
+                const cv::Rect core      = grid.core(i) - roi.tl();
+                const cv::Mat  tile_mask = mask.empty() ? cv::Mat() : mask(roi);
+                std::vector<cv::KeyPoint> found;
+                detector(i, image(roi), tile_mask, core, found);
+
+                std::vector<cv::KeyPoint>& keep = tiles[i];
+                keep.clear();
+                keep.reserve(found.size());
+                for (cv::KeyPoint& kp : found)
+                {
+                    const cv::Point pt(cvFloor(kp.pt.x), cvFloor(kp.pt.y));
+                    if (!core.contains(pt) || (!tile_mask.empty() && !tile_mask.at<uchar>(pt)))
+                        continue;
+                    kp.pt.x += roi.x;
+                    kp.pt.y += roi.y;
+                    keep.push_back(kp);
+                }
+                std::sort(keep.begin(), keep.end(), stronger);
+            }
+        }
+
+        const cv::Mat&                          image;
+        const cv::Mat&                          mask;
+        const TileGrid&                         grid;
+        const TileDetector&                     detector;
+        std::vector<std::vector<cv::KeyPoint>>& tiles;
+    };
+
+    // Grid buckets of min_distance in size, only the 3 x 3 neighbourhood of a bucket can hold points
+    // closer than min_distance
+    class DistanceGrid
+    {
+    public:
+        DistanceGrid(cv::Size size, float min_distance)
+            : m_cell(std::max(1, cvRound(min_distance))), m_min_sqr(min_distance * min_distance),
+              m_enabled(min_distance >= 1.0f)
+        {
+            if (m_enabled)
+            {
+                m_cols = (size.width + m_cell - 1) / m_cell;
+                m_rows = (size.height + m_cell - 1) / m_cell;
+                m_buckets.resize(static_cast<size_t>(m_cols * m_rows));
+            }
+        }
+
+        bool tryInsert(const cv::Point2f& pt)
+        {
+            if (!m_enabled)
+                return true;
+            const int cx = std::min(std::max(cvFloor(pt.x) / m_cell, 0), m_cols - 1);
+            const int cy = std::min(std::max(cvFloor(pt.y) / m_cell, 0), m_rows - 1);
+            for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, m_rows - 1); ++y)
+            {
+                for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, m_cols - 1); ++x)
+                {
+                    for (const cv::Point2f& other : m_buckets[static_cast<size_t>(y * m_cols + x)])
+                    {
+                        const float dx = pt.x - other.x;
+                        const float dy = pt.y - other.y;
+                        if (dx * dx + dy * dy < m_min_sqr)
+                            return false;
+                    }
+                }
+            }
+            m_buckets[static_cast<size_t>(cy * m_cols + cx)].push_back(pt);
+            return true;
+        }
+
+    private:
+        int                                   m_cell;
+        float                                 m_min_sqr;
+        bool                                  m_enabled;
+        int                                   m_cols = 0;
+        int                                   m_rows = 0;
+        std::vector<std::vector<cv::Point2f>> m_buckets;
+    };
+
+    enum State : uchar
+    {
+        Open,
+        Taken,
+        Rejected
+    };
+
+    // k-way merge of the tiles' sorted ranges, a tile drops out once its quota is used up (-1 for none)
+    void mergeTiles(const Candidates& candidates, std::vector<uchar>& state, std::vector<int>& quota,
+                    int max_count, DistanceGrid& grid, std::vector<cv::KeyPoint>& keypoints)
+    {
+        const std::vector<cv::KeyPoint>& kps = candidates.keypoints;
+        auto later = [&kps](int lhs, int rhs) { return stronger(kps[static_cast<size_t>(rhs)], kps[static_cast<size_t>(lhs)]); };
+        std::priority_queue<int, std::vector<int>, decltype(later)> heads(later);
+        std::vector<int> tile_of(kps.size());
+        std::vector<int> cursor(candidates.offsets.begin(), candidates.offsets.end() - 1);
+
+        auto advance = [&](int tile) {
+            int& i = cursor[static_cast<size_t>(tile)];
+            while (i < candidates.offsets[static_cast<size_t>(tile) + 1] && state[static_cast<size_t>(i)] != Open)
+                ++i;
+            if (i < candidates.offsets[static_cast<size_t>(tile) + 1] && quota[static_cast<size_t>(tile)] != 0)
+            {
+                tile_of[static_cast<size_t>(i)] = tile;
+                heads.push(i++);
+            }
+        };
+        for (int tile = 0; tile < candidates.tiles(); ++tile)
+            advance(tile);
+
+        while (!heads.empty() && static_cast<int>(keypoints.size()) < max_count)
+        {
+            const int i    = heads.top();
+            const int tile = tile_of[static_cast<size_t>(i)];
+            heads.pop();
+            if (grid.tryInsert(kps[static_cast<size_t>(i)].pt))
+            {
+                state[static_cast<size_t>(i)] = Taken;
+                keypoints.push_back(kps[static_cast<size_t>(i)]);
+                if (quota[static_cast<size_t>(tile)] > 0)
+                    --quota[static_cast<size_t>(tile)];
+            }
+            else
+            {
+                state[static_cast<size_t>(i)] = Rejected;
+            }
+            advance(tile);
+        }
+    }
+
+    // Drops everything at or below min_response, the ranges are sorted so every tile is a prefix
+    void truncate(Candidates& candidates, float min_response)
+    {
+        int out = 0;
+        for (int tile = 0; tile < candidates.tiles(); ++tile)
+        {
+            const int begin = candidates.offsets[static_cast<size_t>(tile)];
+            const int end   = candidates.offsets[static_cast<size_t>(tile) + 1];
+            candidates.offsets[static_cast<size_t>(tile)] = out;
+            for (int i = begin; i < end && candidates.keypoints[static_cast<size_t>(i)].response > min_response; ++i)
+                candidates.keypoints[static_cast<size_t>(out++)] = candidates.keypoints[static_cast<size_t>(i)];
+        }
+        candidates.offsets.back() = out;
+        candidates.keypoints.resize(static_cast<size_t>(out));
+    }
+
+    // Harris response of cv::ORB, 7 x 7 block of 3 x 3 Sobel gradients
+    const int   harris_block = 7;
+    const float harris_k     = 0.04f;
+
+    float harrisResponse(const cv::Mat& img, cv::Point pt)
+    {
+        const int    r     = harris_block / 2;
+        const int    step  = static_cast<int>(img.step1());
+        const float  scale = 1.0f / ((1 << 2) * harris_block * 255.0f);
+        const float  scale_sqr_sqr = scale * scale * scale * scale;
+        int          a = 0, b = 0, c = 0;
+        for (int y = -r; y <= r; ++y)
+        {
+            const uchar* p = img.ptr<uchar>(pt.y + y) + pt.x;
+            for (int x = -r; x <= r; ++x)
+            {
+                const uchar* q  = p + x;
+                const int    dx = (q[1] - q[-1]) * 2 + (q[-step + 1] - q[-step - 1]) + (q[step + 1] - q[step - 1]);
+                const int    dy = (q[step] - q[-step]) * 2 + (q[step - 1] - q[-step - 1]) + (q[step + 1] - q[-step + 1]);
+                a += dx * dx;
+                b += dy * dy;
+                c += dx * dy;
+            }
+        }
+        return (static_cast<float>(a) * b - static_cast<float>(c) * c - harris_k * (static_cast<float>(a) + b) * (static_cast<float>(a) + b)) * scale_sqr_sqr;
+    }
+
+    // Row extents of the circular patch of cv::ORB, symmetric in x and y
+    std::vector<int> circleExtents(int half_patch)
+    {
+        std::vector<int> umax(static_cast<size_t>(half_patch) + 2);
+        const int vmax = cvFloor(half_patch * std::sqrt(2.0) / 2 + 1);
+        const int vmin = cvCeil(half_patch * std::sqrt(2.0) / 2);
+        for (int v = 0; v <= vmax; ++v)
+            umax[static_cast<size_t>(v)] = cvRound(std::sqrt(static_cast<double>(half_patch) * half_patch - v * v));
+        for (int v = half_patch, v0 = 0; v >= vmin; --v)
+        {
+            while (umax[static_cast<size_t>(v0)] == umax[static_cast<size_t>(v0) + 1])
+                ++v0;
+            umax[static_cast<size_t>(v)] = v0;
+            ++v0;
+        }
+        return umax;
+    }
+
+    // Intensity centroid orientation in degrees
+    float centroidAngle(const cv::Mat& img, cv::Point pt, const std::vector<int>& umax)
+    {
+        const int    half   = static_cast<int>(umax.size()) - 2;
+        const int    step   = static_cast<int>(img.step1());
+        const uchar* center = img.ptr<uchar>(pt.y) + pt.x;
+        int          m_01 = 0, m_10 = 0;
+        for (int u = -half; u <= half; ++u)
+            m_10 += u * center[u];
+        for (int v = 1; v <= half; ++v)
+        {
+            int       v_sum = 0;
+            const int d     = umax[static_cast<size_t>(v)];
+            for (int u = -d; u <= d; ++u)
+            {
+                const int plus  = center[u + v * step];
+                const int minus = center[u - v * step];
+                v_sum += plus - minus;
+                m_10 += u * (plus + minus);
+            }
+            m_01 += v * v_sum;
+        }
+        return cv::fastAtan2(static_cast<float>(m_01), static_cast<float>(m_10));
+    }
+}
+
+TileGrid::TileGrid(cv::Size size, int tile_size, int margin)
+    : m_size(size), m_tile_size(std::max(tile_size, 16)), m_margin(std::max(margin, 0))
+{
+    m_cols = (size.width + m_tile_size - 1) / m_tile_size;
+    m_rows = (size.height + m_tile_size - 1) / m_tile_size;
+}
+
+cv::Rect TileGrid::core(int tile) const
+{
+    const int x = (tile % m_cols) * m_tile_size;
+    const int y = (tile / m_cols) * m_tile_size;
+    return cv::Rect(x, y, std::min(m_tile_size, m_size.width - x), std::min(m_tile_size, m_size.height - y));
+}
+
+cv::Rect TileGrid::roi(int tile) const
+{
+    const cv::Rect rect = core(tile);
+    return cv::Rect(rect.x - m_margin, rect.y - m_margin, rect.width + 2 * m_margin, rect.height + 2 * m_margin) &
+           cv::Rect(cv::Point(), m_size);
+}
+
+void features::detectTiles(const cv::Mat& image, const cv::Mat& mask, const TileGrid& grid,
+                           const TileDetector& detector, Candidates& candidates)
+{
+    CV_Assert(grid.size() == image.size());
+    CV_Assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == image.size()));
+    std::vector<std::vector<cv::KeyPoint>> tiles(static_cast<size_t>(grid.count()));
+    cv::parallel_for_(cv::Range(0, grid.count()), TileBody(image, mask, grid, detector, tiles));
+
+    candidates.keypoints.clear();
+    candidates.offsets.assign(1, 0);
+    size_t total = 0;
+    for (const auto& tile : tiles)
+        total += tile.size();
+    candidates.keypoints.reserve(total);
+    for (const auto& tile : tiles)
+    {
+        candidates.keypoints.insert(candidates.keypoints.end(), tile.begin(), tile.end());
+        candidates.offsets.push_back(static_cast<int>(candidates.keypoints.size()));
+    }
+}
+
+void features::select(const Candidates& candidates, cv::Size size, int max_count, float min_distance, bool uniform,
+                      std::vector<cv::KeyPoint>& keypoints)
+{
+    keypoints.clear();
+    if (max_count <= 0 || candidates.keypoints.empty())
+        return;
+    keypoints.reserve(std::min(static_cast<size_t>(max_count), candidates.keypoints.size()));
+    DistanceGrid       grid(size, min_distance);
+    std::vector<uchar> state(candidates.keypoints.size(), Open);
+    std::vector<int>   quota(static_cast<size_t>(candidates.tiles()), -1);
+    if (uniform)
+    {
+        int occupied = 0;
+        for (int tile = 0; tile < candidates.tiles(); ++tile)
+            occupied += candidates.offsets[static_cast<size_t>(tile) + 1] > candidates.offsets[static_cast<size_t>(tile)];
+        std::fill(quota.begin(), quota.end(), std::max(1, max_count / std::max(occupied, 1)));
+        mergeTiles(candidates, state, quota, max_count, grid, keypoints);
+        std::fill(quota.begin(), quota.end(), -1);
+    }
+    mergeTiles(candidates, state, quota, max_count, grid, keypoints);
+    if (uniform)
+        std::sort(keypoints.begin(), keypoints.end(), stronger);
+}
+
+void features::goodFeaturesToTrack(const cv::Mat& image, const cv::Mat& mask, cv::Mat& corners,
+                                   const GFTTParams& params)
+{
+    CV_Assert(image.channels() == 1);
+    // Sobel aperture and block radius for the response plus one for the 3 x 3 maximum
+    const int          margin = params.block_size / 2 + 2;
+    const TileGrid     grid(image.size(), params.tile_size, margin);
+    std::vector<float> tile_max(static_cast<size_t>(grid.count()), 0.0f);
+
+    auto detector = [&params, &tile_max](int tile, const cv::Mat& img, const cv::Mat& tile_mask, const cv::Rect& core,
+                                         std::vector<cv::KeyPoint>& keypoints) {
+        cv::Mat eig;
+        if (params.use_harris)
+            cv::cornerHarris(img, eig, params.block_size, 3, params.harris_k);
+        else
+            cv::cornerMinEigenVal(img, eig, params.block_size, 3);
+        double max_val = 0.0;
+        cv::minMaxLoc(eig(core), nullptr, &max_val, nullptr, nullptr, tile_mask.empty() ? cv::Mat() : tile_mask(core));
+        tile_max[static_cast<size_t>(tile)] = static_cast<float>(max_val);
+
+        // Local maxima, pixels without a full neighbourhood are on the image border like in cv::goodFeaturesToTrack
+        const int y0 = std::max(core.y, 1);
+        const int y1 = std::min(core.y + core.height, eig.rows - 1);
+        const int x0 = std::max(core.x, 1);
+        const int x1 = std::min(core.x + core.width, eig.cols - 1);
+        for (int y = y0; y < y1; ++y)
+        {
+            const float* above = eig.ptr<float>(y - 1);
+            const float* row   = eig.ptr<float>(y);
+            const float* below = eig.ptr<float>(y + 1);
+            for (int x = x0; x < x1; ++x)
+            {
+                const float v = row[x];
+                if (v <= 0.0f || v < row[x - 1] || v < row[x + 1] || v < above[x - 1] || v < above[x] ||
+                    v < above[x + 1] || v < below[x - 1] || v < below[x] || v < below[x + 1])
+                    continue;
+                keypoints.push_back(cv::KeyPoint(static_cast<float>(x), static_cast<float>(y), 1.0f, -1.0f, v));
+            }
+        }
+    };
+    Candidates candidates;
+    detectTiles(image, mask, grid, detector, candidates);
+    const float max_val = tile_max.empty() ? 0.0f : *std::max_element(tile_max.begin(), tile_max.end());
+    truncate(candidates, static_cast<float>(max_val * params.quality_level));
+
+    std::vector<cv::KeyPoint> keypoints;
+    select(candidates, image.size(), params.max_corners > 0 ? params.max_corners : static_cast<int>(candidates.keypoints.size()),
+           static_cast<float>(params.min_distance), params.uniform, keypoints);
+    if (keypoints.empty())
+    {
+        corners.release();
+        return;
+    }
+    corners.create(1, static_cast<int>(keypoints.size()), CV_32FC2);
+    cv::Point2f* out = corners.ptr<cv::Point2f>();
+    for (size_t i = 0; i < keypoints.size(); ++i)
+        out[i] = keypoints[i].pt;
+}
+
+void features::fast(const cv::Mat& image, const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints,
+                    const FASTParams& params)
+{
+    CV_Assert(image.type() == CV_8UC1);
+    // Circle radius plus one for the non maximum suppression
+    const TileGrid grid(image.size(), params.tile_size, 4);
+    auto detector = [&params](int, const cv::Mat& img, const cv::Mat&, const cv::Rect&, std::vector<cv::KeyPoint>& out) {
+        cv::FAST(img, out, params.threshold, params.nonmax, params.type);
+    };
+    Candidates candidates;
+    detectTiles(image, mask, grid, detector, candidates);
+    select(candidates, image.size(), params.max_points, 0.0f, params.uniform, keypoints);
+}
+
+void features::detectORB(const std::vector<cv::Mat>& levels, const std::vector<float>& scales, const cv::Mat& mask,
+                         std::vector<cv::KeyPoint>& keypoints, const ORBParams& params)
+{
+    CV_Assert(!levels.empty() && levels.size() == scales.size());
+    keypoints.clear();
+    const int   num_levels = static_cast<int>(levels.size());
+    const int   half_patch = params.patch_size / 2;
+    const int   border     = std::max(params.edge_threshold, std::max(half_patch, harris_block / 2 + 1));
+    const auto  umax       = circleExtents(half_patch);
+    const bool  harris     = params.score_type == cv::ORB::HARRIS_SCORE;
+
+    // Budget of cv::ORB, geometric in the level area
+    const float factor  = num_levels > 1 ? scales[0] / scales[1] : 1.0f;
+    float       desired = factor < 1.0f
+                        ? params.num_features * (1.0f - factor) / (1.0f - std::pow(factor, static_cast<float>(num_levels)))
+                        : static_cast<float>(params.num_features) / num_levels;
+    int assigned = 0;
+
+    for (int level = 0; level < num_levels; ++level)
+    {
+        const cv::Mat& img = levels[static_cast<size_t>(level)];
+        CV_Assert(img.type() == CV_8UC1);
+        int budget = level == num_levels - 1 ? std::max(params.num_features - assigned, 0) : cvRound(desired);
+        desired *= factor;
+        assigned += budget;
+        if (budget == 0 || img.cols <= 2 * border || img.rows <= 2 * border)
+            continue;
+
+        // The border is masked off so that the descriptor patch and Harris block stay inside the level
+        cv::Mat level_mask(img.size(), CV_8UC1, cv::Scalar(0));
+        const cv::Rect inner(border, border, img.cols - 2 * border, img.rows - 2 * border);
+        if (mask.empty())
+            level_mask(inner).setTo(cv::Scalar(255));
+        else if (level == 0)
+            mask(inner).copyTo(level_mask(inner));
+        else
+        {
+            cv::Mat resized;
+            cv::resize(mask, resized, img.size(), 0, 0, cv::INTER_NEAREST);
+            resized(inner).copyTo(level_mask(inner));
+        }
+
+        const TileGrid grid(img.size(), params.tile_size, harris_block / 2 + 1);
+        auto detector = [&params, harris](int, const cv::Mat& tile, const cv::Mat&, const cv::Rect&,
+                                          std::vector<cv::KeyPoint>& out) {
+            cv::FAST(tile, out, params.fast_threshold, true, cv::FastFeatureDetector::TYPE_9_16);
+            if (harris)
+            {
+                for (cv::KeyPoint& kp : out)
+                {
+                    const cv::Point pt(cvRound(kp.pt.x), cvRound(kp.pt.y));
+                    // Points the tile doesn't surround fall onto the masked border and are dropped anyway
+                    if (pt.x > harris_block / 2 && pt.y > harris_block / 2 && pt.x < tile.cols - harris_block / 2 - 1 &&
+                        pt.y < tile.rows - harris_block / 2 - 1)
+                        kp.response = harrisResponse(tile, pt);
+                }
+            }
+        };
+        Candidates candidates;
+        detectTiles(img, level_mask, grid, detector, candidates);
+        std::vector<cv::KeyPoint> selected;
+        select(candidates, img.size(), budget, 0.0f, params.uniform, selected);
+
+        const float scale = scales[static_cast<size_t>(level)];
+        for (cv::KeyPoint& kp : selected)
+        {
+            kp.angle  = centroidAngle(img, cv::Point(cvRound(kp.pt.x), cvRound(kp.pt.y)), umax);
+            kp.octave = level;
+            kp.size   = params.patch_size * scale;
+            kp.pt *= scale;
+            keypoints.push_back(kp);
+        }
+    }
+}
+
+void features::packFAST(const std::vector<cv::KeyPoint>& keypoints, cv::Mat& packed)
+{
+    if (keypoints.empty())
+    {
+        packed.release();
+        return;
+    }
+    // Row 0 holds short2 locations, row 1 float responses
+    packed.create(2, static_cast<int>(keypoints.size()), CV_32FC1);
+    short* location = packed.ptr<short>(0);
+    float* response = packed.ptr<float>(1);
+    for (size_t i = 0; i < keypoints.size(); ++i)
+    {
+        location[2 * i]     = static_cast<short>(cvRound(keypoints[i].pt.x));
+        location[2 * i + 1] = static_cast<short>(cvRound(keypoints[i].pt.y));
+        response[i]         = keypoints[i].response;
+    }
+}
+
+void features::packORB(const std::vector<cv::KeyPoint>& keypoints, cv::Mat& packed)
+{
+    if (keypoints.empty())
+    {
+        packed.release();
+        return;
+    }
+    // x, y, response, angle, octave, size rows
+    packed.create(6, static_cast<int>(keypoints.size()), CV_32FC1);
+    for (int i = 0; i < packed.cols; ++i)
+    {
+        const cv::KeyPoint& kp = keypoints[static_cast<size_t>(i)];
+        packed.at<float>(0, i) = kp.pt.x;
+        packed.at<float>(1, i) = kp.pt.y;
+        packed.at<float>(2, i) = kp.response;
+        packed.at<float>(3, i) = kp.angle;
+        packed.at<float>(4, i) = static_cast<float>(kp.octave);
+        packed.at<float>(5, i) = kp.size;
+    }
+}
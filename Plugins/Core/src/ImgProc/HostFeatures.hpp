@@ -0,0 +1,113 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <opencv2/features2d.hpp>
+
+#include <functional>
+#include <vector>
+
+namespace aq
+{
+namespace features
+{
+    // Host feature detection on a grid of tiles.  Every tile owns a core rect, the cores partition the
+    // image.  Detectors see the core grown by a margin so that responses and non maximum suppression
+    // along the seams come out the same as on the full image, and only keep what falls into the core.
+    class Core_EXPORT TileGrid
+    {
+    public:
+        TileGrid(cv::Size size, int tile_size, int margin);
+
+        int      count() const { return m_cols * m_rows; }
+        cv::Size size() const { return m_size; }
+        cv::Rect core(int tile) const;
+        // Core plus margin, clipped to the image
+        cv::Rect roi(int tile) const;
+
+    private:
+        cv::Size m_size;
+        int      m_tile_size;
+        int      m_margin;
+        int      m_cols;
+        int      m_rows;
+    };
+
+    // Keypoints of every tile, each tile's range sorted by descending response
+    struct Core_EXPORT Candidates
+    {
+        std::vector<cv::KeyPoint> keypoints;
+        // Tile i is [offsets[i], offsets[i + 1])
+        std::vector<int> offsets;
+        int tiles() const { return static_cast<int>(offsets.size()) - 1; }
+    };
+
+    // Called concurrently for every tile with the tile index, the tile's roi of the image and of the mask
+    // (empty when there is none) and the core in roi coordinates.  Appends keypoints in roi coordinates,
+    // anything outside the core or the mask is dropped afterwards.
+    typedef std::function<void(int tile, const cv::Mat& image, const cv::Mat& mask, const cv::Rect& core,
+                               std::vector<cv::KeyPoint>& keypoints)>
+        TileDetector;
+
+    Core_EXPORT void detectTiles(const cv::Mat& image, const cv::Mat& mask, const TileGrid& grid,
+                                 const TileDetector& detector, Candidates& candidates);
+
+    // Merges the tiles by descending response and keeps up to max_count keypoints, skipping any that is
+    // closer than min_distance to one already kept.  With uniform set, every tile first only gets its
+    // share of max_count, what is left over is then filled from all tiles by response.
+    Core_EXPORT void select(const Candidates& candidates, cv::Size size, int max_count, float min_distance,
+                            bool uniform, std::vector<cv::KeyPoint>& keypoints);
+
+    struct GFTTParams
+    {
+        int    max_corners   = 1000;
+        double quality_level = 0.01;
+        double min_distance  = 0.0;
+        int    block_size    = 3;
+        bool   use_harris    = false;
+        double harris_k      = 0.04;
+        bool   uniform       = false;
+        int    tile_size     = 128;
+    };
+
+    // cv::goodFeaturesToTrack on tiles.  corners is 1 x N CV_32FC2 sorted by descending response, the
+    // same layout as cv::cuda::CornersDetector.
+    Core_EXPORT void goodFeaturesToTrack(const cv::Mat& image, const cv::Mat& mask, cv::Mat& corners,
+                                         const GFTTParams& params = GFTTParams());
+
+    struct FASTParams
+    {
+        int  threshold  = 10;
+        bool nonmax     = true;
+        int  type       = cv::FastFeatureDetector::TYPE_9_16;
+        int  max_points = 5000;
+        bool uniform    = false;
+        int  tile_size  = 128;
+    };
+
+    Core_EXPORT void fast(const cv::Mat& image, const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints,
+                          const FASTParams& params = FASTParams());
+
+    struct ORBParams
+    {
+        int   num_features   = 500;
+        int   edge_threshold = 31;
+        int   patch_size     = 31;
+        int   fast_threshold = 20;
+        int   score_type     = cv::ORB::HARRIS_SCORE;
+        bool  uniform        = false;
+        int   tile_size      = 128;
+    };
+
+    // Keypoint detection of cv::ORB on a prebuilt grey pyramid: FAST on tiles of every level, Harris
+    // rescoring, per level selection with cv::ORB's feature budget and intensity centroid orientation.
+    // scales[i] is the size of level 0 over the size of level i.  Keypoints are in level 0 coordinates
+    // with octave set to the level, ready for cv::ORB::compute.
+    Core_EXPORT void detectORB(const std::vector<cv::Mat>& levels, const std::vector<float>& scales,
+                               const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints,
+                               const ORBParams& params = ORBParams());
+
+    // Layouts of cv::cuda::FastFeatureDetector and cv::cuda::ORB keypoint outputs, so that the host and
+    // device paths publish the same thing and consumers can use the cuda detectors' convert()
+    Core_EXPORT void packFAST(const std::vector<cv::KeyPoint>& keypoints, cv::Mat& packed);
+    Core_EXPORT void packORB(const std::vector<cv::KeyPoint>& keypoints, cv::Mat& packed);
+}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <opencv2/core/hal/hal.hpp>
+#include <opencv2/core/mat.hpp>
+
+#include <vector>
+
+namespace aq
+{
+namespace filters
+{
+    // Host paths of the MedianBlur, MorphologyFilter and FFT nodes, used when their input lives on the cpu.
+    // They give the same results as the OpenCV functions they replace.
+
+    // cv::medianBlur with a replicated border.  Windows up to 5 go to OpenCV, larger ones take a constant time
+    // histogram filter for 8 bit and a sliding histogram for 16 bit input.  Returns false for other depths.
+    Core_EXPORT bool medianBlur(const cv::Mat& src, cv::Mat& dst, int window_size);
+
+    // cv::morphologyEx with the default border.  Rectangles and crosses of size x size take the separable
+    // van Herk / Gil-Werman filter, every other element goes to OpenCV.
+    Core_EXPORT void morphology(const cv::Mat& src, cv::Mat& dst, int op, int shape, int size, cv::Point anchor,
+                                int iterations, const cv::Mat& element);
+
+    // Host dft plan for one (size, flags, channels) combination along with the buffers it reuses
+    struct DftPlan
+    {
+        cv::Size size;
+        int flags = 0;
+        int src_channels = 0;
+        int dst_channels = 0;
+        cv::Ptr<cv::hal::DFT2D> dft;
+        cv::Mat input;
+        // Size of the last image copied into input, the padding is zeroed again when it changes
+        cv::Size input_size;
+        // Written in turns, the caller holds the other one until the next transform
+        cv::Mat outputs[2];
+        int next_output = 0;
+    };
+
+    // cv::dft of a zero padded copy of the input, complex output unless an inverse real output is asked
+    // for.  Plans of the last few sizes are kept.  With shift the zero frequency is moved to the center,
+    // which pads odd sizes by one, with optimized_size the padding goes up to cv::getOptimalDFTSize.
+    class Core_EXPORT Dft
+    {
+    public:
+        cv::Mat apply(const cv::Mat& in, int flags, bool shift = false, bool optimized_size = false);
+
+    private:
+        DftPlan& getPlan(cv::Size size, int flags, int src_channels, int dst_channels);
+
+        std::vector<DftPlan> m_plans;
+    };
+}
+}
@@ -116,6 +116,27 @@ bool Threshold::processImpl()
     return maxMask;
 }*/
 
-//MO_REGISTER_CLASS(NonMaxSuppression, Image, Processing)
+bool NonMaxSuppression::processImpl()
+{
+    if(method.getValue() == nms::Gaussian && !(sigma > 0.0f))
+    {
+        MO_LOG_EVERY_N(warning, 100) << "sigma has to be greater than 0 for gaussian soft-nms, it is " << sigma;
+        return false;
+    }
+    nms::Options options;
+    options.iou_threshold   = iou_threshold;
+    options.score_threshold = score_threshold;
+    options.class_aware     = class_aware;
+    options.method          = static_cast<nms::Method>(method.getValue());
+    options.sigma           = sigma;
+    options.prefilter       = static_cast<nms::Prefilter>(prefilter.getValue());
+    options.max_detections  = max_detections;
+    std::vector<DetectedObject> objects = *input_detections;
+    nms::suppress(objects, options);
+    detections_param.updateData(objects, mo::tag::_param = input_detections_param, _ctx.get());
+    return true;
+}
+
+MO_REGISTER_CLASS(NonMaxSuppression)
 MO_REGISTER_CLASS(MinMax)
 MO_REGISTER_CLASS(Threshold)
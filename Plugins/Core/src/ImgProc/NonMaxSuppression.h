@@ -1,6 +1,7 @@
 #pragma once
 
 #include "src/precompiled.hpp"
+#include "NMS.hpp"
 
 RUNTIME_COMPILER_SOURCEDEPENDENCY
 RUNTIME_MODIFIABLE_INCLUDE
@@ -45,11 +46,22 @@ namespace aq
         {
         public:
             MO_DERIVE(NonMaxSuppression, Node)
-                PARAM(int, size, 5);
-                INPUT(SyncedMemory, input, nullptr);
-                INPUT(SyncedMemory, mask, nullptr);
-                OUTPUT(SyncedMemory, suppressed_output, SyncedMemory());
+                INPUT(std::vector<DetectedObject>, input_detections, nullptr);
+                PARAM(float, iou_threshold, 0.5f);
+                PARAM(float, score_threshold, 0.0f);
+                TOOLTIP(score_threshold, "Detections with a confidence at or below this value are discarded");
+                PARAM(bool, class_aware, true);
+                TOOLTIP(class_aware, "Only suppress detections that share the same class");
+                ENUM_PARAM(method, aq::nms::Hard, aq::nms::Linear, aq::nms::Gaussian);
+                PARAM(float, sigma, 0.5f);
+                TOOLTIP(sigma, "Gaussian soft-nms decay parameter, has to be greater than 0");
+                ENUM_PARAM(prefilter, aq::nms::NoPrefilter, aq::nms::Grid, aq::nms::SortAndSweep);
+                TOOLTIP(prefilter, "Spatial prefilter used to skip testing distant pairs of boxes, useful with thousands of detections");
+                PARAM(int, max_detections, -1);
+                OUTPUT(std::vector<DetectedObject>, detections, {});
             MO_END;
+        protected:
+            bool processImpl();
         };
     }
 }
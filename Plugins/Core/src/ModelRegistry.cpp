@@ -0,0 +1,170 @@
+#include "ModelRegistry.hpp"
+#include <MetaObject/logging/logging.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <tuple>
+
+using namespace aq;
+
+namespace
+{
+    std::time_t lastWriteTime(const std::string& file)
+    {
+        boost::system::error_code ec;
+        std::time_t               time = boost::filesystem::last_write_time(file, ec);
+        return ec ? 0 : time;
+    }
+
+    bool isReady(const std::shared_future<std::shared_ptr<void> >& future)
+    {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+}
+
+bool ModelRegistry::Key::operator<(const Key& other) const
+{
+    return std::tie(model_file, weight_file, backend) < std::tie(other.model_file, other.weight_file, other.backend);
+}
+
+ModelRegistry& ModelRegistry::instance()
+{
+    static ModelRegistry inst;
+    return inst;
+}
+
+bool ModelRegistry::Poll::due(bool changed)
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!changed && now < next)
+        return false;
+    next = now + ModelRegistry::instance().checkInterval();
+    return true;
+}
+
+void ModelRegistry::setCheckInterval(std::chrono::milliseconds interval)
+{
+    m_check_interval = interval.count();
+}
+
+std::chrono::milliseconds ModelRegistry::checkInterval() const
+{
+    return std::chrono::milliseconds(m_check_interval.load());
+}
+
+ModelRegistry::Entry& ModelRegistry::getEntry(const Key& key, const Loader_t& loader)
+{
+    auto itr = m_entries.find(key);
+    if (itr == m_entries.end())
+    {
+        purgeLocked();
+        Entry entry;
+        entry.loader      = loader;
+        entry.weight_time = lastWriteTime(key.weight_file);
+        entry.model       = std::async(std::launch::async, loader).share();
+        itr               = m_entries.insert(std::make_pair(key, entry)).first;
+        MO_LOG(info) << "Loading " << key.backend << " model " << key.weight_file;
+    }
+    return itr->second;
+}
+
+void ModelRegistry::checkForUpdate(const Key& key, Entry& entry)
+{
+    if (entry.pending.valid())
+    {
+        if (!isReady(entry.pending))
+            return;
+        try
+        {
+            if (entry.pending.get())
+            {
+                entry.model = entry.pending;
+                ++entry.version;
+                MO_LOG(info) << "Swapped in updated weights " << key.weight_file;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            MO_LOG(warning) << "Failed to reload " << key.weight_file << ", keeping the previous weights: " << e.what();
+        }
+        entry.pending = std::shared_future<std::shared_ptr<void> >();
+        return;
+    }
+    const std::time_t time = lastWriteTime(key.weight_file);
+    if (time != 0 && time != entry.weight_time)
+    {
+        entry.weight_time = time;
+        entry.pending     = std::async(std::launch::async, entry.loader).share();
+    }
+}
+
+std::shared_ptr<void> ModelRegistry::acquireImpl(const Key& key, const Loader_t& loader, size_t* version)
+{
+    std::shared_future<std::shared_ptr<void> > model;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        Entry& entry = getEntry(key, loader);
+        entry.pinned = false;
+        checkForUpdate(key, entry);
+        model = entry.model;
+        if (version)
+            *version = entry.version;
+    }
+    // Wait outside of the lock so that other models can be acquired while this one loads
+    try
+    {
+        return model.get();
+    }
+    catch (...)
+    {
+        // Forget the failed load so that the next acquire retries
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_entries.erase(key);
+        throw;
+    }
+}
+
+void ModelRegistry::preloadImpl(const Key& key, const Loader_t& loader)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    getEntry(key, loader).pinned = true;
+}
+
+void ModelRegistry::purge()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    purgeLocked();
+}
+
+void ModelRegistry::purgeLocked()
+{
+    for (auto itr = m_entries.begin(); itr != m_entries.end();)
+    {
+        const Entry& entry = itr->second;
+        // Only the registry holds a reference to an unpinned, fully loaded model
+        if (!entry.pinned && !entry.pending.valid() && isReady(entry.model))
+        {
+            std::shared_ptr<void> model;
+            try
+            {
+                model = entry.model.get();
+            }
+            catch (...)
+            {
+            }
+            if (model.use_count() <= 2)
+            {
+                itr = m_entries.erase(itr);
+                continue;
+            }
+        }
+        ++itr;
+    }
+}
+
+size_t ModelRegistry::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_entries.size();
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "CoreExport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace aq
+{
+    // Process wide cache of loaded network weights, so that nodes running the same model on
+    // different streams share one copy of the weights and only allocate their own activations.
+    // Entries are reference counted through the returned shared_ptr and dropped by purge() once
+    // no node holds them anymore.  When the weight file changes on disk a replacement is loaded
+    // in the background and swapped in atomically, nodes pick it up on their next acquire.  Nodes
+    // acquire when their files change and otherwise once per check interval, see Poll.
+    class Core_EXPORT ModelRegistry
+    {
+    public:
+        struct Core_EXPORT Key
+        {
+            std::string model_file;
+            std::string weight_file;
+            std::string backend;
+            bool operator<(const Key& other) const;
+        };
+        typedef std::function<std::shared_ptr<void>()> Loader_t;
+
+        // Rate limits a node's acquire calls, the weight file is only looked at again once the
+        // check interval has passed unless the node's own model or weight file changed
+        struct Core_EXPORT Poll
+        {
+            bool due(bool changed);
+            std::chrono::steady_clock::time_point next;
+        };
+
+        static ModelRegistry& instance();
+
+        // Returns the current model for key, loading it with loader if necessary.  Only blocks
+        // while the first copy of a model is loading.  version is incremented on every hot-swap.
+        template <class T>
+        std::shared_ptr<T> acquire(const Key& key, const std::function<std::shared_ptr<T>()>& loader, size_t* version = nullptr)
+        {
+            return std::static_pointer_cast<T>(acquireImpl(key, eraseLoader(loader), version));
+        }
+
+        // Starts loading a model on a background thread, the model is kept until it is first acquired
+        template <class T>
+        void preload(const Key& key, const std::function<std::shared_ptr<T>()>& loader)
+        {
+            preloadImpl(key, eraseLoader(loader));
+        }
+
+        // Drops models that are no longer used by any node
+        void   purge();
+        size_t size() const;
+
+        // How often Poll lets a node check for an updated weight file, one second by default
+        void                      setCheckInterval(std::chrono::milliseconds interval);
+        std::chrono::milliseconds checkInterval() const;
+
+    private:
+        struct Entry
+        {
+            std::shared_future<std::shared_ptr<void> > model;
+            std::shared_future<std::shared_ptr<void> > pending;
+            Loader_t                                   loader;
+            std::time_t                                weight_time = 0;
+            size_t                                     version     = 0;
+            bool                                       pinned      = false;
+        };
+
+        template <class T>
+        static Loader_t eraseLoader(const std::function<std::shared_ptr<T>()>& loader)
+        {
+            return [loader]() -> std::shared_ptr<void> { return loader(); };
+        }
+
+        std::shared_ptr<void> acquireImpl(const Key& key, const Loader_t& loader, size_t* version);
+        void   preloadImpl(const Key& key, const Loader_t& loader);
+        Entry& getEntry(const Key& key, const Loader_t& loader);
+        void   checkForUpdate(const Key& key, Entry& entry);
+        void   purgeLocked();
+
+        mutable std::mutex                          m_mtx;
+        std::map<Key, Entry>                        m_entries;
+        std::atomic<std::chrono::milliseconds::rep> m_check_interval{1000};
+    };
+}
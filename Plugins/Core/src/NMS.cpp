@@ -0,0 +1,432 @@
+#include "NMS.hpp"
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace aq;
+using namespace aq::nms;
+
+void BoxArray::resize(size_t size)
+{
+    x1.resize(size);
+    y1.resize(size);
+    x2.resize(size);
+    y2.resize(size);
+    area.resize(size);
+}
+
+void BoxArray::set(size_t idx, const cv::Rect2f& box)
+{
+    x1[idx]   = box.x;
+    y1[idx]   = box.y;
+    x2[idx]   = box.x + box.width;
+    y2[idx]   = box.y + box.height;
+    area[idx] = std::max(box.width, 0.0f) * std::max(box.height, 0.0f);
+}
+
+void aq::nms::overlap(const BoxArray& boxes, size_t idx, size_t begin, size_t end, float* out, Metric metric)
+{
+    const float bx1   = boxes.x1[idx];
+    const float by1   = boxes.y1[idx];
+    const float bx2   = boxes.x2[idx];
+    const float by2   = boxes.y2[idx];
+    const float barea = boxes.area[idx];
+    const bool  iom   = metric == IntersectionOverMinimum;
+    size_t      j     = begin;
+#if CV_SIMD128
+    const cv::v_float32x4 vx1   = cv::v_setall_f32(bx1);
+    const cv::v_float32x4 vy1   = cv::v_setall_f32(by1);
+    const cv::v_float32x4 vx2   = cv::v_setall_f32(bx2);
+    const cv::v_float32x4 vy2   = cv::v_setall_f32(by2);
+    const cv::v_float32x4 varea = cv::v_setall_f32(barea);
+    const cv::v_float32x4 zero  = cv::v_setzero_f32();
+    const cv::v_float32x4 eps   = cv::v_setall_f32(1e-9f);
+    for (; j + 4 <= end; j += 4, out += 4)
+    {
+        cv::v_float32x4 w     = cv::v_max(cv::v_min(vx2, cv::v_load(boxes.x2.data() + j)) - cv::v_max(vx1, cv::v_load(boxes.x1.data() + j)), zero);
+        cv::v_float32x4 h     = cv::v_max(cv::v_min(vy2, cv::v_load(boxes.y2.data() + j)) - cv::v_max(vy1, cv::v_load(boxes.y1.data() + j)), zero);
+        cv::v_float32x4 inter = w * h;
+        cv::v_float32x4 area  = cv::v_load(boxes.area.data() + j);
+        cv::v_float32x4 denom = iom ? cv::v_min(varea, area) : varea + area - inter;
+        cv::v_store(out, inter / cv::v_max(denom, eps));
+    }
+#endif
+    for (; j < end; ++j, ++out)
+    {
+        const float w     = std::max(std::min(bx2, boxes.x2[j]) - std::max(bx1, boxes.x1[j]), 0.0f);
+        const float h     = std::max(std::min(by2, boxes.y2[j]) - std::max(by1, boxes.y1[j]), 0.0f);
+        const float inter = w * h;
+        const float denom = iom ? std::min(barea, boxes.area[j]) : barea + boxes.area[j] - inter;
+        *out              = inter / std::max(denom, 1e-9f);
+    }
+}
+
+namespace
+{
+    // Suppression over a single group of boxes (one class, or everything when class agnostic).
+    // Boxes are stored in descending score order so that hard nms is a single forward pass.
+    class Suppressor
+    {
+    public:
+        Suppressor(const Options& options, const BoxArray& boxes, std::vector<float>& scores)
+            : m_options(options)
+            , m_boxes(boxes)
+            , m_scores(scores)
+            , m_active(boxes.size(), 1)
+        {
+            if (m_options.prefilter == Grid)
+                buildGrid();
+            else if (m_options.prefilter == SortAndSweep)
+                buildSweep();
+        }
+
+        void run(std::vector<size_t>& kept, size_t max_kept)
+        {
+            if (m_options.method == Hard)
+                runHard(kept, max_kept);
+            else
+                runSoft(kept, max_kept);
+        }
+
+    private:
+        void runHard(std::vector<size_t>& kept, size_t max_kept)
+        {
+            const size_t num = m_boxes.size();
+            for (size_t i = 0; i < num && kept.size() < max_kept; ++i)
+            {
+                if (!m_active[i])
+                    continue;
+                kept.push_back(i);
+                m_active[i] = 0;
+                computeOverlap(i, true);
+                for (size_t k = 0; k < m_candidates.size(); ++k)
+                {
+                    if (m_overlap[k] > m_options.iou_threshold)
+                        m_active[m_candidates[k]] = 0;
+                }
+            }
+        }
+
+        void runSoft(std::vector<size_t>& kept, size_t max_kept)
+        {
+            const size_t num = m_boxes.size();
+            while (kept.size() < max_kept)
+            {
+                // scores only ever decay, so the best remaining box has to be searched for each round
+                size_t best = num;
+                for (size_t i = 0; i < num; ++i)
+                {
+                    if (m_active[i] && (best == num || m_scores[i] > m_scores[best]))
+                        best = i;
+                }
+                if (best == num)
+                    break;
+                kept.push_back(best);
+                m_active[best] = 0;
+                computeOverlap(best, false);
+                for (size_t k = 0; k < m_candidates.size(); ++k)
+                {
+                    const float overlap = m_overlap[k];
+                    float       weight  = 1.0f;
+                    if (m_options.method == Linear)
+                    {
+                        if (overlap > m_options.iou_threshold)
+                            weight = 1.0f - overlap;
+                    }
+                    else
+                    {
+                        weight = std::exp(-(overlap * overlap) / m_options.sigma);
+                    }
+                    const size_t idx = m_candidates[k];
+                    m_scores[idx] *= weight;
+                    if (m_scores[idx] <= m_options.score_threshold)
+                        m_active[idx] = 0;
+                }
+            }
+        }
+
+        // Fills m_candidates with the active boxes that may overlap boxes[idx] and m_overlap with their overlap
+        void computeOverlap(size_t idx, bool lower_ranks_only)
+        {
+            m_candidates.clear();
+            const size_t num = m_boxes.size();
+            if (m_options.prefilter == NoPrefilter)
+            {
+                // Contiguous range, evaluate iou directly on the score ordered boxes
+                const size_t begin = lower_ranks_only ? idx + 1 : 0;
+                if (begin >= num)
+                {
+                    m_overlap.clear();
+                    return;
+                }
+                m_overlap.resize(num - begin);
+                overlap(m_boxes, idx, begin, num, m_overlap.data(), m_options.metric);
+                size_t out = 0;
+                for (size_t j = begin; j < num; ++j)
+                {
+                    if (m_active[j])
+                    {
+                        m_candidates.push_back(j);
+                        m_overlap[out++] = m_overlap[j - begin];
+                    }
+                }
+                m_overlap.resize(out);
+                return;
+            }
+            if (m_options.prefilter == Grid)
+                gatherGrid(idx, lower_ranks_only);
+            else
+                gatherSweep(idx, lower_ranks_only);
+
+            // Pack the query box and its candidates so that overlap runs over contiguous memory
+            m_scratch.resize(m_candidates.size() + 1);
+            copyBox(idx, 0);
+            for (size_t k = 0; k < m_candidates.size(); ++k)
+                copyBox(m_candidates[k], k + 1);
+            m_overlap.resize(m_candidates.size());
+            if (!m_candidates.empty())
+                overlap(m_scratch, 0, 1, m_scratch.size(), m_overlap.data(), m_options.metric);
+        }
+
+        void copyBox(size_t src, size_t dst)
+        {
+            m_scratch.x1[dst]   = m_boxes.x1[src];
+            m_scratch.y1[dst]   = m_boxes.y1[src];
+            m_scratch.x2[dst]   = m_boxes.x2[src];
+            m_scratch.y2[dst]   = m_boxes.y2[src];
+            m_scratch.area[dst] = m_boxes.area[src];
+        }
+
+        bool isCandidate(size_t idx, size_t j, bool lower_ranks_only) const
+        {
+            return m_active[j] && j != idx && (!lower_ranks_only || j > idx);
+        }
+
+        void buildGrid()
+        {
+            const size_t num = m_boxes.size();
+            if (num == 0)
+                return;
+            float min_x = m_boxes.x1[0], min_y = m_boxes.y1[0], max_x = m_boxes.x2[0], max_y = m_boxes.y2[0];
+            float sum_w = 0.0f, sum_h = 0.0f;
+            for (size_t i = 0; i < num; ++i)
+            {
+                min_x = std::min(min_x, m_boxes.x1[i]);
+                min_y = std::min(min_y, m_boxes.y1[i]);
+                max_x = std::max(max_x, m_boxes.x2[i]);
+                max_y = std::max(max_y, m_boxes.y2[i]);
+                sum_w += m_boxes.x2[i] - m_boxes.x1[i];
+                sum_h += m_boxes.y2[i] - m_boxes.y1[i];
+            }
+            // Cells of twice the average box size keep most boxes within a 2x2 neighbourhood
+            const int max_cells = 256;
+            m_cell_w            = std::max(2.0f * sum_w / num, (max_x - min_x) / max_cells);
+            m_cell_h            = std::max(2.0f * sum_h / num, (max_y - min_y) / max_cells);
+            m_cell_w            = std::max(m_cell_w, 1e-6f);
+            m_cell_h            = std::max(m_cell_h, 1e-6f);
+            m_grid_origin       = cv::Point2f(min_x, min_y);
+            m_grid_cols         = std::min(max_cells, static_cast<int>((max_x - min_x) / m_cell_w) + 1);
+            m_grid_rows         = std::min(max_cells, static_cast<int>((max_y - min_y) / m_cell_h) + 1);
+            m_grid.assign(static_cast<size_t>(m_grid_cols * m_grid_rows), std::vector<size_t>());
+            for (size_t i = 0; i < num; ++i)
+            {
+                cv::Rect cells = cellRange(i);
+                for (int r = cells.y; r < cells.y + cells.height; ++r)
+                    for (int c = cells.x; c < cells.x + cells.width; ++c)
+                        m_grid[static_cast<size_t>(r * m_grid_cols + c)].push_back(i);
+            }
+            m_stamp.assign(num, 0);
+        }
+
+        cv::Rect cellRange(size_t idx) const
+        {
+            const int c0 = std::max(0, std::min(m_grid_cols - 1, static_cast<int>((m_boxes.x1[idx] - m_grid_origin.x) / m_cell_w)));
+            const int r0 = std::max(0, std::min(m_grid_rows - 1, static_cast<int>((m_boxes.y1[idx] - m_grid_origin.y) / m_cell_h)));
+            const int c1 = std::max(0, std::min(m_grid_cols - 1, static_cast<int>((m_boxes.x2[idx] - m_grid_origin.x) / m_cell_w)));
+            const int r1 = std::max(0, std::min(m_grid_rows - 1, static_cast<int>((m_boxes.y2[idx] - m_grid_origin.y) / m_cell_h)));
+            return cv::Rect(c0, r0, c1 - c0 + 1, r1 - r0 + 1);
+        }
+
+        void gatherGrid(size_t idx, bool lower_ranks_only)
+        {
+            ++m_query;
+            cv::Rect cells = cellRange(idx);
+            for (int r = cells.y; r < cells.y + cells.height; ++r)
+            {
+                for (int c = cells.x; c < cells.x + cells.width; ++c)
+                {
+                    for (size_t j : m_grid[static_cast<size_t>(r * m_grid_cols + c)])
+                    {
+                        if (m_stamp[j] != m_query && isCandidate(idx, j, lower_ranks_only))
+                        {
+                            m_stamp[j] = m_query;
+                            m_candidates.push_back(j);
+                        }
+                    }
+                }
+            }
+        }
+
+        void buildSweep()
+        {
+            const size_t num = m_boxes.size();
+            m_sweep_order.resize(num);
+            std::iota(m_sweep_order.begin(), m_sweep_order.end(), size_t(0));
+            std::sort(m_sweep_order.begin(), m_sweep_order.end(),
+                [this](size_t lhs, size_t rhs) { return m_boxes.x1[lhs] < m_boxes.x1[rhs]; });
+            m_sweep_x1.resize(num);
+            m_max_width = 0.0f;
+            for (size_t i = 0; i < num; ++i)
+            {
+                m_sweep_x1[i] = m_boxes.x1[m_sweep_order[i]];
+                m_max_width   = std::max(m_max_width, m_boxes.x2[i] - m_boxes.x1[i]);
+            }
+        }
+
+        void gatherSweep(size_t idx, bool lower_ranks_only)
+        {
+            // Any box overlapping on the x axis has its left edge within (x1 - max_width, x2)
+            const float x1    = m_boxes.x1[idx];
+            const float x2    = m_boxes.x2[idx];
+            const float y1    = m_boxes.y1[idx];
+            const float y2    = m_boxes.y2[idx];
+            auto        begin = std::upper_bound(m_sweep_x1.begin(), m_sweep_x1.end(), x1 - m_max_width);
+            auto        end   = std::lower_bound(begin, m_sweep_x1.end(), x2);
+            for (auto itr = begin; itr != end; ++itr)
+            {
+                const size_t j = m_sweep_order[static_cast<size_t>(itr - m_sweep_x1.begin())];
+                if (isCandidate(idx, j, lower_ranks_only) && m_boxes.y1[j] < y2 && m_boxes.y2[j] > y1)
+                    m_candidates.push_back(j);
+            }
+        }
+
+        const Options&       m_options;
+        const BoxArray&      m_boxes;
+        std::vector<float>&  m_scores;
+        std::vector<uchar>   m_active;
+        std::vector<size_t>  m_candidates;
+        std::vector<float>   m_overlap;
+        BoxArray             m_scratch;
+
+        // Grid prefilter
+        std::vector<std::vector<size_t> > m_grid;
+        std::vector<size_t>               m_stamp;
+        size_t                            m_query     = 0;
+        int                               m_grid_cols = 0;
+        int                               m_grid_rows = 0;
+        float                             m_cell_w    = 1.0f;
+        float                             m_cell_h    = 1.0f;
+        cv::Point2f                       m_grid_origin;
+
+        // Sort and sweep prefilter
+        std::vector<size_t> m_sweep_order;
+        std::vector<float>  m_sweep_x1;
+        float               m_max_width = 0.0f;
+    };
+}
+
+std::vector<size_t> aq::nms::suppress(const std::vector<cv::Rect2f>& boxes,
+                                      const std::vector<float>&      scores,
+                                      const std::vector<int>&        classes,
+                                      const Options&                 options,
+                                      std::vector<float>*            out_scores)
+{
+    CV_Assert(boxes.size() == scores.size());
+    CV_Assert(classes.empty() || classes.size() == boxes.size());
+    // Gaussian decay divides by sigma, 0 gives NaN scores
+    CV_Assert(options.method != Gaussian || options.sigma > 0.0f);
+    const bool by_class = options.class_aware && !classes.empty();
+
+    std::vector<size_t> order;
+    order.reserve(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+    {
+        if (scores[i] > options.score_threshold)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        if (by_class && classes[lhs] != classes[rhs])
+            return classes[lhs] < classes[rhs];
+        if (scores[lhs] != scores[rhs])
+            return scores[lhs] > scores[rhs];
+        return lhs < rhs;
+    });
+
+    const size_t max_kept = options.max_detections < 0 ? order.size() : static_cast<size_t>(options.max_detections);
+    std::vector<std::pair<float, size_t> > kept;
+    BoxArray                               group_boxes;
+    std::vector<float>                     group_scores;
+    std::vector<size_t>                    group_kept;
+    for (size_t begin = 0; begin < order.size();)
+    {
+        size_t end = begin + 1;
+        if (by_class)
+        {
+            while (end < order.size() && classes[order[end]] == classes[order[begin]])
+                ++end;
+        }
+        else
+        {
+            end = order.size();
+        }
+        const size_t num = end - begin;
+        group_boxes.resize(num);
+        group_scores.resize(num);
+        for (size_t i = 0; i < num; ++i)
+        {
+            group_boxes.set(i, boxes[order[begin + i]]);
+            group_scores[i] = scores[order[begin + i]];
+        }
+        group_kept.clear();
+        Suppressor(options, group_boxes, group_scores).run(group_kept, max_kept);
+        for (size_t idx : group_kept)
+            kept.emplace_back(group_scores[idx], order[begin + idx]);
+        begin = end;
+    }
+
+    std::stable_sort(kept.begin(), kept.end(), [](const std::pair<float, size_t>& lhs, const std::pair<float, size_t>& rhs) {
+        return lhs.first > rhs.first;
+    });
+    if (kept.size() > max_kept)
+        kept.resize(max_kept);
+
+    std::vector<size_t> output;
+    output.reserve(kept.size());
+    if (out_scores)
+        out_scores->clear();
+    for (const auto& itr : kept)
+    {
+        output.push_back(itr.second);
+        if (out_scores)
+            out_scores->push_back(itr.first);
+    }
+    return output;
+}
+
+void aq::nms::suppress(std::vector<DetectedObject>& objects, const Options& options)
+{
+    std::vector<cv::Rect2f> boxes;
+    std::vector<float>      scores;
+    std::vector<int>        classes;
+    boxes.reserve(objects.size());
+    scores.reserve(objects.size());
+    classes.reserve(objects.size());
+    for (const auto& obj : objects)
+    {
+        boxes.push_back(obj.bounding_box);
+        scores.push_back(obj.classification.confidence);
+        classes.push_back(obj.classification.classNumber);
+    }
+    std::vector<float>          kept_scores;
+    std::vector<size_t>         kept = suppress(boxes, scores, classes, options, &kept_scores);
+    std::vector<DetectedObject> output;
+    output.reserve(kept.size());
+    for (size_t i = 0; i < kept.size(); ++i)
+    {
+        output.push_back(objects[kept[i]]);
+        output.back().classification.confidence = kept_scores[i];
+    }
+    objects.swap(output);
+}
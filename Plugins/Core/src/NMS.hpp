@@ -0,0 +1,72 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <Aquila/types/ObjectDetection.hpp>
+#include <opencv2/core/types.hpp>
+#include <vector>
+
+namespace aq
+{
+namespace nms
+{
+    enum Method
+    {
+        Hard,     // discard any box overlapping a higher scoring box
+        Linear,   // soft-nms, score *= 1 - iou
+        Gaussian  // soft-nms, score *= exp(-iou^2 / sigma)
+    };
+
+    enum Metric
+    {
+        IntersectionOverUnion,
+        IntersectionOverMinimum // catches partial boxes cut off at tile seams
+    };
+
+    enum Prefilter
+    {
+        NoPrefilter,  // test every pair, vectorized
+        Grid,         // bucket boxes into a uniform grid, only test boxes sharing a cell
+        SortAndSweep  // sort by left edge, only test boxes overlapping on the x axis
+    };
+
+    struct Core_EXPORT Options
+    {
+        float     iou_threshold   = 0.5f;
+        float     score_threshold = 0.0f;
+        bool      class_aware     = true;
+        Method    method          = Hard;
+        Metric    metric          = IntersectionOverUnion;
+        float     sigma           = 0.5f; // must be > 0 for Gaussian
+        Prefilter prefilter       = NoPrefilter;
+        int       max_detections  = -1;
+    };
+
+    // Structure of arrays box storage so that iou can be evaluated several boxes at a time
+    struct Core_EXPORT BoxArray
+    {
+        void   resize(size_t size);
+        void   set(size_t idx, const cv::Rect2f& box);
+        size_t size() const { return x1.size(); }
+
+        std::vector<float> x1;
+        std::vector<float> y1;
+        std::vector<float> x2;
+        std::vector<float> y2;
+        std::vector<float> area;
+    };
+
+    // Overlap of boxes[idx] against boxes[begin, end), written to out[0, end - begin)
+    Core_EXPORT void overlap(const BoxArray& boxes, size_t idx, size_t begin, size_t end, float* out,
+                             Metric metric = IntersectionOverUnion);
+
+    // Returns the indices of the kept boxes, sorted by descending (possibly decayed) score.
+    // If out_scores is not null it is filled with the final score of each kept box.
+    Core_EXPORT std::vector<size_t> suppress(const std::vector<cv::Rect2f>& boxes,
+                                             const std::vector<float>&      scores,
+                                             const std::vector<int>&        classes,
+                                             const Options&                 options,
+                                             std::vector<float>*            out_scores = nullptr);
+
+    // Suppresses objects in place, the surviving objects are ordered by descending confidence
+    Core_EXPORT void suppress(std::vector<DetectedObject>& objects, const Options& options);
+}
+}
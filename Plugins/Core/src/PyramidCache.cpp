@@ -0,0 +1,310 @@
+#include "PyramidCache.hpp"
+#include <Aquila/rcc/external_includes/cv_cudaimgproc.hpp>
+#include <Aquila/rcc/external_includes/cv_cudawarping.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+using namespace aq;
+
+namespace
+{
+    // Current and previous frame, what optical flow needs
+    const size_t frames_per_source = 2;
+    // Sources that haven't been seen for a while are dropped past this
+    const size_t max_sources = 32;
+
+    int greyCode(int channels) { return channels == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY; }
+
+    // A buffer can only be written again if nobody else holds a header to it
+    void keepIfUnique(cv::Mat& mat)
+    {
+        if (!mat.u || mat.u->refcount != 1)
+            mat.release();
+    }
+
+    void keepIfUnique(cv::cuda::GpuMat& mat)
+    {
+        if (!mat.refcount || *mat.refcount != 1)
+            mat.release();
+    }
+}
+
+ImagePyramid::ImagePyramid(const SyncedMemory& image, float scale_factor, ColorSpace colorspace)
+    : m_image(image), m_scale_factor(scale_factor), m_colorspace(colorspace)
+{
+    CV_Assert(scale_factor > 0.0f && scale_factor < 1.0f);
+    m_size = m_image.getSize();
+}
+
+cv::Size ImagePyramid::getSize(int level) const
+{
+    cv::Size size = m_size;
+    for (int i = 0; i < level; ++i)
+    {
+        if (m_scale_factor == 0.5f)
+            size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+        else
+            size = cv::Size(cvRound(size.width * m_scale_factor), cvRound(size.height * m_scale_factor));
+    }
+    return size;
+}
+
+int ImagePyramid::selectLevel(cv::Size roi, cv::Size target, int max_level) const
+{
+    int level = 0;
+    for (int i = 1; i <= max_level; ++i)
+    {
+        const cv::Size size = getSize(i);
+        const double   sx   = double(size.width) / m_size.width;
+        const double   sy   = double(size.height) / m_size.height;
+        if (roi.width * sx < target.width || roi.height * sy < target.height || size.width < 8 || size.height < 8)
+            break;
+        level = i;
+    }
+    return level;
+}
+
+cv::Rect ImagePyramid::mapRect(const cv::Rect& roi, int level) const
+{
+    const cv::Size size = getSize(level);
+    const double   sx   = double(size.width) / m_size.width;
+    const double   sy   = double(size.height) / m_size.height;
+    const int      x0   = cvFloor(roi.x * sx);
+    const int      y0   = cvFloor(roi.y * sy);
+    const int      x1   = cvCeil((roi.x + roi.width) * sx);
+    const int      y1   = cvCeil((roi.y + roi.height) * sy);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(cv::Point(), size);
+}
+
+void ImagePyramid::buildHost(int level, cv::cuda::Stream& stream)
+{
+    if (m_host.size() <= static_cast<size_t>(level))
+        m_host.resize(static_cast<size_t>(level) + 1);
+    for (size_t i = m_host_levels; i <= static_cast<size_t>(level); ++i)
+    {
+        if (i == 0)
+        {
+            const cv::Mat image = m_image.getMat(stream);
+            if (m_colorspace == Grey && image.channels() > 1)
+                cv::cvtColor(image, m_host[0], greyCode(image.channels()));
+            else
+                m_host[0] = image;
+        }
+        else if (m_scale_factor == 0.5f)
+        {
+            cv::pyrDown(m_host[i - 1], m_host[i]);
+        }
+        else
+        {
+            cv::resize(m_host[i - 1], m_host[i], getSize(static_cast<int>(i)), 0, 0, cv::INTER_LINEAR);
+        }
+    }
+    m_host_levels = std::max(m_host_levels, static_cast<size_t>(level) + 1);
+}
+
+void ImagePyramid::buildDevice(int level, cv::cuda::Stream& stream)
+{
+    if (m_device.size() <= static_cast<size_t>(level))
+        m_device.resize(static_cast<size_t>(level) + 1);
+    // Events are handles, every level needs its own
+    while (m_device_ready.size() < m_device.size())
+        m_device_ready.emplace_back(cv::cuda::Event::DISABLE_TIMING);
+    // Reads of the previous owner of recycled buffers may still be queued
+    for (cv::cuda::Event& event : m_recycled)
+        stream.waitEvent(event);
+    m_recycled.clear();
+    // The next level is resampled from one that may have been built on another stream
+    if (m_device_levels != 0)
+        stream.waitEvent(m_device_ready[m_device_levels - 1]);
+    for (size_t i = m_device_levels; i <= static_cast<size_t>(level); ++i)
+    {
+        if (i == 0)
+        {
+            const cv::cuda::GpuMat image = m_image.getGpuMat(stream);
+            if (m_colorspace == Grey && image.channels() > 1)
+                cv::cuda::cvtColor(image, m_device[0], greyCode(image.channels()), 1, stream);
+            else
+                m_device[0] = image;
+        }
+        else if (m_scale_factor == 0.5f)
+        {
+            cv::cuda::pyrDown(m_device[i - 1], m_device[i], stream);
+        }
+        else
+        {
+            cv::cuda::resize(m_device[i - 1], m_device[i], getSize(static_cast<int>(i)), 0, 0, cv::INTER_LINEAR, stream);
+        }
+        m_device_ready[i].record(stream);
+    }
+    m_device_levels = std::max(m_device_levels, static_cast<size_t>(level) + 1);
+}
+
+void ImagePyramid::useStream(cv::cuda::Stream& stream)
+{
+    const cudaStream_t handle = cv::cuda::StreamAccessor::getStream(stream);
+    for (cv::cuda::Stream& used : m_device_streams)
+    {
+        if (cv::cuda::StreamAccessor::getStream(used) == handle)
+            return;
+    }
+    m_device_streams.push_back(stream);
+}
+
+cv::Mat ImagePyramid::getMat(int level, cv::cuda::Stream& stream)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (static_cast<size_t>(level) >= m_host_levels)
+        buildHost(level, stream);
+    return m_host[level];
+}
+
+cv::cuda::GpuMat ImagePyramid::getGpuMat(int level, cv::cuda::Stream& stream)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    useStream(stream);
+    if (static_cast<size_t>(level) >= m_device_levels)
+        buildDevice(level, stream);
+    else
+        stream.waitEvent(m_device_ready[level]);
+    return m_device[level];
+}
+
+void ImagePyramid::recycle(ImagePyramid& other)
+{
+    std::lock(m_mtx, other.m_mtx);
+    std::lock_guard<std::mutex> lock(m_mtx, std::adopt_lock);
+    std::lock_guard<std::mutex> other_lock(other.m_mtx, std::adopt_lock);
+    if (m_host_levels != 0 || m_device_levels != 0)
+        return;
+    m_host.swap(other.m_host);
+    m_device.swap(other.m_device);
+    std::for_each(m_host.begin(), m_host.end(), [](cv::Mat& mat) { keepIfUnique(mat); });
+    std::for_each(m_device.begin(), m_device.end(), [](cv::cuda::GpuMat& mat) { keepIfUnique(mat); });
+    if (std::any_of(m_device.begin(), m_device.end(), [](const cv::cuda::GpuMat& mat) { return !mat.empty(); }))
+    {
+        // Nobody holds a header anymore so every read of the buffers is queued by now
+        for (cv::cuda::Stream& used : other.m_device_streams)
+        {
+            m_recycled.emplace_back(cv::cuda::Event::DISABLE_TIMING);
+            m_recycled.back().record(used);
+        }
+    }
+    other.m_device_streams.clear();
+    other.m_host_levels   = 0;
+    other.m_device_levels = 0;
+}
+
+bool PyramidCache::Key::operator<(const Key& other) const
+{
+    return std::tie(source, scale_factor, colorspace) < std::tie(other.source, other.scale_factor, other.colorspace);
+}
+
+PyramidCache& PyramidCache::instance()
+{
+    static PyramidCache inst;
+    return inst;
+}
+
+std::shared_ptr<ImagePyramid> PyramidCache::get(const void* source, size_t frame_number, const SyncedMemory& image,
+                                                float scale_factor, ImagePyramid::ColorSpace colorspace)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const Key key  = {source, scale_factor, colorspace};
+    Slot&     slot = m_slots[key];
+    slot.last_use  = ++m_clock;
+    for (const Frame& frame : slot.frames)
+    {
+        if (frame.frame_number == frame_number)
+        {
+            ++m_stats.hits;
+            return frame.pyramid;
+        }
+    }
+    ++m_stats.misses;
+    auto pyramid = std::make_shared<ImagePyramid>(image, scale_factor, colorspace);
+    if (slot.frames.size() >= frames_per_source)
+    {
+        std::shared_ptr<ImagePyramid> oldest = slot.frames.front().pyramid;
+        slot.frames.pop_front();
+        if (oldest.use_count() == 1)
+        {
+            pyramid->recycle(*oldest);
+            ++m_stats.recycled;
+        }
+    }
+    Frame frame;
+    frame.frame_number = frame_number;
+    frame.pyramid      = pyramid;
+    slot.frames.push_back(frame);
+
+    if (m_slots.size() > max_sources)
+    {
+        auto lru = m_slots.end();
+        for (auto itr = m_slots.begin(); itr != m_slots.end(); ++itr)
+        {
+            if (lru == m_slots.end() || itr->second.last_use < lru->second.last_use)
+                lru = itr;
+        }
+        m_slots.erase(lru);
+    }
+    return pyramid;
+}
+
+std::shared_ptr<ImagePyramid> PyramidCache::find(const void* source, size_t frame_number, float scale_factor,
+                                                 ImagePyramid::ColorSpace colorspace) const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const Key key = {source, scale_factor, colorspace};
+    auto      itr = m_slots.find(key);
+    if (itr == m_slots.end())
+        return std::shared_ptr<ImagePyramid>();
+    for (const Frame& frame : itr->second.frames)
+    {
+        if (frame.frame_number == frame_number)
+            return frame.pyramid;
+    }
+    return std::shared_ptr<ImagePyramid>();
+}
+
+void PyramidCache::release(const void* source)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto itr = m_slots.begin(); itr != m_slots.end();)
+    {
+        if (itr->first.source == source)
+            itr = m_slots.erase(itr);
+        else
+            ++itr;
+    }
+}
+
+void PyramidCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_slots.clear();
+}
+
+size_t PyramidCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    size_t count = 0;
+    for (const auto& slot : m_slots)
+        count += slot.second.frames.size();
+    return count;
+}
+
+PyramidCache::Stats PyramidCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_stats;
+}
+
+PyramidSources::~PyramidSources()
+{
+    for (const void* source : m_sources)
+        PyramidCache::instance().release(source);
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <Aquila/types/SyncedMemory.hpp>
+#include <opencv2/core/cuda.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aq
+{
+    // Scale space of one frame.  Levels are built on first request, on the host or the device
+    // depending on which accessor is used, and are shared read-only by everyone holding the pyramid.
+    // Level 0 is the frame in the requested colorspace, level i + 1 is level i scaled by the scale
+    // factor.  A factor of 0.5 uses pyrDown like the optical flow nodes, anything else a linear resize
+    // like cv::ORB.  Device levels are built on the stream of the first requester, every later
+    // requester's stream waits for the level to be ready.
+    class Core_EXPORT ImagePyramid
+    {
+    public:
+        enum ColorSpace
+        {
+            Native,
+            Grey
+        };
+
+        ImagePyramid(const SyncedMemory& image, float scale_factor, ColorSpace colorspace);
+
+        float      getScaleFactor() const { return m_scale_factor; }
+        ColorSpace getColorSpace() const { return m_colorspace; }
+
+        // Size of a level, computed without building it
+        cv::Size getSize(int level) const;
+        // Deepest level at which roi (in level 0 coordinates) is still at least target in size
+        int selectLevel(cv::Size roi, cv::Size target, int max_level = 16) const;
+        // Maps a rect in level 0 coordinates into a level, clipped to the level
+        cv::Rect mapRect(const cv::Rect& roi, int level) const;
+
+        cv::Mat          getMat(int level, cv::cuda::Stream& stream);
+        cv::cuda::GpuMat getGpuMat(int level, cv::cuda::Stream& stream);
+
+        // Takes over the buffers of a pyramid that nobody else references anymore
+        void recycle(ImagePyramid& other);
+
+    private:
+        void buildHost(int level, cv::cuda::Stream& stream);
+        void buildDevice(int level, cv::cuda::Stream& stream);
+
+        void useStream(cv::cuda::Stream& stream);
+
+        SyncedMemory                  m_image;
+        cv::Size                      m_size;
+        float                         m_scale_factor;
+        ColorSpace                    m_colorspace;
+        std::mutex                    m_mtx;
+        std::vector<cv::Mat>          m_host;
+        std::vector<cv::cuda::GpuMat> m_device;
+        // Recorded on the building stream once the device level is written
+        std::vector<cv::cuda::Event>  m_device_ready;
+        // Every stream that was handed a device level, their queued reads have to finish before the
+        // buffers are written again
+        std::vector<cv::cuda::Stream> m_device_streams;
+        // Recorded on the streams of the pyramid whose buffers were taken over, waited on before the
+        // first device level is built into them
+        std::vector<cv::cuda::Event>  m_recycled;
+        size_t                        m_host_levels   = 0;
+        size_t                        m_device_levels = 0;
+    };
+
+    // Per-frame pyramids shared between every node that works on the same source, so that optical
+    // flow, feature detection, resizing and network preprocessing of one frame resample it once.
+    // Pyramids are keyed on the source param, scale factor and colorspace, the last two frames of each
+    // source are kept so that the previous frame's pyramid is available to optical flow.  When a frame
+    // drops out of the cache and no node holds its pyramid anymore, its buffers are reused for the next.
+    class Core_EXPORT PyramidCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits     = 0;
+            uint64_t misses   = 0;
+            uint64_t recycled = 0;
+        };
+
+        static PyramidCache& instance();
+
+        // Identity of the output an input param is connected to, or of the input itself when unconnected
+        template <class Param>
+        static const void* sourceOf(Param& param)
+        {
+            if (const void* source = param.getInputParam())
+                return source;
+            return &param;
+        }
+
+        // Returns the pyramid of frame_number of source, creating it from image if needed.  Sources
+        // are expected to number their frames, a repeated frame number returns the cached pyramid.
+        std::shared_ptr<ImagePyramid> get(const void* source, size_t frame_number, const SyncedMemory& image,
+                                          float scale_factor = 0.5f,
+                                          ImagePyramid::ColorSpace colorspace = ImagePyramid::Native);
+        // Returns an already created pyramid or nullptr
+        std::shared_ptr<ImagePyramid> find(const void* source, size_t frame_number, float scale_factor = 0.5f,
+                                           ImagePyramid::ColorSpace colorspace = ImagePyramid::Native) const;
+
+        // Forgets every pyramid of source, see PyramidSources
+        void   release(const void* source);
+        void   clear();
+        size_t size() const;
+        Stats  getStats() const;
+
+    private:
+        struct Key
+        {
+            const void* source;
+            float       scale_factor;
+            int         colorspace;
+            bool operator<(const Key& other) const;
+        };
+        struct Frame
+        {
+            size_t                        frame_number;
+            std::shared_ptr<ImagePyramid> pyramid;
+        };
+        struct Slot
+        {
+            std::deque<Frame> frames;
+            uint64_t          last_use = 0;
+        };
+
+        mutable std::mutex   m_mtx;
+        std::map<Key, Slot>  m_slots;
+        uint64_t             m_clock = 0;
+        Stats                m_stats;
+    };
+
+    // Sources a node takes pyramids from.  The cache is keyed on param addresses, they are released
+    // when the node is destroyed so that a param allocated later at the same address can not be
+    // handed the pyramids of a source that is gone.
+    class Core_EXPORT PyramidSources
+    {
+    public:
+        PyramidSources() = default;
+        PyramidSources(const PyramidSources&) = delete;
+        PyramidSources& operator=(const PyramidSources&) = delete;
+        ~PyramidSources();
+
+        // Pyramid of the current frame of the input param
+        template <class Param>
+        std::shared_ptr<ImagePyramid> get(Param& param, const SyncedMemory& image, float scale_factor = 0.5f,
+                                          ImagePyramid::ColorSpace colorspace = ImagePyramid::Native)
+        {
+            const void* source = PyramidCache::sourceOf(param);
+            if (std::find(m_sources.begin(), m_sources.end(), source) == m_sources.end())
+                m_sources.push_back(source);
+            return PyramidCache::instance().get(source, param.getFrameNumber(), image, scale_factor, colorspace);
+        }
+
+    private:
+        std::vector<const void*> m_sources;
+    };
+}
@@ -0,0 +1,197 @@
+#include "Quantization.hpp"
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+using namespace aq;
+using namespace aq::quant;
+
+std::string CalibrationTable::pathFor(const std::string& weight_file)
+{
+    return weight_file + ".calib";
+}
+
+bool CalibrationTable::load(const std::string& path)
+{
+    std::ifstream ifs(path.c_str());
+    if (!ifs)
+        return false;
+    scales.clear();
+    std::string name;
+    float       scale;
+    while (ifs >> name >> scale)
+    {
+        scales[name] = scale;
+    }
+    return !scales.empty();
+}
+
+bool CalibrationTable::save(const std::string& path) const
+{
+    std::ofstream ofs(path.c_str());
+    if (!ofs)
+        return false;
+    ofs.precision(9);
+    for (const auto& itr : scales)
+    {
+        ofs << itr.first << " " << itr.second << "\n";
+    }
+    return static_cast<bool>(ofs);
+}
+
+float CalibrationTable::scale(const std::string& name) const
+{
+    auto itr = scales.find(name);
+    return itr == scales.end() ? 0.0f : itr->second;
+}
+
+RangeObserver::RangeObserver(double percentile, int bins)
+    : m_percentile(percentile)
+    , m_bins(bins)
+{
+}
+
+void RangeObserver::observe(const std::string& name, const float* data, size_t size)
+{
+    if (size == 0)
+        return;
+    Histogram& hist = m_histograms[name];
+    float      max  = 0.0f;
+    for (size_t i = 0; i < size; ++i)
+        max = std::max(max, std::abs(data[i]));
+    if (hist.counts.empty())
+    {
+        hist.counts.resize(static_cast<size_t>(m_bins), 0);
+        hist.range = max > 0.0f ? max : 1.0f;
+    }
+    // Double the range by merging neighbouring bins until the new values fit
+    while (max > hist.range)
+    {
+        for (int i = 0; i < m_bins / 2; ++i)
+            hist.counts[i] = hist.counts[2 * i] + hist.counts[2 * i + 1];
+        std::fill(hist.counts.begin() + m_bins / 2, hist.counts.end(), 0);
+        hist.range *= 2.0f;
+    }
+    const float scale = m_bins / hist.range;
+    for (size_t i = 0; i < size; ++i)
+    {
+        const int bin = std::min(static_cast<int>(std::abs(data[i]) * scale), m_bins - 1);
+        ++hist.counts[bin];
+    }
+}
+
+CalibrationTable RangeObserver::table() const
+{
+    CalibrationTable table;
+    for (const auto& itr : m_histograms)
+    {
+        const Histogram& hist  = itr.second;
+        uint64_t         total = 0;
+        for (uint64_t count : hist.counts)
+            total += count;
+        const double target = m_percentile * total;
+        uint64_t     sum    = 0;
+        int          bin    = 0;
+        for (; bin < m_bins - 1; ++bin)
+        {
+            sum += hist.counts[bin];
+            if (sum >= target)
+                break;
+        }
+        const float threshold = hist.range * (bin + 1) / m_bins;
+        table.scales[itr.first] = threshold / 127.0f;
+    }
+    return table;
+}
+
+void aq::quant::quantize(const float* src, int8_t* dst, size_t size, float scale)
+{
+    const float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+    size_t      i   = 0;
+#if CV_SIMD128
+    const cv::v_float32x4 vinv = cv::v_setall_f32(inv);
+    for (; i + 16 <= size; i += 16)
+    {
+        cv::v_int32x4 a = cv::v_round(cv::v_load(src + i) * vinv);
+        cv::v_int32x4 b = cv::v_round(cv::v_load(src + i + 4) * vinv);
+        cv::v_int32x4 c = cv::v_round(cv::v_load(src + i + 8) * vinv);
+        cv::v_int32x4 d = cv::v_round(cv::v_load(src + i + 12) * vinv);
+        // Saturating packs, then clip -128 to keep the range symmetric
+        cv::v_int8x16 q = cv::v_pack(cv::v_pack(a, b), cv::v_pack(c, d));
+        cv::v_store(reinterpret_cast<schar*>(dst + i), cv::v_max(q, cv::v_setall_s8(-127)));
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        const int q = cvRound(src[i] * inv);
+        dst[i]      = static_cast<int8_t>(std::max(-127, std::min(127, q)));
+    }
+}
+
+namespace
+{
+    inline int32_t dot(const int8_t* a, const int8_t* b, int K)
+    {
+        int k = 0;
+        int32_t sum = 0;
+#if CV_SIMD128
+        cv::v_int32x4 acc = cv::v_setzero_s32();
+        for (; k + 16 <= K; k += 16)
+        {
+            cv::v_int16x8 a0, a1, b0, b1;
+            cv::v_expand(cv::v_load(reinterpret_cast<const schar*>(a + k)), a0, a1);
+            cv::v_expand(cv::v_load(reinterpret_cast<const schar*>(b + k)), b0, b1);
+            acc += cv::v_dotprod(a0, b0);
+            acc += cv::v_dotprod(a1, b1);
+        }
+        sum = cv::v_reduce_sum(acc);
+#endif
+        for (; k < K; ++k)
+            sum += static_cast<int32_t>(a[k]) * b[k];
+        return sum;
+    }
+
+    class GemmBody : public cv::ParallelLoopBody
+    {
+    public:
+        GemmBody(int N_, int K_, const int8_t* A_, int lda_, const int8_t* B_, int ldb_, int32_t* C_)
+            : N(N_), K(K_), A(A_), lda(lda_), B(B_), ldb(ldb_), C(C_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            // Block over columns of C so that a strip of B stays in cache while the rows of A stream past
+            const int block = 64;
+            for (int n0 = 0; n0 < N; n0 += block)
+            {
+                const int n1 = std::min(N, n0 + block);
+                for (int m = range.start; m < range.end; ++m)
+                {
+                    const int8_t* a = A + static_cast<size_t>(m) * lda;
+                    int32_t*      c = C + static_cast<size_t>(m) * N;
+                    for (int n = n0; n < n1; ++n)
+                        c[n] = dot(a, B + static_cast<size_t>(n) * ldb, K);
+                }
+            }
+        }
+
+    private:
+        int           N, K;
+        const int8_t* A;
+        int           lda;
+        const int8_t* B;
+        int           ldb;
+        int32_t*      C;
+    };
+}
+
+void aq::quant::gemm(int M, int N, int K, const int8_t* A, int lda, const int8_t* B, int ldb, int32_t* C)
+{
+    // Rows are padded with zeros, so the dot product can run over the full aligned length
+    const int K_aligned = std::min(alignK(K), std::min(lda, ldb));
+    cv::parallel_for_(cv::Range(0, M), GemmBody(N, K_aligned, A, lda, B, ldb, C));
+}
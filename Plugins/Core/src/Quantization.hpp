@@ -0,0 +1,67 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace aq
+{
+namespace quant
+{
+    enum Precision
+    {
+        Float32,
+        Float16, // weights rounded to half precision, arithmetic in float
+        Int8     // symmetric int8 weights and activations, int32 accumulation
+    };
+
+    // Per tensor activation scale, q = round(x / scale).  Saved as plain text next to the weight file
+    class Core_EXPORT CalibrationTable
+    {
+    public:
+        static std::string pathFor(const std::string& weight_file);
+
+        bool  load(const std::string& path);
+        bool  save(const std::string& path) const;
+        bool  empty() const { return scales.empty(); }
+        // 0 if name was not calibrated
+        float scale(const std::string& name) const;
+
+        std::map<std::string, float> scales;
+    };
+
+    // Collects a histogram of |x| per tensor over the calibration set and clips each tensor at the
+    // value below which `percentile` of the activations fall, which is robust against rare outliers
+    class Core_EXPORT RangeObserver
+    {
+    public:
+        explicit RangeObserver(double percentile = 0.9999, int bins = 2048);
+
+        void             observe(const std::string& name, const float* data, size_t size);
+        CalibrationTable table() const;
+        size_t           size() const { return m_histograms.size(); }
+
+    private:
+        struct Histogram
+        {
+            float                 range = 0.0f;
+            std::vector<uint64_t> counts;
+        };
+        double                           m_percentile;
+        int                              m_bins;
+        std::map<std::string, Histogram> m_histograms;
+    };
+
+    // q = clamp(round(src / scale), -127, 127)
+    Core_EXPORT void quantize(const float* src, int8_t* dst, size_t size, float scale);
+
+    // C[M x N] = A[M x K] * B[N x K]^T with int32 accumulation.  Both operands are row major and
+    // contiguous along K, rows are strided by lda / ldb which have to be multiples of 16 with the
+    // padding zeroed.  Parallel over the rows of A.
+    Core_EXPORT void gemm(int M, int N, int K, const int8_t* A, int lda, const int8_t* B, int ldb, int32_t* C);
+
+    // K rounded up to the row stride gemm expects
+    inline int alignK(int K) { return (K + 15) & ~15; }
+}
+}
@@ -0,0 +1,193 @@
+#include "ThreadPlacement.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace aq;
+
+namespace
+{
+#ifdef __linux__
+    // From numaif.h, the syscalls are used directly to not depend on libnuma
+    const int           mpol_default   = 0;
+    const int           mpol_preferred = 1;
+    const unsigned long node_bits      = 1024;
+    const unsigned long bits_per_word  = sizeof(unsigned long) * 8;
+#endif
+    // Re-reading the placement is two syscalls, the feeding thread only does it this often
+    const unsigned int publish_interval = 64;
+}
+
+ThreadPlacement ThreadPlacement::current()
+{
+    ThreadPlacement placement;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        const int online = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &set))
+                placement.cpus.push_back(cpu);
+        }
+        // Unrestricted is the same as no placement
+        if(static_cast<int>(placement.cpus.size()) >= online)
+            placement.cpus.clear();
+    }
+    int mode = mpol_default;
+    unsigned long mask[node_bits / bits_per_word] = {0};
+    if(syscall(SYS_get_mempolicy, &mode, mask, node_bits, nullptr, 0) == 0 && mode == mpol_preferred)
+    {
+        for(unsigned long node = 0; node < node_bits; ++node)
+        {
+            if(mask[node / bits_per_word] & (1UL << (node % bits_per_word)))
+            {
+                placement.numa_node = static_cast<int>(node);
+                break;
+            }
+        }
+    }
+#endif
+    return placement;
+}
+
+bool ThreadPlacement::apply() const
+{
+#ifdef __linux__
+    bool success = true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cpus.empty())
+    {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &set);
+    }
+    else
+    {
+        for(int cpu : cpus)
+        {
+            if(cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+    }
+    success &= pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    unsigned long mask[node_bits / bits_per_word] = {0};
+    if(numa_node >= 0 && static_cast<unsigned long>(numa_node) < node_bits)
+    {
+        mask[numa_node / bits_per_word] = 1UL << (numa_node % bits_per_word);
+        // The kernel drops one from maxnode
+        success &= syscall(SYS_set_mempolicy, mpol_preferred, mask, node_bits + 1) == 0;
+    }
+    else
+    {
+        success &= syscall(SYS_set_mempolicy, mpol_default, nullptr, 0) == 0;
+    }
+    return success;
+#else
+    return cpus.empty() && numa_node < 0;
+#endif
+}
+
+std::string ThreadPlacement::describe() const
+{
+    std::stringstream ss;
+    if(cpus.empty())
+    {
+        ss << "any cpu";
+    }
+    else
+    {
+        ss << "cpus ";
+        // Runs of consecutive cores are printed as ranges
+        for(size_t i = 0; i < cpus.size();)
+        {
+            size_t j = i;
+            while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+                ++j;
+            if(i)
+                ss << ',';
+            ss << cpus[i];
+            if(j > i)
+                ss << '-' << cpus[j];
+            i = j + 1;
+        }
+    }
+    if(numa_node >= 0)
+        ss << ", numa node " << numa_node;
+    return ss.str();
+}
+
+bool ThreadPlacement::parseCpus(const std::string& list, std::vector<int>& cpus)
+{
+    std::vector<int> parsed;
+    std::stringstream ss(list);
+    std::string item;
+    try
+    {
+        while(std::getline(ss, item, ','))
+        {
+            if(item.empty())
+                continue;
+            const size_t dash = item.find('-');
+            const int first = boost::lexical_cast<int>(item.substr(0, dash));
+            const int last = dash == std::string::npos ? first : boost::lexical_cast<int>(item.substr(dash + 1));
+            if(first < 0 || last < first)
+                return false;
+            for(int cpu = first; cpu <= last; ++cpu)
+                parsed.push_back(cpu);
+        }
+    }
+    catch(boost::bad_lexical_cast&)
+    {
+        return false;
+    }
+    std::sort(parsed.begin(), parsed.end());
+    parsed.erase(std::unique(parsed.begin(), parsed.end()), parsed.end());
+    cpus.swap(parsed);
+    return true;
+}
+
+bool ThreadPlacement::operator==(const ThreadPlacement& other) const
+{
+    return cpus == other.cpus && numa_node == other.numa_node;
+}
+
+void PlacementFollower::publish()
+{
+    const std::thread::id self = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if(self == m_publisher && m_calls++ % publish_interval != 0)
+        return;
+    m_publisher = self;
+    ThreadPlacement placement = ThreadPlacement::current();
+    if(placement != m_placement)
+    {
+        m_placement = placement;
+        ++m_version;
+    }
+}
+
+void PlacementFollower::follow()
+{
+    const unsigned version = m_version;
+    if(version == m_applied)
+        return;
+    ThreadPlacement placement;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        placement = m_placement;
+    }
+    placement.apply();
+    m_applied = version;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "CoreExport.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aq
+{
+    // Cores a thread may run on and the NUMA node its memory is preferably allocated from.  Only
+    // implemented on Linux, elsewhere current() is empty and apply() does nothing.
+    struct Core_EXPORT ThreadPlacement
+    {
+        std::vector<int> cpus;
+        int              numa_node = -1;
+
+        static ThreadPlacement current();
+        bool apply() const;
+        std::string describe() const;
+        bool empty() const { return cpus.empty() && numa_node < 0; }
+
+        // Comma separated cores and ranges, "0-7,16-23", sorted and without duplicates
+        static bool parseCpus(const std::string& list, std::vector<int>& cpus);
+
+        bool operator==(const ThreadPlacement& other) const;
+        bool operator!=(const ThreadPlacement& other) const { return !(*this == other); }
+    };
+
+    // Moves a worker thread to wherever the thread feeding it runs, so that the writer threads of a
+    // node stay on the cores and memory node of the stream they serve.  The feeding thread calls publish
+    // with every item it queues, the worker calls follow between items.
+    class Core_EXPORT PlacementFollower
+    {
+    public:
+        void publish();
+        void follow();
+
+    private:
+        std::mutex            m_mtx;
+        ThreadPlacement       m_placement;
+        std::thread::id       m_publisher;
+        unsigned int          m_calls = 0;
+        std::atomic<unsigned> m_version{0};
+        unsigned              m_applied = 0;
+    };
+}
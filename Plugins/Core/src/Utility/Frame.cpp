@@ -1,4 +1,5 @@
 #include "Frame.h"
+#include "../PyramidCache.hpp"
 #include "Aquila/rcc/external_includes/cv_cudawarping.hpp"
 #include "Aquila/rcc/external_includes/cv_cudaarithm.hpp"
 #include "MetaObject/params/detail/TInputParamPtrImpl.hpp"
@@ -6,6 +7,8 @@
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 
+#include <thread>
+
 using namespace aq;
 using namespace aq::nodes;
 
@@ -79,16 +82,55 @@ bool DetectFrameSkip::processImpl()
 }
 MO_REGISTER_CLASS(DetectFrameSkip)
 
+FrameLimiter::Clock::time_point FrameLimiter::nextDeadline()
+{
+    const Clock::time_point now = Clock::now();
+    if(real_time_replay && input)
+    {
+        const auto ts = input_param.getTimestamp();
+        if(ts)
+        {
+            const double speed = playback_speed > 0.0 ? playback_speed : 1.0;
+            // Seeks and loops move the timestamp backwards, the replay restarts from the new position
+            if(!m_anchor_timestamp || *ts < *m_anchor_timestamp || real_time_replay_param.modified() || playback_speed_param.modified())
+            {
+                m_anchor_timestamp = ts;
+                m_anchor_time = now;
+                real_time_replay_param.modified(false);
+                playback_speed_param.modified(false);
+            }
+            const std::chrono::duration<double> offset = std::chrono::duration_cast<std::chrono::duration<double>>(*ts - *m_anchor_timestamp);
+            return m_anchor_time + std::chrono::duration_cast<Clock::duration>(offset / speed);
+        }
+    }
+    m_anchor_timestamp.reset();
+    const double rate = desired_framerate > 0.0 ? desired_framerate : 30.0;
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    if(!m_deadline || desired_framerate_param.modified())
+    {
+        desired_framerate_param.modified(false);
+        return now;
+    }
+    return *m_deadline + period;
+}
+
 bool FrameLimiter::processImpl()
 {
-    auto currentTime = boost::posix_time::microsec_clock::universal_time();
-    boost::posix_time::time_duration delta(currentTime - lastTime);
-    lastTime = currentTime;
-    int goalTime = int(1000.0 / desired_framerate);
-    if (delta.total_milliseconds() < goalTime)
+    Clock::time_point deadline = nextDeadline();
+    const Clock::time_point now = Clock::now();
+    const double late = std::chrono::duration<double, std::milli>(now - deadline).count();
+    if(late > max_lag * 1000.0)
     {
-        boost::this_thread::sleep_for(boost::chrono::milliseconds(goalTime - delta.total_milliseconds()));
+        // Too far behind to catch up without a burst of frames, restart the schedule from here
+        deadline = now;
+        m_anchor_timestamp.reset();
     }
+    else if(deadline > now)
+    {
+        std::this_thread::sleep_until(deadline);
+    }
+    m_deadline = deadline;
+    lateness_ms_param.updateData(std::max(late, 0.0));
     return true;
 }
 MO_REGISTER_CLASS(FrameLimiter)
@@ -128,17 +170,30 @@ bool Resize::processImpl()
 {
     if(input && !input->empty())
     {
+        const cv::Size size(width, height);
+        const int interpolation = interpolation_method.getValue();
+        // Large reductions start from the shared pyramid level just above the output size
+        std::shared_ptr<ImagePyramid> pyramid;
+        int level = 0;
+        if(use_pyramid_cache && (interpolation == cv::INTER_LINEAR || interpolation == cv::INTER_AREA) &&
+           size.width * 2 <= input->getSize().width && size.height * 2 <= input->getSize().height)
+        {
+            pyramid = pyramids.get(input_param, *input);
+            level = pyramid->selectLevel(input->getSize(), size);
+        }
         if (input->getSyncState() < SyncedMemory::DEVICE_UPDATED)
         {
             cv::Mat resized;
-            cv::resize(input->getMat(stream()), resized, cv::Size(width, height), 0.0, 0.0, interpolation_method.getValue());
+            const cv::Mat src = level ? pyramid->getMat(level, stream()) : input->getMat(stream());
+            cv::resize(src, resized, size, 0.0, 0.0, interpolation);
             output_param.updateData(resized, input_param.getTimestamp(), _ctx.get());
             return true;
         }
         else
         {
             cv::cuda::GpuMat resized;
-            cv::cuda::resize(input->getGpuMat(stream()), resized, cv::Size(width, height), 0.0, 0.0, interpolation_method.getValue(), stream());
+            const cv::cuda::GpuMat src = level ? pyramid->getGpuMat(level, stream()) : input->getGpuMat(stream());
+            cv::cuda::resize(src, resized, size, 0.0, 0.0, interpolation, stream());
             output_param.updateData(resized, input_param.getTimestamp(), _ctx.get());
             return true;
         }
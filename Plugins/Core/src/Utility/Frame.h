@@ -1,5 +1,6 @@
 #pragma once
 #include <src/precompiled.hpp>
+#include "../PyramidCache.hpp"
 #include <MetaObject/params/ParamMacros.hpp>
 #include "RuntimeObjectSystem/RuntimeInclude.h"
 #include "RuntimeObjectSystem/RuntimeSourceDependency.h"
@@ -39,14 +40,29 @@ namespace nodes{
         boost::optional<mo::Time_t> _initial_time; // used to zero base time
     };
 
+    // Paces the stream against absolute deadlines on a monotonic clock.  Each deadline follows from the
+    // previous one rather than from when the last frame happened to finish, so time spent processing is
+    // absorbed and the rate does not drift.  With real_time_replay the deadline comes from the input
+    // timestamp instead, recorded data then plays back at the speed it was captured.
     class FrameLimiter : public Node{
     public:
+        typedef std::chrono::steady_clock Clock;
         MO_DERIVE(FrameLimiter, Node)
+            OPTIONAL_INPUT(SyncedMemory, input, nullptr)
             PARAM(double, desired_framerate, 30.0)
+            PARAM(bool, real_time_replay, false)
+            TOOLTIP(real_time_replay, "Schedule frames by the input timestamp instead of desired_framerate")
+            PARAM(double, playback_speed, 1.0)
+            PARAM(double, max_lag, 0.25)
+            TOOLTIP(max_lag, "Seconds behind schedule after which the schedule restarts instead of catching up")
+            STATUS(double, lateness_ms, 0.0)
         MO_END
     protected:
         bool processImpl();
-        boost::posix_time::ptime lastTime;
+        Clock::time_point nextDeadline();
+        boost::optional<Clock::time_point> m_deadline;
+        boost::optional<mo::Time_t> m_anchor_timestamp;
+        Clock::time_point m_anchor_time;
     };
 
     class CreateMat: public Node{
@@ -81,10 +97,13 @@ namespace nodes{
             ENUM_PARAM(interpolation_method, cv::INTER_NEAREST, cv::INTER_LINEAR, cv::INTER_CUBIC, cv::INTER_AREA, cv::INTER_LANCZOS4, cv::INTER_MAX)
             PARAM(int, width, 224)
             PARAM(int, height, 224)
+            PARAM(bool, use_pyramid_cache, true)
+            TOOLTIP(use_pyramid_cache, "Resize from the shared image pyramid level closest to the output size when shrinking by 2x or more")
             OUTPUT(SyncedMemory, output, SyncedMemory())
         MO_END
     protected:
         bool processImpl();
+        PyramidSources pyramids;
     };
 
     class RescaleContours: public Node
@@ -1,5 +1,8 @@
 #include "FrameSkip.hpp"
 #include <Aquila/nodes/NodeInfo.hpp>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
 
 using namespace aq::nodes;
 
@@ -16,3 +19,112 @@ bool FrameSkip::processImpl()
 }
 
 MO_REGISTER_CLASS(FrameSkip)
+
+namespace
+{
+    double ewma(double average, double sample, double alpha)
+    {
+        return average <= 0.0 ? sample : average + alpha * (sample - average);
+    }
+}
+
+bool AdaptiveFrameSkip::process()
+{
+    const Clock::time_point start = Clock::now();
+    m_forwarded = false;
+    const bool result = Node::process();
+    const Clock::time_point done = Clock::now();
+    if(m_forwarded)
+    {
+        const double alpha = std::min(std::max(smoothing, 0.001), 1.0);
+        m_cost_ms = ewma(m_cost_ms, std::chrono::duration<double, std::milli>(done - start).count(), alpha);
+    }
+    m_previous_done = done;
+    return result;
+}
+
+bool AdaptiveFrameSkip::isPriority()
+{
+    if(detections && !detections->empty())
+        return true;
+    if(foreground && !foreground->empty())
+    {
+        const cv::Mat& mask = foreground->getMat(stream());
+        if(mask.channels() == 1)
+        {
+            stream().waitForCompletion();
+            return cv::countNonZero(mask) >= motion_threshold * mask.total();
+        }
+    }
+    return false;
+}
+
+bool AdaptiveFrameSkip::processImpl()
+{
+    const Clock::time_point now = Clock::now();
+    const double alpha = std::min(std::max(smoothing, 0.001), 1.0);
+    const auto ts = input_param.getTimestamp();
+    // The source's own frame interval when it has timestamps.  Otherwise the time from the end of the previous
+    // frame, which leaves out what the children spent on it, is how quickly the nodes above deliver a frame.
+    double interval = -1.0;
+    if(ts && m_previous_timestamp && *ts > *m_previous_timestamp)
+        interval = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(*ts - *m_previous_timestamp).count();
+    else if(!ts && m_previous_done)
+        interval = std::chrono::duration<double, std::milli>(now - *m_previous_done).count();
+    if(interval > 0.0)
+        m_interval_ms = ewma(m_interval_ms, interval, alpha);
+    m_previous_timestamp = ts;
+
+    // Lag behind live is how much further the wall clock has moved than the stream since the first frame
+    double lag = 0.0;
+    if(ts)
+    {
+        if(!m_anchor_timestamp || *ts < *m_anchor_timestamp)
+        {
+            m_anchor_timestamp = ts;
+            m_anchor_time = now;
+        }
+        const double stream_ms = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(*ts - *m_anchor_timestamp).count();
+        lag = std::chrono::duration<double, std::milli>(now - m_anchor_time).count() - stream_ms;
+        if(lag < 0.0)
+        {
+            // The source ran ahead of the clock (a file read faster than real time), nothing to catch up
+            m_anchor_time -= std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(-lag));
+            lag = 0.0;
+        }
+    }
+
+    // Share of frames the children keep up with, the credit spreads them evenly over the input.  Over the
+    // latency budget only min_keep_ratio of the frames go besides the priority ones, so that the lag shrinks
+    // without the output stalling.
+    const double min_keep = std::min(std::max(min_keep_ratio, 0.0), 1.0);
+    double keep = 1.0;
+    if(m_cost_ms > 0.0 && m_interval_ms > 0.0)
+        keep = std::min(1.0, std::max(min_keep, m_interval_ms / m_cost_ms));
+    if(lag > latency_budget_ms)
+        keep = min_keep;
+    m_credit = std::min(m_credit + keep, 2.0);
+    const bool priority = isPriority();
+    const bool forward = priority || m_credit >= 1.0;
+    if(forward)
+    {
+        // Priority frames may borrow from the credit of the frames that follow them
+        m_credit = std::max(m_credit - 1.0, -2.0);
+        if(m_previous_forward)
+        {
+            const double interval = std::chrono::duration<double>(now - *m_previous_forward).count();
+            if(interval > 0.0)
+                m_forwarded_rate = ewma(m_forwarded_rate, 1.0 / interval, alpha);
+        }
+        m_previous_forward = now;
+        m_forwarded = true;
+        output_param.updateData(*input, input_param.getTimestamp(), _ctx.get(), input_param.getCoordinateSystem(), input_param.getFrameNumber());
+    }
+    m_skipped += alpha * ((forward ? 0.0 : 1.0) - m_skipped);
+    effective_fps_param.updateData(m_forwarded_rate);
+    skip_ratio_param.updateData(m_skipped);
+    lag_ms_param.updateData(lag);
+    return true;
+}
+
+MO_REGISTER_CLASS(AdaptiveFrameSkip)
@@ -1,6 +1,9 @@
 #pragma once
 #include <Aquila/nodes/Node.hpp>
 #include <Aquila/types/SyncedMemory.hpp>
+#include <Aquila/types/ObjectDetection.hpp>
+
+#include <chrono>
 
 namespace aq
 {
@@ -18,5 +21,53 @@ namespace aq
             bool processImpl();
             int frame_count = 0;
         };
+
+        // Forwards as many frames as the nodes below it can keep up with.  The time the children take per
+        // frame and the time between arriving frames are tracked as moving averages, their ratio is the share
+        // of frames that can be processed and a credit decides which ones go.  When the input carries
+        // timestamps the lag behind live is measured as well, while it is over latency_budget_ms only
+        // min_keep_ratio of the frames pass besides the priority ones.  Frames with motion in the foreground mask or with detections are priority frames,
+        // both are expected from cheap nodes upstream of this one.
+        class AdaptiveFrameSkip: public Node
+        {
+        public:
+            typedef std::chrono::steady_clock Clock;
+            MO_DERIVE(AdaptiveFrameSkip, Node)
+                INPUT(SyncedMemory, input, nullptr)
+                OPTIONAL_INPUT(SyncedMemory, foreground, nullptr)
+                OPTIONAL_INPUT(std::vector<DetectedObject>, detections, nullptr)
+                OUTPUT(SyncedMemory, output, {})
+                PARAM(double, latency_budget_ms, 500.0)
+                TOOLTIP(latency_budget_ms, "Lag behind the input timestamps above which only frames with motion or detections and min_keep_ratio of the rest are kept")
+                PARAM(double, motion_threshold, 0.005)
+                TOOLTIP(motion_threshold, "Fraction of foreground pixels that makes a frame a priority frame")
+                PARAM(double, min_keep_ratio, 0.05)
+                TOOLTIP(min_keep_ratio, "Share of frames forwarded however busy the children are or however far behind the input is")
+                PARAM(double, smoothing, 0.1)
+                STATUS(double, effective_fps, 0.0)
+                STATUS(double, skip_ratio, 0.0)
+                STATUS(double, lag_ms, 0.0)
+            MO_END
+
+            // Times the children to learn what a forwarded frame costs
+            bool process() override;
+
+        protected:
+            bool processImpl();
+            bool isPriority();
+
+            bool                               m_forwarded = false;
+            double                             m_credit = 1.0;
+            double                             m_cost_ms = 0.0;
+            double                             m_interval_ms = 0.0;
+            double                             m_skipped = 0.0;
+            double                             m_forwarded_rate = 0.0;
+            // End of the previous process(), after the children ran
+            boost::optional<Clock::time_point> m_previous_done;
+            boost::optional<Clock::time_point> m_previous_forward;
+            boost::optional<mo::Time_t>        m_previous_timestamp;
+            boost::optional<mo::Time_t>        m_anchor_timestamp;
+            Clock::time_point                  m_anchor_time;
+        };
     }
 }
@@ -0,0 +1,315 @@
+#include "ParallelBranches.hpp"
+#include "../WorkStealingPool.hpp"
+#include <Aquila/nodes/NodeInfo.hpp>
+#include <Aquila/types/SyncedMemory.hpp>
+#include <MetaObject/params/ITParam.hpp>
+#include <MetaObject/logging/logging.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+
+using namespace aq;
+using namespace aq::nodes;
+
+namespace
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // Makes both the host and the device side of a published image valid, later getMat and getGpuMat
+    // calls only read.  A copy of a SyncedMemory shares the buffers and the sync state of the original.
+    void syncImage(mo::IParam* param, cv::cuda::Stream& stream)
+    {
+        auto typed = dynamic_cast<mo::ITParam<SyncedMemory>*>(param);
+        SyncedMemory data;
+        if(!typed || !typed->getData(data) || data.empty())
+            return;
+        data.getMat(stream);
+        data.getGpuMat(stream);
+    }
+
+    struct FrameRun
+    {
+        explicit FrameRun(size_t count)
+            : remaining(new std::atomic<int>[count])
+            , ms(count, 0.0)
+            , finished(0)
+        {
+        }
+
+        std::unique_ptr<std::atomic<int>[]> remaining;
+        std::vector<double>                  ms;
+        std::atomic<size_t>                  finished;
+    };
+}
+
+void ParallelBranches::signature(std::vector<const void*>& sig)
+{
+    sig.clear();
+    // Setting the context of this node hands it to the children as well, theirs have to be assigned again
+    sig.push_back(_ctx.get());
+    std::deque<Node*> pending;
+    for(auto& child : getChildren())
+        pending.push_back(child.get());
+    while(!pending.empty())
+    {
+        Node* node = pending.front();
+        pending.pop_front();
+        sig.push_back(node);
+        if(!node)
+            continue;
+        for(mo::InputParam* input : node->getInputs())
+            sig.push_back(input->getInputParam());
+        // A join is listed once per parent, enough to see a change and cheaper than deduplicating
+        for(auto& child : node->getChildren())
+            pending.push_back(child.get());
+        sig.push_back(nullptr);
+    }
+}
+
+bool ParallelBranches::buildGraph(Graph& graph)
+{
+    graph.nodes.clear();
+    std::map<Node*, int> index;
+    std::deque<Node*> pending;
+    for(auto& child : getChildren())
+        pending.push_back(child.get());
+    while(!pending.empty())
+    {
+        Node* node = pending.front();
+        pending.pop_front();
+        // A join is a child of each of its branches, it is only scheduled once
+        if(!node || !index.insert(std::make_pair(node, static_cast<int>(graph.nodes.size()))).second)
+            continue;
+        graph.nodes.push_back(node);
+        for(auto& child : node->getChildren())
+            pending.push_back(child.get());
+    }
+    const size_t count = graph.nodes.size();
+    graph.dependents.assign(count, std::vector<int>());
+    graph.dependencies.assign(count, 0);
+
+    std::map<mo::IParam*, int> owner;
+    for(size_t i = 0; i < count; ++i)
+    {
+        for(mo::IParam* output : graph.nodes[i]->getOutputs())
+            owner[output] = static_cast<int>(i);
+    }
+    auto addEdge = [&graph](int from, int to) {
+        std::vector<int>& dependents = graph.dependents[from];
+        if(from == to || std::find(dependents.begin(), dependents.end(), to) != dependents.end())
+            return;
+        dependents.push_back(to);
+        ++graph.dependencies[to];
+    };
+    for(size_t i = 0; i < count; ++i)
+    {
+        Node* node = graph.nodes[i];
+        for(auto& child : node->getChildren())
+            addEdge(static_cast<int>(i), index[child.get()]);
+        // Sources outside of this node's subtree are already up to date when it runs
+        for(mo::InputParam* input : node->getInputs())
+        {
+            auto itr = owner.find(input->getInputParam());
+            if(itr != owner.end())
+                addEdge(itr->second, static_cast<int>(i));
+        }
+    }
+
+    std::map<mo::IParam*, int> readers;
+    for(size_t i = 0; i < count; ++i)
+    {
+        for(mo::InputParam* input : graph.nodes[i]->getInputs())
+        {
+            mo::IParam* source = input->getInputParam();
+            if(dynamic_cast<mo::ITParam<SyncedMemory>*>(source))
+                ++readers[source];
+        }
+    }
+    graph.shared_outputs.assign(count, std::vector<mo::IParam*>());
+    graph.shared_inputs.clear();
+    for(const auto& reader : readers)
+    {
+        if(reader.second < 2)
+            continue;
+        auto itr = owner.find(reader.first);
+        if(itr != owner.end())
+            graph.shared_outputs[itr->second].push_back(reader.first);
+        else
+            graph.shared_inputs.push_back(reader.first);
+    }
+
+    graph.order.clear();
+    std::vector<int> dependencies = graph.dependencies;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(dependencies[i] == 0)
+            graph.order.push_back(static_cast<int>(i));
+    }
+    for(size_t i = 0; i < graph.order.size(); ++i)
+    {
+        for(int dependent : graph.dependents[graph.order[i]])
+        {
+            if(--dependencies[dependent] == 0)
+                graph.order.push_back(dependent);
+        }
+    }
+    graph.valid = graph.order.size() == count;
+    return graph.valid;
+}
+
+void ParallelBranches::assignContexts(Graph& graph)
+{
+    const bool own = parallel && graph.valid && graph.nodes.size() > 1;
+    graph.contexts.assign(graph.nodes.size(), std::shared_ptr<mo::Context>());
+    std::map<const Node*, std::shared_ptr<mo::Context>> contexts;
+    for(size_t i = 0; i < graph.nodes.size(); ++i)
+    {
+        if(!own)
+        {
+            graph.contexts[i] = _ctx;
+            continue;
+        }
+        // Kept across rebuilds, a context owns a cuda stream
+        std::shared_ptr<mo::Context>& ctx = contexts[graph.nodes[i]];
+        auto itr = m_contexts.find(graph.nodes[i]);
+        ctx = itr != m_contexts.end() ? itr->second : mo::Context::create();
+        graph.contexts[i] = ctx;
+    }
+    m_contexts.swap(contexts);
+    if(own)
+    {
+        // Parents before children, so that a node's context is not replaced when its parent's is set
+        for(int i : graph.order)
+            graph.nodes[i]->setContext(graph.contexts[i], true);
+    }
+    else
+    {
+        for(size_t i = 0; i < graph.nodes.size(); ++i)
+            graph.nodes[i]->setContext(_ctx, true);
+    }
+    m_graph_parallel = own;
+}
+
+double ParallelBranches::runNode(int i)
+{
+    Node* node = m_graph.nodes[i];
+    const Clock::time_point start = Clock::now();
+    try
+    {
+        // Only the node itself, its children are scheduled by the graph
+        node->Algorithm::process();
+        if(m_graph_parallel)
+        {
+            cv::cuda::Stream& stream = m_graph.contexts[i]->getStream();
+            for(mo::IParam* output : m_graph.shared_outputs[i])
+                syncImage(output, stream);
+            // Dependents run on other streams, the node's work has to be done before they start
+            stream.waitForCompletion();
+        }
+    }
+    catch(cv::Exception& e)
+    {
+        MO_LOG(warning) << node->getTreeName() << " failed: " << e.what();
+    }
+    catch(std::exception& e)
+    {
+        MO_LOG(warning) << node->getTreeName() << " failed: " << e.what();
+    }
+    catch(mo::IExceptionWithCallStackBase&)
+    {
+        MO_LOG(warning) << node->getTreeName() << " failed";
+    }
+    catch(...)
+    {
+        // Nothing may escape, the frame only completes once every node is counted as finished
+        MO_LOG(warning) << node->getTreeName() << " failed with an unknown exception";
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+bool ParallelBranches::process()
+{
+    if(!Algorithm::process())
+        return false;
+    const Clock::time_point start = Clock::now();
+    signature(m_current);
+    if(m_current != m_signature || parallel_param.modified())
+    {
+        m_signature.swap(m_current);
+        buildGraph(m_graph);
+        assignContexts(m_graph);
+        parallel_param.modified(false);
+    }
+    const Graph& graph = m_graph;
+    if(!graph.valid)
+    {
+        MO_LOG_EVERY_N(warning, 100) << getTreeName() << " has a dependency cycle, processing children depth first";
+        for(auto& child : getChildren())
+            child->process();
+        frame_ms_param.updateData(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        return true;
+    }
+    const size_t count = graph.nodes.size();
+    FrameRun run(count);
+    if(m_graph_parallel)
+    {
+        // Shared images are made valid on both sides once, their readers may then run concurrently.  The
+        // inputs were produced on this node's stream, the branches read them on their own.
+        for(mo::IParam* input : graph.shared_inputs)
+            syncImage(input, stream());
+        stream().waitForCompletion();
+        WorkStealingPool& pool = WorkStealingPool::instance();
+        for(size_t i = 0; i < count; ++i)
+            run.remaining[i] = graph.dependencies[i];
+        std::function<void(int)> schedule;
+        schedule = [&](int i) {
+            pool.submit([&, i]() {
+                run.ms[i] = runNode(i);
+                for(int dependent : graph.dependents[i])
+                {
+                    if(--run.remaining[dependent] == 0)
+                        schedule(dependent);
+                }
+                // Last touch of the frame state, the stream thread may return once every node is counted
+                ++run.finished;
+            });
+        };
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(graph.dependencies[i] == 0)
+                schedule(static_cast<int>(i));
+        }
+        // The stream thread works through the graph too instead of idling
+        pool.helpUntil([&run, count]() { return run.finished == count; });
+    }
+    else
+    {
+        for(int i : graph.order)
+            run.ms[i] = runNode(i);
+    }
+
+    // Longest chain of node times, what the frame would take with unlimited workers
+    std::vector<double> finish(count, 0.0);
+    double critical = 0.0;
+    for(int i : graph.order)
+    {
+        finish[i] += run.ms[i];
+        critical = std::max(critical, finish[i]);
+        for(int dependent : graph.dependents[i])
+            finish[dependent] = std::max(finish[dependent], finish[i]);
+    }
+    frame_ms_param.updateData(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    critical_path_ms_param.updateData(critical);
+    return true;
+}
+
+bool ParallelBranches::processImpl()
+{
+    return true;
+}
+
+MO_REGISTER_CLASS(ParallelBranches)
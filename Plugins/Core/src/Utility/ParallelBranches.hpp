@@ -0,0 +1,65 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <Aquila/nodes/Node.hpp>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace aq
+{
+    namespace nodes
+    {
+        // Runs the nodes below it as a dependency graph instead of depth first.  A node depends on its parent
+        // and on the owner of every input it is connected to, so a join such as AddBinary or DrawDetections
+        // waits for all of its branches.  Nodes whose dependencies are done are handed to the shared work
+        // stealing pool, independent branches run concurrently and the frame takes about as long as the
+        // slowest path through the graph rather than the sum of every node.
+        // Every node of the graph gets a context and cuda stream of its own while running in parallel, a
+        // node's work is complete before its dependents start.  Images read by more than one node are synced
+        // to host and device before any of their readers runs, so readers never write the shared sync state.
+        class Core_EXPORT ParallelBranches : public Node
+        {
+        public:
+            MO_DERIVE(ParallelBranches, Node)
+                PARAM(bool, parallel, true)
+                TOOLTIP(parallel, "Process the children in dependency order on the stream thread when disabled")
+                STATUS(double, frame_ms, 0.0)
+                STATUS(double, critical_path_ms, 0.0)
+            MO_END
+
+            bool process() override;
+
+        protected:
+            bool processImpl();
+
+        private:
+            struct Graph
+            {
+                std::vector<Node*>                        nodes;
+                std::vector<std::vector<int>>             dependents;
+                std::vector<int>                          dependencies;
+                std::vector<int>                          order;
+                // Image outputs of a node read by several nodes of the graph
+                std::vector<std::vector<mo::IParam*>>     shared_outputs;
+                // Images from outside of the graph read by several of its nodes
+                std::vector<mo::IParam*>                  shared_inputs;
+                std::vector<std::shared_ptr<mo::Context>> contexts;
+                bool                                      valid = false;
+            };
+
+            // Nodes of the subtree and their input connections, the graph is rebuilt when this changes
+            void signature(std::vector<const void*>& sig);
+            bool buildGraph(Graph& graph);
+            // Hands every node its own context when running in parallel and the stream's context otherwise
+            void assignContexts(Graph& graph);
+            double runNode(int i);
+
+            Graph                                              m_graph;
+            bool                                               m_graph_parallel = false;
+            std::vector<const void*>                           m_signature;
+            std::vector<const void*>                           m_current;
+            std::map<const Node*, std::shared_ptr<mo::Context>> m_contexts;
+        };
+    }
+}
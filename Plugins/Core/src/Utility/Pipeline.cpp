@@ -0,0 +1,170 @@
+#include "Pipeline.hpp"
+#include <Aquila/nodes/NodeInfo.hpp>
+#include <MetaObject/logging/logging.hpp>
+
+#include <algorithm>
+#include <deque>
+
+using namespace aq;
+using namespace aq::nodes;
+
+PipelineStage::~PipelineStage()
+{
+    stopWorker();
+}
+
+bool PipelineStage::process()
+{
+    // The upstream side only runs this node, the worker runs the children
+    return Algorithm::process();
+}
+
+bool PipelineStage::processImpl()
+{
+    if(!m_worker.joinable())
+        startWorker();
+    Frame frame;
+    frame.data = *input;
+    frame.ts = input_param.getTimestamp();
+    frame.fn = input_param.getFrameNumber();
+    frame.cs = input_param.getCoordinateSystem();
+    int queued = 0;
+    int drops = 0;
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        const size_t limit = static_cast<size_t>(std::max(max_in_flight, 1));
+        auto full = [this, limit]() { return m_queue.size() + static_cast<size_t>(m_busy) >= limit; };
+        if(drop_when_full)
+        {
+            while(!m_queue.empty() && full())
+            {
+                m_queue.pop_front();
+                ++drops;
+            }
+            // Every worker is busy, the new frame is the one that goes
+            if(full())
+                ++drops;
+            else
+                m_queue.push_back(std::move(frame));
+        }
+        else
+        {
+            // Backpressure on the stream thread bounds the frames in flight
+            while(!m_stop && full())
+                m_cv.wait(lock);
+            m_queue.push_back(std::move(frame));
+        }
+        queued = static_cast<int>(m_queue.size()) + m_busy;
+    }
+    m_cv.notify_all();
+    in_flight_param.updateData(queued);
+    if(drops)
+        dropped_param.updateData(dropped + drops);
+    return true;
+}
+
+void PipelineStage::startWorker()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        m_stop = false;
+    }
+    // The stream's context belongs to the stream thread, the worker publishes with its own
+    if(!m_worker_ctx)
+        m_worker_ctx = mo::Context::create();
+    m_worker = boost::thread([this]() { work(); });
+    mo::setThreadName(m_worker, getTreeName() + " worker");
+}
+
+void PipelineStage::stopWorker()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if(m_worker.joinable())
+        m_worker.join();
+    boost::mutex::scoped_lock lock(m_mtx);
+    m_busy = 0;
+}
+
+void PipelineStage::attachChildren()
+{
+    // Setting the stage's own context hands it down to the children, theirs have to be replaced again
+    if(m_attached_parent != _ctx.get())
+    {
+        m_attached.clear();
+        m_attached_parent = _ctx.get();
+    }
+    std::deque<Node*> pending;
+    for(auto& child : getChildren())
+        pending.push_back(child.get());
+    while(!pending.empty())
+    {
+        Node* node = pending.front();
+        pending.pop_front();
+        if(!node || !m_attached.insert(node).second)
+            continue;
+        node->setContext(m_worker_ctx, true);
+        for(auto& child : node->getChildren())
+            pending.push_back(child.get());
+    }
+}
+
+void PipelineStage::work()
+{
+    // Marks the frame as done however processing ends, the stream thread waits on m_busy for backpressure
+    struct BusyGuard
+    {
+        PipelineStage* stage;
+        ~BusyGuard()
+        {
+            {
+                boost::mutex::scoped_lock lock(stage->m_mtx);
+                --stage->m_busy;
+            }
+            stage->m_cv.notify_all();
+        }
+    };
+    while(true)
+    {
+        Frame frame;
+        {
+            boost::mutex::scoped_lock lock(m_mtx);
+            while(!m_stop && m_queue.empty())
+                m_cv.wait(lock);
+            if(m_stop)
+                return;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+            ++m_busy;
+        }
+        BusyGuard guard{this};
+        try
+        {
+            attachChildren();
+            output_param.updateData(frame.data, frame.ts, m_worker_ctx.get(), frame.cs, frame.fn);
+            for(auto& child : getChildren())
+                child->process();
+        }
+        catch(cv::Exception& e)
+        {
+            MO_LOG(warning) << getTreeName() << " failed to process frame " << frame.fn << ": " << e.what();
+        }
+        catch(std::exception& e)
+        {
+            MO_LOG(warning) << getTreeName() << " failed to process frame " << frame.fn << ": " << e.what();
+        }
+        catch(mo::IExceptionWithCallStackBase&)
+        {
+            MO_LOG(warning) << getTreeName() << " failed to process frame " << frame.fn;
+        }
+        catch(...)
+        {
+            MO_LOG(warning) << getTreeName() << " failed to process frame " << frame.fn << " with an unknown exception";
+        }
+    }
+}
+
+MO_REGISTER_CLASS(PipelineStage)
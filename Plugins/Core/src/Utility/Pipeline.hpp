@@ -0,0 +1,70 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <Aquila/nodes/Node.hpp>
+#include <Aquila/types/SyncedMemory.hpp>
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <deque>
+#include <memory>
+#include <set>
+
+namespace aq
+{
+    namespace nodes
+    {
+        // Boundary of a pipeline stage.  Frames are handed to a worker thread through a bounded queue and the
+        // children of the stage are processed there, so the stream thread is free to start on the next frame
+        // while the stage works on the previous one.  Every node under the stage is switched to the worker's
+        // context, so its cuda work never shares a stream with the nodes before the stage.  The worker
+        // processes frames one at a time and the children see every frame in order.
+        // A stage is never replicated across several workers: a replica would need its own node instances
+        // and nodes outside of the stage can only read the outputs of one of them.
+        class Core_EXPORT PipelineStage : public Node
+        {
+        public:
+            MO_DERIVE(PipelineStage, Node)
+                INPUT(SyncedMemory, input, nullptr)
+                OUTPUT(SyncedMemory, output, {})
+                PARAM(int, max_in_flight, 2)
+                TOOLTIP(max_in_flight, "Frames queued or being processed by the stage before the stream thread waits")
+                PARAM(bool, drop_when_full, false)
+                TOOLTIP(drop_when_full, "Drop the oldest queued frame instead of waiting when max_in_flight is reached")
+                STATUS(int, in_flight, 0)
+                STATUS(int, dropped, 0)
+            MO_END
+
+            ~PipelineStage();
+
+            // Only queues the frame, the children are processed by the worker
+            bool process() override;
+
+        protected:
+            bool processImpl();
+
+        private:
+            struct Frame
+            {
+                SyncedMemory                           data;
+                mo::OptionalTime_t                     ts;
+                size_t                                 fn = 0;
+                std::shared_ptr<mo::ICoordinateSystem> cs;
+            };
+
+            void startWorker();
+            void stopWorker();
+            void work();
+            // Hands the worker's context to nodes that joined the stage since the last frame, worker thread only
+            void attachChildren();
+
+            boost::mutex                 m_mtx;
+            boost::condition_variable    m_cv;
+            std::deque<Frame>            m_queue;
+            int                          m_busy = 0;
+            bool                         m_stop = false;
+            std::shared_ptr<mo::Context> m_worker_ctx;
+            boost::thread                m_worker;
+            std::set<const Node*>        m_attached;
+            const mo::Context*           m_attached_parent = nullptr;
+        };
+    }
+}
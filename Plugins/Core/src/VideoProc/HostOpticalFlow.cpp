@@ -0,0 +1,414 @@
+#include "HostOpticalFlow.hpp"
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace aq;
+
+namespace
+{
+    // Bilinear sample with the coordinates clamped to the image
+    template <class T>
+    inline float sample(const cv::Mat& img, float x, float y)
+    {
+        x              = std::min(std::max(x, 0.0f), static_cast<float>(img.cols - 1));
+        y              = std::min(std::max(y, 0.0f), static_cast<float>(img.rows - 1));
+        const int   x0 = static_cast<int>(x);
+        const int   y0 = static_cast<int>(y);
+        const int   x1 = std::min(x0 + 1, img.cols - 1);
+        const int   y1 = std::min(y0 + 1, img.rows - 1);
+        const float fx = x - x0;
+        const float fy = y - y0;
+        const T*    r0 = img.ptr<T>(y0);
+        const T*    r1 = img.ptr<T>(y1);
+        const float top    = static_cast<float>(r0[x0]) + (static_cast<float>(r0[x1]) - static_cast<float>(r0[x0])) * fx;
+        const float bottom = static_cast<float>(r1[x0]) + (static_cast<float>(r1[x1]) - static_cast<float>(r1[x0])) * fx;
+        return top + (bottom - top) * fy;
+    }
+
+    int usableLevels(const std::vector<cv::Mat>& prev, const std::vector<cv::Mat>& next, cv::Size min_size)
+    {
+        int levels = static_cast<int>(std::min(prev.size(), next.size()));
+        CV_Assert(levels > 0);
+        while (levels > 1 && (prev[levels - 1].cols < min_size.width || prev[levels - 1].rows < min_size.height))
+            --levels;
+        for (int i = 0; i < levels; ++i)
+        {
+            CV_Assert(prev[i].channels() == 1 && prev[i].type() == next[i].type() && prev[i].size() == next[i].size());
+        }
+        return levels;
+    }
+
+    template <class T>
+    class SparseLKBody : public cv::ParallelLoopBody
+    {
+    public:
+        SparseLKBody(const std::vector<cv::Mat>& prev_, const std::vector<cv::Mat>& next_, int levels_,
+                     const cv::Point2f* prev_pts_, cv::Point2f* next_pts_, uchar* status_, float* error_,
+                     const flow::LKParams& params_, bool use_initial_)
+            : prev(prev_), next(next_), levels(levels_), prev_pts(prev_pts_), next_pts(next_pts_), status(status_),
+              error(error_), params(params_), use_initial(use_initial_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int   w  = params.window.width;
+            const int   h  = params.window.height;
+            const int   pw = w + 2;
+            const float hx = (w - 1) * 0.5f;
+            const float hy = (h - 1) * 0.5f;
+            // Template with a one pixel border for the central difference gradients
+            std::vector<float> patch(static_cast<size_t>(pw) * (h + 2));
+            std::vector<float> ix(static_cast<size_t>(w) * h);
+            std::vector<float> iy(static_cast<size_t>(w) * h);
+            for (int i = range.start; i < range.end; ++i)
+            {
+                const cv::Point2f p     = prev_pts[i];
+                cv::Point2f       g     = use_initial ? (next_pts[i] - p) * (1.0f / (1 << (levels - 1))) : cv::Point2f();
+                bool              found = true;
+                float             err   = 0.0f;
+                for (int level = levels - 1; level >= 0; --level)
+                {
+                    const cv::Mat&    I  = prev[level];
+                    const cv::Mat&    J  = next[level];
+                    const cv::Point2f pl = p * (1.0f / (1 << level));
+                    for (int y = 0; y < h + 2; ++y)
+                        for (int x = 0; x < pw; ++x)
+                            patch[y * pw + x] = sample<T>(I, pl.x - hx + x - 1, pl.y - hy + y - 1);
+                    float gxx = 0.0f, gxy = 0.0f, gyy = 0.0f;
+                    for (int y = 0; y < h; ++y)
+                    {
+                        for (int x = 0; x < w; ++x)
+                        {
+                            const float* c  = &patch[(y + 1) * pw + x + 1];
+                            const float  dx = (c[1] - c[-1]) * 0.5f;
+                            const float  dy = (c[pw] - c[-pw]) * 0.5f;
+                            ix[y * w + x]   = dx;
+                            iy[y * w + x]   = dy;
+                            gxx += dx * dx;
+                            gxy += dx * dy;
+                            gyy += dy * dy;
+                        }
+                    }
+                    const float det     = gxx * gyy - gxy * gxy;
+                    const float min_eig = (gxx + gyy - std::sqrt((gxx - gyy) * (gxx - gyy) + 4.0f * gxy * gxy)) / (2.0f * w * h);
+                    if (min_eig < params.min_eigen || det < FLT_EPSILON)
+                    {
+                        // Not enough texture on this level, carry the estimate down
+                        if (level == 0)
+                            found = false;
+                        else
+                            g = g * 2.0f;
+                        continue;
+                    }
+                    cv::Point2f q = pl + g;
+                    for (int k = 0; k < params.iterations; ++k)
+                    {
+                        float bx = 0.0f, by = 0.0f;
+                        for (int y = 0; y < h; ++y)
+                        {
+                            for (int x = 0; x < w; ++x)
+                            {
+                                const float diff = patch[(y + 1) * pw + x + 1] - sample<T>(J, q.x - hx + x, q.y - hy + y);
+                                bx += diff * ix[y * w + x];
+                                by += diff * iy[y * w + x];
+                            }
+                        }
+                        const cv::Point2f delta((gyy * bx - gxy * by) / det, (gxx * by - gxy * bx) / det);
+                        q += delta;
+                        if (delta.dot(delta) < params.epsilon * params.epsilon)
+                            break;
+                    }
+                    g = q - pl;
+                    if (level > 0)
+                    {
+                        g = g * 2.0f;
+                        continue;
+                    }
+                    if (q.x < 0.0f || q.y < 0.0f || q.x > I.cols - 1 || q.y > I.rows - 1)
+                        found = false;
+                    for (int y = 0; y < h; ++y)
+                        for (int x = 0; x < w; ++x)
+                            err += std::abs(patch[(y + 1) * pw + x + 1] - sample<T>(J, q.x - hx + x, q.y - hy + y));
+                    err /= static_cast<float>(w * h);
+                }
+                next_pts[i] = p + g;
+                status[i]   = found ? 1 : 0;
+                error[i]    = err;
+            }
+        }
+
+    private:
+        const std::vector<cv::Mat>& prev;
+        const std::vector<cv::Mat>& next;
+        int                         levels;
+        const cv::Point2f*          prev_pts;
+        cv::Point2f*                next_pts;
+        uchar*                      status;
+        float*                      error;
+        const flow::LKParams&       params;
+        bool                        use_initial;
+    };
+
+    // Top left corners of the patches along one axis, the last patch is moved in to end at the border
+    std::vector<int> gridPositions(int size, int patch, int stride)
+    {
+        std::vector<int> positions;
+        for (int p = 0; p + patch <= size; p += stride)
+            positions.push_back(p);
+        if (positions.empty() || positions.back() + patch < size)
+            positions.push_back(size - patch);
+        return positions;
+    }
+
+    template <class T>
+    class PatchBody : public cv::ParallelLoopBody
+    {
+    public:
+        PatchBody(const cv::Mat& I0_, const cv::Mat& I1_, const cv::Mat& gx_, const cv::Mat& gy_, const cv::Mat& U_,
+                  const std::vector<int>& xs_, const std::vector<int>& ys_, int patch_, int iterations_,
+                  std::vector<cv::Point2f>& patch_flow_)
+            : I0(I0_), I1(I1_), gx(gx_), gy(gy_), U(U_), xs(xs_), ys(ys_), patch(patch_), iterations(iterations_),
+              patch_flow(patch_flow_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int          n = patch * patch;
+            std::vector<float> tmpl(static_cast<size_t>(n));
+            std::vector<float> diff(static_cast<size_t>(n));
+            for (int r = range.start; r < range.end; ++r)
+            {
+                const int py = ys[r];
+                for (size_t c = 0; c < xs.size(); ++c)
+                {
+                    const int         px = xs[c];
+                    const cv::Point2f u0 = U.at<cv::Point2f>(py + patch / 2, px + patch / 2);
+                    // The Hessian only depends on the template, which is what makes the search inverse
+                    float hxx = 0.0f, hxy = 0.0f, hyy = 0.0f;
+                    for (int y = 0; y < patch; ++y)
+                    {
+                        const T*     row = I0.ptr<T>(py + y) + px;
+                        const float* dx  = gx.ptr<float>(py + y) + px;
+                        const float* dy  = gy.ptr<float>(py + y) + px;
+                        for (int x = 0; x < patch; ++x)
+                        {
+                            tmpl[y * patch + x] = static_cast<float>(row[x]);
+                            hxx += dx[x] * dx[x];
+                            hxy += dx[x] * dy[x];
+                            hyy += dy[x] * dy[x];
+                        }
+                    }
+                    const float det = hxx * hyy - hxy * hxy;
+                    cv::Point2f& u  = patch_flow[r * xs.size() + c];
+                    u               = u0;
+                    if (det < FLT_EPSILON)
+                        continue;
+                    float initial_error = 0.0f, final_error = 0.0f;
+                    for (int k = 0;; ++k)
+                    {
+                        // Residual with the mean removed for some robustness against lighting changes
+                        float mean = 0.0f;
+                        for (int y = 0; y < patch; ++y)
+                        {
+                            for (int x = 0; x < patch; ++x)
+                            {
+                                const float d = sample<T>(I1, px + x + u.x, py + y + u.y) - tmpl[y * patch + x];
+                                diff[y * patch + x] = d;
+                                mean += d;
+                            }
+                        }
+                        mean /= static_cast<float>(n);
+                        float err = 0.0f, bx = 0.0f, by = 0.0f;
+                        for (int y = 0; y < patch; ++y)
+                        {
+                            const float* dx = gx.ptr<float>(py + y) + px;
+                            const float* dy = gy.ptr<float>(py + y) + px;
+                            for (int x = 0; x < patch; ++x)
+                            {
+                                const float d = diff[y * patch + x] - mean;
+                                err += d * d;
+                                bx += d * dx[x];
+                                by += d * dy[x];
+                            }
+                        }
+                        if (k == 0)
+                            initial_error = err;
+                        final_error = err;
+                        if (k == iterations)
+                            break;
+                        const cv::Point2f du((hyy * bx - hxy * by) / det, (hxx * by - hxy * bx) / det);
+                        u -= du;
+                        if (du.dot(du) < 1e-4f)
+                            k = iterations - 1;
+                    }
+                    // Keep the coarser estimate if the search diverged
+                    const cv::Point2f moved = u - u0;
+                    if (final_error > initial_error || moved.dot(moved) > static_cast<float>(patch * patch))
+                        u = u0;
+                }
+            }
+        }
+
+    private:
+        const cv::Mat&            I0;
+        const cv::Mat&            I1;
+        const cv::Mat&            gx;
+        const cv::Mat&            gy;
+        const cv::Mat&            U;
+        const std::vector<int>&   xs;
+        const std::vector<int>&   ys;
+        int                       patch;
+        int                       iterations;
+        std::vector<cv::Point2f>& patch_flow;
+    };
+
+    template <class T>
+    class DensifyBody : public cv::ParallelLoopBody
+    {
+    public:
+        DensifyBody(const cv::Mat& I0_, const cv::Mat& I1_, const std::vector<int>& xs_, const std::vector<int>& ys_,
+                    int patch_, const std::vector<cv::Point2f>& patch_flow_, cv::Mat& dense_)
+            : I0(I0_), I1(I1_), xs(xs_), ys(ys_), patch(patch_), patch_flow(patch_flow_), dense(dense_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                // Patches covering this row, positions are sorted so these are contiguous
+                const size_t i0  = std::upper_bound(ys.begin(), ys.end(), y - patch) - ys.begin();
+                const size_t i1  = std::upper_bound(ys.begin(), ys.end(), y) - ys.begin();
+                const T*     row = I0.ptr<T>(y);
+                cv::Point2f* out = dense.ptr<cv::Point2f>(y);
+                size_t       j0 = 0, j1 = 0;
+                for (int x = 0; x < I0.cols; ++x)
+                {
+                    while (j0 < xs.size() && xs[j0] + patch <= x)
+                        ++j0;
+                    while (j1 < xs.size() && xs[j1] <= x)
+                        ++j1;
+                    const float value = static_cast<float>(row[x]);
+                    float       sum_w = 0.0f;
+                    cv::Point2f sum_u;
+                    for (size_t i = i0; i < i1; ++i)
+                    {
+                        for (size_t j = j0; j < j1; ++j)
+                        {
+                            const cv::Point2f& u = patch_flow[i * xs.size() + j];
+                            const float        w = 1.0f / std::max(1.0f, std::abs(sample<T>(I1, x + u.x, y + u.y) - value));
+                            sum_w += w;
+                            sum_u += u * w;
+                        }
+                    }
+                    out[x] = sum_w > 0.0f ? sum_u * (1.0f / sum_w) : cv::Point2f();
+                }
+            }
+        }
+
+    private:
+        const cv::Mat&                  I0;
+        const cv::Mat&                  I1;
+        const std::vector<int>&         xs;
+        const std::vector<int>&         ys;
+        int                             patch;
+        const std::vector<cv::Point2f>& patch_flow;
+        cv::Mat&                        dense;
+    };
+
+    template <class T>
+    void disLevel(const cv::Mat& I0, const cv::Mat& I1, cv::Mat& U, int patch, int stride, int iterations)
+    {
+        cv::Mat gx, gy;
+        cv::Scharr(I0, gx, CV_32F, 1, 0, 1.0 / 32);
+        cv::Scharr(I0, gy, CV_32F, 0, 1, 1.0 / 32);
+        const std::vector<int>   xs = gridPositions(I0.cols, patch, stride);
+        const std::vector<int>   ys = gridPositions(I0.rows, patch, stride);
+        std::vector<cv::Point2f> patch_flow(xs.size() * ys.size());
+        cv::parallel_for_(cv::Range(0, static_cast<int>(ys.size())),
+                          PatchBody<T>(I0, I1, gx, gy, U, xs, ys, patch, iterations, patch_flow));
+        cv::Mat dense(I0.size(), CV_32FC2);
+        cv::parallel_for_(cv::Range(0, I0.rows), DensifyBody<T>(I0, I1, xs, ys, patch, patch_flow, dense),
+                          std::max(1.0, I0.rows / 16.0));
+        U = dense;
+    }
+
+    void rescaleFlow(const cv::Mat& src, cv::Mat& dst, cv::Size size)
+    {
+        cv::Mat scaled;
+        cv::resize(src, scaled, size, 0, 0, cv::INTER_LINEAR);
+        cv::multiply(scaled, cv::Scalar(double(size.width) / src.cols, double(size.height) / src.rows), dst);
+    }
+}
+
+void aq::flow::sparsePyrLK(const std::vector<cv::Mat>& prev, const std::vector<cv::Mat>& next,
+                           const cv::Mat& prev_pts, cv::Mat& next_pts, cv::Mat& status, cv::Mat& error,
+                           const LKParams& params, bool use_initial)
+{
+    CV_Assert(prev_pts.type() == CV_32FC2 && prev_pts.rows == 1 && prev_pts.isContinuous());
+    const int levels = usableLevels(prev, next, params.window);
+    const int count  = prev_pts.cols;
+    use_initial      = use_initial && next_pts.type() == CV_32FC2 && next_pts.total() == static_cast<size_t>(count);
+    if (!use_initial)
+        next_pts.create(1, count, CV_32FC2);
+    status.create(1, count, CV_8U);
+    error.create(1, count, CV_32F);
+    if (count == 0)
+        return;
+    // Batches of points, each point is a few thousand samples per level
+    const double stripes = std::max(1.0, count / 64.0);
+    const cv::Point2f* src = prev_pts.ptr<cv::Point2f>();
+    cv::Point2f*       dst = next_pts.ptr<cv::Point2f>();
+    switch (prev[0].depth())
+    {
+    case CV_8U:
+        cv::parallel_for_(cv::Range(0, count), SparseLKBody<uchar>(prev, next, levels, src, dst, status.ptr<uchar>(),
+                                                                    error.ptr<float>(), params, use_initial),
+                          stripes);
+        break;
+    case CV_32F:
+        cv::parallel_for_(cv::Range(0, count), SparseLKBody<float>(prev, next, levels, src, dst, status.ptr<uchar>(),
+                                                                    error.ptr<float>(), params, use_initial),
+                          stripes);
+        break;
+    default:
+        CV_Error(cv::Error::StsUnsupportedFormat, "Only CV_8U and CV_32F pyramids are supported");
+    }
+}
+
+void aq::flow::denseInverseSearch(const std::vector<cv::Mat>& prev, const std::vector<cv::Mat>& next, cv::Mat& flow,
+                                  const DISParams& params, bool use_initial)
+{
+    const int patch  = std::max(4, params.patch_size);
+    const int stride = params.patch_stride > 0 ? params.patch_stride : std::max(1, patch / 2);
+    // Levels smaller than a patch can't be aligned
+    const int      levels = usableLevels(prev, next, cv::Size(patch, patch));
+    const cv::Size top    = prev[levels - 1].size();
+    cv::Mat        U;
+    if (use_initial && flow.type() == CV_32FC2 && flow.size() == prev[0].size())
+        rescaleFlow(flow, U, top);
+    else
+        U = cv::Mat::zeros(top, CV_32FC2);
+    for (int level = levels - 1; level >= 0; --level)
+    {
+        const cv::Mat& I0 = prev[level];
+        const cv::Mat& I1 = next[level];
+        if (U.size() != I0.size())
+            rescaleFlow(U, U, I0.size());
+        if (I0.cols < patch || I0.rows < patch)
+            continue;
+        switch (I0.depth())
+        {
+        case CV_8U: disLevel<uchar>(I0, I1, U, patch, stride, params.iterations); break;
+        case CV_32F: disLevel<float>(I0, I1, U, patch, stride, params.iterations); break;
+        default: CV_Error(cv::Error::StsUnsupportedFormat, "Only CV_8U and CV_32F pyramids are supported");
+        }
+    }
+    flow = U;
+}
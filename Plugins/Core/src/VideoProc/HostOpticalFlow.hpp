@@ -0,0 +1,49 @@
+#pragma once
+#include "CoreExport.hpp"
+#include <opencv2/core/mat.hpp>
+
+#include <vector>
+
+namespace aq
+{
+namespace flow
+{
+    // Host optical flow on plain image pyramids, level i + 1 half the size of level i as built by
+    // pyrDown / ImagePyramid.  Levels are single channel CV_8U or CV_32F and are only read, so the
+    // previous frame's pyramid can be passed in again without rebuilding it.
+
+    struct LKParams
+    {
+        cv::Size window     = cv::Size(21, 21);
+        int      iterations = 30;
+        float    epsilon    = 0.01f;
+        // Points whose structure tensor has a smaller normalized min eigenvalue are marked as lost
+        float    min_eigen  = 1e-4f;
+    };
+
+    // Pyramidal Lucas-Kanade for a sparse set of points, parallelized over batches of points.
+    // prev_pts is 1 x N CV_32FC2.  next_pts receives the tracked points, when use_initial is set and
+    // it already holds N points they are used as the initial estimate.  status is 1 x N CV_8U,
+    // error 1 x N CV_32F mean absolute intensity difference over the window.
+    Core_EXPORT void sparsePyrLK(const std::vector<cv::Mat>& prev, const std::vector<cv::Mat>& next,
+                                 const cv::Mat& prev_pts, cv::Mat& next_pts, cv::Mat& status, cv::Mat& error,
+                                 const LKParams& params = LKParams(), bool use_initial = false);
+
+    struct DISParams
+    {
+        int patch_size = 8;
+        // Patch spacing, defaults to half the patch size
+        int patch_stride = 0;
+        int iterations   = 12;
+    };
+
+    // Dense inverse search (Kroeger et al. 2016) without the variational refinement.  On every level,
+    // coarse to fine, patches on a regular grid are aligned with inverse compositional LK starting from
+    // the upsampled flow of the coarser level, then every pixel takes the photometric error weighted
+    // mean of the patches covering it.  Both steps run in parallel over tiles of rows.  flow is
+    // CV_32FC2 of the size of level 0, it is used as the initial estimate when use_initial is set.
+    Core_EXPORT void denseInverseSearch(const std::vector<cv::Mat>& prev, const std::vector<cv::Mat>& next,
+                                        cv::Mat& flow, const DISParams& params = DISParams(),
+                                        bool use_initial = false);
+}
+}
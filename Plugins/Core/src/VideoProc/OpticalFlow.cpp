@@ -19,42 +19,76 @@ IPyrOpticalFlow::IPyrOpticalFlow()
 
 size_t IPyrOpticalFlow::PrepPyramid()
 {
-    if (input->getChannels() != 1)
+    if (image_pyramid != nullptr)
     {
-        cv::cuda::cvtColor(input->getGpuMat(stream()), greyImg[0], cv::COLOR_BGR2GRAY, 1, stream());
+        _host = false;
+        greyImg = *image_pyramid;
+        return image_pyramid_param.getFrameNumber();
     }
-    else
-    {
-        greyImg[0] = input->getGpuMat(stream());
-    }
-    size_t fn;
-    if (image_pyramid == nullptr)
+    // Shared with every other node that needs a grey pyramid of the same frame
+    const size_t fn = input_param.getFrameNumber();
+    pyramid = pyramid_sources.get(input_param, *input, 0.5f, ImagePyramid::Grey);
+    _host = input->getSyncState() < SyncedMemory::DEVICE_UPDATED;
+    if (_host)
     {
-        image_pyramid = &greyImg;
-        THROW(debug) << "Need to reimplement and redesign";
-
-        fn= input_param.getFrameNumber();
+        h_greyImg.resize(pyramid_levels);
+        for (int level = 0; level < pyramid_levels; ++level)
+        {
+            h_greyImg[level] = pyramid->getMat(level, stream());
+        }
     }
     else
     {
-        fn = image_pyramid_param.getFrameNumber();
+        greyImg.resize(pyramid_levels);
+        for (int level = 0; level < pyramid_levels; ++level)
+        {
+            greyImg[level] = pyramid->getGpuMat(level, stream());
+        }
     }
     return fn;
 }
 
-void IPyrOpticalFlow::build_pyramid(std::vector<cv::cuda::GpuMat>& pyramid)
+bool IPyrOpticalFlow::hasPrevious() const
+{
+    return _host ? !h_prevGreyImg.empty() : !prevGreyImg.empty();
+}
+
+void IPyrOpticalFlow::swapPyramids()
 {
-    CV_Assert(pyramid.size());
-    CV_Assert(!pyramid[0].empty());
-    pyramid.resize(pyramid_levels);
-    for (int level = 1; level < pyramid_levels; ++level)
+    if (_host)
     {
-        cv::cuda::pyrDown(pyramid[level - 1], pyramid[level], stream());
+        h_prevGreyImg = h_greyImg;
+        prevGreyImg.clear();
+    }
+    else
+    {
+        prevGreyImg = greyImg;
+        h_prevGreyImg.clear();
     }
 }
 
 bool DensePyrLKOpticalFlow::processImpl()
 {
+    auto fn = PrepPyramid();
+    if(!hasPrevious())
+    {
+        swapPyramids();
+        return true;
+    }
+    if(_host)
+    {
+        // window_size is the patch size of the dense inverse search, iterations the per patch iterations
+        flow::DISParams params;
+        params.patch_size = window_size;
+        params.iterations = iterations;
+        // The previous output may still be in use downstream, the new flow is always a fresh buffer
+        cv::Mat flow = h_flow;
+        flow::denseInverseSearch(h_prevGreyImg, h_greyImg, flow, params, use_initial_flow);
+        h_flow = flow;
+        swapPyramids();
+        flow_field_param.updateData(flow, fn, _ctx.get());
+        return true;
+    }
     if(window_size_param.modified() ||
         pyramid_levels_param.modified() ||
         iterations_param.modified() ||
@@ -74,23 +108,48 @@ bool DensePyrLKOpticalFlow::processImpl()
         use_initial_flow_param.modified(false);
     }
     cv::cuda::GpuMat flow;
-    if(prevGreyImg.empty())
-    {
-        prevGreyImg = greyImg;
-        return true;
-    }
-
-    auto fn = PrepPyramid();
+    opt_flow->calc(prevGreyImg, greyImg, flow, stream());
 
-    opt_flow->calc(prevGreyImg, *image_pyramid, flow, stream());
-
-    prevGreyImg = greyImg;
+    swapPyramids();
     flow_field_param.updateData(flow, fn, _ctx.get());
     return true;
 }
 
 bool SparsePyrLKOpticalFlow::processImpl()
 {
+    auto ts = PrepPyramid();
+    // Points of the previous frame are tracked into the current one
+    if(!ts || !hasPrevious() || !input_points_param.getInput(ts - 1))
+    {
+        swapPyramids();
+        return false;
+    }
+    if(_host)
+    {
+        cv::Mat points = input_points->getMat(stream());
+        if(points.depth() != CV_32F || points.total() * points.channels() % 2 != 0)
+        {
+            MO_LOG_EVERY_N(warning, 100) << "Expected CV_32F points with two channels or columns";
+            swapPyramids();
+            return false;
+        }
+        // Points are tracked independently, batches of them run in parallel
+        flow::LKParams params;
+        params.window     = cv::Size(window_size, window_size);
+        params.iterations = iterations;
+        cv::Mat tracked_points, status, error;
+        // The previous result is published, the estimate is refined in a copy
+        if(use_initial_flow && h_tracked_points.total() * 2 == points.total() * points.channels())
+            h_tracked_points.copyTo(tracked_points);
+        flow::sparsePyrLK(h_prevGreyImg, h_greyImg, points.isContinuous() ? points.reshape(2, 1) : points.clone().reshape(2, 1),
+                          tracked_points, status, error, params, use_initial_flow);
+        h_tracked_points = tracked_points;
+        swapPyramids();
+        tracked_points_param.updateData(tracked_points, ts, _ctx.get());
+        status_param.updateData(status, ts, _ctx.get());
+        error_param.updateData(error, ts, _ctx.get());
+        return true;
+    }
     if (window_size_param.modified() ||
         pyramid_levels_param.modified() ||
         iterations_param.modified() ||
@@ -108,30 +167,23 @@ bool SparsePyrLKOpticalFlow::processImpl()
         iterations_param.modified(false);
         use_initial_flow_param.modified(false);
     }
-    auto ts = PrepPyramid();
-    if(ts)
+    cv::cuda::GpuMat tracked_points, status, error;
+    const cv::cuda::GpuMat& points = input_points->getGpuMat(stream());
+    if(use_initial_flow)
     {
-        cv::cuda::GpuMat tracked_points, status, error;
-        if(input_points_param.getInput(ts - 1))
-        {
-            optFlow->calc(prevGreyImg, greyImg, input_points->getGpuMat(stream()), tracked_points, status, error, stream());
-        }else
-        {
-            if(!prev_key_points.empty())
-            {
-                prev_key_points = input_points->getGpuMat(stream());
-                return false;
-            }else
-            {
-                optFlow->calc(prevGreyImg, greyImg, prev_key_points, tracked_points, status, error, stream());
-            }
-        }
-        tracked_points_param.updateData(tracked_points, ts, _ctx.get());
-        status_param.updateData(status, ts, _ctx.get());
-        error_param.updateData(error, ts, _ctx.get());
-        return true;
+        // The cuda implementation requires an estimate for every point, without one the points themselves are used
+        if(d_tracked_points.size() == points.size() && d_tracked_points.type() == points.type())
+            d_tracked_points.copyTo(tracked_points, stream());
+        else
+            points.copyTo(tracked_points, stream());
     }
-    return false;
+    optFlow->calc(prevGreyImg, greyImg, points, tracked_points, status, error, stream());
+    d_tracked_points = tracked_points;
+    swapPyramids();
+    tracked_points_param.updateData(tracked_points, ts, _ctx.get());
+    status_param.updateData(status, ts, _ctx.get());
+    error_param.updateData(error, ts, _ctx.get());
+    return true;
 }
 
 MO_REGISTER_CLASS(SparsePyrLKOpticalFlow)
@@ -3,6 +3,8 @@
 
 #include <Aquila/rcc/external_includes/cv_cudaoptflow.hpp>
 #include "Aquila/utilities/cuda/CudaUtils.hpp"
+#include "../PyramidCache.hpp"
+#include "HostOpticalFlow.hpp"
 
 RUNTIME_COMPILER_SOURCEDEPENDENCY
 RUNTIME_MODIFIABLE_INCLUDE
@@ -21,12 +23,24 @@ namespace aq
                 PARAM(int, iterations, 30)
                 PARAM(int, pyramid_levels, 3)
                 PARAM(bool, use_initial_flow, false)
+                TOOLTIP(use_initial_flow, "Start from the previous result, the previous flow field or where each point was tracked to in the previous frame")
             MO_END;
         protected:
+            // Fills greyImg from image_pyramid or the shared grey pyramid of input, h_greyImg instead when
+            // the input is on the host.  Returns the frame number
             size_t PrepPyramid();
-            void build_pyramid(std::vector<cv::cuda::GpuMat>& pyramid);
+            // True if the previous frame's pyramid is available in the memory space of the current one
+            bool hasPrevious() const;
+            // The current pyramid becomes the previous one, no level is rebuilt
+            void swapPyramids();
+
+            std::shared_ptr<ImagePyramid> pyramid;
+            PyramidSources pyramid_sources;
             TS<std::vector<cv::cuda::GpuMat>> prevGreyImg;
             std::vector<cv::cuda::GpuMat> greyImg;
+            std::vector<cv::Mat> h_prevGreyImg;
+            std::vector<cv::Mat> h_greyImg;
+            bool _host = false;
         };
         class DensePyrLKOpticalFlow : public IPyrOpticalFlow
         {
@@ -37,6 +51,7 @@ namespace aq
             bool processImpl();
         protected:
             cv::Ptr<cv::cuda::DensePyrLKOpticalFlow> opt_flow;
+            cv::Mat h_flow;
         };
 
         class SparsePyrLKOpticalFlow : public IPyrOpticalFlow
@@ -51,8 +66,10 @@ namespace aq
             MO_END;
         protected:
             bool processImpl();
-            cv::cuda::GpuMat prev_key_points;
             cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> optFlow;
+            // Last result, the initial estimate with use_initial_flow
+            cv::Mat h_tracked_points;
+            cv::cuda::GpuMat d_tracked_points;
         };
     }
 }
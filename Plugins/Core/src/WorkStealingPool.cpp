@@ -0,0 +1,146 @@
+#include "WorkStealingPool.hpp"
+#include <MetaObject/logging/logging.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+using namespace aq;
+
+namespace
+{
+    // Index of the calling thread's own deque, one past the workers for threads outside the pool
+    thread_local const WorkStealingPool* t_pool  = nullptr;
+    thread_local size_t                  t_index = 0;
+}
+
+WorkStealingPool& WorkStealingPool::instance()
+{
+    static WorkStealingPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : m_pending(0)
+    , m_next(0)
+{
+    threads = std::max<size_t>(threads, 1);
+    for(size_t i = 0; i < threads; ++i)
+        m_queues.emplace_back(new Queue());
+    for(size_t i = 0; i < threads; ++i)
+        m_threads.emplace_back([this, i]() { work(i); });
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for(auto& thread : m_threads)
+        thread.join();
+}
+
+void WorkStealingPool::submit(Task task)
+{
+    // Workers keep their continuations, outside threads spread their tasks round robin
+    const size_t index = t_pool == this ? t_index : m_next++ % m_queues.size();
+    {
+        // Counted before the task is visible, a thief may pop and decrement it right after the push
+        std::lock_guard<std::mutex> lock(m_mtx);
+        ++m_pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mtx);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    m_work_cv.notify_one();
+}
+
+bool WorkStealingPool::tryPop(size_t self, Task& task)
+{
+    const size_t count = m_queues.size();
+    if(self < count)
+    {
+        Queue& own = *m_queues[self];
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if(!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --m_pending;
+            return true;
+        }
+    }
+    for(size_t i = 1; i <= count; ++i)
+    {
+        Queue& victim = *m_queues[(self + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if(!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --m_pending;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::execute(Task& task)
+{
+    try
+    {
+        task();
+    }
+    catch(std::exception& e)
+    {
+        MO_LOG(warning) << "Task failed: " << e.what();
+    }
+    catch(...)
+    {
+        MO_LOG(warning) << "Task failed with an unknown exception";
+    }
+    task = Task();
+    {
+        // Taking the lock orders the notification after a waiter's predicate check
+        std::lock_guard<std::mutex> lock(m_mtx);
+    }
+    m_done_cv.notify_all();
+}
+
+void WorkStealingPool::work(size_t index)
+{
+    t_pool  = this;
+    t_index = index;
+    Task task;
+    while(true)
+    {
+        if(tryPop(index, task))
+        {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_work_cv.wait(lock, [this]() { return m_stop || m_pending > 0; });
+        if(m_stop)
+            return;
+    }
+}
+
+void WorkStealingPool::helpUntil(const std::function<bool()>& done)
+{
+    const size_t self = t_pool == this ? t_index : m_queues.size();
+    Task task;
+    while(!done())
+    {
+        if(tryPop(self, task))
+        {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mtx);
+        // The timeout covers tasks that finish between the check and the wait on another pool's lock
+        m_done_cv.wait_for(lock, std::chrono::milliseconds(10), [this, &done]() { return m_pending > 0 || done(); });
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "CoreExport.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aq
+{
+    // Fixed size thread pool with a task deque per worker.  Tasks submitted from a worker go to the back
+    // of its own deque and are popped from there, so a task's continuations run hot in the same cache,
+    // idle workers steal from the front of the others.  Threads outside the pool can lend a hand while
+    // they wait for their tasks with helpUntil.
+    class Core_EXPORT WorkStealingPool
+    {
+    public:
+        typedef std::function<void()> Task;
+
+        // Shared pool with one worker less than there are cores, the waiting thread makes up the last one
+        static WorkStealingPool& instance();
+
+        explicit WorkStealingPool(size_t threads);
+        ~WorkStealingPool();
+
+        void submit(Task task);
+        // Runs queued tasks on the calling thread until done returns true
+        void helpUntil(const std::function<bool()>& done);
+
+        size_t size() const { return m_threads.size(); }
+
+    private:
+        struct Queue
+        {
+            std::mutex       mtx;
+            std::deque<Task> tasks;
+        };
+
+        bool tryPop(size_t self, Task& task);
+        void execute(Task& task);
+        void work(size_t index);
+
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread>            m_threads;
+        std::mutex                          m_mtx;
+        std::condition_variable             m_work_cv;
+        std::condition_variable             m_done_cv;
+        std::atomic<size_t>                 m_pending;
+        std::atomic<size_t>                 m_next;
+        bool                                m_stop = false;
+    };
+}
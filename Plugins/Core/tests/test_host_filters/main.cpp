@@ -0,0 +1,182 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "Aquila/Core/test_host_filters"
+#include <ImgProc/HostFilters.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+cv::Mat randomMat(cv::Size size, int type, uint64_t seed) {
+    cv::RNG rng(seed);
+    cv::Mat out(size, type);
+    if (CV_MAT_DEPTH(type) == CV_32F)
+        rng.fill(out, cv::RNG::UNIFORM, cv::Scalar::all(-100), cv::Scalar::all(100));
+    else if (CV_MAT_DEPTH(type) == CV_16U)
+        rng.fill(out, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(65536));
+    else
+        rng.fill(out, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    return out;
+}
+
+bool identical(const cv::Mat& lhs, const cv::Mat& rhs) {
+    return lhs.size() == rhs.size() && lhs.type() == rhs.type() && cv::norm(lhs, rhs, cv::NORM_INF) == 0;
+}
+
+// Brute force median with a replicated border, OpenCV only has windows above 5 for 8 bit input
+cv::Mat naiveMedian(const cv::Mat& src, int window_size) {
+    const int r = window_size / 2;
+    cv::Mat   padded;
+    cv::copyMakeBorder(src, padded, r, r, r, r, cv::BORDER_REPLICATE);
+    cv::Mat             dst(src.size(), src.type());
+    const int           cn = src.channels();
+    std::vector<ushort> window;
+    for (int y = 0; y < src.rows; ++y) {
+        for (int x = 0; x < src.cols; ++x) {
+            for (int c = 0; c < cn; ++c) {
+                window.clear();
+                for (int dy = 0; dy < window_size; ++dy) {
+                    const ushort* row = padded.ptr<ushort>(y + dy);
+                    for (int dx = 0; dx < window_size; ++dx)
+                        window.push_back(row[(x + dx) * cn + c]);
+                }
+                std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+                dst.ptr<ushort>(y)[x * cn + c] = window[window.size() / 2];
+            }
+        }
+    }
+    return dst;
+}
+
+// Zero padded to size, modulated by (-1)^(x + y) or (-1)^x, then transformed by OpenCV
+cv::Mat referenceDft(const cv::Mat& in, cv::Size size, int flags, bool shift) {
+    cv::Mat padded;
+    cv::copyMakeBorder(in, padded, 0, size.height - in.rows, 0, size.width - in.cols, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    padded.convertTo(padded, CV_MAKETYPE(CV_32F, in.channels()));
+    if (shift) {
+        const bool rows_only = (flags & cv::DFT_ROWS) != 0;
+        for (int y = 0; y < padded.rows; ++y) {
+            float* row = padded.ptr<float>(y);
+            for (int x = 0; x < padded.cols; ++x) {
+                if ((rows_only ? x : x + y) & 1) {
+                    for (int c = 0; c < padded.channels(); ++c)
+                        row[x * padded.channels() + c] = -row[x * padded.channels() + c];
+                }
+            }
+        }
+    }
+    cv::Mat out;
+    cv::dft(padded, out, flags | cv::DFT_COMPLEX_OUTPUT);
+    return out;
+}
+
+void requireClose(const cv::Mat& result, const cv::Mat& expected) {
+    BOOST_REQUIRE_EQUAL(result.size(), expected.size());
+    BOOST_REQUIRE_EQUAL(result.type(), expected.type());
+    const double scale = std::max(cv::norm(expected, cv::NORM_INF), 1.0);
+    BOOST_REQUIRE_LE(cv::norm(result, expected, cv::NORM_INF) / scale, 1e-4);
+}
+}
+
+BOOST_AUTO_TEST_CASE(median_8u) {
+    for (int cn : {1, 3}) {
+        const cv::Mat src = randomMat(cv::Size(97, 61), CV_8UC(cn), 1);
+        for (int window_size : {3, 5, 7, 15, 31}) {
+            cv::Mat result, expected;
+            BOOST_REQUIRE(aq::filters::medianBlur(src, result, window_size));
+            cv::medianBlur(src, expected, window_size);
+            BOOST_REQUIRE_MESSAGE(identical(result, expected), "window " << window_size << " channels " << cn);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(median_16u) {
+    for (int cn : {1, 3}) {
+        const cv::Mat src = randomMat(cv::Size(45, 38), CV_16UC(cn), 2);
+        cv::Mat       result, expected;
+        BOOST_REQUIRE(aq::filters::medianBlur(src, result, 5));
+        cv::medianBlur(src, expected, 5);
+        BOOST_REQUIRE(identical(result, expected));
+        for (int window_size : {7, 11}) {
+            BOOST_REQUIRE(aq::filters::medianBlur(src, result, window_size));
+            BOOST_REQUIRE_MESSAGE(identical(result, naiveMedian(src, window_size)), "window " << window_size << " channels " << cn);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(median_unsupported_depth) {
+    cv::Mat result;
+    BOOST_REQUIRE(!aq::filters::medianBlur(randomMat(cv::Size(32, 32), CV_32F, 3), result, 9));
+}
+
+BOOST_AUTO_TEST_CASE(morphology) {
+    const int ops[] = {cv::MORPH_ERODE, cv::MORPH_DILATE, cv::MORPH_OPEN, cv::MORPH_CLOSE,
+                       cv::MORPH_GRADIENT, cv::MORPH_TOPHAT, cv::MORPH_BLACKHAT};
+    for (int type : {CV_8UC1, CV_8UC3, CV_16UC1, CV_32FC1}) {
+        const cv::Mat src = randomMat(cv::Size(83, 47), type, 4);
+        for (int shape : {cv::MORPH_RECT, cv::MORPH_CROSS}) {
+            for (int size : {3, 5, 9, 15}) {
+                const cv::Mat element = cv::getStructuringElement(shape, cv::Size(size, size));
+                for (int op : ops) {
+                    for (int iterations : {1, 2}) {
+                        cv::Mat result, expected;
+                        aq::filters::morphology(src, result, op, shape, size, cv::Point(-1, -1), iterations, element);
+                        cv::morphologyEx(src, expected, op, element, cv::Point(-1, -1), iterations);
+                        BOOST_REQUIRE_MESSAGE(identical(result, expected), "type " << type << " shape " << shape << " size "
+                                                                                    << size << " op " << op << " iterations " << iterations);
+                    }
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dft) {
+    aq::filters::Dft dft;
+    for (cv::Size size : {cv::Size(64, 48), cv::Size(63, 37)}) {
+        for (int type : {CV_32FC1, CV_8UC1, CV_32FC2}) {
+            const cv::Mat in = randomMat(size, type, 5);
+            for (int flags : {0, int(cv::DFT_ROWS), int(cv::DFT_SCALE)}) {
+                requireClose(dft.apply(in, flags), referenceDft(in, size, flags, false));
+                // Shifting pads odd sizes by one, rows only along x
+                cv::Size shifted(size.width + (size.width & 1), size.height);
+                if (!(flags & cv::DFT_ROWS))
+                    shifted.height += size.height & 1;
+                requireClose(dft.apply(in, flags, true), referenceDft(in, shifted, flags, true));
+            }
+            const cv::Size optimal(cv::getOptimalDFTSize(size.width), cv::getOptimalDFTSize(size.height));
+            requireClose(dft.apply(in, 0, false, true), referenceDft(in, optimal, 0, false));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dft_inverse) {
+    aq::filters::Dft dft;
+    const cv::Mat    in       = randomMat(cv::Size(40, 30), CV_32FC1, 6);
+    const cv::Mat    spectrum = dft.apply(in, 0).clone();
+    const cv::Mat    restored = dft.apply(spectrum, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+    BOOST_REQUIRE_EQUAL(restored.channels(), 1);
+    requireClose(restored, in);
+}
+
+BOOST_AUTO_TEST_CASE(dft_held_output) {
+    // A result still held by the caller may not be overwritten by later transforms of the same shape
+    aq::filters::Dft dft;
+    const cv::Mat    first    = randomMat(cv::Size(32, 32), CV_32FC1, 7);
+    const cv::Mat    held     = dft.apply(first, 0);
+    const cv::Mat    expected = referenceDft(first, first.size(), 0, false);
+    for (uint64_t seed = 8; seed < 12; ++seed) {
+        const cv::Mat other = randomMat(first.size(), CV_32FC1, seed);
+        requireClose(dft.apply(other, 0), referenceDft(other, other.size(), 0, false));
+    }
+    requireClose(held, expected);
+    // Both take the 16 x 16 plan, the smaller image leaves nothing of the previous one in the padding
+    dft.apply(randomMat(cv::Size(16, 16), CV_32FC1, 12), 0, true);
+    const cv::Mat small = randomMat(cv::Size(15, 15), CV_32FC1, 13);
+    requireClose(dft.apply(small, 0, true), referenceDft(small, cv::Size(16, 16), 0, true));
+}
@@ -0,0 +1,112 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "Aquila/Core/test_model_registry"
+#include <ModelRegistry.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace {
+struct Weights {
+    explicit Weights(int value_)
+        : value(value_) {
+    }
+    int value;
+};
+
+struct WeightFile {
+    WeightFile()
+        : path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("registry_%%%%%%.weights")) {
+        std::ofstream ofs(path.string().c_str());
+        ofs << "weights";
+    }
+    ~WeightFile() {
+        boost::system::error_code ec;
+        boost::filesystem::remove(path, ec);
+    }
+    boost::filesystem::path path;
+};
+
+std::function<std::shared_ptr<Weights>()> countingLoader(std::atomic<int>& loads) {
+    return [&loads]() { return std::make_shared<Weights>(++loads); };
+}
+}
+
+BOOST_AUTO_TEST_CASE(shared_acquire) {
+    WeightFile                   file;
+    const aq::ModelRegistry::Key key{"shared.prototxt", file.path.string(), "test"};
+    std::atomic<int>             loads(0);
+    auto                         first  = aq::ModelRegistry::instance().acquire(key, countingLoader(loads));
+    auto                         second = aq::ModelRegistry::instance().acquire(key, countingLoader(loads));
+    BOOST_REQUIRE(first);
+    BOOST_REQUIRE_EQUAL(first, second);
+    BOOST_REQUIRE_EQUAL(loads, 1);
+
+    // A different backend for the same files is a different model
+    const aq::ModelRegistry::Key other{key.model_file, key.weight_file, "other"};
+    auto                         third = aq::ModelRegistry::instance().acquire(other, countingLoader(loads));
+    BOOST_REQUIRE(third != first);
+    BOOST_REQUIRE_EQUAL(loads, 2);
+}
+
+BOOST_AUTO_TEST_CASE(purge_unused) {
+    WeightFile                   file;
+    const aq::ModelRegistry::Key key{"purge.prototxt", file.path.string(), "test"};
+    std::atomic<int>             loads(0);
+    aq::ModelRegistry::instance().purge();
+    const size_t before = aq::ModelRegistry::instance().size();
+    {
+        auto weights = aq::ModelRegistry::instance().acquire(key, countingLoader(loads));
+        aq::ModelRegistry::instance().purge();
+        // Still held
+        BOOST_REQUIRE_EQUAL(aq::ModelRegistry::instance().size(), before + 1);
+    }
+    aq::ModelRegistry::instance().purge();
+    BOOST_REQUIRE_EQUAL(aq::ModelRegistry::instance().size(), before);
+}
+
+BOOST_AUTO_TEST_CASE(reload_on_change) {
+    WeightFile                   file;
+    const aq::ModelRegistry::Key key{"reload.prototxt", file.path.string(), "test"};
+    std::atomic<int>             loads(0);
+    size_t                       version  = 0;
+    auto                         original = aq::ModelRegistry::instance().acquire(key, countingLoader(loads), &version);
+    BOOST_REQUIRE_EQUAL(original->value, 1);
+    BOOST_REQUIRE_EQUAL(version, 0);
+
+    // Modification times have a resolution of a second
+    boost::filesystem::last_write_time(file.path, boost::filesystem::last_write_time(file.path) + 10);
+    std::shared_ptr<Weights> reloaded = original;
+    for (int i = 0; i < 500 && reloaded == original; ++i) {
+        reloaded = aq::ModelRegistry::instance().acquire(key, countingLoader(loads), &version);
+        if (reloaded == original)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_REQUIRE(reloaded != original);
+    BOOST_REQUIRE_EQUAL(reloaded->value, 2);
+    BOOST_REQUIRE_EQUAL(version, 1);
+    // Holders of the previous weights keep them until they acquire again
+    BOOST_REQUIRE_EQUAL(original->value, 1);
+    BOOST_REQUIRE_EQUAL(aq::ModelRegistry::instance().acquire(key, countingLoader(loads)), reloaded);
+    BOOST_REQUIRE_EQUAL(loads, 2);
+}
+
+BOOST_AUTO_TEST_CASE(poll_interval) {
+    aq::ModelRegistry&              registry = aq::ModelRegistry::instance();
+    const std::chrono::milliseconds interval = registry.checkInterval();
+    registry.setCheckInterval(std::chrono::milliseconds(50));
+    aq::ModelRegistry::Poll poll;
+    BOOST_REQUIRE(poll.due(false));
+    BOOST_REQUIRE(!poll.due(false));
+    // A changed file is always checked
+    BOOST_REQUIRE(poll.due(true));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    BOOST_REQUIRE(poll.due(false));
+    registry.setCheckInterval(interval);
+}
@@ -0,0 +1,159 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "Aquila/Core/test_nms"
+#include <NMS.hpp>
+
+#include <opencv2/core.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+namespace {
+struct Detections {
+    std::vector<cv::Rect2f> boxes;
+    std::vector<float>      scores;
+    std::vector<int>        classes;
+};
+
+// Clusters of overlapping boxes so that every method has something to suppress
+Detections randomDetections(int count, int num_classes, uint64_t seed) {
+    cv::RNG    rng(seed);
+    Detections out;
+    for (int i = 0; i < count; ++i) {
+        const float x = rng.uniform(0.0f, 200.0f);
+        const float y = rng.uniform(0.0f, 200.0f);
+        const int   n = rng.uniform(1, 5);
+        for (int j = 0; j < n; ++j) {
+            out.boxes.emplace_back(x + rng.uniform(-8.0f, 8.0f), y + rng.uniform(-8.0f, 8.0f), rng.uniform(10.0f, 40.0f), rng.uniform(10.0f, 40.0f));
+            out.scores.push_back(rng.uniform(0.01f, 1.0f));
+            out.classes.push_back(rng.uniform(0, num_classes));
+        }
+    }
+    return out;
+}
+
+float iou(const cv::Rect2f& a, const cv::Rect2f& b) {
+    const float w     = std::max(std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x), 0.0f);
+    const float h     = std::max(std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y), 0.0f);
+    const float inter = w * h;
+    return inter / std::max(a.width * a.height + b.width * b.height - inter, 1e-9f);
+}
+
+// Textbook greedy suppression, every remaining pair is tested
+std::vector<size_t> reference(const Detections& dets, const aq::nms::Options& options, std::vector<float>& kept_scores) {
+    std::vector<float>  scores = dets.scores;
+    std::vector<size_t> active;
+    for (size_t i = 0; i < scores.size(); ++i) {
+        if (scores[i] > options.score_threshold)
+            active.push_back(i);
+    }
+    std::vector<std::pair<float, size_t> > kept;
+    while (!active.empty()) {
+        auto best = std::min_element(active.begin(), active.end(), [&](size_t lhs, size_t rhs) {
+            return scores[lhs] != scores[rhs] ? scores[lhs] > scores[rhs] : lhs < rhs;
+        });
+        const size_t idx = *best;
+        active.erase(best);
+        kept.emplace_back(scores[idx], idx);
+        std::vector<size_t> remaining;
+        for (size_t j : active) {
+            if (options.class_aware && dets.classes[j] != dets.classes[idx]) {
+                remaining.push_back(j);
+                continue;
+            }
+            const float overlap = iou(dets.boxes[idx], dets.boxes[j]);
+            if (options.method == aq::nms::Hard) {
+                if (overlap <= options.iou_threshold)
+                    remaining.push_back(j);
+                continue;
+            }
+            if (options.method == aq::nms::Linear) {
+                if (overlap > options.iou_threshold)
+                    scores[j] *= 1.0f - overlap;
+            } else {
+                scores[j] *= std::exp(-(overlap * overlap) / options.sigma);
+            }
+            if (scores[j] > options.score_threshold)
+                remaining.push_back(j);
+        }
+        active.swap(remaining);
+    }
+    std::stable_sort(kept.begin(), kept.end(), [](const std::pair<float, size_t>& lhs, const std::pair<float, size_t>& rhs) {
+        return lhs.first > rhs.first;
+    });
+    std::vector<size_t> out;
+    kept_scores.clear();
+    for (const auto& item : kept) {
+        out.push_back(item.second);
+        kept_scores.push_back(item.first);
+    }
+    return out;
+}
+
+void compare(const Detections& dets, const aq::nms::Options& options) {
+    std::vector<float>        expected_scores, scores;
+    const std::vector<size_t> expected = reference(dets, options, expected_scores);
+    const std::vector<size_t> kept     = aq::nms::suppress(dets.boxes, dets.scores, dets.classes, options, &scores);
+    // Kept sets have to match, ties in the decayed scores may be ordered differently
+    std::vector<size_t> lhs = expected, rhs = kept;
+    std::sort(lhs.begin(), lhs.end());
+    std::sort(rhs.begin(), rhs.end());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+    for (size_t i = 0; i < kept.size(); ++i) {
+        const size_t pos = std::find(expected.begin(), expected.end(), kept[i]) - expected.begin();
+        BOOST_REQUIRE_CLOSE(scores[i], expected_scores[pos], 1e-3);
+    }
+}
+}
+
+BOOST_AUTO_TEST_CASE(hard_matches_reference) {
+    const Detections dets = randomDetections(200, 3, 1);
+    for (int prefilter : {aq::nms::NoPrefilter, aq::nms::Grid, aq::nms::SortAndSweep}) {
+        for (bool class_aware : {true, false}) {
+            aq::nms::Options options;
+            options.prefilter   = static_cast<aq::nms::Prefilter>(prefilter);
+            options.class_aware = class_aware;
+            compare(dets, options);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(soft_matches_reference) {
+    const Detections dets = randomDetections(100, 2, 2);
+    for (int method : {aq::nms::Linear, aq::nms::Gaussian}) {
+        for (int prefilter : {aq::nms::NoPrefilter, aq::nms::Grid, aq::nms::SortAndSweep}) {
+            aq::nms::Options options;
+            options.method          = static_cast<aq::nms::Method>(method);
+            options.prefilter       = static_cast<aq::nms::Prefilter>(prefilter);
+            options.score_threshold = 0.05f;
+            compare(dets, options);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(max_detections) {
+    const Detections dets = randomDetections(100, 1, 3);
+    aq::nms::Options options;
+    std::vector<float>        scores;
+    const std::vector<size_t> all = aq::nms::suppress(dets.boxes, dets.scores, dets.classes, options);
+    options.max_detections        = 5;
+    const std::vector<size_t> top = aq::nms::suppress(dets.boxes, dets.scores, dets.classes, options, &scores);
+    BOOST_REQUIRE_EQUAL(top.size(), 5);
+    BOOST_REQUIRE(std::equal(top.begin(), top.end(), all.begin()));
+    BOOST_REQUIRE(std::is_sorted(scores.rbegin(), scores.rend()));
+}
+
+BOOST_AUTO_TEST_CASE(gaussian_sigma_validated) {
+    const Detections dets = randomDetections(10, 1, 4);
+    aq::nms::Options options;
+    options.method = aq::nms::Gaussian;
+    options.sigma  = 0.0f;
+    BOOST_REQUIRE_THROW(aq::nms::suppress(dets.boxes, dets.scores, dets.classes, options), cv::Exception);
+    // Only the gaussian decay uses sigma
+    options.method = aq::nms::Linear;
+    BOOST_REQUIRE_NO_THROW(aq::nms::suppress(dets.boxes, dets.scores, dets.classes, options));
+}
@@ -0,0 +1,502 @@
+#include "SemiGlobalMatching.hpp"
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace aq;
+using namespace aq::stereo;
+
+namespace
+{
+    // 9 x 7 census, 62 bits
+    const int census_rx  = 4;
+    const int census_ry  = 3;
+    const int max_cost   = (2 * census_rx + 1) * (2 * census_ry + 1) - 1;
+    // Path costs outside the disparity range, large but with room for the penalties
+    const uint16_t blocked = 0x3fff;
+
+    inline int popCount64(uint64_t v)
+    {
+        v = v - ((v >> 1) & 0x5555555555555555ULL);
+        v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+        v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+    }
+
+    // Disparities padded to whole vectors
+    inline int paddedDisparities(int num_disparities) { return (num_disparities + 7) & ~7; }
+
+    class CensusBody : public cv::ParallelLoopBody
+    {
+    public:
+        // padded has census_ry rows and census_rx columns of replicated border
+        CensusBody(const cv::Mat& padded_, cv::Mat& census_) : padded(padded_), census(census_) {}
+
+        void operator()(const cv::Range& range) const
+        {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                uint64_t* out = census.ptr<uint64_t>(y);
+                for (int x = 0; x < census.cols; ++x)
+                {
+                    const uchar center = padded.ptr<uchar>(y + census_ry)[x + census_rx];
+                    uint64_t    code   = 0;
+                    for (int dy = 0; dy <= 2 * census_ry; ++dy)
+                    {
+                        const uchar* row = padded.ptr<uchar>(y + dy) + x;
+                        for (int dx = 0; dx <= 2 * census_rx; ++dx)
+                        {
+                            if (dy == census_ry && dx == census_rx)
+                                continue;
+                            code = (code << 1) | (row[dx] < center ? 1u : 0u);
+                        }
+                    }
+                    out[x] = code;
+                }
+            }
+        }
+
+        const cv::Mat& padded;
+        cv::Mat&       census;
+    };
+
+    // Hamming distance of the census codes, pixels matching outside the right image get the maximum
+    class CostBody : public cv::ParallelLoopBody
+    {
+    public:
+        CostBody(const cv::Mat& left_, const cv::Mat& right_, cv::Mat& cost_, int min_disparity_, int num_disparities_)
+            : left(left_), right(right_), cost(cost_), min_disparity(min_disparity_), num_disparities(num_disparities_),
+              padded_disparities(paddedDisparities(num_disparities_))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            for (int y = range.start; y < range.end; ++y)
+            {
+                const uint64_t* l = left.ptr<uint64_t>(y);
+                const uint64_t* r = right.ptr<uint64_t>(y);
+                uchar*          c = cost.ptr<uchar>(y);
+                for (int x = 0; x < left.cols; ++x, c += padded_disparities)
+                {
+                    // xr = x - min_disparity - d is inside the right image for d in [first, last)
+                    const int first = std::min(std::max(x - min_disparity - right.cols + 1, 0), num_disparities);
+                    const int last  = std::max(std::min(x - min_disparity + 1, num_disparities), first);
+                    const uint64_t code = l[x];
+                    std::fill(c, c + first, static_cast<uchar>(max_cost));
+                    for (int d = first; d < last; ++d)
+                        c[d] = static_cast<uchar>(popCount64(code ^ r[x - min_disparity - d]));
+                    std::fill(c + last, c + padded_disparities, static_cast<uchar>(max_cost));
+                }
+            }
+        }
+
+        const cv::Mat& left;
+        const cv::Mat& right;
+        cv::Mat&       cost;
+        int            min_disparity;
+        int            num_disparities;
+        int            padded_disparities;
+    };
+
+    // L(p, d) = C(p, d) + min(L(p - r, d), L(p - r, d -+ 1) + P1, min_k L(p - r, k) + P2) - min_k L(p - r, k)
+    // Path cost buffers hold one blocked disparity on each side so that d - 1 and d + 1 are plain
+    // unaligned loads, D is the padded disparity count.
+    inline void updatePath(const uchar* c, const uint16_t* prev, uint16_t* cur, uint16_t prev_min, int D, uint16_t P1,
+                           uint16_t P2)
+    {
+#if CV_SIMD128
+        const cv::v_uint16x8 p1   = cv::v_setall_u16(P1);
+        const cv::v_uint16x8 jump = cv::v_setall_u16(static_cast<uint16_t>(std::min<int>(prev_min + P2, 0xffff)));
+        const cv::v_uint16x8 base = cv::v_setall_u16(prev_min);
+        for (int d = 0; d < D; d += 8)
+        {
+            const cv::v_uint16x8 same  = cv::v_load(prev + d + 1);
+            const cv::v_uint16x8 lower = cv::v_load(prev + d);
+            const cv::v_uint16x8 upper = cv::v_load(prev + d + 2);
+            const cv::v_uint16x8 best  = cv::v_min(cv::v_min(same, jump), cv::v_min(lower, upper) + p1);
+            cv::v_store(cur + d + 1, cv::v_load_expand(c + d) + (best - base));
+        }
+#else
+        const int jump = prev_min + P2;
+        for (int d = 0; d < D; ++d)
+        {
+            const int best = std::min(std::min<int>(prev[d + 1], jump), std::min(prev[d], prev[d + 2]) + P1);
+            cur[d + 1]     = static_cast<uint16_t>(c[d] + best - prev_min);
+        }
+#endif
+    }
+
+    // Starts a path, the first pixel's path cost is its matching cost
+    inline void startPath(const uchar* c, uint16_t* cur, int D)
+    {
+        for (int d = 0; d < D; ++d)
+            cur[d + 1] = c[d];
+    }
+
+    // Blocks the padding around the disparity range, adds the path costs into the sum and returns
+    // their minimum
+    inline uint16_t accumulatePath(uint16_t* cur, uint16_t* s, int num_disparities, int D)
+    {
+        cur[0] = blocked;
+        for (int d = num_disparities; d <= D; ++d)
+            cur[d + 1] = blocked;
+        const uint16_t* L = cur + 1;
+#if CV_SIMD128
+        cv::v_uint16x8 minimum = cv::v_setall_u16(0xffff);
+        for (int d = 0; d < D; d += 8)
+        {
+            const cv::v_uint16x8 l = cv::v_load(L + d);
+            minimum                = cv::v_min(minimum, l);
+            cv::v_store(s + d, cv::v_load(s + d) + l);
+        }
+        uint16_t lanes[8];
+        cv::v_store(lanes, minimum);
+        return *std::min_element(lanes, lanes + 8);
+#else
+        uint16_t minimum = 0xffff;
+        for (int d = 0; d < D; ++d)
+        {
+            minimum = std::min(minimum, L[d]);
+            s[d]    = static_cast<uint16_t>(std::min(s[d] + L[d], 0xffff));
+        }
+        return minimum;
+#endif
+    }
+
+    // Left to right or right to left, every row is a scanline and rows run in parallel
+    class RowPathBody : public cv::ParallelLoopBody
+    {
+    public:
+        RowPathBody(const cv::Mat& cost_, cv::Mat& sum_, int dx_, int num_disparities_, int P1_, int P2_)
+            : cost(cost_), sum(sum_), dx(dx_), num_disparities(num_disparities_),
+              padded_disparities(paddedDisparities(num_disparities_)), P1(static_cast<uint16_t>(P1_)),
+              P2(static_cast<uint16_t>(P2_))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int             D     = padded_disparities;
+            const int             width = cost.cols / D;
+            std::vector<uint16_t> buffer(2 * static_cast<size_t>(D + 2), blocked);
+            for (int y = range.start; y < range.end; ++y)
+            {
+                uint16_t* prev     = buffer.data();
+                uint16_t* cur      = prev + D + 2;
+                uint16_t  prev_min = 0;
+                for (int i = 0; i < width; ++i)
+                {
+                    const int    x = dx > 0 ? i : width - 1 - i;
+                    const uchar* c = cost.ptr<uchar>(y) + x * D;
+                    if (i == 0)
+                        startPath(c, cur, D);
+                    else
+                        updatePath(c, prev, cur, prev_min, D, P1, P2);
+                    prev_min = accumulatePath(cur, sum.ptr<uint16_t>(y) + x * D, num_disparities, D);
+                    std::swap(prev, cur);
+                }
+            }
+        }
+
+        const cv::Mat& cost;
+        cv::Mat&       sum;
+        int            dx;
+        int            num_disparities;
+        int            padded_disparities;
+        uint16_t       P1;
+        uint16_t       P2;
+    };
+
+    // Vertical and diagonal directions.  Scanlines are identified by k = x - dx * dy * y, every stripe of
+    // scanlines is swept row by row in the direction's row order so that the pixels of one step are
+    // adjacent in memory.  Stripes are independent and cover every pixel exactly once, so they run in
+    // parallel and add into the shared sum without synchronization.
+    class SweepBody : public cv::ParallelLoopBody
+    {
+    public:
+        SweepBody(const cv::Mat& cost_, cv::Mat& sum_, cv::Point step_, int k_min_, int lines_per_stripe_,
+                  int num_disparities_, int P1_, int P2_)
+            : cost(cost_), sum(sum_), step(step_), slope(step_.x * step_.y), k_min(k_min_), lines_per_stripe(lines_per_stripe_),
+              num_disparities(num_disparities_), padded_disparities(paddedDisparities(num_disparities_)),
+              P1(static_cast<uint16_t>(P1_)), P2(static_cast<uint16_t>(P2_))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int D      = padded_disparities;
+            const int width  = cost.cols / D;
+            const int height = cost.rows;
+            const size_t line = static_cast<size_t>(D + 2);
+            std::vector<uint16_t> buffers(2 * line * static_cast<size_t>(lines_per_stripe), blocked);
+            std::vector<uint16_t> minimums(static_cast<size_t>(lines_per_stripe));
+            for (int stripe = range.start; stripe < range.end; ++stripe)
+            {
+                const int k0   = k_min + stripe * lines_per_stripe;
+                uint16_t* prev = buffers.data();
+                uint16_t* cur  = prev + line * static_cast<size_t>(lines_per_stripe);
+                for (int i = 0; i < height; ++i)
+                {
+                    const int y  = step.y > 0 ? i : height - 1 - i;
+                    // x = k + dx * dy * y over the stripe, clipped to the row
+                    const int x0 = std::max(k0 + slope * y, 0);
+                    const int x1 = std::min(k0 + lines_per_stripe + slope * y, width);
+                    const uchar* c = cost.ptr<uchar>(y);
+                    uint16_t*    s = sum.ptr<uint16_t>(y);
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        const size_t j = static_cast<size_t>(x - slope * y - k0);
+                        const int    px = x - step.x;
+                        const int    py = y - step.y;
+                        if (px < 0 || px >= width || py < 0 || py >= height)
+                            startPath(c + x * D, cur + j * line, D);
+                        else
+                            updatePath(c + x * D, prev + j * line, cur + j * line, minimums[j], D, P1, P2);
+                        minimums[j] = accumulatePath(cur + j * line, s + x * D, num_disparities, D);
+                    }
+                    std::swap(prev, cur);
+                }
+            }
+        }
+
+        const cv::Mat& cost;
+        cv::Mat&       sum;
+        cv::Point      step;
+        int            slope;
+        int            k_min;
+        int            lines_per_stripe;
+        int            num_disparities;
+        int            padded_disparities;
+        uint16_t       P1;
+        uint16_t       P2;
+    };
+
+    // Winner takes all on the aggregated costs with uniqueness and left right checks and a parabola
+    // fit through the neighbouring costs.  Like cv::StereoSGBM the right disparity of a pixel is the
+    // best left match landing on it, which keeps the check linear in the width.
+    class SelectBody : public cv::ParallelLoopBody
+    {
+    public:
+        SelectBody(const cv::Mat& sum_, cv::Mat& disparity_, const SGMParams& params_)
+            : sum(sum_), disparity(disparity_), params(params_), padded_disparities(paddedDisparities(params_.num_disparities))
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int        D     = params.num_disparities;
+            const int        width = disparity.cols;
+            std::vector<int> best_of(static_cast<size_t>(width));
+            std::vector<int> right_best(static_cast<size_t>(width));
+            std::vector<int> right_cost(static_cast<size_t>(width));
+            for (int y = range.start; y < range.end; ++y)
+            {
+                const uint16_t* row = sum.ptr<uint16_t>(y);
+                float*          out = disparity.ptr<float>(y);
+                std::fill(right_cost.begin(), right_cost.end(), 0x7fffffff);
+                std::fill(right_best.begin(), right_best.end(), -1);
+                for (int x = 0; x < width; ++x)
+                {
+                    const uint16_t* s     = row + x * padded_disparities;
+                    const int       valid = std::min(D, x - params.min_disparity + 1);
+                    best_of[static_cast<size_t>(x)] = -1;
+                    out[x]                          = SemiGlobalMatcher::invalid();
+                    if (valid <= 0)
+                        continue;
+                    int best = 0;
+                    int cost = s[0];
+                    for (int d = 1; d < valid; ++d)
+                    {
+                        if (s[d] < cost)
+                        {
+                            cost = s[d];
+                            best = d;
+                        }
+                    }
+                    // Runner up away from the best disparity
+                    int runner_up = 0xffff;
+                    for (int d = 0; d < best - 1; ++d)
+                        runner_up = std::min<int>(runner_up, s[d]);
+                    for (int d = best + 2; d < valid; ++d)
+                        runner_up = std::min<int>(runner_up, s[d]);
+                    if (runner_up * (100 - params.uniqueness_ratio) < cost * 100)
+                        continue;
+                    const size_t xr = static_cast<size_t>(x - params.min_disparity - best);
+                    if (cost < right_cost[xr])
+                    {
+                        right_cost[xr] = cost;
+                        right_best[xr] = best;
+                    }
+                    best_of[static_cast<size_t>(x)] = best;
+                    float value = static_cast<float>(best);
+                    if (params.subpixel && best > 0 && best < valid - 1)
+                    {
+                        const int denominator = s[best - 1] + s[best + 1] - 2 * cost;
+                        if (denominator > 0)
+                            value += static_cast<float>(s[best - 1] - s[best + 1]) / (2.0f * denominator);
+                    }
+                    out[x] = value + params.min_disparity;
+                }
+                if (params.disp12_max_diff < 0)
+                    continue;
+                for (int x = 0; x < width; ++x)
+                {
+                    const int best = best_of[static_cast<size_t>(x)];
+                    if (best < 0)
+                        continue;
+                    const size_t xr = static_cast<size_t>(x - params.min_disparity - best);
+                    if (std::abs(right_best[xr] - best) > params.disp12_max_diff)
+                        out[x] = SemiGlobalMatcher::invalid();
+                }
+            }
+        }
+
+        const cv::Mat&   sum;
+        cv::Mat&         disparity;
+        const SGMParams& params;
+        int              padded_disparities;
+    };
+
+    void toGrey(const cv::Mat& src, cv::Mat& grey)
+    {
+        cv::Mat tmp = src;
+        if (src.channels() == 3)
+            cv::cvtColor(src, tmp, cv::COLOR_BGR2GRAY);
+        else if (src.channels() == 4)
+            cv::cvtColor(src, tmp, cv::COLOR_BGRA2GRAY);
+        if (tmp.depth() != CV_8U)
+            tmp.convertTo(tmp, CV_8U);
+        grey = tmp;
+    }
+
+    void census(const cv::Mat& image, cv::Mat& codes)
+    {
+        cv::Mat grey, padded;
+        toGrey(image, grey);
+        cv::copyMakeBorder(grey, padded, census_ry, census_ry, census_rx, census_rx, cv::BORDER_REPLICATE);
+        // 8 byte codes, there is no 64 bit unsigned Mat type
+        codes.create(grey.size(), CV_64FC1);
+        cv::parallel_for_(cv::Range(0, grey.rows), CensusBody(padded, codes));
+    }
+
+    class MedianBody : public cv::ParallelLoopBody
+    {
+    public:
+        MedianBody(const cv::Mat& src_, const cv::Mat& guide_, cv::Mat& dst_, int radius_, const std::vector<float>& weights_)
+            : src(src_), guide(guide_), dst(dst_), radius(radius_), weights(weights_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int                           cn = guide.channels();
+            std::vector<std::pair<float, float>> samples;
+            samples.reserve(static_cast<size_t>((2 * radius + 1) * (2 * radius + 1)));
+            for (int y = range.start; y < range.end; ++y)
+            {
+                float* out = dst.ptr<float>(y);
+                for (int x = 0; x < src.cols; ++x)
+                {
+                    const uchar* center = guide.ptr<uchar>(y) + x * cn;
+                    samples.clear();
+                    float total = 0.0f;
+                    for (int v = std::max(y - radius, 0); v <= std::min(y + radius, src.rows - 1); ++v)
+                    {
+                        const float* d = src.ptr<float>(v);
+                        const uchar* g = guide.ptr<uchar>(v);
+                        for (int u = std::max(x - radius, 0); u <= std::min(x + radius, src.cols - 1); ++u)
+                        {
+                            if (d[u] < 0.0f)
+                                continue;
+                            int diff = 0;
+                            for (int c = 0; c < cn; ++c)
+                                diff += std::abs(g[u * cn + c] - center[c]);
+                            const float w = weights[static_cast<size_t>(diff / cn)];
+                            samples.push_back(std::make_pair(d[u], w));
+                            total += w;
+                        }
+                    }
+                    if (samples.empty() || total <= 0.0f)
+                    {
+                        out[x] = src.ptr<float>(y)[x];
+                        continue;
+                    }
+                    std::sort(samples.begin(), samples.end());
+                    float acc = 0.0f;
+                    size_t i  = 0;
+                    for (; i + 1 < samples.size(); ++i)
+                    {
+                        acc += samples[i].second;
+                        if (acc >= total * 0.5f)
+                            break;
+                    }
+                    out[x] = samples[i].first;
+                }
+            }
+        }
+
+        const cv::Mat&            src;
+        const cv::Mat&            guide;
+        cv::Mat&                  dst;
+        int                       radius;
+        const std::vector<float>& weights;
+    };
+}
+
+void SemiGlobalMatcher::compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity, const SGMParams& params)
+{
+    CV_Assert(left.size() == right.size() && params.num_disparities > 0);
+    const int D = paddedDisparities(params.num_disparities);
+    census(left, m_census_left);
+    census(right, m_census_right);
+
+    m_cost.create(left.rows, left.cols * D, CV_8UC1);
+    cv::parallel_for_(cv::Range(0, left.rows),
+                      CostBody(m_census_left, m_census_right, m_cost, params.min_disparity, params.num_disparities));
+
+    m_sum.create(left.rows, left.cols * D, CV_16UC1);
+    m_sum.setTo(cv::Scalar::all(0));
+    const int P1 = std::max(params.P1, 0);
+    const int P2 = std::max(params.P2, P1 + 1);
+    for (int dx = -1; dx <= 1; dx += 2)
+        cv::parallel_for_(cv::Range(0, left.rows), RowPathBody(m_cost, m_sum, dx, params.num_disparities, P1, P2));
+    const cv::Point sweeps[] = {cv::Point(0, 1), cv::Point(0, -1), cv::Point(1, 1), cv::Point(-1, 1),
+                                cv::Point(1, -1), cv::Point(-1, -1)};
+    const int lines_per_stripe = 32;
+    for (const cv::Point& step : sweeps)
+    {
+        // Range of k = x - dx * dy * y over the image
+        const int slope   = step.x * step.y;
+        const int k_min   = std::min(0, -slope * (left.rows - 1));
+        const int k_max   = std::max(left.cols - 1, left.cols - 1 - slope * (left.rows - 1));
+        const int stripes = (k_max - k_min + lines_per_stripe) / lines_per_stripe;
+        cv::parallel_for_(cv::Range(0, stripes),
+                          SweepBody(m_cost, m_sum, step, k_min, lines_per_stripe, params.num_disparities, P1, P2));
+    }
+
+    disparity.create(left.size(), CV_32FC1);
+    cv::parallel_for_(cv::Range(0, left.rows), SelectBody(m_sum, disparity, params));
+}
+
+void stereo::refineDisparity(const cv::Mat& disparity, const cv::Mat& guide, cv::Mat& refined, int radius,
+                             float sigma_color, int iterations)
+{
+    CV_Assert(disparity.type() == CV_32FC1 && guide.size() == disparity.size());
+    CV_Assert(guide.type() == CV_8UC1 || guide.type() == CV_8UC3);
+    std::vector<float> weights(256);
+    for (int i = 0; i < 256; ++i)
+        weights[static_cast<size_t>(i)] = std::exp(-static_cast<float>(i) / std::max(sigma_color, 1e-3f));
+    cv::Mat src = disparity;
+    for (int i = 0; i < std::max(iterations, 1); ++i)
+    {
+        cv::Mat dst(src.size(), CV_32FC1);
+        cv::parallel_for_(cv::Range(0, src.rows), MedianBody(src, guide, dst, std::max(radius, 1), weights));
+        src = dst;
+    }
+    refined = src;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+namespace aq
+{
+namespace stereo
+{
+    struct SGMParams
+    {
+        int   min_disparity    = 0;
+        int   num_disparities  = 64;
+        // Penalties for disparity changes of one and of more than one pixel between neighbours, in
+        // units of the census cost which is the number of differing bits of a 9 x 7 census, 0 to 62
+        int   P1               = 10;
+        int   P2               = 120;
+        // Percentage the best cost has to beat any non neighbouring disparity by
+        int   uniqueness_ratio = 10;
+        // Allowed difference between the left and the right disparity, negative disables the check
+        int   disp12_max_diff  = 1;
+        bool  subpixel         = true;
+    };
+
+    // Semi-global matching (Hirschmueller 2008) on rectified grey images.  Census matching costs are
+    // aggregated along 8 paths, every path direction runs its scanlines in parallel and the recurrence
+    // is vectorized over the disparities.  Buffers are kept between calls of the same size.
+    class SemiGlobalMatcher
+    {
+    public:
+        // disparity is CV_32F in pixels, pixels without a reliable match are set to invalid()
+        void compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity, const SGMParams& params);
+
+        static float invalid() { return -1.0f; }
+
+    private:
+        cv::Mat m_census_left;
+        cv::Mat m_census_right;
+        cv::Mat m_cost;
+        cv::Mat m_sum;
+    };
+
+    // Edge aware refinement: every pixel becomes the weighted median of the disparities around it,
+    // weighted by the colour similarity of the guide image, which removes speckles and fills invalid
+    // (negative) pixels without smearing depth across object boundaries.  disparity is CV_32F, guide is
+    // CV_8UC1 or CV_8UC3 of the same size.
+    void refineDisparity(const cv::Mat& disparity, const cv::Mat& guide, cv::Mat& refined, int radius = 3,
+                         float sigma_color = 10.0f, int iterations = 1);
+}
+}
@@ -17,6 +17,22 @@ RUNTIME_COMPILER_LINKLIBRARY("-lopencv_cudastereo")
 using namespace aq;
 using namespace aq::nodes;
 
+namespace
+{
+    // Guide images of the host refinement are 8 bit grey or BGR
+    cv::Mat hostGuide(const cv::Mat& image)
+    {
+        cv::Mat guide = image;
+        if (guide.depth() != CV_8U)
+            guide.convertTo(guide, CV_8U);
+        if (guide.channels() == 4)
+            cv::cvtColor(guide, guide, cv::COLOR_BGRA2BGR);
+        else if (guide.channels() == 2)
+            cv::extractChannel(guide, guide, 0);
+        return guide;
+    }
+}
+
 
 bool StereoBM::processImpl()
 {
@@ -61,6 +77,75 @@ bool StereoBeliefPropagation::processImpl()
 
 
 
+bool StereoSGM::processImpl()
+{
+    if (left_image->getSize() != right_image->getSize())
+    {
+        MO_LOG(debug) << "Images are of mismatched size";
+        return false;
+    }
+    stereo::SGMParams params;
+    params.min_disparity = std::max(min_disparity, 0);
+    params.num_disparities = std::max(num_disparities, 1);
+    params.P1 = P1;
+    params.P2 = P2;
+    params.uniqueness_ratio = uniqueness_ratio;
+    params.disp12_max_diff = disp12_max_diff;
+    params.subpixel = subpixel;
+    const cv::Mat left = left_image->getMat(stream());
+    cv::Mat disparity;
+    sgm.compute(left, right_image->getMat(stream()), disparity, params);
+    if (edge_aware_refinement)
+    {
+        stereo::refineDisparity(disparity, hostGuide(left), disparity, refinement_radius, refinement_sigma);
+    }
+    this->disparity_param.updateData(disparity, left_image_param.getTimestamp(), _ctx.get());
+    return true;
+}
+
+bool StereoBilateralFilter::processImpl()
+{
+    if (disparity->getSize() != image->getSize())
+    {
+        MO_LOG(debug) << "Disparity and image are of mismatched size";
+        return false;
+    }
+    if (disparity->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        // Weighted median on float disparities, integer disparities go through it and back
+        const cv::Mat input = disparity->getMat(stream());
+        cv::Mat disp = input;
+        if (input.type() != CV_32FC1)
+            input.convertTo(disp, CV_32F);
+        cv::Mat refined;
+        stereo::refineDisparity(disp, hostGuide(image->getMat(stream())), refined, radius, sigma_range, iterations);
+        if (input.type() != CV_32FC1)
+            refined.convertTo(refined, input.type());
+        filtered_param.updateData(refined, disparity_param.getTimestamp(), _ctx.get());
+        return true;
+    }
+    if (!filter || num_disparities_param.modified() || radius_param.modified() || iterations_param.modified())
+    {
+        filter = cv::cuda::createDisparityBilateralFilter(num_disparities, radius, iterations);
+        num_disparities_param.modified(false);
+        radius_param.modified(false);
+        iterations_param.modified(false);
+    }
+    filter->setSigmaRange(sigma_range);
+    // The cuda filter only takes integer disparities
+    cv::cuda::GpuMat disp = disparity->getGpuMat(stream());
+    if (disp.type() != CV_8UC1 && disp.type() != CV_16SC1)
+    {
+        cv::cuda::GpuMat converted;
+        disp.convertTo(converted, CV_16S, stream());
+        disp = converted;
+    }
+    cv::cuda::GpuMat filtered;
+    filter->apply(disp, image->getGpuMat(stream()), filtered, stream());
+    filtered_param.updateData(filtered, disparity_param.getTimestamp(), _ctx.get());
+    return true;
+}
+
 /*void StereoConstantSpaceBP::nodeInit(bool firstInit)
 {
     if(firstInit)
@@ -123,6 +208,7 @@ bool UndistortStereo::processImpl()
 
 
 MO_REGISTER_CLASS(StereoBM)
+MO_REGISTER_CLASS(StereoSGM)
 MO_REGISTER_CLASS(StereoBilateralFilter)
 MO_REGISTER_CLASS(StereoBeliefPropagation)
 MO_REGISTER_CLASS(StereoConstantSpaceBP)
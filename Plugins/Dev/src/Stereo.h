@@ -7,6 +7,7 @@
 #include "opencv2/cudastereo.hpp"
 #include <opencv2/imgproc.hpp>
 #include "Aquila/utilities/cuda/CudaUtils.hpp"
+#include "SemiGlobalMatching.hpp"
 namespace aq
 {
     namespace nodes
@@ -31,14 +32,45 @@ namespace aq
         bool processImpl();
         cv::Ptr<cv::cuda::StereoBM> stereoBM;
     };
+    // Host semi-global matching, disparity is CV_32F in pixels with -1 where there is no reliable match
+    class StereoSGM: public StereoBase
+    {
+    public:
+        MO_DERIVE(StereoSGM, StereoBase)
+            PARAM(int, min_disparity, 0)
+            PARAM(int, P1, 10)
+            TOOLTIP(P1, "Penalty for a disparity change of one pixel, census costs range from 0 to 62")
+            PARAM(int, P2, 120)
+            TOOLTIP(P2, "Penalty for larger disparity changes")
+            PARAM(int, uniqueness_ratio, 10)
+            PARAM(int, disp12_max_diff, 1)
+            TOOLTIP(disp12_max_diff, "Allowed left right disparity difference, negative disables the check")
+            PARAM(bool, subpixel, true)
+            PARAM(bool, edge_aware_refinement, false)
+            TOOLTIP(edge_aware_refinement, "Weighted median of the disparity guided by the left image, same as StereoBilateralFilter on the host")
+            PARAM(int, refinement_radius, 3)
+            PARAM(float, refinement_sigma, 10.0f)
+        MO_END
+    protected:
+        bool processImpl();
+        stereo::SemiGlobalMatcher sgm;
+    };
+
     class StereoBilateralFilter: public Node
     {
     public:
         MO_DERIVE(StereoBilateralFilter, Node)
-
+            INPUT(SyncedMemory, disparity, nullptr)
+            INPUT(SyncedMemory, image, nullptr)
+            PARAM(int, num_disparities, 64)
+            PARAM(int, radius, 3)
+            PARAM(int, iterations, 1)
+            PARAM(float, sigma_range, 10.0f)
+            OUTPUT(SyncedMemory, filtered, SyncedMemory())
         MO_END
     protected:
-        bool processImpl(){return false;}
+        bool processImpl();
+        cv::Ptr<cv::cuda::DisparityBilateralFilter> filter;
     };
 
     class StereoBeliefPropagation: public StereoBase
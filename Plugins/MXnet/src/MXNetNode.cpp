@@ -1,6 +1,7 @@
 #include "MXNetNode.hpp"
 #include "MXNetHandler.hpp"
 #include <Aquila/nodes/NodeInfo.hpp>
+#include <ModelRegistry.hpp>
 #include <MetaObject/logging/profiling.hpp>
 #include <MetaObject/thread/boost_thread.hpp>
 #include <mxnet-cpp/executor.hpp>
@@ -23,6 +24,35 @@
 
 using namespace aq;
 using namespace aq::nodes;
+
+namespace aq {
+struct MXNetWeights {
+    std::map<std::string, mxnet::cpp::NDArray> args;
+    std::map<std::string, mxnet::cpp::NDArray> aux;
+};
+}
+
+namespace {
+std::shared_ptr<MXNetWeights> loadWeights(const std::string& weight_file) {
+    auto                                       gpu_ctx = mxnet::cpp::Context::gpu();
+    auto                                       weights = std::make_shared<MXNetWeights>();
+    std::map<std::string, mxnet::cpp::NDArray> parameters;
+    mxnet::cpp::NDArray::Load(weight_file, 0, &parameters);
+    // upload weights to the GPU... Why is this not automatic? -_-
+    for (const auto& k : parameters) {
+        if (k.first.substr(0, 4) == "aux:") {
+            auto name          = k.first.substr(4, k.first.size() - 4);
+            weights->aux[name] = k.second.Copy(gpu_ctx); // copy to gpu
+        }
+        if (k.first.substr(0, 4) == "arg:") {
+            auto name           = k.first.substr(4, k.first.size() - 4);
+            weights->args[name] = k.second.Copy(gpu_ctx);
+        }
+    }
+    mxnet::cpp::NDArray::WaitAll();
+    return weights;
+}
+}
 // opencv uses BGR ordering, mxnet uses RGB
 std::vector<std::vector<cv::Mat> > aq::wrapInput(mxnet::cpp::NDArray& arr, bool swap_rgb) {
     std::vector<std::vector<cv::Mat> > output;
@@ -97,6 +127,26 @@ bool MXNet::processImpl() {
         label_file_param.modified(false);
     }
     unsigned int batch_size = 5;
+    // Weights are shared with every other MXNet node running the same model, a new
+    // shared copy (hot-swapped weight file) requires rebinding the executor.  Acquired again
+    // when the files change, otherwise only once per check interval.
+    const bool weights_changed = model_file_param.modified() || weight_file_param.modified() || !_weights;
+    if (_weight_poll.due(weights_changed) && boost::filesystem::exists(model_file) && boost::filesystem::exists(weight_file)) {
+        std::shared_ptr<MXNetWeights> weights;
+        try {
+            weights = ModelRegistry::instance().acquire(ModelRegistry::Key{ model_file.string(), weight_file.string(), "mxnet" },
+                std::function<std::shared_ptr<MXNetWeights>()>(std::bind(&loadWeights, weight_file.string())));
+        } catch (...) {
+            MO_LOG(ERROR) << "Unable to load weights from '" << weight_file.string() << "' " << MXGetLastError();
+            return false;
+        }
+        model_file_param.modified(false);
+        weight_file_param.modified(false);
+        if (weights != _weights) {
+            _weights = weights;
+            _executor.reset();
+        }
+    }
     if (!_executor || bounding_boxes_param.modified()) {
         if (!boost::filesystem::exists(model_file)) {
             BOOST_LOG_TRIVIAL(warning) << "Model file '" << model_file.string() << "' does not exist!";
@@ -113,19 +163,9 @@ bool MXNet::processImpl() {
         const char** out_names;
         MXListAllOpNames(&num_ops, &out_names); // https://github.com/dmlc/mxnet/pull/4537
 
-        std::map<std::string, mxnet::cpp::NDArray> parameters;
-        mxnet::cpp::NDArray::Load(weight_file.string(), 0, &parameters);
-        // upload weights to the GPU... Why is this not automatic? -_-
-        for (const auto& k : parameters) {
-            if (k.first.substr(0, 4) == "aux:") {
-                auto name      = k.first.substr(4, k.first.size() - 4);
-                _aux_map[name] = k.second.Copy(gpu_ctx); // copy to gpu
-            }
-            if (k.first.substr(0, 4) == "arg:") {
-                auto name       = k.first.substr(4, k.first.size() - 4);
-                _args_map[name] = k.second.Copy(gpu_ctx);
-            }
-        }
+        // NDArray copies are handles, the executor binds to the shared gpu weights
+        _args_map = _weights->args;
+        _aux_map  = _weights->aux;
         mxnet::cpp::Symbol sym = mxnet::cpp::Symbol::Load(model_file.string());
         std::map<std::string, std::vector<mx_uint> > arg_shapes;
         std::vector<std::vector<mx_uint> > in_shape = { { batch_size, 3, network_height, network_width } };
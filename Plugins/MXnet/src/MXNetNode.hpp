@@ -5,6 +5,7 @@
 #include <Aquila/types/SyncedMemory.hpp>
 #include <MetaObject/params/Types.hpp>
 #include <MetaObject/params/detail/TInputParamPtrImpl.hpp>
+#include <ModelRegistry.hpp>
 #define DMLC_USE_CXX11 1
 #define MXNET_USE_CUDA 1
 #define MSHADOW_USE_CBLAS 1
@@ -15,6 +16,7 @@
 
 namespace aq {
 class MXNetHandler;
+struct MXNetWeights;
 std::vector<std::vector<cv::Mat> > wrapInput(mxnet::cpp::NDArray& arr, bool swap_rgb = true);
 std::vector<std::vector<cv::cuda::GpuMat> > wrapInputGpu(mxnet::cpp::NDArray& arr, bool swap_rgb = true);
 cv::Mat wrapOutput(mxnet::cpp::NDArray& arr);
@@ -48,6 +50,8 @@ namespace nodes {
         std::map<std::string, mxnet::cpp::NDArray> _inputs;
         mxnet::cpp::NDArray                         _gpu_buffer;
         std::vector<rcc::shared_ptr<MXNetHandler> > _handlers;
+        std::shared_ptr<MXNetWeights>               _weights;
+        ModelRegistry::Poll                         _weight_poll;
     }; // class MXNet
 
 } // namespace aq::nodes
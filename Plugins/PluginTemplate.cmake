@@ -168,6 +168,70 @@ macro(aquila_declare_plugin tgt)
     LINK_DIRECTORIES(${LINK_DIRS_RELEASE})
     LINK_DIRECTORIES(${LINK_DIRS})
 
+    # ============= Static variant for GraphExecutorStatic, the shared plugin above stays as it is
+    if(EAGLEEYE_STATIC_PLUGINS)
+        list(FIND EAGLEEYE_STATIC_PLUGIN_LIST ${tgt} static_index_)
+        if(NOT static_index_ EQUAL -1)
+            get_target_property(plugin_sources_ ${tgt} SOURCES)
+            add_library(${tgt}_static STATIC ${plugin_sources_})
+            set_target_properties(${tgt}_static PROPERTIES
+                FOLDER Plugins
+                ARCHIVE_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/lib/static_plugins
+            )
+            get_target_property(plugin_include_dirs_ ${tgt} INCLUDE_DIRECTORIES)
+            get_target_property(plugin_interface_dirs_ ${tgt} INTERFACE_INCLUDE_DIRECTORIES)
+            get_target_property(plugin_definitions_ ${tgt} COMPILE_DEFINITIONS)
+            set_target_properties(${tgt}_static PROPERTIES
+                INCLUDE_DIRECTORIES "${plugin_include_dirs_}"
+                INTERFACE_INCLUDE_DIRECTORIES "${plugin_interface_dirs_}"
+            )
+            if(plugin_definitions_)
+                set_target_properties(${tgt}_static PROPERTIES COMPILE_DEFINITIONS "${plugin_definitions_}")
+            endif()
+            # Public so that the plugins built on top of this one also see the static export header
+            target_compile_definitions(${tgt}_static PUBLIC ${tgt}_STATIC)
+
+            # Other static plugins are linked as their static variant, a shared one would register its classes twice
+            get_target_property(plugin_link_libs_ ${tgt} LINK_LIBRARIES)
+            set(static_link_libs_)
+            foreach(lib_ ${plugin_link_libs_})
+                list(FIND EAGLEEYE_STATIC_PLUGIN_LIST "${lib_}" lib_index_)
+                if(NOT lib_index_ EQUAL -1)
+                    list(APPEND static_link_libs_ ${lib_}_static)
+                else()
+                    if(TARGET ${lib_})
+                        get_target_property(lib_folder_ ${lib_} FOLDER)
+                        if(lib_folder_ STREQUAL "Plugins")
+                            message(WARNING "${tgt} is linked statically but depends on the shared plugin ${lib_}, add it to EAGLEEYE_STATIC_PLUGIN_LIST")
+                        endif()
+                    endif()
+                    list(APPEND static_link_libs_ ${lib_})
+                endif()
+            endforeach()
+            if(static_link_libs_)
+                target_link_libraries(${tgt}_static ${static_link_libs_})
+            endif()
+
+            # Table of the classes registered by the plugin for GraphExecutorStatic to check after startup
+            set(plugin_classes_)
+            foreach(source_ ${plugin_sources_})
+                if(source_ MATCHES "\\.(cpp|cu)$" AND EXISTS "${CMAKE_CURRENT_LIST_DIR}/${source_}")
+                    set(source_ "${CMAKE_CURRENT_LIST_DIR}/${source_}")
+                endif()
+                if(source_ MATCHES "\\.(cpp|cu)$" AND EXISTS "${source_}")
+                    file(STRINGS "${source_}" registrations_ REGEX "^[ \t]*MO_REGISTER_CLASS\\([A-Za-z0-9_:]+\\)")
+                    foreach(registration_ ${registrations_})
+                        string(REGEX REPLACE "^[ \t]*MO_REGISTER_CLASS\\(([A-Za-z0-9_:]+)\\).*$" "\\1" class_ "${registration_}")
+                        string(REGEX REPLACE "^.*::" "" class_ "${class_}")
+                        list(APPEND plugin_classes_ ${class_})
+                    endforeach()
+                endif()
+            endforeach()
+            set_property(GLOBAL APPEND PROPERTY EAGLEEYE_STATIC_PLUGIN_TARGETS ${tgt})
+            set_property(GLOBAL PROPERTY EAGLEEYE_STATIC_PLUGIN_CLASSES_${tgt} ${plugin_classes_})
+        endif()
+    endif()
+
     # ============= Write out a file containing external include info
 
     set(external_include_file "#pragma once\n\n#include \"RuntimeObjectSystem/RuntimeLinkLibrary.h\"\n\n")
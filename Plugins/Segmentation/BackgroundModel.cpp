@@ -0,0 +1,344 @@
+#include "BackgroundModel.hpp"
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace aq;
+using namespace aq::bgsegm;
+
+namespace
+{
+    const int max_mixtures = 8;
+    const int max_channels = 4;
+
+    // The mixture kernel is written once against these and runs on single pixels and on vectors
+    struct ScalarLanes
+    {
+        typedef float V;
+        typedef bool  M;
+        static const int lanes = 1;
+
+        static V    load(const float* ptr) { return *ptr; }
+        static void store(float* ptr, V v) { *ptr = v; }
+        static V    all(float v) { return v; }
+        static V    select(M m, V a, V b) { return m ? a : b; }
+        static M    lt(V a, V b) { return a < b; }
+        static M    le(V a, V b) { return a <= b; }
+        static M    gt(V a, V b) { return a > b; }
+        static M    eq(V a, V b) { return a == b; }
+        static M    both(M a, M b) { return a && b; }
+        static M    either(M a, M b) { return a || b; }
+        static M    invert(M a) { return !a; }
+        static M    none() { return false; }
+        static V    clamp(V v, float lo, float hi) { return std::min(std::max(v, lo), hi); }
+    };
+
+#if CV_SIMD128
+    struct VectorLanes
+    {
+        typedef cv::v_float32x4 V;
+        typedef cv::v_float32x4 M;
+        static const int lanes = 4;
+
+        static V    load(const float* ptr) { return cv::v_load(ptr); }
+        static void store(float* ptr, V v) { cv::v_store(ptr, v); }
+        static V    all(float v) { return cv::v_setall_f32(v); }
+        static V    select(M m, V a, V b) { return cv::v_select(m, a, b); }
+        static M    lt(V a, V b) { return a < b; }
+        static M    le(V a, V b) { return a <= b; }
+        static M    gt(V a, V b) { return a > b; }
+        static M    eq(V a, V b) { return a == b; }
+        static M    both(M a, M b) { return a & b; }
+        static M    either(M a, M b) { return a | b; }
+        static M    invert(M a) { return ~a; }
+        static M    none() { return cv::v_setzero_f32(); }
+        static V    clamp(V v, float lo, float hi) { return cv::v_min(cv::v_max(v, cv::v_setall_f32(lo)), cv::v_setall_f32(hi)); }
+    };
+#endif
+
+    // Per frame constants of the update
+    struct Rates
+    {
+        float alpha;
+        float alpha1;
+        float prune;
+        bool  update;
+    };
+
+    // Plane layout of one model row: weights, variances, then the means of every mode and channel,
+    // each plane one row of the image wide
+    struct RowPlanes
+    {
+        float* weight[max_mixtures];
+        float* variance[max_mixtures];
+        float* mean[max_mixtures][max_channels];
+    };
+
+    template <class L>
+    void mixtureKernel(const float* const* data, const RowPlanes& planes, int x, int mixtures, int channels,
+                       const MOG2Params& params, const Rates& rates, float* result)
+    {
+        typedef typename L::V V;
+        typedef typename L::M M;
+        const V zero = L::all(0.0f);
+
+        V d[max_channels];
+        for (int c = 0; c < channels; ++c)
+            d[c] = L::load(data[c] + x);
+        V w[max_mixtures], var[max_mixtures], m[max_mixtures][max_channels], dist[max_mixtures];
+        for (int k = 0; k < mixtures; ++k)
+        {
+            w[k]    = L::load(planes.weight[k] + x);
+            var[k]  = L::load(planes.variance[k] + x);
+            dist[k] = zero;
+            for (int c = 0; c < channels; ++c)
+            {
+                m[k][c]       = L::load(planes.mean[k][c] + x);
+                const V diff  = m[k][c] - d[c];
+                dist[k]       = dist[k] + diff * diff;
+            }
+        }
+
+        // Weight of the modes ranked above each mode, ties go to the lower index
+        V above[max_mixtures];
+        for (int k = 0; k < mixtures; ++k)
+        {
+            above[k] = zero;
+            for (int j = 0; j < mixtures; ++j)
+            {
+                if (j == k)
+                    continue;
+                const M higher = j < k ? L::le(w[k], w[j]) : L::lt(w[k], w[j]);
+                above[k]       = above[k] + L::select(higher, w[j], zero);
+            }
+        }
+
+        // The highest ranked mode close enough to take the pixel
+        V matched_weight = L::all(-1.0f);
+        V matched        = L::all(-1.0f);
+        for (int k = 0; k < mixtures; ++k)
+        {
+            const M fits   = L::both(L::both(L::gt(w[k], zero), L::lt(dist[k], var[k] * L::all(params.var_threshold_gen))),
+                                     L::gt(w[k], matched_weight));
+            matched_weight = L::select(fits, w[k], matched_weight);
+            matched        = L::select(fits, L::all(static_cast<float>(k)), matched);
+        }
+
+        // Background when one of the background modes ranked up to the match explains the pixel
+        const V ratio      = L::all(params.background_ratio);
+        M       background = L::none();
+        M       shadow     = background;
+        for (int k = 0; k < mixtures; ++k)
+        {
+            const V index   = L::all(static_cast<float>(k));
+            const M ranked  = L::either(L::gt(w[k], matched_weight), L::both(L::eq(w[k], matched_weight), L::le(index, matched)));
+            const M in_bg   = L::both(L::gt(w[k], zero), L::lt(above[k], ratio));
+            const M explain = L::lt(dist[k], var[k] * L::all(params.var_threshold));
+            background      = L::either(background, L::both(L::both(ranked, in_bg), explain));
+            if (params.detect_shadows)
+            {
+                // A darker version of a background mode, d = a * mean with tau <= a <= 1
+                V numerator = zero, denominator = zero;
+                for (int c = 0; c < channels; ++c)
+                {
+                    numerator   = numerator + m[k][c] * d[c];
+                    denominator = denominator + m[k][c] * m[k][c];
+                }
+                const M valid = L::gt(denominator, zero);
+                const V a     = numerator / L::select(valid, denominator, L::all(1.0f));
+                V       error = zero;
+                for (int c = 0; c < channels; ++c)
+                {
+                    const V diff = a * m[k][c] - d[c];
+                    error        = error + diff * diff;
+                }
+                const M darker = L::both(L::both(valid, L::le(a, L::all(1.0f))), L::le(L::all(params.shadow_threshold), a));
+                const M close  = L::lt(error, var[k] * L::all(params.var_threshold) * a * a);
+                shadow         = L::either(shadow, L::both(L::both(L::gt(w[k], zero), L::le(above[k], ratio)), L::both(darker, close)));
+            }
+        }
+        const V foreground = L::select(L::both(shadow, L::invert(background)), L::all(params.shadow_value), L::all(255.0f));
+        L::store(result, L::select(background, zero, foreground));
+
+        if (!rates.update)
+            return;
+
+        const V alpha  = L::all(rates.alpha);
+        const V alpha1 = L::all(rates.alpha1);
+        const V prune  = L::all(rates.prune);
+        V       total  = zero;
+        for (int k = 0; k < mixtures; ++k)
+        {
+            const M is_match = L::eq(matched, L::all(static_cast<float>(k)));
+            V       weight   = alpha1 * w[k] + prune + L::select(is_match, alpha, zero);
+            // Learning rate of the matched mode's mean and variance
+            const V rate = L::select(is_match, alpha / L::select(is_match, weight, L::all(1.0f)), zero);
+            for (int c = 0; c < channels; ++c)
+                m[k][c] = m[k][c] + rate * (d[c] - m[k][c]);
+            V v    = var[k] + rate * (dist[k] - var[k]);
+            var[k] = L::select(is_match, L::clamp(v, params.var_min, params.var_max), var[k]);
+            weight = L::select(L::lt(weight, zero - prune), zero, weight);
+            w[k]   = weight;
+            total  = total + weight;
+        }
+        const V scale = L::all(1.0f) / L::select(L::gt(total, zero), total, L::all(1.0f));
+        for (int k = 0; k < mixtures; ++k)
+            w[k] = w[k] * scale;
+
+        // Unexplained pixels replace the weakest mode, ties go to the lower index
+        const M unmatched = L::both(L::lt(matched, zero), L::gt(alpha, zero));
+        V       weakest   = L::all(0.0f);
+        V       weakest_w = w[0];
+        for (int k = 1; k < mixtures; ++k)
+        {
+            const M lower = L::lt(w[k], weakest_w);
+            weakest       = L::select(lower, L::all(static_cast<float>(k)), weakest);
+            weakest_w     = L::select(lower, w[k], weakest_w);
+        }
+        const V others     = L::select(L::gt(total, zero), L::all(1.0f) - weakest_w, zero);
+        const V new_weight = L::select(L::gt(others, zero), alpha, L::all(1.0f));
+        for (int k = 0; k < mixtures; ++k)
+        {
+            const M replace = L::both(unmatched, L::eq(weakest, L::all(static_cast<float>(k))));
+            const M keep    = L::both(unmatched, L::invert(replace));
+            w[k]            = L::select(replace, new_weight, L::select(keep, w[k] * alpha1, w[k]));
+            var[k]          = L::select(replace, L::all(params.var_init), var[k]);
+            for (int c = 0; c < channels; ++c)
+                m[k][c] = L::select(replace, d[c], m[k][c]);
+
+            L::store(planes.weight[k] + x, w[k]);
+            L::store(planes.variance[k] + x, var[k]);
+            for (int c = 0; c < channels; ++c)
+                L::store(planes.mean[k][c] + x, m[k][c]);
+        }
+    }
+
+    class MixtureBody : public cv::ParallelLoopBody
+    {
+    public:
+        MixtureBody(const cv::Mat& image_, cv::Mat& model_, cv::Mat& mask_, int mixtures_, const MOG2Params& params_,
+                    const Rates& rates_)
+            : image(image_), model(model_), mask(mask_), mixtures(mixtures_), params(params_), rates(rates_)
+        {
+        }
+
+        void operator()(const cv::Range& range) const
+        {
+            const int          width    = image.cols;
+            const int          channels = image.channels();
+            std::vector<float> buffer(static_cast<size_t>(width) * (channels + 1));
+            const float*       data[max_channels];
+            for (int c = 0; c < channels; ++c)
+                data[c] = buffer.data() + static_cast<size_t>(c) * width;
+            float* result = buffer.data() + static_cast<size_t>(channels) * width;
+
+            for (int y = range.start; y < range.end; ++y)
+            {
+                // Deinterleave the row into float planes
+                for (int c = 0; c < channels; ++c)
+                {
+                    float* plane = buffer.data() + static_cast<size_t>(c) * width;
+                    if (image.depth() == CV_8U)
+                    {
+                        const uchar* src = image.ptr<uchar>(y) + c;
+                        for (int x = 0; x < width; ++x)
+                            plane[x] = src[x * channels];
+                    }
+                    else
+                    {
+                        const float* src = image.ptr<float>(y) + c;
+                        for (int x = 0; x < width; ++x)
+                            plane[x] = src[x * channels];
+                    }
+                }
+                float*    row = model.ptr<float>(y);
+                RowPlanes planes;
+                for (int k = 0; k < mixtures; ++k)
+                {
+                    planes.weight[k]   = row + static_cast<size_t>(k) * width;
+                    planes.variance[k] = row + static_cast<size_t>(mixtures + k) * width;
+                    for (int c = 0; c < channels; ++c)
+                        planes.mean[k][c] = row + static_cast<size_t>(2 * mixtures + k * channels + c) * width;
+                }
+                int x = 0;
+#if CV_SIMD128
+                for (; x <= width - VectorLanes::lanes; x += VectorLanes::lanes)
+                    mixtureKernel<VectorLanes>(data, planes, x, mixtures, channels, params, rates, result + x);
+#endif
+                for (; x < width; ++x)
+                    mixtureKernel<ScalarLanes>(data, planes, x, mixtures, channels, params, rates, result + x);
+                uchar* out = mask.ptr<uchar>(y);
+                for (int i = 0; i < width; ++i)
+                    out[i] = static_cast<uchar>(result[i]);
+            }
+        }
+
+        const cv::Mat&    image;
+        cv::Mat&          model;
+        cv::Mat&          mask;
+        int               mixtures;
+        const MOG2Params& params;
+        const Rates&      rates;
+    };
+}
+
+void MOG2Model::reset()
+{
+    m_model.release();
+    m_frames = 0;
+}
+
+void MOG2Model::initialize(cv::Size size, int channels, int mixtures, float var_init)
+{
+    m_channels = channels;
+    m_mixtures = mixtures;
+    m_frames   = 0;
+    m_model.create(size.height, size.width * mixtures * (2 + channels), CV_32FC1);
+    m_model.setTo(cv::Scalar::all(0));
+    for (int y = 0; y < size.height; ++y)
+    {
+        float* variance = m_model.ptr<float>(y) + static_cast<size_t>(mixtures) * size.width;
+        std::fill(variance, variance + static_cast<size_t>(mixtures) * size.width, var_init);
+    }
+}
+
+void MOG2Model::apply(const cv::Mat& image, cv::Mat& mask, double learning_rate, const MOG2Params& params)
+{
+    CV_Assert(image.channels() <= max_channels && (image.depth() == CV_8U || image.depth() == CV_32F));
+    if (params.half_resolution)
+    {
+        cv::resize(image, m_small, cv::Size((image.cols + 1) / 2, (image.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+        MOG2Params half      = params;
+        half.half_resolution = false;
+        apply(m_small, m_small_mask, learning_rate, half);
+        cv::resize(m_small_mask, mask, image.size(), 0, 0, cv::INTER_NEAREST);
+        return;
+    }
+
+    const int mixtures = std::min(std::max(params.mixtures, 1), max_mixtures);
+    const int width    = m_mixtures ? m_model.cols / (m_mixtures * (2 + m_channels)) : 0;
+    if (m_model.empty() || m_channels != image.channels() || m_mixtures != mixtures || width != image.cols ||
+        m_model.rows != image.rows)
+    {
+        initialize(image.size(), image.channels(), mixtures, params.var_init);
+    }
+
+    const int interval = std::max(params.update_interval, 1);
+    ++m_frames;
+    double alpha = learning_rate >= 0 ? learning_rate : 1.0 / std::min(2 * m_frames, std::max(params.history, 1));
+    // The first frame always updates and seeds a mode at every pixel so that there is a model to compare
+    // against, even with a learning rate of 0 which otherwise never creates one
+    Rates rates;
+    rates.update = m_frames == 1 || (m_frames - 1) % interval == 0;
+    alpha        = m_frames == 1 ? 1.0 : std::min(1.0, 1.0 - std::pow(1.0 - std::min(alpha, 1.0), interval));
+    rates.alpha  = static_cast<float>(alpha);
+    rates.alpha1 = static_cast<float>(1.0 - alpha);
+    rates.prune  = static_cast<float>(-alpha * params.complexity_reduction);
+
+    mask.create(image.size(), CV_8UC1);
+    cv::parallel_for_(cv::Range(0, image.rows), MixtureBody(image, m_model, mask, mixtures, params, rates),
+                      std::max(1, image.rows / 16));
+}
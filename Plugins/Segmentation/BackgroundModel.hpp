@@ -0,0 +1,57 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+namespace aq
+{
+namespace bgsegm
+{
+    // Defaults of cv::BackgroundSubtractorMOG2
+    struct MOG2Params
+    {
+        int   history              = 500;
+        // Squared Mahalanobis distance below which a pixel is explained by a background mode
+        float var_threshold        = 16.0f;
+        bool  detect_shadows       = true;
+        int   mixtures             = 5;
+        float background_ratio     = 0.9f;
+        // Squared Mahalanobis distance below which a pixel updates a mode instead of creating one
+        float var_threshold_gen    = 9.0f;
+        float var_init             = 15.0f;
+        float var_min              = 4.0f;
+        float var_max              = 75.0f;
+        float complexity_reduction = 0.05f;
+        uchar shadow_value         = 127;
+        float shadow_threshold     = 0.5f;
+        // Only every update_interval-th frame updates the model, with the learning rate compounded
+        // over the skipped frames.  The other frames are only classified.
+        int   update_interval      = 1;
+        // Model and classification on a half size image, the mask is scaled back up
+        bool  half_resolution      = false;
+    };
+
+    // Zivkovic's adaptive Gaussian mixture background model on the host.  The mixture is stored as a
+    // structure of arrays, one plane per mode and parameter, so that a vector of neighbouring pixels
+    // is processed in lockstep with universal intrinsics.  Modes are not kept sorted, the rank of a mode
+    // is derived from the weights when it is needed.  Row stripes are updated in parallel.
+    class MOG2Model
+    {
+    public:
+        // mask is CV_8UC1, 0 for background, 255 for foreground and shadow_value for shadows.  A
+        // negative learning rate picks 1 / min(2 * frames, history) like cv::BackgroundSubtractorMOG2.
+        void apply(const cv::Mat& image, cv::Mat& mask, double learning_rate, const MOG2Params& params = MOG2Params());
+        void reset();
+
+        int getFrames() const { return m_frames; }
+
+    private:
+        void initialize(cv::Size size, int channels, int mixtures, float var_init);
+
+        cv::Mat m_model;
+        cv::Mat m_small;
+        cv::Mat m_small_mask;
+        int     m_channels = 0;
+        int     m_mixtures = 0;
+        int     m_frames   = 0;
+    };
+}
+}
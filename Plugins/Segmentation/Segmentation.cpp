@@ -4,6 +4,7 @@
 #include <Aquila/rcc/external_includes/cv_cudaarithm.hpp>
 #include <Aquila/rcc/external_includes/cv_cudalegacy.hpp>
 #include <Aquila/nodes/NodeInfo.hpp>
+#include <HostHistogram.hpp>
 #include "RuntimeObjectSystem/RuntimeLinkLibrary.h"
 #ifdef FASTMS_FOUND
 #ifdef _DEBUG
@@ -24,21 +25,29 @@ bool OtsuThreshold::processImpl()
         MO_LOG_EVERY_N(warning, 100) << "Currently only supports single channel images!";
         return false;
     }
-    cv::cuda::GpuMat hist;
+    // Host inputs are binned on the cpu so that the node also runs without a gpu
+    const bool host = image->getSyncState() < SyncedMemory::DEVICE_UPDATED;
+    cv::Mat counts;
+    cv::Mat bins;
     if(!histogram)
     {
-        cv::Mat h_levels(1,200,CV_32F);
         double minVal, maxVal;
-        cv::cuda::minMax(image->getGpuMat(stream()), &minVal, &maxVal);
-        // Generate 300 equally spaced bins over the space
-        float step = float((maxVal - minVal) / float(200));
-
-        float val = minVal;
-        for(int i = 0; i < 200; ++i, val += step)
+        if(host)
+            cv::minMaxLoc(image->getMat(stream()), &minVal, &maxVal);
+        else
+            cv::cuda::minMax(image->getGpuMat(stream()), &minVal, &maxVal);
+        // Generate 200 equally spaced bins over the space
+        bins = aq::hist::uniformLevels(200, float(minVal), float(maxVal));
+        if(host)
+        {
+            aq::hist::range(image->getMat(stream()), counts, bins);
+        }else
         {
-            h_levels.at<float>(i) = val;
+            cv::cuda::GpuMat hist;
+            cv::cuda::histRange(image->getGpuMat(stream()), hist, cv::cuda::GpuMat(bins), stream());
+            hist.download(counts, stream());
+            stream().waitForCompletion();
         }
-        cv::cuda::histRange(image->getGpuMat(stream()), hist, cv::cuda::GpuMat(h_levels), stream());
     }else{
         if(range == nullptr){
             MO_LOG_EVERY_N(error, 100) << "Histogram provided but range not provided";
@@ -48,14 +57,13 @@ bool OtsuThreshold::processImpl()
             MO_LOG_EVERY_N(error, 100) << "Currently only support equal bins accross all histograms";
             return false;
         }
-        hist = histogram->getGpuMat(stream());
+        bins = range->getMat(stream());
+        counts = histogram->getMat(stream());
+        stream().waitForCompletion();
     }
     // Normalize histogram
-    hist.convertTo(hist, CV_32F, 1 / float(image->getSize().area()), 0, stream());
-    cv::cuda::HostMem h_hist;
-    hist.download(h_hist, stream());
-    stream().waitForCompletion();
-    cv::Mat h_hist_ = h_hist.createMatHeader();
+    cv::Mat h_hist_;
+    counts.convertTo(h_hist_, CV_32F, 1 / float(image->getSize().area()));
     int channels = h_hist_.channels();
     std::vector<double> optValue(channels);
 
@@ -77,7 +85,6 @@ bool OtsuThreshold::processImpl()
 
         // Currently we only support equal bins accross all channels
         float val = 0;
-        cv::Mat bins = range->getMat(stream());
         for (int i = 0; i < bins.cols - 1; ++i)
         {
             val = h_hist_.at<float>(i);
@@ -99,7 +106,6 @@ bool OtsuThreshold::processImpl()
     }
     else
     {
-        cv::Mat bins = range->getMat(stream());
         if (channels == 4)
         {
             for (int c = 0; c < channels; ++c)
@@ -147,12 +153,39 @@ bool OtsuThreshold::processImpl()
     {
         //updateParameter("Optimal threshold " + boost::lexical_cast<std::string>(i), optValue[i]);
     }
+    if (channels == 1)
+    {
+        if (host)
+        {
+            cv::Mat mask;
+            cv::threshold(image->getMat(stream()), mask, optValue[0], 255, cv::THRESH_BINARY);
+            output_param.updateData(mask, image_param.getTimestamp(), _ctx.get());
+        }else
+        {
+            cv::cuda::GpuMat mask;
+            cv::cuda::threshold(image->getGpuMat(stream()), mask, optValue[0], 255, cv::THRESH_BINARY, stream());
+            output_param.updateData(mask, image_param.getTimestamp(), _ctx.get());
+        }
+    }
     return true;
 }
 
 
 bool MOG2::processImpl()
 {
+    if(image->getSyncState() < SyncedMemory::DEVICE_UPDATED)
+    {
+        bgsegm::MOG2Params params;
+        params.history = history;
+        params.var_threshold = static_cast<float>(threshold);
+        params.detect_shadows = detect_shadows;
+        params.update_interval = update_interval;
+        params.half_resolution = half_resolution;
+        cv::Mat mask;
+        h_mog2.apply(image->getMat(stream()), mask, learning_rate, params);
+        background_param.updateData(mask, image_param.getTimestamp(), _ctx.get());
+        return true;
+    }
     if(mog2 == nullptr)
     {
         mog2 = cv::cuda::createBackgroundSubtractorMOG2(history, threshold, detect_shadows);
@@ -4,6 +4,7 @@
 #include "Aquila/utilities/cuda/CudaUtils.hpp"
 #include <Aquila/metatypes/SyncedMemoryMetaParams.hpp>
 #include "Segmentation_impl.h"
+#include "BackgroundModel.hpp"
 #ifdef FASTMS_FOUND
 #include "libfastms/solver/solver.h"
 #endif
@@ -33,12 +34,18 @@ namespace aq{
             PARAM(double, threshold, 15)
             PARAM(bool, detect_shadows, true)
             PARAM(double, learning_rate, 1.0)
+            TOOLTIP(learning_rate, "Negative picks 1 / min(2 * frames, history), 0 freezes the model after the first frame and 1 reinitializes it every frame")
+            PARAM(int, update_interval, 1)
+            TOOLTIP(update_interval, "Host only, update the model every Nth frame with the learning rate compounded over N frames")
+            PARAM(bool, half_resolution, false)
+            TOOLTIP(half_resolution, "Host only, run the model on a half size image and scale the mask back up")
             OUTPUT(SyncedMemory, background, SyncedMemory())
         MO_END;
 
     protected:
         bool processImpl();
         cv::Ptr<cv::cuda::BackgroundSubtractorMOG2> mog2;
+        bgsegm::MOG2Model h_mog2;
     };
 
     class Watershed: public Node
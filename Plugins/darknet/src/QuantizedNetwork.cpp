@@ -0,0 +1,176 @@
+#include "QuantizedNetwork.hpp"
+#include <MetaObject/logging/logging.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace aq {
+namespace nodes {
+namespace {
+template <class T>
+void im2col(const T* input, int channels, int height, int width, int size, int stride, int pad,
+    int out_h, int out_w, T* columns, int ldb) {
+    // One row per output pixel so that the gemm reads both operands contiguously
+    for (int oy = 0; oy < out_h; ++oy) {
+        for (int ox = 0; ox < out_w; ++ox) {
+            T* row = columns + static_cast<size_t>(oy * out_w + ox) * ldb;
+            for (int c = 0; c < channels; ++c) {
+                const T* plane = input + static_cast<size_t>(c) * height * width;
+                for (int ky = 0; ky < size; ++ky) {
+                    const int iy = oy * stride + ky - pad;
+                    for (int kx = 0; kx < size; ++kx, ++row) {
+                        const int ix = ox * stride + kx - pad;
+                        *row = (iy >= 0 && iy < height && ix >= 0 && ix < width) ? plane[iy * width + ix] : T(0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+inline float activate(float x, ACTIVATION a) {
+    switch (a) {
+    case LEAKY:
+        return x > 0.0f ? x : 0.1f * x;
+    case RELU:
+        return x > 0.0f ? x : 0.0f;
+    case LOGISTIC:
+        return 1.0f / (1.0f + std::exp(-x));
+    default:
+        return x;
+    }
+}
+}
+
+std::string QuantizedNetwork::tensorName(int layer) {
+    return "layer_" + std::to_string(layer);
+}
+
+bool QuantizedNetwork::canConvert(const layer& l) {
+    return l.type == CONVOLUTIONAL && l.groups <= 1 && !l.xnor && !l.binary
+        && (l.activation == LINEAR || l.activation == LEAKY || l.activation == RELU || l.activation == LOGISTIC);
+}
+
+void QuantizedNetwork::clear() {
+    m_layers.clear();
+    m_lookup.clear();
+}
+
+bool QuantizedNetwork::build(network* net, quant::Precision precision, const quant::CalibrationTable& table) {
+    clear();
+    if (net == nullptr || precision == quant::Float32)
+        return false;
+    m_lookup.assign(static_cast<size_t>(net->n), -1);
+    for (int i = 0; i < net->n; ++i) {
+        const layer& l = net->layers[i];
+        if (!canConvert(l))
+            continue;
+        Layer q;
+        q.precision   = precision;
+        q.M           = l.n;
+        q.K           = l.c * l.size * l.size;
+        q.lda         = quant::alignK(q.K);
+        q.input_scale = table.scale(tensorName(i));
+        if (precision == quant::Int8 && q.input_scale <= 0.0f) {
+            MO_LOG(debug) << "Layer " << i << " is not calibrated, keeping it in float";
+            continue;
+        }
+
+        // Fold batch norm into the weights and bias
+        cv::Mat weights(q.M, q.K, CV_32F);
+        q.bias.resize(static_cast<size_t>(q.M));
+        for (int m = 0; m < q.M; ++m) {
+            float gain = 1.0f, shift = 0.0f;
+            if (l.batch_normalize) {
+                gain  = l.scales[m] / (std::sqrt(l.rolling_variance[m]) + .000001f);
+                shift = -l.rolling_mean[m] * gain;
+            }
+            const float* src = l.weights + static_cast<size_t>(m) * q.K;
+            float*       dst = weights.ptr<float>(m);
+            for (int k = 0; k < q.K; ++k)
+                dst[k] = src[k] * gain;
+            q.bias[m] = l.biases[m] + shift;
+        }
+
+        if (precision == quant::Int8) {
+            q.weights.assign(static_cast<size_t>(q.M) * q.lda, 0);
+            q.weight_scale.resize(static_cast<size_t>(q.M));
+            for (int m = 0; m < q.M; ++m) {
+                double max = 0.0;
+                cv::minMaxIdx(cv::abs(weights.row(m)), nullptr, &max);
+                q.weight_scale[m] = max > 0.0 ? static_cast<float>(max / 127.0) : 1.0f;
+                quant::quantize(weights.ptr<float>(m), q.weights.data() + static_cast<size_t>(m) * q.lda,
+                    static_cast<size_t>(q.K), q.weight_scale[m]);
+            }
+        } else {
+            cv::Mat half_weights;
+            cv::convertFp16(weights, half_weights);
+            cv::convertFp16(half_weights, q.float_weights);
+        }
+        m_lookup[i] = static_cast<int>(m_layers.size());
+        m_layers.push_back(std::move(q));
+    }
+    if (m_layers.empty()) {
+        clear();
+        return false;
+    }
+    MO_LOG(info) << "Running " << m_layers.size() << " convolutional layers at "
+                 << (precision == quant::Int8 ? "int8" : "fp16");
+    return true;
+}
+
+void QuantizedNetwork::forward(network* net, float* input) {
+    // Same as network_predict but with the converted layers swapped in
+    network orig = *net;
+    net->input   = input;
+    net->truth   = 0;
+    net->train   = 0;
+    net->delta   = 0;
+    for (int i = 0; i < net->n; ++i) {
+        net->index = i;
+        layer l    = net->layers[i];
+        if (i < static_cast<int>(m_lookup.size()) && m_lookup[i] >= 0) {
+            for (int b = 0; b < l.batch; ++b) {
+                forwardLayer(m_layers[m_lookup[i]], l, net->input + static_cast<size_t>(b) * l.inputs,
+                    l.output + static_cast<size_t>(b) * l.outputs);
+            }
+        } else {
+            l.forward(l, *net);
+        }
+        net->input = l.output;
+    }
+    *net = orig;
+}
+
+void QuantizedNetwork::forwardLayer(const Layer& q, const layer& l, const float* input, float* output) {
+    const int N = l.out_h * l.out_w;
+    if (q.precision == quant::Int8) {
+        m_input.resize(static_cast<size_t>(l.inputs));
+        quant::quantize(input, m_input.data(), m_input.size(), q.input_scale);
+        m_columns.assign(static_cast<size_t>(N) * q.lda, 0);
+        im2col(m_input.data(), l.c, l.h, l.w, l.size, l.stride, l.pad, l.out_h, l.out_w, m_columns.data(), q.lda);
+        m_accumulator.resize(static_cast<size_t>(q.M) * N);
+        quant::gemm(q.M, N, q.K, q.weights.data(), q.lda, m_columns.data(), q.lda, m_accumulator.data());
+        for (int m = 0; m < q.M; ++m) {
+            const float    scale = q.weight_scale[m] * q.input_scale;
+            const float    bias  = q.bias[m];
+            const int32_t* acc   = m_accumulator.data() + static_cast<size_t>(m) * N;
+            float*         dst   = output + static_cast<size_t>(m) * N;
+            for (int n = 0; n < N; ++n)
+                dst[n] = activate(acc[n] * scale + bias, l.activation);
+        }
+    } else {
+        m_float_columns.create(N, q.K, CV_32F);
+        im2col(input, l.c, l.h, l.w, l.size, l.stride, l.pad, l.out_h, l.out_w, m_float_columns.ptr<float>(), q.K);
+        cv::gemm(q.float_weights, m_float_columns, 1.0, cv::noArray(), 0.0, m_float_output, cv::GEMM_2_T);
+        for (int m = 0; m < q.M; ++m) {
+            const float  bias = q.bias[m];
+            const float* src  = m_float_output.ptr<float>(m);
+            float*       dst  = output + static_cast<size_t>(m) * N;
+            for (int n = 0; n < N; ++n)
+                dst[n] = activate(src[n] + bias, l.activation);
+        }
+    }
+}
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+extern "C" {
+#include "darknet.h"
+}
+
+#include <Quantization.hpp>
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+namespace aq {
+namespace nodes {
+    // Runs the convolutional layers of a darknet network at reduced precision on the cpu, every
+    // other layer is still forwarded by darknet.  Batch norm is folded into the weights, int8
+    // weights are quantized per output channel and activations per tensor from the calibration table.
+    // There is no half precision gemm on the cpu, fp16 weights are rounded to half once when the
+    // network is built and kept in float for the gemm.
+    class QuantizedNetwork {
+    public:
+        // Returns false if no layer could be converted
+        bool build(network* net, quant::Precision precision, const quant::CalibrationTable& table);
+        void clear();
+        bool empty() const { return m_layers.empty(); }
+
+        // Replacement for network_predict
+        void forward(network* net, float* input);
+
+        // Name of the calibrated tensor feeding layer i
+        static std::string tensorName(int layer);
+        static bool        canConvert(const layer& l);
+
+    private:
+        struct Layer {
+            quant::Precision    precision;
+            int                 M;
+            int                 K;
+            int                 lda;
+            std::vector<int8_t> weights;
+            std::vector<float>  weight_scale;
+            // Float16 only, rounded through half precision
+            cv::Mat             float_weights;
+            std::vector<float>  bias;
+            float               input_scale;
+        };
+        void forwardLayer(const Layer& q, const layer& l, const float* input, float* output);
+
+        std::vector<Layer> m_layers;
+        std::vector<int>   m_lookup;
+
+        std::vector<int8_t>  m_input;
+        std::vector<int8_t>  m_columns;
+        std::vector<int32_t> m_accumulator;
+        cv::Mat              m_float_columns;
+        cv::Mat              m_float_output;
+    };
+}
+}
@@ -0,0 +1,276 @@
+#include "YOLO.hpp"
+#include <Aquila/nodes/NodeInfo.hpp>
+#include <NMS.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <cmath>
+#include <fstream>
+
+namespace aq {
+namespace nodes {
+namespace {
+// Darknet convolutions downsample by 32, input dimensions have to be a multiple of it
+unsigned int roundToStride(unsigned int size) {
+    return std::max(32U, (size + 16U) / 32U * 32U);
+}
+}
+
+bool reshapeDarknet(network* net, int batch, int width, int height) {
+    if (batch == net->batch && width == net->w && height == net->h)
+        return false;
+    // set_batch_network only updates the batch fields, the layer outputs and the workspace are sized for
+    // batch * outputs and only reallocated by resize_network, which has to run even at an unchanged size
+    set_batch_network(net, batch);
+    resize_network(net, width, height);
+    return true;
+}
+
+void YOLO::nodeInit(bool firstInit) {
+    if (firstInit) {
+        // Darknet expects rgb input scaled to [0, 1] at the network resolution
+        channel_mean_param.updateData(cv::Scalar::all(0));
+        pixel_scale_param.updateData(1.0f / 255.0f);
+        image_scale_param.updateData(-1.0f);
+    }
+}
+
+bool YOLO::initNetwork() {
+    if (!_net || model_file_param.modified() || weight_file_param.modified()) {
+        if (!boost::filesystem::exists(model_file) || !boost::filesystem::exists(weight_file)) {
+            MO_LOG_EVERY_N(warning, 100) << "Model file '" << model_file << "' or weight file '" << weight_file << "' does not exist";
+            return false;
+        }
+        std::string cfg     = model_file.string();
+        std::string weights = weight_file.string();
+        network*    net     = load_network(&cfg[0], &weights[0], 0);
+        if (net == nullptr) {
+            MO_LOG(warning) << "Unable to load darknet network from " << cfg;
+            return false;
+        }
+        _net.reset(net, [](network* ptr) { free_network(ptr); });
+        _input_buffer.clear();
+        _quantized.clear();
+        if (precision.getValue() != quant::Float32)
+            applyPrecision();
+        model_file_param.modified(false);
+        weight_file_param.modified(false);
+        MO_LOG(info) << "Loaded darknet network " << cfg << " (" << net->w << "x" << net->h << ")";
+    }
+
+    if ((label_file_param.modified() || labels.empty()) && boost::filesystem::exists(label_file)) {
+        labels.clear();
+        std::ifstream ifs(label_file.string().c_str());
+        std::string   line;
+        while (std::getline(ifs, line, '\n')) {
+            labels.push_back(line);
+        }
+        MO_LOG(info) << "Loaded " << labels.size() << " classes";
+        labels_param.emitUpdate();
+        label_file_param.modified(false);
+    }
+    return true;
+}
+
+bool YOLO::reshapeNetwork(unsigned int num, unsigned int channels, unsigned int height, unsigned int width) {
+    if (!_net || channels != static_cast<unsigned int>(_net->c))
+        return false;
+    width  = roundToStride(width);
+    height = roundToStride(height);
+    if (num == 0)
+        num = 1;
+    if (reshapeDarknet(_net.get(), static_cast<int>(num), static_cast<int>(width), static_cast<int>(height)))
+        _input_buffer.clear();
+    return true;
+}
+
+cv::Scalar_<unsigned int> YOLO::getNetworkShape() const {
+    if (!_net)
+        return cv::Scalar_<unsigned int>(0, 0, 0, 0);
+    return cv::Scalar_<unsigned int>(static_cast<unsigned int>(_net->batch),
+        static_cast<unsigned int>(_net->c),
+        static_cast<unsigned int>(_net->h),
+        static_cast<unsigned int>(_net->w));
+}
+
+std::vector<std::vector<cv::cuda::GpuMat> > YOLO::getNetImageInput(int) {
+    // Darknet owns its device buffers, input is always handed over from the host
+    return std::vector<std::vector<cv::cuda::GpuMat> >();
+}
+
+void YOLO::allocateInput() {
+    const int w = _net->w, h = _net->h, c = _net->c;
+    _workspace.create(1, _net->batch * c * h * w, CV_32F);
+    float* ptr = _workspace.ptr<float>();
+    _input_buffer.clear();
+    for (int b = 0; b < _net->batch; ++b) {
+        std::vector<cv::Mat> channels;
+        for (int i = 0; i < c; ++i) {
+            channels.emplace_back(h, w, CV_32F, static_cast<void*>(ptr));
+            ptr += h * w;
+        }
+        if (swap_bgr && c == 3) {
+            std::swap(channels[0], channels[2]);
+        }
+        _input_buffer.push_back(channels);
+    }
+}
+
+std::vector<std::vector<cv::Mat> > YOLO::getNetImageInputHost(int) {
+    if (_net && (_input_buffer.empty() || swap_bgr_param.modified())) {
+        allocateInput();
+        swap_bgr_param.modified(false);
+    }
+    return _input_buffer;
+}
+
+void YOLO::preBatch(int batch_size) {
+    (void)batch_size;
+    _boxes.clear();
+    _scores.clear();
+    _classes.clear();
+    _num_regions = 0;
+}
+
+bool YOLO::forwardMinibatch() {
+    if (!_net || _workspace.empty())
+        return false;
+    if (_quantized.empty()) {
+        network_predict(_net.get(), _workspace.ptr<float>());
+    } else {
+        _quantized.forward(_net.get(), _workspace.ptr<float>());
+    }
+    return true;
+}
+
+bool YOLO::setPrecision(quant::Precision precision, const quant::CalibrationTable& table) {
+    if (precision == quant::Float32) {
+        _quantized.clear();
+        return true;
+    }
+    return _quantized.build(_net.get(), precision, table);
+}
+
+void YOLO::observeActivations(quant::RangeObserver& observer) {
+    // The input of every layer is the output of the one before it
+    for (int i = 0; i < _net->n; ++i) {
+        const layer& l = _net->layers[i];
+        if (!QuantizedNetwork::canConvert(l))
+            continue;
+        const float* input = i == 0 ? _workspace.ptr<float>() : _net->layers[i - 1].output;
+        observer.observe(QuantizedNetwork::tensorName(i), input, static_cast<size_t>(l.inputs) * l.batch);
+    }
+}
+
+cv::Mat YOLO::getNetOutput() {
+    // Raw outputs of the detection layers, or of the last layer for classifiers
+    std::vector<cv::Mat> outputs;
+    for (int i = 0; i < _net->n; ++i) {
+        const layer& l = _net->layers[i];
+        if (l.type == ::YOLO || l.type == ::REGION)
+            outputs.emplace_back(1, l.outputs * l.batch, CV_32F, l.output);
+    }
+    if (outputs.empty()) {
+        const layer& l = _net->layers[_net->n - 1];
+        outputs.emplace_back(1, l.outputs * l.batch, CV_32F, l.output);
+    }
+    cv::Mat output;
+    cv::hconcat(outputs, output);
+    return output;
+}
+
+void YOLO::decodeLayer(const layer& l, int b, const cv::Rect& roi) {
+    const int    hw      = l.w * l.h;
+    const int    entries = 4 + 1 + l.classes;
+    const float* output  = l.output + b * l.outputs;
+    for (int n = 0; n < l.n; ++n) {
+        float* anchor = const_cast<float*>(output + n * entries * hw);
+        // Score every grid cell of this anchor at once, objectness * best class probability
+        cv::Mat objectness(1, hw, CV_32F, anchor + 4 * hw);
+        cv::Mat class_prob(l.classes, hw, CV_32F, anchor + 5 * hw);
+        cv::reduce(class_prob, _best_class, 0, cv::REDUCE_MAX);
+        cv::multiply(_best_class, objectness, _score);
+        cv::compare(_score, detection_threshold, _mask, cv::CMP_GT);
+        if (cv::countNonZero(_mask) == 0)
+            continue;
+        cv::findNonZero(_mask, _candidates);
+
+        float anchor_w, anchor_h;
+        if (l.type == ::YOLO) {
+            anchor_w = l.biases[2 * l.mask[n]] / _net->w;
+            anchor_h = l.biases[2 * l.mask[n] + 1] / _net->h;
+        } else {
+            anchor_w = l.biases[2 * n] / l.w;
+            anchor_h = l.biases[2 * n + 1] / l.h;
+        }
+        for (const cv::Point& pt : _candidates) {
+            const int idx      = pt.x;
+            const int row      = idx / l.w;
+            const int col      = idx % l.w;
+            const float* probs = class_prob.ptr<float>(0) + idx;
+            int       best     = 0;
+            for (int c = 1; c < l.classes; ++c) {
+                if (probs[c * hw] > probs[best * hw])
+                    best = c;
+            }
+            const float x = (col + anchor[idx]) / l.w;
+            const float y = (row + anchor[hw + idx]) / l.h;
+            const float w = std::exp(anchor[2 * hw + idx]) * anchor_w;
+            const float h = std::exp(anchor[3 * hw + idx]) * anchor_h;
+            _boxes.emplace_back(roi.x + (x - w / 2) * roi.width, roi.y + (y - h / 2) * roi.height,
+                w * roi.width, h * roi.height);
+            _scores.push_back(_score.at<float>(idx));
+            _classes.push_back(best);
+        }
+    }
+}
+
+void YOLO::postMiniBatch(const std::vector<cv::Rect>& batch_bb, const std::vector<DetectedObject2d>& dets) {
+    (void)dets;
+    for (int i = 0; i < _net->n; ++i) {
+        const layer& l = _net->layers[i];
+        if (l.type != ::YOLO && l.type != ::REGION)
+            continue;
+        for (size_t b = 0; b < batch_bb.size(); ++b) {
+            decodeLayer(l, static_cast<int>(b), batch_bb[b]);
+        }
+    }
+    _num_regions += batch_bb.size();
+}
+
+void YOLO::postBatch() {
+    nms::Options options;
+    options.iou_threshold = nms_threshold;
+    options.prefilter     = _boxes.size() > 256 ? nms::SortAndSweep : nms::NoPrefilter;
+    std::vector<size_t> keep = nms::suppress(_boxes, _scores, _classes, options);
+
+    std::vector<DetectedObject> objects;
+    objects.reserve(keep.size());
+    for (size_t i = 0; i < keep.size(); ++i) {
+        const size_t   idx = keep[i];
+        const int      cls = _classes[idx];
+        DetectedObject obj;
+        obj.bounding_box = _boxes[idx];
+        obj.timestamp    = input_param.getTimestamp();
+        obj.framenumber  = input_param.getFrameNumber();
+        obj.id           = static_cast<int>(i);
+        if (static_cast<size_t>(cls) < labels.size())
+            obj.classification = Classification(labels[static_cast<size_t>(cls)], _scores[idx], cls);
+        else
+            obj.classification = Classification("", _scores[idx], cls);
+        objects.push_back(obj);
+    }
+    if (_num_regions > 1) {
+        // Objects cut by a region border are detected partially in one region and fully in its neighbour
+        options.iou_threshold = seam_overlap_threshold;
+        options.metric        = nms::IntersectionOverMinimum;
+        options.class_aware   = false;
+        nms::suppress(objects, options);
+    }
+    detections_param.updateData(objects, mo::tag::_param = input_param, _ctx.get());
+}
+
+// Registered inside the namespace, at global scope YOLO also names darknet's layer type
+MO_REGISTER_CLASS(YOLO)
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+extern "C" {
+#include "darknet.h"
+}
+
+#include "QuantizedNetwork.hpp"
+#include "darknetExport.hpp"
+
+#include <Aquila/nodes/Node.hpp>
+#include <Aquila/types/ObjectDetection.hpp>
+#include <Aquila/types/SyncedMemory.hpp>
+#include <INeuralNet.hpp>
+
+namespace aq {
+namespace nodes {
+    // Sets the batch size and input resolution of a darknet network, reallocating every layer buffer when
+    // either changes.  Returns false if the network already had this shape.
+    darknet_EXPORT bool reshapeDarknet(network* net, int batch, int width, int height);
+
+    class YOLO : public INeuralNet {
+    public:
+        MO_DERIVE(YOLO, INeuralNet)
+            PARAM(float, detection_threshold, 0.5f)
+            TOOLTIP(detection_threshold, "Minimum objectness * class probability of a detection")
+            PARAM(float, nms_threshold, 0.45f)
+            TOOLTIP(nms_threshold, "Overlap above which a lower scoring detection of the same class is suppressed")
+            PARAM(float, seam_overlap_threshold, 0.7f)
+            TOOLTIP(seam_overlap_threshold, "When a frame is processed as several regions, detections whose intersection covers this fraction of the smaller box are merged")
+            OUTPUT(std::vector<DetectedObject>, detections, std::vector<DetectedObject>())
+        MO_END
+
+    protected:
+        virtual void nodeInit(bool firstInit);
+        virtual bool initNetwork();
+        virtual bool reshapeNetwork(unsigned int num, unsigned int channels, unsigned int height, unsigned int width);
+        virtual cv::Scalar_<unsigned int> getNetworkShape() const;
+
+        virtual std::vector<std::vector<cv::cuda::GpuMat> > getNetImageInput(int requested_batch_size = 1);
+        virtual std::vector<std::vector<cv::Mat> >          getNetImageInputHost(int requested_batch_size = 1);
+
+        virtual void preBatch(int batch_size);
+        virtual bool forwardMinibatch();
+        virtual void postMiniBatch(const std::vector<cv::Rect>& batch_bb, const std::vector<DetectedObject2d>& dets);
+        virtual void postBatch();
+
+        virtual bool    setPrecision(quant::Precision precision, const quant::CalibrationTable& table);
+        virtual void    observeActivations(quant::RangeObserver& observer);
+        virtual cv::Mat getNetOutput();
+
+    private:
+        // Decodes every anchor of a yolo or region layer for image b of the minibatch, boxes are mapped into roi
+        void decodeLayer(const layer& l, int b, const cv::Rect& roi);
+        void allocateInput();
+
+        std::shared_ptr<network>            _net;
+        QuantizedNetwork                    _quantized;
+        cv::Mat                             _workspace;
+        std::vector<std::vector<cv::Mat> >  _input_buffer;
+
+        // Candidates accumulated over all minibatches of the current frame
+        std::vector<cv::Rect2f> _boxes;
+        std::vector<float>      _scores;
+        std::vector<int>        _classes;
+        size_t                  _num_regions = 0;
+
+        // Scratch for the vectorized thresholding
+        cv::Mat _best_class;
+        cv::Mat _score;
+        cv::Mat _mask;
+        std::vector<cv::Point> _candidates;
+    };
+}
+}
@@ -0,0 +1,65 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "Aquila/darknet/test_yolo_batch"
+#include <YOLO.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace {
+const int width  = 64;
+const int height = 64;
+
+// Two convolutions around a maxpool, small enough to run without weights on any machine
+std::shared_ptr<network> createNetwork() {
+    const boost::filesystem::path cfg = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("yolo_batch_%%%%%%.cfg");
+    {
+        std::ofstream ofs(cfg.string().c_str());
+        ofs << "[net]\nbatch=1\nwidth=" << width << "\nheight=" << height << "\nchannels=3\n\n"
+            << "[convolutional]\nfilters=8\nsize=3\nstride=1\npad=1\nactivation=leaky\n\n"
+            << "[maxpool]\nsize=2\nstride=2\n\n"
+            << "[convolutional]\nfilters=16\nsize=3\nstride=1\npad=1\nactivation=leaky\n";
+    }
+    std::string path = cfg.string();
+    network*    net  = parse_network_cfg(&path[0]);
+    boost::filesystem::remove(cfg);
+    return std::shared_ptr<network>(net, [](network* ptr) { free_network(ptr); });
+}
+
+std::vector<float> image() {
+    std::vector<float> data(3 * width * height);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<float>(i % 251) / 251.0f;
+    return data;
+}
+}
+
+BOOST_AUTO_TEST_CASE(yolo_batch_grow_same_size) {
+    std::shared_ptr<network> net = createNetwork();
+    BOOST_REQUIRE(net);
+    aq::nodes::reshapeDarknet(net.get(), 1, width, height);
+    std::vector<float> input = image();
+    network_predict(net.get(), input.data());
+    const layer&       last = net->layers[net->n - 1];
+    std::vector<float> single(last.output, last.output + last.outputs);
+
+    // A larger batch at the same resolution has to reallocate the layer buffers
+    BOOST_REQUIRE(aq::nodes::reshapeDarknet(net.get(), 8, width, height));
+    BOOST_REQUIRE_EQUAL(net->batch, 8);
+    BOOST_REQUIRE_EQUAL(net->layers[net->n - 1].batch, 8);
+    std::vector<float> batch;
+    for (int b = 0; b < 8; ++b)
+        batch.insert(batch.end(), input.begin(), input.end());
+    network_predict(net.get(), batch.data());
+    const layer& grown = net->layers[net->n - 1];
+    for (int b = 0; b < 8; ++b) {
+        for (int i = 0; i < grown.outputs; ++i)
+            BOOST_REQUIRE_SMALL(grown.output[b * grown.outputs + i] - single[i], 1e-4f);
+    }
+    BOOST_REQUIRE(!aq::nodes::reshapeDarknet(net.get(), 8, width, height));
+}
@@ -0,0 +1,201 @@
+#include "BatchRunner.hpp"
+#include "NodeStats.hpp"
+#include "StreamPlacement.hpp"
+#include "StreamRun.hpp"
+
+#include <Aquila/core/IDataStream.hpp>
+#include <Aquila/core/Logging.hpp>
+#include <Aquila/framegrabbers/IFrameGrabber.hpp>
+
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <signal.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace {
+typedef FrameTracker::Clock Clock;
+
+// Only set by the handler, the main loop reports it, nothing else is async signal safe
+static volatile sig_atomic_t g_interrupted = 0;
+
+void batchSigHandler(int) {
+    g_interrupted = 1;
+}
+
+double toMs(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+struct BatchStream {
+    std::unique_ptr<FrameTracker> tracker;
+    std::string                   name;
+};
+
+std::string streamName(const rcc::shared_ptr<aq::IDataStream>& stream, const std::string& fallback) {
+    for (auto& node : stream->getTopLevelNodes()) {
+        if (auto fg = node.DynamicCast<aq::nodes::IFrameGrabber>()) {
+            if (!fg->loaded_document.empty())
+                return fg->loaded_document;
+        }
+    }
+    return fallback;
+}
+}
+
+int runBatch(const boost::program_options::variables_map& vm,
+    std::map<std::string, std::string>&                   variable_replace_map,
+    std::map<std::string, std::string>&                   replace_map,
+    volatile bool&                                        quit) {
+    std::vector<std::unique_ptr<BatchStream> > streams;
+    bool                                        failed = false;
+    auto add_streams = [&streams](const std::vector<rcc::shared_ptr<aq::IDataStream> >& loaded, const std::string& source) {
+        for (auto& stream : loaded) {
+            std::unique_ptr<BatchStream> batch(new BatchStream());
+            batch->tracker.reset(new FrameTracker(stream));
+            batch->name = source;
+            streams.push_back(std::move(batch));
+        }
+    };
+    auto load_config = [&](std::string file, const std::string& preset) {
+        replace_map["${config_file_dir}"] = boost::filesystem::path(file).parent_path().string();
+        auto loaded                       = aq::IDataStream::load(file, variable_replace_map, replace_map, preset);
+        if (loaded.empty()) {
+            MO_LOG(error) << "Load of " << file << " failed";
+            failed = true;
+        }
+        PlacementRegistry::instance()->applyConfig(file, loaded);
+        add_streams(loaded, file);
+    };
+    if (vm.count("config"))
+        load_config(vm["config"].as<std::string>(), vm["preset"].as<std::string>());
+    if (vm.count("launch"))
+        load_config(vm["launch"].as<std::string>(), "Default");
+    if (vm.count("file")) {
+        const std::string file = vm["file"].as<std::string>();
+        auto              ds   = aq::IDataStream::create(file, "");
+        if (ds) {
+            add_streams({ds}, file);
+        } else {
+            MO_LOG(error) << "Unable to create a data stream for " << file;
+            failed = true;
+        }
+    }
+    if (streams.empty()) {
+        MO_LOG(error) << "Batch mode needs at least one stream from --config, --launch or --file";
+        return 1;
+    }
+    if (failed)
+        return 1;
+
+    boost::mutex              mtx;
+    boost::condition_variable cv;
+    for (auto& batch : streams) {
+        batch->name = streamName(batch->tracker->getStream(), batch->name);
+        // Only wakes the main loop early, it polls the trackers anyway so a missed notification costs one period
+        batch->tracker->attach([&cv]() { cv.notify_all(); });
+        StatsRegistry::instance()->add(batch->tracker->getStream());
+    }
+
+    g_interrupted = 0;
+    signal(SIGINT, batchSigHandler);
+    const int               stall_timeout = vm["batch-stall-timeout"].as<int>();
+    const int               run_time      = vm.count("profile-for") ? vm["profile-for"].as<int>() : -1;
+    const Clock::time_point start         = Clock::now();
+    for (auto& batch : streams)
+        batch->tracker->getStream()->startThread();
+
+    bool stalled   = false;
+    bool timed_out = false;
+    {
+        boost::mutex::scoped_lock lock(mtx);
+        Clock::time_point         last_progress = start;
+        size_t                    last_updates  = 0;
+        while (!quit) {
+            if (g_interrupted) {
+                std::cout << "Caught SIGINT, stopping batch run" << std::endl;
+                quit = true;
+                break;
+            }
+            bool   all_eos = true;
+            size_t updates = 0;
+            for (auto& batch : streams) {
+                all_eos = all_eos && batch->tracker->eos();
+                updates += batch->tracker->updates();
+            }
+            if (all_eos)
+                break;
+            const Clock::time_point now = Clock::now();
+            if (updates != last_updates) {
+                last_updates  = updates;
+                last_progress = now;
+            }
+            if (stall_timeout > 0 && now - last_progress > std::chrono::seconds(stall_timeout)) {
+                stalled = true;
+                break;
+            }
+            if (run_time != -1 && now - start > std::chrono::seconds(run_time)) {
+                timed_out = true;
+                break;
+            }
+            cv.wait_for(lock, boost::chrono::milliseconds(100));
+        }
+    }
+    const Clock::time_point end = Clock::now();
+    for (auto& batch : streams)
+        batch->tracker->getStream()->stopThread();
+    signal(SIGINT, SIG_DFL);
+
+    LatencyHistogram total;
+    std::cout << std::fixed << std::setprecision(2) << "Batch report\n";
+    for (auto& batch : streams) {
+        FrameTracker& tracker = *batch->tracker;
+        tracker.finish();
+        const LatencyHistogram& latency = tracker.latency();
+        const uint64_t          frames  = latency.count();
+        const double            seconds = tracker.anyOutput() ? toMs(tracker.lastOutput() - tracker.firstOutput()) / 1000.0 : 0.0;
+        std::cout << " - " << batch->name << "\n"
+                  << "    frames " << frames << ", " << (seconds > 0.0 ? static_cast<double>(frames) / seconds : 0.0) << " fps"
+                  << (tracker.eos() ? "" : ", no end of stream") << "\n"
+                  << "    latency ms mean " << latency.mean() / 1000.0 << ", p50 " << latency.percentile(0.5) / 1000.0 << ", p95 "
+                  << latency.percentile(0.95) / 1000.0 << ", p99 " << latency.percentile(0.99) / 1000.0 << ", max " << latency.max() / 1000.0
+                  << "\n";
+        if (frames == 0) {
+            MO_LOG(error) << batch->name << " did not produce any frames";
+            failed = true;
+        }
+        if (StreamStats* stats = StatsRegistry::instance()->get(tracker.getStream().get())) {
+            stats->print(std::cout);
+        }
+        total.merge(latency);
+    }
+    const double wall = toMs(end - start) / 1000.0;
+    std::cout << " - total: " << streams.size() << " streams, " << total.count() << " frames in " << wall << " s, "
+              << (wall > 0.0 ? static_cast<double>(total.count()) / wall : 0.0) << " fps, latency p50 " << total.percentile(0.5) / 1000.0
+              << " ms, p99 " << total.percentile(0.99) / 1000.0 << " ms" << std::endl;
+
+    if (stalled) {
+        MO_LOG(error) << "No output for " << stall_timeout << " seconds, aborting batch run";
+        failed = true;
+    }
+    if (quit) {
+        MO_LOG(error) << "Batch run interrupted";
+        failed = true;
+    }
+    if (timed_out)
+        MO_LOG(info) << "Stopped after " << run_time << " seconds";
+    // Final stats of the run before the streams go away
+    if (vm.count("stats-file"))
+        StatsRegistry::instance()->dump(vm["stats-file"].as<std::string>());
+    for (auto& batch : streams)
+        StatsRegistry::instance()->remove(batch->tracker->getStream().get());
+    streams.clear();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <boost/program_options.hpp>
+
+#include <map>
+#include <string>
+
+// Headless processing of the streams given by --config, --launch and --file.  Streams run unthrottled
+// without the gui thread or console input until every stream signals end of stream, then a throughput
+// and latency report is printed.  Returns the process exit code, non zero if a stream failed to load,
+// stalled, produced no frames or the run was interrupted.
+int runBatch(const boost::program_options::variables_map& vm,
+    std::map<std::string, std::string>&                   variable_replace_map,
+    std::map<std::string, std::string>&                   replace_map,
+    volatile bool&                                        quit);
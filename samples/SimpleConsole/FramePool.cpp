@@ -0,0 +1,303 @@
+#include "FramePool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <cuda_runtime_api.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+const size_t cache_line = 64;
+const size_t page       = 4096;
+const size_t huge_page  = 2 * 1024 * 1024;
+
+// Gives the arena back when its thread exits, so that the cache of short lived threads does not linger
+struct ThreadArena {
+    FramePool::Arena* arena = nullptr;
+    ~ThreadArena() {
+        if (arena)
+            FramePool::instance()->retireArena(*arena);
+    }
+};
+
+thread_local ThreadArena t_arena;
+
+void updatePeak(std::atomic<uint64_t>& peak, uint64_t value) {
+    uint64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+double megabytes(uint64_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+} // namespace
+
+FramePool* FramePool::instance() {
+    static FramePool* pool = new FramePool();
+    return pool;
+}
+
+FramePool::FramePool()
+    : m_min_pooled(64 * 1024)
+    , m_max_cached(size_t(512) * 1024 * 1024)
+    , m_huge_pages(false)
+    , m_pinned(true) {
+}
+
+void FramePool::setLimits(size_t min_pooled, size_t max_cached) {
+    m_min_pooled = min_pooled;
+    m_max_cached = max_cached;
+}
+
+void FramePool::setHugePages(bool enabled) {
+    m_huge_pages = enabled;
+}
+
+void FramePool::setPinned(bool enabled) {
+    m_pinned = enabled;
+}
+
+size_t FramePool::sizeClass(size_t bytes) {
+    bytes = std::max<size_t>((bytes + page - 1) & ~(page - 1), page);
+    // Eight classes per power of two, a buffer wastes at most an eighth of its size
+    size_t top = 1;
+    while ((top << 1) <= bytes)
+        top <<= 1;
+    const size_t step = std::max(top / 8, page);
+    return (bytes + step - 1) / step * step;
+}
+
+FramePool::Arena* FramePool::arena() const {
+    if (!t_arena.arena) {
+        std::stringstream ss;
+        ss << "thread " << std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(m_mtx);
+        Arena*                      adopted = nullptr;
+        for (auto& existing : m_arenas) {
+            std::lock_guard<std::mutex> arena_lock(existing->mtx);
+            if (existing->retired) {
+                existing->retired = false;
+                existing->name    = ss.str();
+                adopted           = existing.get();
+                break;
+            }
+        }
+        if (!adopted) {
+            m_arenas.emplace_back(new Arena());
+            m_arenas.back()->name = ss.str();
+            adopted               = m_arenas.back().get();
+        }
+        t_arena.arena = adopted;
+    }
+    return t_arena.arena;
+}
+
+void FramePool::retireArena(Arena& arena) const {
+    {
+        std::lock_guard<std::mutex> lock(arena.mtx);
+        arena.retired = true;
+    }
+    releaseArena(arena);
+}
+
+void FramePool::nameArena(const std::string& name) {
+    Arena* current = arena();
+    std::lock_guard<std::mutex> lock(current->mtx);
+    current->name = name;
+}
+
+void* FramePool::allocateBlock(size_t bytes) const {
+    const bool   huge      = m_huge_pages && bytes >= huge_page;
+    // Page locking works on whole pages, two blocks must never share one
+    const size_t alignment = huge ? huge_page : m_pinned ? page : cache_line;
+#ifdef _WIN32
+    void* ptr = _aligned_malloc(bytes, alignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, bytes) != 0)
+        ptr = nullptr;
+#ifdef MADV_HUGEPAGE
+    // Only a hint, without THP support in the kernel the buffer simply uses regular pages
+    if (ptr && huge)
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+    if (!ptr)
+        CV_Error(cv::Error::StsNoMem, "Failed to allocate " + std::to_string(bytes) + " bytes");
+    if (m_pinned) {
+        if (cudaHostRegister(ptr, bytes, cudaHostRegisterPortable) == cudaSuccess) {
+            std::lock_guard<std::mutex> lock(m_pinned_mtx);
+            m_registered.insert(ptr);
+        } else {
+            // Still usable, uploads from it are staged through a driver buffer
+            cudaGetLastError();
+        }
+    }
+    return ptr;
+}
+
+void FramePool::freeBlock(void* ptr) const {
+    bool registered = false;
+    {
+        std::lock_guard<std::mutex> lock(m_pinned_mtx);
+        registered = m_registered.erase(ptr) != 0;
+    }
+    if (registered)
+        cudaHostUnregister(ptr);
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+cv::UMatData* FramePool::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, int /*flags*/, cv::UMatUsageFlags /*usage*/) const {
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+    cv::UMatData* u = new cv::UMatData(this);
+    u->size         = total;
+    if (data0) {
+        u->data = u->origdata = static_cast<uchar*>(data0);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+    Arena* current = arena();
+    if (total < m_min_pooled) {
+        ++current->bypassed;
+        u->data = u->origdata = static_cast<uchar*>(cv::fastMalloc(total));
+        return u;
+    }
+    const size_t bytes = sizeClass(total);
+    void*        ptr   = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(current->mtx);
+        auto itr = current->free.find(bytes);
+        if (itr != current->free.end() && !itr->second.empty()) {
+            ptr = itr->second.back();
+            itr->second.pop_back();
+            current->cached -= bytes;
+            m_cached -= bytes;
+        }
+    }
+    if (ptr) {
+        ++current->hits;
+    } else {
+        ++current->misses;
+        ptr = allocateBlock(bytes);
+    }
+    updatePeak(current->peak, current->in_use += bytes);
+    u->data = u->origdata = static_cast<uchar*>(ptr);
+    // The owning arena, released buffers go back to it from whichever thread drops the last reference
+    u->userdata = current;
+    return u;
+}
+
+bool FramePool::allocate(cv::UMatData* u, int /*access*/, cv::UMatUsageFlags /*usage*/) const {
+    return u != nullptr;
+}
+
+void FramePool::deallocate(cv::UMatData* u) const {
+    if (!u)
+        return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        Arena* owner = static_cast<Arena*>(u->userdata);
+        if (!owner) {
+            cv::fastFree(u->origdata);
+        } else {
+            const size_t bytes = sizeClass(u->size);
+            owner->in_use -= bytes;
+            bool cached = false;
+            {
+                std::lock_guard<std::mutex> lock(owner->mtx);
+                if (!owner->retired) {
+                    // Reserve room in the shared limit first, other arenas cache concurrently
+                    if (m_cached.fetch_add(bytes) + bytes <= m_max_cached) {
+                        owner->free[bytes].push_back(u->origdata);
+                        owner->cached += bytes;
+                        cached = true;
+                    } else {
+                        m_cached -= bytes;
+                    }
+                }
+            }
+            if (!cached)
+                freeBlock(u->origdata);
+        }
+        u->origdata = 0;
+    }
+    delete u;
+}
+
+void FramePool::releaseArena(Arena& arena) const {
+    std::vector<void*> blocks;
+    {
+        std::lock_guard<std::mutex> lock(arena.mtx);
+        for (auto& bin : arena.free)
+            blocks.insert(blocks.end(), bin.second.begin(), bin.second.end());
+        arena.free.clear();
+        m_cached -= arena.cached;
+        arena.cached = 0;
+    }
+    for (void* ptr : blocks)
+        freeBlock(ptr);
+}
+
+void FramePool::release() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto& arena : m_arenas)
+        releaseArena(*arena);
+}
+
+void FramePool::resetCounters() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto& arena : m_arenas) {
+        arena->hits     = 0;
+        arena->misses   = 0;
+        arena->bypassed = 0;
+        arena->peak     = arena->in_use.load();
+    }
+}
+
+void FramePool::print(std::ostream& os) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_arenas.empty()) {
+        os << "No frames allocated from the frame pool\n";
+        return;
+    }
+    os << std::left << std::setw(32) << "arena" << std::right << std::setw(10) << "hits" << std::setw(10) << "misses" << std::setw(8) << "hit %"
+       << std::setw(10) << "small" << std::setw(12) << "in use MB" << std::setw(12) << "peak MB" << std::setw(12) << "cached MB"
+       << "\n";
+    for (auto& arena : m_arenas) {
+        const uint64_t hits   = arena->hits;
+        const uint64_t misses = arena->misses;
+        std::string    name;
+        {
+            std::lock_guard<std::mutex> arena_lock(arena->mtx);
+            name = arena->name;
+        }
+        os << std::left << std::setw(32) << name << std::right << std::setw(10) << hits << std::setw(10) << misses << std::setw(8) << std::fixed
+           << std::setprecision(1) << (hits + misses ? 100.0 * hits / (hits + misses) : 0.0) << std::setw(10) << arena->bypassed << std::setw(12)
+           << megabytes(arena->in_use) << std::setw(12) << megabytes(arena->peak) << std::setw(12) << megabytes(arena->cached) << "\n";
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Host cv::Mat allocator that keeps released frame buffers for reuse.  Every thread allocates from its own
+// arena, stream threads are dedicated so an arena holds the recurring frame shapes of one stream.  Buffers
+// are binned into size classes of 1/8 of a power of two so that frames of the same shape always land in the
+// same free list, and they go back to the arena that made them as soon as the last Mat or SyncedMemory
+// referencing them is released, whichever thread that happens on.  Small allocations are not worth caching
+// and go straight to cv::fastMalloc.  The cache limit is shared by all arenas, the arena of a thread that
+// exits frees its cache and is handed to the next new thread.  Pooled buffers are page locked with
+// cudaHostRegister by default, like the pinned allocator this replaces, so that uploads are a single DMA
+// instead of a staged copy.  Registering is costly but only happens when a block is first allocated.
+class FramePool : public cv::MatAllocator {
+  public:
+    struct Arena {
+        std::string name;
+        std::mutex  mtx;
+        // Its thread exited, released buffers are freed instead of cached
+        bool retired = false;
+        // Free buffers by size class
+        std::map<size_t, std::vector<void*>> free;
+        std::atomic<uint64_t>                hits{0};
+        std::atomic<uint64_t>                misses{0};
+        std::atomic<uint64_t>                bypassed{0};
+        std::atomic<uint64_t>                in_use{0};
+        std::atomic<uint64_t>                peak{0};
+        std::atomic<uint64_t>                cached{0};
+    };
+
+    // Never destroyed, Mats released during static destruction still find their arena
+    static FramePool* instance();
+
+    // Smallest buffer that is pooled, and the most all arenas together keep cached before buffers are freed instead
+    void setLimits(size_t min_pooled, size_t max_cached);
+    // Back buffers of 2MB and more with transparent huge pages where the kernel supports it
+    void setHugePages(bool enabled);
+    // Page lock pooled buffers, on by default.  Only affects blocks allocated afterwards.
+    void setPinned(bool enabled);
+
+    // Arena of the calling thread, created on first use
+    Arena* arena() const;
+    // Names the calling thread's arena for print, usually after the stream it processes
+    void nameArena(const std::string& name);
+    // Frees the cache of the arena of an exiting thread and marks it for reuse, called from a thread_local destructor
+    void retireArena(Arena& arena) const;
+
+    // Frees every cached buffer, buffers in use are returned as usual
+    void release();
+    void resetCounters();
+    void print(std::ostream& os) const;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usage) const override;
+    bool allocate(cv::UMatData* data, int access, cv::UMatUsageFlags usage) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    static size_t sizeClass(size_t bytes);
+
+  private:
+    FramePool();
+
+    void* allocateBlock(size_t bytes) const;
+    void  freeBlock(void* ptr) const;
+    void  releaseArena(Arena& arena) const;
+
+    mutable std::mutex                          m_mtx;
+    mutable std::vector<std::unique_ptr<Arena>> m_arenas;
+    std::atomic<size_t>                         m_min_pooled;
+    std::atomic<size_t>                         m_max_cached;
+    mutable std::atomic<uint64_t>               m_cached{0};
+    std::atomic<bool>                           m_huge_pages;
+    std::atomic<bool>                           m_pinned;
+    // Blocks registered with cuda, a failed registration leaves a block pageable
+    mutable std::mutex                          m_pinned_mtx;
+    mutable std::unordered_set<void*>           m_registered;
+};
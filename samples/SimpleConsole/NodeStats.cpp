@@ -0,0 +1,411 @@
+#include "NodeStats.hpp"
+#include "StreamRun.hpp"
+
+#include <Aquila/core/Logging.hpp>
+#include <Aquila/types/SyncedMemory.hpp>
+
+#include <MetaObject/params/ITParam.hpp>
+#include <MetaObject/params/InputParam.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+namespace {
+uint64_t payloadBytes(mo::IParam* param) {
+    auto typed = dynamic_cast<mo::ITParam<aq::SyncedMemory>*>(param);
+    if (!typed)
+        return 0;
+    aq::SyncedMemory data;
+    if (!typed->getData(data))
+        return 0;
+    const cv::Size size = data.getSize();
+    return static_cast<uint64_t>(size.area()) * CV_ELEM_SIZE(data.getType());
+}
+
+void atomicMax(std::atomic<uint64_t>& value, uint64_t candidate) {
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+std::string jsonEscape(const std::string& str) {
+    std::string out;
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+// Frames for which a node still waits for an output
+const size_t max_pending_frames = 64;
+
+// Nodes that run their children off the stream thread, on a worker or spread over the thread pool
+bool runsChildrenConcurrently(aq::nodes::Node* node) {
+    const std::string type = node->GetTypeName();
+    return type == "PipelineStage" || type == "ParallelBranches";
+}
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+size_t LatencyHistogram::index(uint64_t us) {
+    us = std::min<uint64_t>(us, (uint64_t(1) << magnitudes) - 1);
+    if (us < static_cast<uint64_t>(sub_count))
+        return static_cast<size_t>(us);
+    int msb = 0;
+    for (uint64_t x = us; x >>= 1;)
+        ++msb;
+    const int shift = msb - sub_bits;
+    return static_cast<size_t>(shift + 1) * sub_count + static_cast<size_t>((us >> shift) - sub_count);
+}
+
+uint64_t LatencyHistogram::upper(size_t idx) {
+    if (idx < static_cast<size_t>(sub_count))
+        return idx;
+    const size_t   shift    = idx / sub_count - 1;
+    const uint64_t mantissa = idx % sub_count + sub_count;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    m_buckets[index(us)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(us, std::memory_order_relaxed);
+    atomicMax(m_max, us);
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < bucket_count; ++i)
+        m_buckets[i].fetch_add(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_count.fetch_add(other.count(), std::memory_order_relaxed);
+    m_sum.fetch_add(other.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    atomicMax(m_max, other.max());
+}
+
+double LatencyHistogram::mean() const {
+    const uint64_t n = count();
+    return n ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / static_cast<double>(n) : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    const uint64_t n = count();
+    if (n == 0)
+        return 0;
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::min(std::max(p, 0.0), 1.0) * static_cast<double>(n))));
+    uint64_t       seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(upper(i), max());
+    }
+    return max();
+}
+
+void NodeStats::reset() {
+    latency.reset();
+    calls     = 0;
+    skips     = 0;
+    frames_in = 0;
+    bytes_in  = 0;
+    bytes_out = 0;
+}
+
+StreamStats::StreamStats(const rcc::shared_ptr<aq::IDataStream>& stream, bool payload_bytes)
+    : m_stream(stream)
+    , m_payload_bytes(payload_bytes) {
+    attach();
+}
+
+void StreamStats::attach() {
+    if (!m_stream)
+        return;
+    boost::mutex::scoped_lock lock(m_mtx);
+    std::set<aq::nodes::Node*> concurrent;
+    forEachNode(*m_stream, [&concurrent](aq::nodes::Node* node) {
+        if (!runsChildrenConcurrently(node))
+            return;
+        // A PipelineStage's own output is published from its worker as well
+        if (node->GetTypeName() == std::string("PipelineStage"))
+            concurrent.insert(node);
+        std::vector<aq::nodes::Node*> pending;
+        for (auto& child : node->getChildren())
+            pending.push_back(child.get());
+        while (!pending.empty()) {
+            aq::nodes::Node* current = pending.back();
+            pending.pop_back();
+            if (!concurrent.insert(current).second)
+                continue;
+            for (auto& child : current->getChildren())
+                pending.push_back(child.get());
+        }
+    });
+    forEachNode(*m_stream, [this, &concurrent](aq::nodes::Node* node) {
+        const std::string name    = node->getTreeName();
+        auto&             tracker = m_trackers[name];
+        if (!tracker) {
+            tracker.reset(new Tracker());
+            tracker->stats.name = name;
+            m_order.push_back(name);
+        }
+        Tracker* ptr = tracker.get();
+        ptr->stats.measured = !concurrent.count(node);
+        // Inputs are hooked at their source so that readiness is seen when the producer publishes
+        for (mo::InputParam* input : node->getInputs()) {
+            mo::IParam* source = input->getInputParam();
+            if (!source || !m_hooked.insert(std::make_pair(ptr, source)).second)
+                continue;
+            ptr->slots.emplace_back(new UpdateSlot(
+                [this, ptr](mo::IParam* param, mo::Context*, mo::OptionalTime_t, size_t fn, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags) {
+                    onInput(ptr, param, fn);
+                }));
+            m_connections.push_back(source->registerUpdateNotifier(ptr->slots.back().get()));
+        }
+        for (mo::IParam* output : node->getOutputs()) {
+            ptr->stats.has_outputs = true;
+            if (!m_hooked.insert(std::make_pair(ptr, output)).second)
+                continue;
+            ptr->slots.emplace_back(new UpdateSlot(
+                [this, ptr](mo::IParam* param, mo::Context*, mo::OptionalTime_t, size_t fn, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags) {
+                    onOutput(ptr, param, fn);
+                }));
+            m_connections.push_back(output->registerUpdateNotifier(ptr->slots.back().get()));
+        }
+    });
+}
+
+void StreamStats::onInput(Tracker* tracker, mo::IParam* param, size_t fn) {
+    if (m_payload_bytes)
+        tracker->stats.bytes_in += payloadBytes(param);
+    const Clock::time_point   now = Clock::now();
+    boost::mutex::scoped_lock lock(tracker->mtx);
+    auto itr = tracker->ready.find(fn);
+    if (itr != tracker->ready.end()) {
+        // Another input of a join, the frame is ready once the last one arrives
+        itr->second = now;
+        return;
+    }
+    ++tracker->stats.frames_in;
+    // Earlier frames that never got an output were skipped by the node
+    while (!tracker->ready.empty() && (tracker->ready.begin()->first < fn || tracker->ready.size() >= max_pending_frames)) {
+        const size_t old = tracker->ready.begin()->first;
+        if (tracker->stats.has_outputs && !tracker->produced.count(old))
+            ++tracker->stats.skips;
+        tracker->produced.erase(old);
+        tracker->ready.erase(tracker->ready.begin());
+    }
+    tracker->ready[fn] = now;
+    if (!tracker->stats.has_outputs)
+        ++tracker->stats.calls;
+}
+
+void StreamStats::onOutput(Tracker* tracker, mo::IParam* param, size_t fn) {
+    if (m_payload_bytes)
+        tracker->stats.bytes_out += payloadBytes(param);
+    const Clock::time_point now = Clock::now();
+    // Publishes from other threads say nothing about when the stream thread moved on to its next node
+    const Clock::time_point previous = tracker->stats.measured
+                                           ? Clock::time_point(Clock::duration(m_last_publish.exchange(now.time_since_epoch().count())))
+                                           : Clock::time_point();
+    boost::mutex::scoped_lock lock(tracker->mtx);
+    if (!tracker->produced.insert(fn).second)
+        return;
+    ++tracker->stats.calls;
+    while (tracker->produced.size() > max_pending_frames)
+        tracker->produced.erase(tracker->produced.begin());
+    if (!tracker->stats.measured)
+        return;
+    Clock::time_point start;
+    auto              itr = tracker->ready.find(fn);
+    if (itr != tracker->ready.end()) {
+        start = std::max(itr->second, previous);
+    } else if (tracker->ready.empty() && previous != Clock::time_point()) {
+        // Sources have no inputs, their frame starts when the stream published the previous output
+        start = previous;
+    } else {
+        return;
+    }
+    tracker->stats.latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count()));
+}
+
+void StreamStats::reset() {
+    boost::mutex::scoped_lock lock(m_mtx);
+    for (auto& tracker : m_trackers)
+        tracker.second->stats.reset();
+}
+
+const NodeStats* StreamStats::find(const std::string& node) const {
+    boost::mutex::scoped_lock lock(m_mtx);
+    auto                      itr = m_trackers.find(node);
+    return itr == m_trackers.end() ? nullptr : &itr->second->stats;
+}
+
+void StreamStats::printNode(std::ostream& os, const NodeStats& stats) const {
+    const LatencyHistogram& latency = stats.latency;
+    os << std::fixed << std::setprecision(3);
+    if (stats.measured)
+        os << "Latency ms: mean " << latency.mean() / 1000.0 << " p50 " << latency.percentile(0.5) / 1000.0
+           << " p90 " << latency.percentile(0.9) / 1000.0 << " p99 " << latency.percentile(0.99) / 1000.0
+           << " max " << latency.max() / 1000.0 << " (" << latency.count() << " samples)\n";
+    else
+        os << "Latency ms: not measured, runs concurrently\n";
+    os << "Calls: " << stats.calls << " Skips: " << stats.skips << " Frames in: " << stats.frames_in;
+    if (m_payload_bytes)
+        os << " MB in: " << stats.bytes_in / (1024.0 * 1024.0) << " MB out: " << stats.bytes_out / (1024.0 * 1024.0);
+    os << std::endl;
+}
+
+void StreamStats::print(std::ostream& os) const {
+    boost::mutex::scoped_lock lock(m_mtx);
+    for (const auto& name : m_order) {
+        os << "--------\n"
+           << name << std::endl;
+        printNode(os, m_trackers.find(name)->second->stats);
+    }
+}
+
+void StreamStats::writeJson(std::ostream& os) const {
+    boost::mutex::scoped_lock lock(m_mtx);
+    os << "{\"nodes\": [";
+    for (size_t i = 0; i < m_order.size(); ++i) {
+        const NodeStats&        stats   = m_trackers.find(m_order[i])->second->stats;
+        const LatencyHistogram& latency = stats.latency;
+        os << (i ? ", " : "") << "{\"name\": \"" << jsonEscape(stats.name) << "\""
+           << ", \"calls\": " << stats.calls << ", \"skips\": " << stats.skips << ", \"frames_in\": " << stats.frames_in;
+        if (m_payload_bytes)
+            os << ", \"bytes_in\": " << stats.bytes_in << ", \"bytes_out\": " << stats.bytes_out;
+        if (!stats.measured) {
+            os << ", \"latency_us\": null}";
+            continue;
+        }
+        os << ", \"latency_us\": {\"count\": " << latency.count() << ", \"mean\": " << static_cast<uint64_t>(latency.mean())
+           << ", \"p50\": " << latency.percentile(0.5) << ", \"p90\": " << latency.percentile(0.9)
+           << ", \"p99\": " << latency.percentile(0.99) << ", \"p999\": " << latency.percentile(0.999)
+           << ", \"max\": " << latency.max() << "}}";
+    }
+    os << "]}";
+}
+
+StatsRegistry* StatsRegistry::instance() {
+    static StatsRegistry registry;
+    return &registry;
+}
+
+StatsRegistry::~StatsRegistry() {
+    dumpEvery(std::string(), 0);
+}
+
+StreamStats* StatsRegistry::add(const rcc::shared_ptr<aq::IDataStream>& stream) {
+    boost::mutex::scoped_lock lock(m_mtx);
+    for (auto& stats : m_streams) {
+        if (stats->getStream() == stream.get()) {
+            stats->attach();
+            return stats.get();
+        }
+    }
+    m_streams.emplace_back(new StreamStats(stream, m_payload_bytes));
+    return m_streams.back().get();
+}
+
+StreamStats* StatsRegistry::get(const aq::IDataStream* stream) const {
+    boost::mutex::scoped_lock lock(m_mtx);
+    for (auto& stats : m_streams) {
+        if (stats->getStream() == stream)
+            return stats.get();
+    }
+    return nullptr;
+}
+
+void StatsRegistry::remove(const aq::IDataStream* stream) {
+    boost::mutex::scoped_lock lock(m_mtx);
+    m_streams.erase(std::remove_if(m_streams.begin(), m_streams.end(), [stream](const std::unique_ptr<StreamStats>& stats) {
+        return stats->getStream() == stream;
+    }),
+        m_streams.end());
+}
+
+void StatsRegistry::clear() {
+    boost::mutex::scoped_lock lock(m_mtx);
+    m_streams.clear();
+}
+
+void StatsRegistry::setPayloadBytes(bool enabled) {
+    boost::mutex::scoped_lock lock(m_mtx);
+    m_payload_bytes = enabled;
+    for (auto& stats : m_streams)
+        stats->setPayloadBytes(enabled);
+}
+
+void StatsRegistry::writeJson(std::ostream& os) const {
+    boost::mutex::scoped_lock lock(m_mtx);
+    os << "{\"timestamp_ms\": "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+       << ", \"streams\": [";
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+        os << (i ? ", " : "");
+        m_streams[i]->writeJson(os);
+    }
+    os << "]}\n";
+}
+
+bool StatsRegistry::dump(const std::string& file) const {
+    const std::string tmp = file + ".tmp";
+    {
+        std::ofstream ofs(tmp);
+        if (!ofs.is_open())
+            return false;
+        writeJson(ofs);
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, file, ec);
+    return !ec;
+}
+
+void StatsRegistry::dumpEvery(const std::string& file, int interval_ms) {
+    const int interval = file.empty() ? 0 : interval_ms;
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        m_dump_file     = file;
+        m_dump_interval = interval;
+    }
+    m_dump_cv.notify_all();
+    if (interval <= 0) {
+        if (m_dump_thread.joinable())
+            m_dump_thread.join();
+        return;
+    }
+    if (!m_dump_thread.joinable())
+        m_dump_thread = boost::thread([this]() { dumpLoop(); });
+}
+
+void StatsRegistry::dumpLoop() {
+    mo::setThreadName("stats-dump");
+    boost::mutex::scoped_lock lock(m_mtx);
+    while (m_dump_interval > 0) {
+        m_dump_cv.wait_for(lock, boost::chrono::milliseconds(m_dump_interval));
+        if (m_dump_interval <= 0)
+            break;
+        const std::string file = m_dump_file;
+        lock.unlock();
+        if (!dump(file)) {
+            MO_LOG_EVERY_N(warning, 100) << "Unable to write node stats to " << file;
+        }
+        lock.lock();
+    }
+}
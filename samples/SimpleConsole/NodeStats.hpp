@@ -0,0 +1,153 @@
+#pragma once
+#include <Aquila/core/IDataStream.hpp>
+#include <Aquila/nodes/Node.hpp>
+
+#include <MetaObject/params/IParam.hpp>
+#include <MetaObject/signals/TSlot.hpp>
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Log linear latency histogram in microseconds, 32 buckets per power of two so any recorded value is
+// within ~3% of its bucket.  Recording is wait free so that stream threads never block on readers.
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void record(uint64_t us);
+    void reset();
+    // Adds the values recorded by other, used to total the histograms of several streams
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double   mean() const;
+    // Upper edge of the bucket holding the p-th value, p in [0, 1]
+    uint64_t percentile(double p) const;
+
+  private:
+    static const int    sub_bits     = 5;
+    static const int    sub_count    = 1 << sub_bits;
+    static const int    magnitudes   = 40;
+    static const size_t bucket_count = (magnitudes - sub_bits + 1) * sub_count + sub_count;
+
+    static size_t   index(uint64_t us);
+    static uint64_t upper(size_t idx);
+
+    std::atomic<uint64_t> m_buckets[bucket_count];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+struct NodeStats {
+    std::string      name;
+    LatencyHistogram latency;
+    // Frames with an output, frames whose input was superseded without an output and input frames
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> skips{0};
+    std::atomic<uint64_t> frames_in{0};
+    // SyncedMemory payload of the inputs and outputs, only counted when payload bytes are enabled
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    bool                  has_outputs = false;
+    // False for nodes run off the stream thread by a PipelineStage or ParallelBranches, nothing orders their
+    // outputs with the rest of the stream so the time from ready to output is not their processing time
+    std::atomic<bool>     measured{true};
+
+    void reset();
+};
+
+// Always on instrumentation of the nodes of one data stream, built on the update notifications of
+// their params so that neither nodes nor the stream have to cooperate.  A node's latency is the time
+// from its frame being ready, the later of its newest input and the previous output published in the
+// stream, to its first output for that frame, which on a serial stream thread is its processing time.
+// Nodes that run concurrently are counted but their latency is not measured, see NodeStats::measured.
+// Every node has its own lock so that publishes of different nodes never wait on each other.
+class StreamStats {
+  public:
+    typedef mo::TSlot<void(mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags)> UpdateSlot;
+
+    explicit StreamStats(const rcc::shared_ptr<aq::IDataStream>& stream, bool payload_bytes = false);
+
+    // Hooks params of nodes added since the last call, safe to call repeatedly
+    void attach();
+    void reset();
+    // Counting bytes reads the data of every published SyncedMemory, it's off unless the MB columns are wanted
+    void setPayloadBytes(bool enabled) { m_payload_bytes = enabled; }
+    bool getPayloadBytes() const { return m_payload_bytes; }
+
+    const NodeStats* find(const std::string& node) const;
+    void             print(std::ostream& os) const;
+    void             printNode(std::ostream& os, const NodeStats& stats) const;
+    void             writeJson(std::ostream& os) const;
+
+    aq::IDataStream* getStream() const { return m_stream.get(); }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Tracker {
+        NodeStats                                 stats;
+        // Guards ready and produced
+        boost::mutex                              mtx;
+        std::map<size_t, Clock::time_point>       ready;
+        std::set<size_t>                          produced;
+        std::vector<std::unique_ptr<UpdateSlot> > slots;
+    };
+
+    void onInput(Tracker* tracker, mo::IParam* param, size_t fn);
+    void onOutput(Tracker* tracker, mo::IParam* param, size_t fn);
+
+    rcc::shared_ptr<aq::IDataStream>                 m_stream;
+    // Guards the tracker map and the hooks, not taken when params publish
+    mutable boost::mutex                             m_mtx;
+    std::map<std::string, std::unique_ptr<Tracker> > m_trackers;
+    std::vector<std::string>                         m_order;
+    std::set<std::pair<Tracker*, mo::IParam*> >      m_hooked;
+    std::vector<std::shared_ptr<mo::Connection> >    m_connections;
+    // Clock::time_point of the last output published in the stream, as ticks since the clock's epoch
+    std::atomic<Clock::rep>                          m_last_publish{0};
+    std::atomic<bool>                                m_payload_bytes;
+};
+
+// Stats of every stream of the process, dumped as JSON to a file on an interval by a background thread
+class StatsRegistry {
+  public:
+    static StatsRegistry* instance();
+
+    StreamStats* add(const rcc::shared_ptr<aq::IDataStream>& stream);
+    StreamStats* get(const aq::IDataStream* stream) const;
+    // The stream's thread has to be stopped first, its params publish into the stats
+    void         remove(const aq::IDataStream* stream);
+    void         clear();
+    // Applies to the stats of every stream, current and future
+    void         setPayloadBytes(bool enabled);
+
+    void writeJson(std::ostream& os) const;
+    // Writes to a temporary file first so that readers never see a partial dump
+    bool dump(const std::string& file) const;
+    // interval_ms <= 0 or an empty file stops dumping
+    void dumpEvery(const std::string& file, int interval_ms);
+
+    ~StatsRegistry();
+
+  private:
+    void dumpLoop();
+
+    mutable boost::mutex                       m_mtx;
+    std::vector<std::unique_ptr<StreamStats> > m_streams;
+    std::string                                m_dump_file;
+    int                                        m_dump_interval = 0;
+    bool                                       m_payload_bytes = false;
+    boost::thread                              m_dump_thread;
+    boost::condition_variable                  m_dump_cv;
+};
@@ -38,6 +38,12 @@
 #include <signal.h> // SIGINT, etc
 
 #include "Aquila/rcc/SystemTable.hpp"
+#include "BatchRunner.hpp"
+#include "FramePool.hpp"
+#include "NodeStats.hpp"
+#include "StaticPlugins.hpp"
+#include "StreamPlacement.hpp"
+#include "StreamRun.hpp"
 #include "MetaObject/MetaParameters.hpp"
 #include <cuda.h>
 #include <cuda_runtime.h>
@@ -138,7 +144,7 @@ void PrintBuffers(aq::nodes::Node* node, std::vector<std::string>& printed_nodes
     }
 }
 
-void printStatus(aq::nodes::Node* node, std::vector<std::string>& printed_nodes){
+void printStatus(aq::nodes::Node* node, std::vector<std::string>& printed_nodes, const StreamStats* stats){
     std::string name = node->getTreeName();
     if (std::find(printed_nodes.begin(), printed_nodes.end(), name) != printed_nodes.end()) {
         return;
@@ -152,10 +158,13 @@ void printStatus(aq::nodes::Node* node, std::vector<std::string>& printed_nodes)
     }else{
         std::cout << "Locked: locked. Modified: " << node->getModified() << std::endl;
     }
+    if (const NodeStats* node_stats = stats ? stats->find(name) : nullptr) {
+        stats->printNode(std::cout, *node_stats);
+    }
 
     auto children = node->getChildren();
     for (auto child : children) {
-        printStatus(child.get(), printed_nodes);
+        printStatus(child.get(), printed_nodes, stats);
     }
 }
 
@@ -221,7 +230,15 @@ int main(int argc, char* argv[]) {
             ("disable-rcc", boost::program_options::bool_switch(), "Disable rcc")
             ("quit-on-eos", boost::program_options::bool_switch(), "Quit program on end of stream signal")
             ("disable-input", boost::program_options::bool_switch(), "Disable input for batch scripting, and nvprof")
+            ("batch-stall-timeout", boost::program_options::value<int>()->default_value(60), "Batch mode - seconds without any output before the run fails, 0 disables")
             ("profile-for", boost::program_options::value<int>(), "Amount of time to run before quitting, use with profiler")
+            ("stats-file", boost::program_options::value<std::string>(), "Periodically write per node latency and throughput stats as JSON to this file")
+            ("stats-interval", boost::program_options::value<int>()->default_value(1000), "Interval in ms between stats-file writes")
+            ("stats-bytes", boost::program_options::bool_switch(), "Also count the MB of frames flowing in and out of every node, reads every published frame")
+            ("frame-pool", boost::program_options::bool_switch(), "Allocate host frames from per stream pools of reused buffers")
+            ("frame-pool-thp", boost::program_options::bool_switch(), "Back pooled frames of 2MB and more with transparent huge pages")
+            ("frame-pool-pageable", boost::program_options::bool_switch(), "Do not page lock pooled frames, saves the cudaHostRegister call per new buffer but uploads are staged through a driver buffer")
+            ("frame-pool-cache", boost::program_options::value<int>()->default_value(512), "MB of released frames kept for reuse by all streams together")
             ("preset", boost::program_options::value<std::string>()->default_value("Default"), "Preset config file setting");
     // clang-format on
     boost::program_options::variables_map vm;
@@ -245,7 +262,14 @@ int main(int argc, char* argv[]) {
     if (!mo::GpuThreadAllocatorSetter<cv::cuda::GpuMat>::Set(g_allocator)) {
         MO_LOG(info) << "Unable to set thread specific gpu allocator in opencv";
     }
-    if (!mo::CpuThreadAllocatorSetter<cv::Mat>::Set(g_allocator)) {
+    if (vm["frame-pool"].as<bool>()) {
+        // Host frames come from the pool, page locked unless --frame-pool-pageable, device memory stays with the global allocator
+        FramePool* pool = FramePool::instance();
+        pool->setLimits(64 * 1024, size_t(std::max(vm["frame-pool-cache"].as<int>(), 0)) * 1024 * 1024);
+        pool->setHugePages(vm["frame-pool-thp"].as<bool>());
+        pool->setPinned(!vm["frame-pool-pageable"].as<bool>());
+        cv::Mat::setDefaultAllocator(pool);
+    } else if (!mo::CpuThreadAllocatorSetter<cv::Mat>::Set(g_allocator)) {
         MO_LOG(info) << "Unable to set thread specific cpu allocator in opencv";
     }
 
@@ -353,88 +377,76 @@ int main(int argc, char* argv[]) {
 #endif
 #endif
 
+#ifdef AQ_STATIC_PLUGINS
+    // The plugins are part of the executable, their classes only need to be picked up by the factory
+    registerStaticPlugins();
+#else
     currentDir = boost::filesystem::path(currentDir.string() + "/Plugins");
 
     MO_LOG(info) << "Looking for plugins in: " << currentDir.string();
-    boost::filesystem::directory_iterator end_itr;
-    if (boost::filesystem::is_directory(currentDir)) {
-        for (boost::filesystem::directory_iterator itr(currentDir); itr != end_itr; ++itr) {
-            if (boost::filesystem::is_regular_file(itr->path())) {
-#ifdef _MSC_VER
-                if (itr->path().extension() == ".dll")
-#else
-                if (itr->path().extension() == ".so")
+    loadPluginDirectory(currentDir);
 #endif
-                {
-                    std::string file = itr->path().string();
-                    mo::MetaObjectFactory::instance()->loadPlugin(file);
+    // Batch runs have no windows, only interactive sessions pump gui events
+    const bool    batch = vm["mode"].as<std::string>() == "batch";
+    boost::thread gui_thread;
+    if (!batch) {
+        gui_thread = boost::thread([] {
+            mo::ThreadRegistry::instance()->registerThread(mo::ThreadRegistry::GUI);
+            boost::mutex              dummy_mtx; // needed for cv
+            boost::condition_variable cv;
+            auto notifier = mo::ThreadSpecificQueue::registerNotifier([&cv]() {
+                cv.notify_all();
+            });
+            while (!boost::this_thread::interruption_requested()) {
+                mo::setThreadName("SimpleConsole GUI thread");
+                try {
+                    boost::mutex::scoped_lock lock(dummy_mtx);
+                    cv.wait(lock);
+                    mo::ThreadSpecificQueue::run();
+                } catch (boost::thread_interrupted& err) {
+                    (void)err;
+                    break;
+                } catch(mo::ExceptionWithCallStack<cv::Exception>& e){
+                    MO_LOG(debug) << "Opencv exception with callstack " << e.what() << " " << e.callStack();
+                } catch(mo::IExceptionWithCallStackBase& e){
+                    MO_LOG(debug) << "Exception with callstack " << e.callStack();
+                } catch(cv::Exception& e){
+                    MO_LOG(debug) << "OpenCV exception: " << e.what();
+                } catch (...) {
+                    MO_LOG(debug) << "Unknown / unhandled exception thrown in gui thread event handler";
+                }
+                try {
+                    //cv::waitKey(1);
+                    aq::WindowCallbackHandler::EventLoop::Instance()->run();
+                } catch (mo::ExceptionWithCallStack<cv::Exception>& e) {
+                    (void)e;
+
+                } catch (cv::Exception& e) {
+                    (void)e;
+                } catch (boost::thread_interrupted& err) {
+                    break;
+                } catch (...) {
                 }
             }
-        }
-    }
-    boost::thread gui_thread([] {
-        mo::ThreadRegistry::instance()->registerThread(mo::ThreadRegistry::GUI);
-        boost::mutex              dummy_mtx; // needed for cv
-        boost::condition_variable cv;
-        auto notifier = mo::ThreadSpecificQueue::registerNotifier([&cv]() {
-            cv.notify_all();
+            mo::ThreadSpecificQueue::cleanup();
+            MO_LOG(info) << "Gui thread shutting down naturally";
         });
-        while (!boost::this_thread::interruption_requested()) {
-            mo::setThreadName("SimpleConsole GUI thread");
-            try {
-                boost::mutex::scoped_lock lock(dummy_mtx);
-                cv.wait(lock);
-                mo::ThreadSpecificQueue::run();
-            } catch (boost::thread_interrupted& err) {
-                (void)err;
-                break;
-            } catch(mo::ExceptionWithCallStack<cv::Exception>& e){
-                MO_LOG(debug) << "Opencv exception with callstack " << e.what() << " " << e.callStack();
-            } catch(mo::IExceptionWithCallStackBase& e){
-                MO_LOG(debug) << "Exception with callstack " << e.callStack();
-            } catch(cv::Exception& e){
-                MO_LOG(debug) << "OpenCV exception: " << e.what();
-            } catch (...) {
-                MO_LOG(debug) << "Unknown / unhandled exception thrown in gui thread event handler";
-            }
-            try {
-                //cv::waitKey(1);
-                aq::WindowCallbackHandler::EventLoop::Instance()->run();
-            } catch (mo::ExceptionWithCallStack<cv::Exception>& e) {
-                (void)e;
-
-            } catch (cv::Exception& e) {
-                (void)e;
-            } catch (boost::thread_interrupted& err) {
-                break;
-            } catch (...) {
-            }
-        }
-        mo::ThreadSpecificQueue::cleanup();
-        MO_LOG(info) << "Gui thread shutting down naturally";
-    });
-    mo::setThreadName(gui_thread, "Gui-thread");
+        mo::setThreadName(gui_thread, "Gui-thread");
+    }
     mo::RelayManager manager;
 
     if (vm.count("plugins")) {
         currentDir = boost::filesystem::path(vm["plugins"].as<boost::filesystem::path>());
-        for (boost::filesystem::directory_iterator itr(currentDir); itr != end_itr; ++itr) {
-            if (boost::filesystem::is_regular_file(itr->path())) {
-#ifdef _MSC_VER
-                if (itr->path().extension() == ".dll")
-#else
-                if (itr->path().extension() == ".so")
-#endif
-                {
-                    std::string file = itr->path().string();
-                    mo::MetaObjectFactory::instance()->loadPlugin(file);
-                }
-            }
-        }
+        loadPluginDirectory(currentDir);
     }
 
-    if (vm["mode"].as<std::string>() == "batch") {
-
+    StatsRegistry::instance()->setPayloadBytes(vm["stats-bytes"].as<bool>());
+    if (vm.count("stats-file")) {
+        StatsRegistry::instance()->dumpEvery(vm["stats-file"].as<std::string>(), vm["stats-interval"].as<int>());
+    }
+    int exit_code = 0;
+    if (batch) {
+        exit_code = runBatch(vm, variable_replace_map, replace_map, quit);
     } else {
         std::vector<rcc::shared_ptr<aq::IDataStream> > _dataStreams;
         rcc::weak_ptr<aq::IDataStream>                 current_stream;
@@ -458,6 +470,7 @@ int main(int argc, char* argv[]) {
                          "    current         -- prints what is currently selected (default)\n"
                          "    signals         -- prints current signal map\n"
                          "    inputs          -- prints possible inputs\n"
+                         "    allocator       -- prints frame pool reuse per stream (--frame-pool)\n"
                          " - info             -- get info on given node\n"
                          " - set              -- Set a parameters value\n"
                          "    name value      -- name value pair to be applied to parameter\n"
@@ -473,6 +486,14 @@ int main(int argc, char* argv[]) {
                          " - help             -- Print this help\n"
                          " - quit             -- Close program and cleanup\n"
                          " - log              -- change logging level\n"
+                         " - stats            -- Prints per node latency and throughput of all streams\n"
+                         "    reset           -- clears the collected stats\n"
+                         "    dump [file] [ms]-- writes the stats as JSON to stdout or file, every ms milliseconds if given\n"
+                         "    stop            -- stops periodic dumps\n"
+                         "    bytes [on|off]  -- counts the MB in and out of every node\n"
+                         "    release         -- frees the frames cached by the frame pool\n"
+                         " - placement        -- Pins the threads of the current stream, and its frames to a NUMA node\n"
+                         "    cpus [node]     -- cores as \"0-7,16-23\" and optional NUMA node, \"none\" removes the placement\n"
                          " - link             -- add link directory\n"
                          " - recompile        \n"
                          "   check            -- checks if any files need to be recompiled\n"
@@ -517,6 +538,7 @@ int main(int argc, char* argv[]) {
                 }
                 auto ds = aq::IDataStream::create(doc, fg_override);
                 if (ds) {
+                    StatsRegistry::instance()->add(ds);
                     ds->startThread();
                     _dataStreams.push_back(ds);
                 }
@@ -543,6 +565,13 @@ int main(int argc, char* argv[]) {
                         } else {
                         }
                     }
+                    aq::ThreadPlacement policy;
+                    size_t              placed = 0;
+                    if (PlacementRegistry::instance()->get(itr.get(), policy, placed)) {
+                        std::cout << "   placement: " << policy.describe() << ", " << placed << " threads placed\n";
+                    } else {
+                        std::cout << "   placement: none\n";
+                    }
                 }
                 if (_dataStreams.empty())
                     std::cout << "No streams exist\n";
@@ -668,13 +697,18 @@ int main(int argc, char* argv[]) {
                     }
                 }
             }
+            if (what == "allocator") {
+                FramePool::instance()->print(std::cout);
+            }
             if(what == "status"){
                 if(current_stream){
                     std::cout << "Datastream modified: " << current_stream->getDirty() << std::endl;
+                    // Also picks up nodes added since the stream was loaded
+                    StreamStats*             stats = StatsRegistry::instance()->add(rcc::shared_ptr<aq::IDataStream>(current_stream));
                     auto                     nodes = current_stream->getNodes();
                     std::vector<std::string> printed;
                     for (auto node : nodes) {
-                        printStatus(node.get(), printed);
+                        printStatus(node.get(), printed, stats);
                     }
                 }
             }
@@ -743,7 +777,10 @@ int main(int argc, char* argv[]) {
                 replace_map["${config_file_dir}"] = boost::filesystem::path(file).parent_path().string();
                 auto streams                      = aq::IDataStream::load(file, variable_replace_map, replace_map, preset);
                 if (streams.size()) {
+                    // Placement is set before the threads start so that the first frames are already local
+                    PlacementRegistry::instance()->applyConfig(file, streams);
                     for (auto& stream : streams) {
+                        StatsRegistry::instance()->add(stream);
                         stream->startThread();
                         _dataStreams.push_back(stream);
                         if (quit_on_eos) {
@@ -910,6 +947,10 @@ int main(int argc, char* argv[]) {
                 if (current_stream) {
                     auto itr = std::find(_dataStreams.begin(), _dataStreams.end(), current_stream.get());
                     if (itr != _dataStreams.end()) {
+                        // The stream thread publishes into the registries until it is stopped
+                        current_stream->stopThread();
+                        StatsRegistry::instance()->remove(current_stream.get());
+                        PlacementRegistry::instance()->remove(current_stream.get());
                         _dataStreams.erase(itr);
                         current_stream.reset();
                         std::cout << "Sucessfully deleted stream\n";
@@ -937,6 +978,68 @@ int main(int argc, char* argv[]) {
 
         connections.push_back(manager.connect(slot, "delete"));
 
+        slot = new mo::TSlot<void(std::string)>(std::bind([&_dataStreams](std::string what) -> void {
+            std::stringstream ss(what);
+            std::string       command, file;
+            int               interval = 0;
+            ss >> command >> file >> interval;
+            if (command == "reset") {
+                for (auto& ds : _dataStreams) {
+                    StatsRegistry::instance()->add(ds)->reset();
+                }
+                FramePool::instance()->resetCounters();
+            } else if (command == "dump") {
+                if (file.empty()) {
+                    StatsRegistry::instance()->writeJson(std::cout);
+                } else if (interval > 0) {
+                    StatsRegistry::instance()->dumpEvery(file, interval);
+                } else if (!StatsRegistry::instance()->dump(file)) {
+                    std::cout << "Unable to write " << file << std::endl;
+                }
+            } else if (command == "stop") {
+                StatsRegistry::instance()->dumpEvery(std::string(), 0);
+            } else if (command == "bytes") {
+                StatsRegistry::instance()->setPayloadBytes(file != "off");
+            } else if (command == "release") {
+                FramePool::instance()->release();
+            } else {
+                for (auto& ds : _dataStreams) {
+                    StatsRegistry::instance()->add(ds)->print(std::cout);
+                }
+            }
+        },
+            std::placeholders::_1));
+        _slots.emplace_back(slot);
+        connections.push_back(manager.connect(slot, "stats"));
+
+        slot = new mo::TSlot<void(std::string)>(std::bind([&_dataStreams, &current_stream](std::string what) -> void {
+            if (!current_stream) {
+                std::cout << "Select a stream first\n";
+                return;
+            }
+            std::stringstream   ss(what);
+            std::string         cpus;
+            aq::ThreadPlacement policy;
+            ss >> cpus >> policy.numa_node;
+            if (cpus == "none") {
+                cpus.clear();
+                ss.clear();
+                policy.numa_node = -1;
+            }
+            if (!aq::ThreadPlacement::parseCpus(cpus, policy.cpus)) {
+                std::cout << "Invalid cpu list " << cpus << "\n";
+                return;
+            }
+            if (ss.fail())
+                policy.numa_node = -1;
+            const size_t index = std::find(_dataStreams.begin(), _dataStreams.end(), current_stream.get()) - _dataStreams.begin();
+            PlacementRegistry::instance()->set(rcc::shared_ptr<aq::IDataStream>(current_stream), policy, "stream " + std::to_string(index));
+            std::cout << "Placing stream on " << policy.describe() << "\n";
+        },
+            std::placeholders::_1));
+        _slots.emplace_back(slot);
+        connections.push_back(manager.connect(slot, "placement"));
+
         slot = new mo::TSlot<void(std::string)>(std::bind([&print_options](std::string) -> void { print_options(); }, std::placeholders::_1));
 
         connections.push_back(manager.connect(slot, "help"));
@@ -1292,7 +1395,11 @@ int main(int argc, char* argv[]) {
 
         print_options();
         bool compiling   = false;
+#ifdef AQ_STATIC_PLUGINS
+        bool rcc_enabled = false;
+#else
         bool rcc_enabled = !vm["disable-rcc"].as<bool>() && (vm.count("profile-for") == 0);
+#endif
         if (rcc_enabled)
             mo::MetaObjectFactory::instance()->checkCompile();
         auto compile_check_function = [&_dataStreams, &compiling, rcc_enabled]() {
@@ -1414,6 +1521,12 @@ int main(int argc, char* argv[]) {
         gui_thread.interrupt();
         gui_thread.join();
         mo::ThreadSpecificQueue::cleanup();
+        // Stream threads publish into the stats and placement registries until they are stopped
+        for (auto& stream : _dataStreams)
+            stream->stopThread();
+        StatsRegistry::instance()->dumpEvery(std::string(), 0);
+        StatsRegistry::instance()->clear();
+        PlacementRegistry::instance()->clear();
         _dataStreams.clear();
         MO_LOG(info) << "Gui thread shut down complete";
         mo::ThreadPool::instance()->cleanup();
@@ -1427,8 +1540,14 @@ int main(int argc, char* argv[]) {
         mo::Allocator::cleanupThreadSpecificAllocator();
         return 0;
     }
-    gui_thread.interrupt();
-    gui_thread.join();
+    // runBatch stops its streams before returning
+    StatsRegistry::instance()->dumpEvery(std::string(), 0);
+    StatsRegistry::instance()->clear();
+    PlacementRegistry::instance()->clear();
+    if (gui_thread.joinable()) {
+        gui_thread.interrupt();
+        gui_thread.join();
+    }
     mo::ThreadSpecificQueue::cleanup();
     MO_LOG(info) << "Gui thread shut down complete, cleaning up thread pool";
     mo::ThreadPool::instance()->cleanup();
@@ -1436,6 +1555,5 @@ int main(int argc, char* argv[]) {
     delete g_allocator;
     table.cleanUp();
     std::cout << "Program exiting" << std::endl;
-    std::cout << "Program exiting" << std::endl;
-    return 0;
+    return exit_code;
 }
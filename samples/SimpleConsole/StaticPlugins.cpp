@@ -0,0 +1,30 @@
+#include "StaticPlugins.hpp"
+#include <MetaObject/logging/logging.hpp>
+#include <MetaObject/object/MetaObjectFactory.hpp>
+
+#ifndef AQ_STATIC_PLUGINS
+const StaticPlugin* staticPlugins() {
+    static const StaticPlugin none[] = {{nullptr, nullptr, nullptr}};
+    return none;
+}
+#endif
+
+size_t registerStaticPlugins() {
+    mo::MetaObjectFactory::instance()->registerTranslationUnit();
+    size_t found = 0;
+    size_t total = 0;
+    for (const StaticPlugin* plugin = staticPlugins(); plugin->name; ++plugin) {
+        MO_LOG(debug) << plugin->build_info();
+        for (const char* const* cls = plugin->classes; *cls; ++cls) {
+            ++total;
+            if (mo::MetaObjectFactory::instance()->getConstructor(*cls)) {
+                ++found;
+            } else {
+                // Either dropped by the linker or its registration is compiled out for this configuration
+                MO_LOG(warning) << plugin->name << " lists " << *cls << " but it is not registered";
+            }
+        }
+    }
+    MO_LOG(info) << found << " of " << total << " statically linked classes registered";
+    return found;
+}
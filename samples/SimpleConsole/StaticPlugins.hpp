@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+
+// Plugins linked into GraphExecutorStatic.  Their classes register themselves with the executable's module
+// from static initializers that --whole-archive keeps, the table generated by cmake from their
+// MO_REGISTER_CLASS lines does not drive registration, it is only checked against what got registered.
+struct StaticPlugin {
+    const char* name;
+    const char* (*build_info)();
+    // Null terminated
+    const char* const* classes;
+};
+
+// Terminated by an entry with a null name, empty unless built with EAGLEEYE_STATIC_PLUGINS
+const StaticPlugin* staticPlugins();
+
+// Registers the classes linked into the executable with the factory and warns about every class of the table
+// that is missing, returns the number of classes found
+size_t registerStaticPlugins();
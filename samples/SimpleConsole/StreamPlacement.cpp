@@ -0,0 +1,142 @@
+#include "StreamPlacement.hpp"
+#include "FramePool.hpp"
+
+#include <Aquila/core/Logging.hpp>
+#include <Aquila/nodes/Node.hpp>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace {
+// Generation of the placement the calling thread last applied
+thread_local uint64_t t_placed_generation = 0;
+
+// Outputs published by threads the stream owns.  Nodes under a ParallelBranches run on the process wide work
+// stealing pool, whose threads serve every stream and must not be pinned to one of them.  A PipelineStage
+// publishes its output from its own worker, which belongs to the stream again.
+void ownedOutputs(aq::nodes::Node* node, bool shared, std::vector<mo::IParam*>& outputs) {
+    const std::string type = node->GetTypeName();
+    if (!shared) {
+        for (mo::IParam* output : node->getOutputs())
+            outputs.push_back(output);
+    } else if (type == "PipelineStage") {
+        if (mo::IParam* output = node->getOutput("output"))
+            outputs.push_back(output);
+    }
+    if (type == "ParallelBranches")
+        shared = true;
+    else if (type == "PipelineStage")
+        shared = false;
+    for (auto& child : node->getChildren())
+        ownedOutputs(child.get(), shared, outputs);
+}
+} // namespace
+
+PlacementRegistry* PlacementRegistry::instance() {
+    static PlacementRegistry registry;
+    return &registry;
+}
+
+void PlacementRegistry::onPublish(Entry* entry) {
+    // Every publish ends here, a thread already running with the current placement returns without locking
+    if (entry->generation.load(std::memory_order_acquire) == t_placed_generation)
+        return;
+    aq::ThreadPlacement policy;
+    std::string         name;
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        entry->placed.insert(std::this_thread::get_id());
+        policy              = entry->policy;
+        name                = entry->name;
+        t_placed_generation = entry->generation;
+    }
+    if (!policy.apply())
+        MO_LOG(warning) << "Unable to place a thread of " << name << " on " << policy.describe();
+    // Frames of this thread come from its own arena, which now lives on the stream's memory node
+    if (cv::Mat::getDefaultAllocator() == FramePool::instance())
+        FramePool::instance()->nameArena(name);
+}
+
+void PlacementRegistry::set(const rcc::shared_ptr<aq::IDataStream>& stream, const aq::ThreadPlacement& policy, const std::string& name) {
+    if (!stream)
+        return;
+    boost::mutex::scoped_lock lock(m_mtx);
+    std::unique_ptr<Entry>&   entry = m_entries[stream.get()];
+    if (!entry) {
+        entry.reset(new Entry());
+        Entry* ptr = entry.get();
+        entry->slot.reset(new UpdateSlot(
+            [this, ptr](mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags) {
+                onPublish(ptr);
+            }));
+    }
+    // Every thread is placed again with the new policy the next time it publishes
+    entry->policy = policy;
+    entry->name   = name;
+    entry->placed.clear();
+    entry->generation = ++m_generation;
+    std::vector<mo::IParam*> outputs;
+    for (auto& node : stream->getNodes())
+        ownedOutputs(node.get(), false, outputs);
+    for (mo::IParam* output : outputs) {
+        if (entry->hooked.insert(output).second)
+            entry->connections.push_back(output->registerUpdateNotifier(entry->slot.get()));
+    }
+}
+
+bool PlacementRegistry::get(const aq::IDataStream* stream, aq::ThreadPlacement& policy, size_t& placed_threads) {
+    boost::mutex::scoped_lock lock(m_mtx);
+    auto                      itr = m_entries.find(stream);
+    if (itr == m_entries.end())
+        return false;
+    policy         = itr->second->policy;
+    placed_threads = itr->second->placed.size();
+    return true;
+}
+
+void PlacementRegistry::remove(const aq::IDataStream* stream) {
+    boost::mutex::scoped_lock lock(m_mtx);
+    auto                      itr = m_entries.find(stream);
+    if (itr == m_entries.end())
+        return;
+    itr->second->connections.clear();
+    m_retired.push_back(std::move(itr->second));
+    m_entries.erase(itr);
+}
+
+void PlacementRegistry::clear() {
+    // Only once the streams are stopped, entries are freed here while a publishing thread could still use them
+    boost::mutex::scoped_lock lock(m_mtx);
+    m_entries.clear();
+    m_retired.clear();
+}
+
+size_t PlacementRegistry::applyConfig(const std::string& file, const std::vector<rcc::shared_ptr<aq::IDataStream> >& streams) {
+    boost::property_tree::ptree tree;
+    try {
+        boost::property_tree::read_json(file, tree);
+    } catch (boost::property_tree::json_parser_error&) {
+        return 0;
+    }
+    auto placements = tree.get_child_optional("placement");
+    if (!placements)
+        return 0;
+    size_t index  = 0;
+    size_t placed = 0;
+    for (auto& item : *placements) {
+        if (index >= streams.size())
+            break;
+        aq::ThreadPlacement policy;
+        const std::string cpus = item.second.get<std::string>("cpus", "");
+        policy.numa_node       = item.second.get<int>("numa_node", -1);
+        if (!aq::ThreadPlacement::parseCpus(cpus, policy.cpus)) {
+            MO_LOG(warning) << "Invalid cpu list '" << cpus << "' for stream " << index << " in " << file;
+        } else if (!policy.empty()) {
+            set(streams[index], policy, file + " stream " + boost::lexical_cast<std::string>(index));
+            ++placed;
+        }
+        ++index;
+    }
+    return placed;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <Aquila/core/IDataStream.hpp>
+#include <ThreadPlacement.hpp>
+
+#include <MetaObject/params/IParam.hpp>
+#include <MetaObject/signals/TSlot.hpp>
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Placement of every stream, the cores its threads run on and the NUMA node their memory comes from.
+// Frames are allocated by the stream threads, so with the thread's memory policy set the stream's frame
+// pool arena ends up on the local node as well.  Threads are placed the first time they publish an output
+// of the stream, which covers the stream thread, pipeline workers and the frame grabber's capture thread,
+// threads they start afterwards inherit the cpu set.  Threads of the shared work stealing pool are left
+// alone.  Writer threads follow their stream on their own.
+class PlacementRegistry {
+  public:
+    static PlacementRegistry* instance();
+
+    void set(const rcc::shared_ptr<aq::IDataStream>& stream, const aq::ThreadPlacement& policy, const std::string& name);
+    bool get(const aq::IDataStream* stream, aq::ThreadPlacement& policy, size_t& placed_threads);
+    void remove(const aq::IDataStream* stream);
+    // Frees every entry, the streams have to be stopped first
+    void clear();
+
+    // Applies the "placement" array of a launch config, entry i to the i-th stream loaded from it:
+    // "placement": [{"cpus": "0-7", "numa_node": 0}, {"cpus": "8-15", "numa_node": 1}]
+    // Returns the number of streams placed.
+    size_t applyConfig(const std::string& file, const std::vector<rcc::shared_ptr<aq::IDataStream> >& streams);
+
+  private:
+    typedef mo::TSlot<void(mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags)> UpdateSlot;
+
+    struct Entry {
+        aq::ThreadPlacement                        policy;
+        std::string                                name;
+        std::atomic<uint64_t>                      generation{0};
+        std::set<std::thread::id>                  placed;
+        std::set<mo::IParam*>                      hooked;
+        std::unique_ptr<UpdateSlot>                slot;
+        std::vector<std::shared_ptr<mo::Connection> > connections;
+    };
+
+    void onPublish(Entry* entry);
+
+    boost::mutex                                            m_mtx;
+    uint64_t                                                m_generation = 0;
+    std::map<const aq::IDataStream*, std::unique_ptr<Entry> > m_entries;
+    // Disconnected entries, kept since a publishing thread may still be about to use them
+    std::vector<std::unique_ptr<Entry> > m_retired;
+};
@@ -0,0 +1,121 @@
+#include "StreamRun.hpp"
+
+#include <MetaObject/object/MetaObjectFactory.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+void forEachNode(aq::IDataStream& stream, const std::function<void(aq::nodes::Node*)>& visit) {
+    std::vector<aq::nodes::Node*> pending;
+    for (auto& node : stream.getNodes())
+        pending.push_back(node.get());
+    while (!pending.empty()) {
+        aq::nodes::Node* current = pending.back();
+        pending.pop_back();
+        for (auto& child : current->getChildren())
+            pending.push_back(child.get());
+        visit(current);
+    }
+}
+
+size_t loadPluginDirectory(const boost::filesystem::path& dir) {
+    size_t found = 0;
+    if (!boost::filesystem::is_directory(dir))
+        return found;
+    boost::filesystem::directory_iterator end_itr;
+    for (boost::filesystem::directory_iterator itr(dir); itr != end_itr; ++itr) {
+        if (boost::filesystem::is_regular_file(itr->path())) {
+#ifdef _MSC_VER
+            if (itr->path().extension() == ".dll")
+#else
+            if (itr->path().extension() == ".so")
+#endif
+            {
+                mo::MetaObjectFactory::instance()->loadPlugin(itr->path().string());
+                ++found;
+            }
+        }
+    }
+    return found;
+}
+
+FrameTracker::FrameTracker(const rcc::shared_ptr<aq::IDataStream>& stream)
+    : m_stream(stream) {
+}
+
+FrameTracker::~FrameTracker() {
+    m_connections.clear();
+}
+
+void FrameTracker::attach(std::function<void()> notify) {
+    m_notify = notify;
+    m_update_slot.reset(new UpdateSlot(
+        [this](mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t fn, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags) {
+            onUpdate(fn);
+        }));
+    m_eos_slot.reset(new mo::TSlot<void()>([this]() {
+        m_eos = true;
+        if (m_notify)
+            m_notify();
+    }));
+    std::set<mo::IParam*> hooked;
+    forEachNode(*m_stream, [this, &hooked](aq::nodes::Node* node) {
+        for (mo::IParam* output : node->getOutputs()) {
+            if (hooked.insert(output).second)
+                m_connections.push_back(output->registerUpdateNotifier(m_update_slot.get()));
+        }
+    });
+    m_connections.push_back(m_stream->getRelayManager()->connect(m_eos_slot.get(), "eos"));
+}
+
+void FrameTracker::finish() {
+    m_connections.clear();
+    boost::mutex::scoped_lock lock(m_mtx);
+    retire(0);
+}
+
+bool FrameTracker::retire(size_t keep) {
+    bool any = false;
+    while (m_open.size() > keep) {
+        auto itr = m_open.begin();
+        if (m_measuring)
+            m_latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(itr->second.second - itr->second.first).count()));
+        ++m_retired;
+        m_open.erase(itr);
+        any = true;
+    }
+    return any;
+}
+
+void FrameTracker::onUpdate(size_t fn) {
+    const Clock::time_point now = Clock::now();
+    ++m_updates;
+    bool retired = false;
+    {
+        boost::mutex::scoped_lock lock(m_mtx);
+        if (!m_any_output) {
+            m_first_output = now;
+            m_any_output   = true;
+        }
+        m_last_output = now;
+        if (fn == std::numeric_limits<size_t>::max())
+            return;
+        auto itr = m_open.find(fn);
+        if (itr == m_open.end()) {
+            // Late output of an already retired frame
+            if (fn + open_frames < m_newest)
+                return;
+            m_open[fn] = std::make_pair(now, now);
+        } else {
+            itr->second.second = now;
+        }
+        m_newest = std::max(m_newest, fn);
+        while (!m_open.empty() && m_open.begin()->first + open_frames < m_newest)
+            retired = retire(m_open.size() - 1) || retired;
+    }
+    if (retired && m_notify)
+        m_notify();
+}
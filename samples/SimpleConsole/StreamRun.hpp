@@ -0,0 +1,90 @@
+#pragma once
+#include "NodeStats.hpp"
+
+#include <Aquila/core/IDataStream.hpp>
+#include <Aquila/nodes/Node.hpp>
+
+#include <MetaObject/params/IParam.hpp>
+#include <MetaObject/signals/TSlot.hpp>
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Pieces shared by the batch runner of the console and the perf_test benchmark, both run streams
+// headless and measure them from the outside.
+
+// Visits every node of the stream, children included
+void forEachNode(aq::IDataStream& stream, const std::function<void(aq::nodes::Node*)>& visit);
+
+// Loads every plugin library in dir, returns the number of libraries found
+size_t loadPluginDirectory(const boost::filesystem::path& dir);
+
+// End to end latency of the frames of one stream.  The latency of a frame is the time between the first
+// and the last output published with its frame number by any node of the stream.  A frame is retired
+// once it is open_frames frame numbers behind the newest, outputs of slow branches can still arrive until
+// then.  Every tracker has its own lock so that streams never wait on each other, readers merge the
+// trackers of a run after the streams stopped.
+class FrameTracker {
+  public:
+    typedef std::chrono::steady_clock Clock;
+    typedef mo::TSlot<void(mo::IParam*, mo::Context*, mo::OptionalTime_t, size_t, const std::shared_ptr<mo::ICoordinateSystem>&, mo::UpdateFlags)> UpdateSlot;
+
+    static const size_t open_frames = 16;
+
+    explicit FrameTracker(const rcc::shared_ptr<aq::IDataStream>& stream);
+    ~FrameTracker();
+
+    // Hooks every output of the stream and its end of stream signal, call before the stream starts.
+    // notify is called after a frame retires and at the end of stream, from the stream's threads.
+    void attach(std::function<void()> notify = std::function<void()>());
+    // Disconnects and retires the frames still open, call after the stream stopped.  They are only
+    // recorded if still measuring, turn measuring off first when the stop cut them off.
+    void finish();
+
+    // Only frames retired while measuring are recorded, on by default
+    void setMeasuring(bool measuring) { m_measuring = measuring; }
+
+    const rcc::shared_ptr<aq::IDataStream>& getStream() const { return m_stream; }
+    uint64_t                                updates() const { return m_updates; }
+    uint64_t                                retired() const { return m_retired; }
+    uint64_t                                measured() const { return m_latency.count(); }
+    bool                                    eos() const { return m_eos; }
+
+    // Valid after finish
+    const LatencyHistogram& latency() const { return m_latency; }
+    bool                    anyOutput() const { return m_any_output; }
+    Clock::time_point       firstOutput() const { return m_first_output; }
+    Clock::time_point       lastOutput() const { return m_last_output; }
+
+  private:
+    void onUpdate(size_t fn);
+    // Records the oldest frames until keep are left open, returns true if any was retired
+    bool retire(size_t keep);
+
+    rcc::shared_ptr<aq::IDataStream>              m_stream;
+    std::unique_ptr<UpdateSlot>                   m_update_slot;
+    std::unique_ptr<mo::TSlot<void()> >           m_eos_slot;
+    std::vector<std::shared_ptr<mo::Connection> > m_connections;
+    std::function<void()>                         m_notify;
+
+    boost::mutex                                                        m_mtx;
+    std::map<size_t, std::pair<Clock::time_point, Clock::time_point> > m_open;
+    size_t                                                              m_newest = 0;
+    Clock::time_point                                                   m_first_output;
+    Clock::time_point                                                   m_last_output;
+    bool                                                                m_any_output = false;
+
+    LatencyHistogram      m_latency;
+    std::atomic<uint64_t> m_updates{0};
+    std::atomic<uint64_t> m_retired{0};
+    std::atomic<bool>     m_measuring{true};
+    std::atomic<bool>     m_eos{false};
+};
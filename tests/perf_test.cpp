@@ -1,89 +1,616 @@
+// End to end benchmark of a node graph.  The graph of a config file is fed from a synthetic generator of
+// moving shapes or a recorded file at a fixed or unlimited rate, and per node and end to end throughput,
+// latency percentiles, cpu utilization and peak memory are written as JSON.  Given a baseline JSON from an
+// earlier run the exit code reports regressions, so CI can run it across the deployed plugins.
+//
+//   perf_test --config graph.yml --synthetic 1280x720 --frames 2000 --output run.json --baseline ref.json
+//
+// Exit codes: 0 ok, 1 the run failed, 2 a metric regressed past the tolerance.
+#include "NodeStats.hpp"
+#include "StreamRun.hpp"
 
-#include "Aquila/nodes/Node.hpp"
+#include "Aquila/rcc/SystemTable.hpp"
+#include <Aquila/core/Aquila.hpp>
+#include <Aquila/core/IDataStream.hpp>
+#include <Aquila/core/Logging.hpp>
+#include <Aquila/framegrabbers/IFrameGrabber.hpp>
+#include <Aquila/nodes/Node.hpp>
+#include <Aquila/types/SyncedMemory.hpp>
+
+#include <MetaObject/object/MetaObjectFactory.hpp>
+#include <MetaObject/params/ITParam.hpp>
+#include <MetaObject/params/ParamMacros.hpp>
+#include <MetaObject/thread/boost_thread.hpp>
+
+#include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace aq {
+namespace nodes {
+    // Frames of a few shapes drifting over a static textured background, deterministic for a given seed so
+    // that every run of a benchmark sees the same content.  Timestamps advance by frame_period_ms per frame.
+    class SyntheticSource : public Node {
+      public:
+        MO_DERIVE(SyntheticSource, Node)
+            PARAM(int, width, 1280)
+            PARAM(int, height, 720)
+            PARAM(int, shapes, 8)
+            PARAM(int, seed, 0)
+            PARAM(double, frame_period_ms, 1000.0 / 30.0)
+            OUTPUT(SyncedMemory, output, {})
+        MO_END
+
+      protected:
+        struct Shape {
+            cv::Point2f position;
+            cv::Point2f velocity;
+            float       size;
+            cv::Scalar  color;
+            bool        circle;
+        };
+
+        bool processImpl();
+        void reset();
+
+        cv::Mat            m_background;
+        std::vector<Shape> m_shapes;
+        size_t             m_frame = 0;
+    };
+} // namespace nodes
+} // namespace aq
+
+using namespace aq::nodes;
+
+void SyntheticSource::reset() {
+    m_background.create(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        cv::Vec3b* row = m_background.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < width; ++x) {
+            const uchar gx = static_cast<uchar>(x * 255 / std::max(width - 1, 1));
+            const uchar gy = static_cast<uchar>(y * 255 / std::max(height - 1, 1));
+            row[x]         = cv::Vec3b(gx, gy, static_cast<uchar>((gx ^ gy) / 2));
+        }
+    }
+    std::mt19937                          rng(static_cast<unsigned int>(seed));
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float                           extent = static_cast<float>(std::min(width, height));
+    m_shapes.resize(static_cast<size_t>(std::max(shapes, 0)));
+    for (Shape& shape : m_shapes) {
+        shape.position = cv::Point2f(unit(rng) * width, unit(rng) * height);
+        // Up to 1% of the frame per frame in either direction
+        shape.velocity = cv::Point2f((unit(rng) - 0.5f) * 0.02f * width, (unit(rng) - 0.5f) * 0.02f * height);
+        shape.size     = extent * (0.02f + 0.08f * unit(rng));
+        shape.color    = cv::Scalar(unit(rng) * 255, unit(rng) * 255, unit(rng) * 255);
+        shape.circle   = unit(rng) < 0.5f;
+    }
+    m_frame = 0;
+}
 
+bool SyntheticSource::processImpl() {
+    if (m_background.empty() || width_param.modified() || height_param.modified() || shapes_param.modified() || seed_param.modified()) {
+        reset();
+        width_param.modified(false);
+        height_param.modified(false);
+        shapes_param.modified(false);
+        seed_param.modified(false);
+    }
+    // A new buffer per frame, downstream nodes may still hold the previous one
+    cv::Mat frame = m_background.clone();
+    for (Shape& shape : m_shapes) {
+        shape.position += shape.velocity;
+        if (shape.position.x < 0 || shape.position.x >= width) {
+            shape.velocity.x = -shape.velocity.x;
+            shape.position.x = std::min(std::max(shape.position.x, 0.0f), static_cast<float>(width - 1));
+        }
+        if (shape.position.y < 0 || shape.position.y >= height) {
+            shape.velocity.y = -shape.velocity.y;
+            shape.position.y = std::min(std::max(shape.position.y, 0.0f), static_cast<float>(height - 1));
+        }
+        if (shape.circle) {
+            cv::circle(frame, shape.position, static_cast<int>(shape.size), shape.color, -1);
+        } else {
+            const cv::Point2f half(shape.size, shape.size * 0.6f);
+            cv::rectangle(frame, shape.position - half, shape.position + half, shape.color, -1);
+        }
+    }
+    const mo::Time_t ts(static_cast<double>(m_frame) * frame_period_ms * mo::ms);
+    output_param.updateData(frame, mo::tag::_timestamp = ts, mo::tag::_frame_number = m_frame, _ctx.get());
+    ++m_frame;
+    return true;
+}
+MO_REGISTER_CLASS(SyntheticSource)
 
+namespace {
 namespace po = boost::program_options;
-/*
-aq::nodes::Node::Ptr setVideoFile(aq::nodes::Node::Ptr node, const std::string& videoFile)
-{
-    if(node->getName() == "VideoLoader")
-    {
-        node->updateParameter<boost::filesystem::path>("Filename", boost::filesystem::path(videoFile));
-        node->updateParameter<bool>("Loop", false);
-        return node;
+typedef FrameTracker::Clock Clock;
+
+struct Usage {
+    double   cpu_seconds = 0.0;
+    uint64_t peak_rss    = 0;
+};
+
+Usage processUsage() {
+    Usage usage;
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        auto seconds = [](const FILETIME& time) {
+            return static_cast<double>((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+        };
+        usage.cpu_seconds = seconds(kernel) + seconds(user);
     }
-    for(size_t i = 0; i < node->children.size(); ++i)
-    {
-        auto retNode = setVideoFile(node->children[i], videoFile);
-        if(retNode != nullptr)
-        {
-            return retNode;
+    PROCESS_MEMORY_COUNTERS memory;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+        usage.peak_rss = memory.PeakWorkingSetSize;
+#else
+    rusage self;
+    if (getrusage(RUSAGE_SELF, &self) == 0) {
+        usage.cpu_seconds = self.ru_utime.tv_sec + self.ru_stime.tv_sec + (self.ru_utime.tv_usec + self.ru_stime.tv_usec) * 1e-6;
+#ifdef __APPLE__
+        usage.peak_rss = static_cast<uint64_t>(self.ru_maxrss);
+#else
+        usage.peak_rss = static_cast<uint64_t>(self.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return usage;
+}
+
+// Frames are tracked per stream so that streams never serialize on each other, the end to end numbers
+// are merged once the streams stopped
+struct BenchStream {
+    std::unique_ptr<FrameTracker> tracker;
+    std::unique_ptr<StreamStats>  stats;
+};
+
+template <class T>
+bool setParam(const rcc::shared_ptr<aq::nodes::Node>& node, const std::string& name, const T& value) {
+    auto typed = dynamic_cast<mo::ITParam<T>*>(node->getParam(name));
+    if (!typed)
+        return false;
+    typed->updateData(value);
+    return true;
+}
+
+// Feeds every unconnected input of the graph's top level nodes from the outputs of source with the same
+// type, returns the number of inputs connected
+size_t attachSource(const std::vector<rcc::shared_ptr<aq::nodes::Node> >& roots, const rcc::shared_ptr<aq::nodes::Node>& source) {
+    size_t connected = 0;
+    for (auto& root : roots) {
+        bool fed = false;
+        for (mo::InputParam* input : root->getInputs()) {
+            if (input->getInputParam())
+                continue;
+            for (mo::IParam* output : source->getOutputs()) {
+                if (output->getTypeInfo() == input->getTypeInfo() && root->connectInput(source, output, input)) {
+                    fed = true;
+                    ++connected;
+                    break;
+                }
+            }
         }
+        if (fed)
+            root->addParent(source.get());
     }
-    return aq::nodes::Node::Ptr();
+    return connected;
+}
+
+std::string number(double value) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3) << value;
+    return ss.str();
 }
 
-int main(int argc, char* argv[])
-{
+std::string jsonString(const std::string& str) {
+    std::string out = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string latencyJson(const LatencyHistogram& latency) {
+    std::stringstream ss;
+    ss << "{\"count\": " << latency.count() << ", \"mean\": " << number(latency.mean() / 1000.0)
+       << ", \"p50\": " << number(latency.percentile(0.5) / 1000.0) << ", \"p90\": " << number(latency.percentile(0.9) / 1000.0)
+       << ", \"p95\": " << number(latency.percentile(0.95) / 1000.0) << ", \"p99\": " << number(latency.percentile(0.99) / 1000.0)
+       << ", \"max\": " << number(latency.max() / 1000.0) << "}";
+    return ss.str();
+}
+
+// Compares a run against a baseline written by an earlier run, metrics missing from either are skipped.
+// Latencies get an absolute slack on top of the tolerance so that noise on sub millisecond nodes does not
+// fail the build.
+class BaselineCheck {
+  public:
+    BaselineCheck(const boost::property_tree::ptree& baseline, double tolerance, double slack_ms)
+        : m_baseline(baseline)
+        , m_tolerance(tolerance)
+        , m_slack_ms(slack_ms) {}
+
+    void higherIsBetter(const std::string& metric, const std::string& path, double current) {
+        auto base = m_baseline.get_optional<double>(path);
+        if (base)
+            add(metric, *base, current, current < *base * (1.0 - m_tolerance));
+    }
+
+    void lowerIsBetter(const std::string& metric, const std::string& path, double current, bool latency) {
+        auto base = m_baseline.get_optional<double>(path);
+        if (base)
+            add(metric, *base, current, current > *base * (1.0 + m_tolerance) + (latency ? m_slack_ms : 0.0));
+    }
+
+    void nodes(const std::map<std::string, std::pair<double, double> >& current) {
+        auto baseline_nodes = m_baseline.get_child_optional("nodes");
+        if (!baseline_nodes)
+            return;
+        for (auto& item : *baseline_nodes) {
+            const std::string name = item.second.get<std::string>("name", "");
+            auto              itr  = current.find(name);
+            if (itr == current.end()) {
+                std::cerr << "  " << name << " is not part of this run\n";
+                continue;
+            }
+            auto fps = item.second.get_optional<double>("fps");
+            if (fps)
+                add(name + " fps", *fps, itr->second.first, itr->second.first < *fps * (1.0 - m_tolerance));
+            auto p95 = item.second.get_optional<double>("latency_ms.p95");
+            if (p95)
+                add(name + " p95 ms", *p95, itr->second.second, itr->second.second > *p95 * (1.0 + m_tolerance) + m_slack_ms);
+        }
+    }
+
+    size_t regressions() const { return m_regressions; }
+
+  private:
+    void add(const std::string& metric, double base, double current, bool regressed) {
+        const double change = base != 0.0 ? 100.0 * (current - base) / base : 0.0;
+        std::cerr << std::left << std::setw(48) << metric << std::right << std::fixed << std::setprecision(3) << std::setw(14) << base
+                  << std::setw(14) << current << std::setprecision(1) << std::setw(9) << change << "%" << (regressed ? "  REGRESSION" : "")
+                  << "\n";
+        m_regressions += regressed ? 1 : 0;
+    }
+
+    const boost::property_tree::ptree& m_baseline;
+    double                             m_tolerance;
+    double                             m_slack_ms;
+    size_t                             m_regressions = 0;
+};
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // clang-format off
     po::options_description desc("Allowed options");
     desc.add_options()
-            ("Help", "Produce help message")
-            ("nodeFile", po::value<std::string>(), "Set input file describing node map")
-            ("videoFile",po::value<std::string>(), "Set file to process")
-            ("loop", po::value<bool>(), "flag to loop video, defaults to false");
+            ("help", "Produce help message")
+            ("config", po::value<std::string>(), "Node graph to benchmark")
+            ("preset", po::value<std::string>()->default_value("Default"), "Preset config file setting")
+            ("synthetic", po::value<std::string>(), "Feed the graph synthetic WIDTHxHEIGHT frames of moving shapes")
+            ("shapes", po::value<int>()->default_value(8), "Number of moving shapes in synthetic frames")
+            ("seed", po::value<int>()->default_value(0), "Seed of the synthetic shapes")
+            ("file", po::value<std::string>(), "Feed the graph from a recorded file, without --synthetic or --file the config's own source is used")
+            ("rate", po::value<double>()->default_value(0.0), "Frames per second fed to the graph, 0 for unlimited")
+            ("frames", po::value<size_t>()->default_value(1000), "Frames to measure, summed over the streams of the config")
+            ("warmup", po::value<size_t>()->default_value(50), "Frames per stream processed before measuring starts")
+            ("duration", po::value<double>()->default_value(0.0), "Stop after this many seconds of measuring, 0 for no limit")
+            ("stall-timeout", po::value<int>()->default_value(30), "Seconds without any output before the run fails")
+            ("plugins", po::value<boost::filesystem::path>(), "Plugin directory, defaults to Plugins next to the executable")
+            ("output", po::value<std::string>(), "Write the results JSON to this file instead of stdout")
+            ("baseline", po::value<std::string>(), "Results JSON of an earlier run to compare against")
+            ("tolerance", po::value<double>()->default_value(10.0), "Percent a metric may regress from the baseline")
+            ("latency-slack", po::value<double>()->default_value(0.5), "Milliseconds a latency may additionally regress from the baseline");
+    // clang-format on
     po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
-    po::notify(vm);
-    if(vm.count("help") || vm.count("nodeFile") == 0)
-    {
+    auto              parsed_options = po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
+    po::store(parsed_options, vm);
+    if (vm.count("help") || !vm.count("config")) {
         std::cout << desc << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+    if (vm.count("synthetic") && vm.count("file")) {
+        std::cerr << "Only one of --synthetic and --file can feed the graph" << std::endl;
         return 1;
     }
+    int width = 0, height = 0;
+    if (vm.count("synthetic")) {
+        const std::string size = vm["synthetic"].as<std::string>();
+        char              x    = 0;
+        std::stringstream ss(size);
+        if (!(ss >> width >> x >> height) || x != 'x' || width <= 0 || height <= 0) {
+            std::cerr << "Invalid synthetic frame size '" << size << "', expected WIDTHxHEIGHT" << std::endl;
+            return 1;
+        }
+    }
 
-    auto nodes = aq::NodeManager::getInstance().loadNodes(vm["nodeFile"].as<std::string>());
-    aq::NodeManager::getInstance().printNodeTree();
-    aq::nodes::Node::Ptr playbackNode;
-    bool loop = false;
-    if(vm.count("loop"))
-    {
-        loop = vm["loop"].as<bool>();
+    aq::Init();
+    SystemTable table;
+    mo::MetaObjectFactory::instance(&table);
+    mo::MetaObjectFactory::instance()->registerTranslationUnit();
+#ifdef _MSC_VER
+#ifdef _DEBUG
+    mo::MetaObjectFactory::instance()->loadPlugin("aquila_cored.dll");
+#else
+    mo::MetaObjectFactory::instance()->loadPlugin("aquila_core.dll");
+#endif
+#else
+#ifdef NDEBUG
+    mo::MetaObjectFactory::instance()->loadPlugin("aquila_core.so");
+#else
+    mo::MetaObjectFactory::instance()->loadPlugin("aquila_cored.so");
+#endif
+#endif
+    boost::filesystem::path plugin_dir = boost::filesystem::path(argv[0]).parent_path() / "Plugins";
+    if (vm.count("plugins"))
+        plugin_dir = vm["plugins"].as<boost::filesystem::path>();
+    loadPluginDirectory(plugin_dir);
+
+    // Same config substitutions as the console, name:=value for strings and --name=value for variables
+    std::map<std::string, std::string> replace_map;
+    std::map<std::string, std::string> variable_replace_map;
+    const std::string                  config = vm["config"].as<std::string>();
+    replace_map["${config_file_dir}"]         = boost::filesystem::path(config).parent_path().string();
+    for (auto& option : po::collect_unrecognized(parsed_options.options, po::include_positional)) {
+        auto pos = option.find(":=");
+        if (pos != std::string::npos) {
+            replace_map["${" + option.substr(0, pos) + "}"] = option.substr(pos + 2);
+            continue;
+        }
+        pos = option.find("=");
+        if (option.find("--") == 0 && pos != std::string::npos)
+            variable_replace_map[option.substr(2, pos - 2)] = option.substr(pos + 1);
     }
-    if(vm.count("videoFile"))
-    {
-        std::string fileName = vm["videoFile"].as<std::string>();
-        for(size_t i = 0; i < nodes.size(); ++i)
-        {
-           aq::nodes::Node::Ptr tmpNode = setVideoFile(nodes[i], fileName);
-           if(tmpNode != nullptr)
-           {
-               playbackNode = tmpNode;
-               playbackNode->updateParameter("Loop", loop);
-           }
+
+    auto loaded = aq::IDataStream::load(config, variable_replace_map, replace_map, vm["preset"].as<std::string>());
+    if (loaded.empty()) {
+        MO_LOG(error) << "Load of " << config << " failed";
+        return 1;
+    }
+
+    const double rate        = std::max(vm["rate"].as<double>(), 0.0);
+    std::string  source_name = "config";
+    if (vm.count("synthetic"))
+        source_name = "synthetic " + vm["synthetic"].as<std::string>();
+    if (vm.count("file"))
+        source_name = vm["file"].as<std::string>();
+    if (source_name == "config" && rate > 0.0)
+        MO_LOG(warning) << "--rate only applies to --synthetic and --file sources, the config's own source runs at its own rate";
+
+    boost::mutex                               mtx;
+    boost::condition_variable                  cv;
+    const size_t                               warmup = vm["warmup"].as<size_t>() * loaded.size();
+    std::vector<std::unique_ptr<BenchStream> > streams;
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        const rcc::shared_ptr<aq::IDataStream>& stream = loaded[i];
+        if (source_name != "config") {
+            const std::vector<rcc::shared_ptr<aq::nodes::Node> > roots = stream->getTopLevelNodes();
+            rcc::shared_ptr<aq::nodes::Node>                     source;
+            if (vm.count("synthetic")) {
+                source = mo::MetaObjectFactory::instance()->create("SyntheticSource");
+                if (source) {
+                    setParam<int>(source, "width", width);
+                    setParam<int>(source, "height", height);
+                    setParam<int>(source, "shapes", vm["shapes"].as<int>());
+                    setParam<int>(source, "seed", vm["seed"].as<int>() + static_cast<int>(i));
+                    if (rate > 0.0)
+                        setParam<double>(source, "frame_period_ms", 1000.0 / rate);
+                }
+            } else {
+                source = aq::nodes::IFrameGrabber::create(source_name, "");
+            }
+            if (!source) {
+                MO_LOG(error) << "Unable to create a source for " << source_name;
+                return 1;
+            }
+            // The limiter runs before the source so that its wait is not part of a frame's latency
+            if (rate > 0.0) {
+                rcc::shared_ptr<aq::nodes::Node> limiter = mo::MetaObjectFactory::instance()->create("FrameLimiter");
+                if (!limiter || !setParam<double>(limiter, "desired_framerate", rate)) {
+                    MO_LOG(error) << "Unable to create a FrameLimiter, is the Core plugin in " << plugin_dir.string() << "?";
+                    return 1;
+                }
+                stream->addNode(limiter);
+                source->addParent(limiter.get());
+            } else {
+                stream->addNode(source);
+            }
+            if (!attachSource(roots, source)) {
+                MO_LOG(error) << config << " has no unconnected input for " << source_name
+                              << ", run without --synthetic and --file to use the config's own source";
+                return 1;
+            }
         }
-        if(playbackNode == nullptr)
-        {
-            std::cout << "Error, no video playback node defined" << std::endl;
-            return 1;
+        std::unique_ptr<BenchStream> bench(new BenchStream());
+        bench->tracker.reset(new FrameTracker(stream));
+        // Warmup frames are not measured, the main loop turns measuring on once enough retired
+        bench->tracker->setMeasuring(false);
+        // Only wakes the main loop early, it polls the trackers anyway so a missed notification costs one period
+        bench->tracker->attach([&cv]() { cv.notify_all(); });
+        bench->stats.reset(new StreamStats(stream));
+        streams.push_back(std::move(bench));
+    }
+
+    const size_t      frames        = vm["frames"].as<size_t>();
+    const double      duration      = vm["duration"].as<double>();
+    const int         stall_timeout = vm["stall-timeout"].as<int>();
+    Usage             usage_start;
+    Clock::time_point start;
+    for (auto& bench : streams)
+        bench->tracker->getStream()->startThread();
+
+    bool   stalled   = false;
+    bool   ended     = false;
+    bool   measuring = false;
+    size_t retired   = 0;
+    size_t measured  = 0;
+    {
+        boost::mutex::scoped_lock lock(mtx);
+        Clock::time_point         last_progress = Clock::now();
+        size_t                    last_updates  = 0;
+        while (true) {
+            const Clock::time_point now     = Clock::now();
+            size_t                  updates = 0;
+            retired                         = 0;
+            measured                        = 0;
+            ended                           = true;
+            for (auto& bench : streams) {
+                updates += bench->tracker->updates();
+                retired += bench->tracker->retired();
+                measured += bench->tracker->measured();
+                ended = ended && bench->tracker->eos();
+            }
+            if (!measuring && retired >= warmup) {
+                for (auto& bench : streams) {
+                    bench->stats->reset();
+                    bench->tracker->setMeasuring(true);
+                }
+                usage_start = processUsage();
+                start       = now;
+                measuring   = true;
+            }
+            if (ended || (measuring && measured >= frames))
+                break;
+            if (measuring && duration > 0.0 && std::chrono::duration<double>(now - start).count() >= duration)
+                break;
+            if (updates != last_updates) {
+                last_updates  = updates;
+                last_progress = now;
+            }
+            if (stall_timeout > 0 && now - last_progress > std::chrono::seconds(stall_timeout)) {
+                stalled = true;
+                break;
+            }
+            cv.wait_for(lock, boost::chrono::milliseconds(100));
         }
+    }
+    // Measuring ends here, frames still open are cut off by the stop and are not recorded.  The wall clock
+    // and the cpu time are read at the same moment so that cores and fps cover the same span.
+    for (auto& bench : streams)
+        bench->tracker->setMeasuring(false);
+    const Clock::time_point end       = Clock::now();
+    const Usage             usage_end = processUsage();
+    for (auto& bench : streams)
+        bench->tracker->getStream()->stopThread();
 
+    LatencyHistogram latency;
+    for (auto& bench : streams) {
+        bench->tracker->finish();
+        latency.merge(bench->tracker->latency());
+    }
+    measured = latency.count();
+    if (stalled) {
+        MO_LOG(error) << "No output for " << stall_timeout << " seconds, aborting benchmark";
+        return 1;
+    }
+    if (!measuring || !measured) {
+        MO_LOG(error) << "No frames measured, the run " << (ended ? "ended" : "stopped") << " after " << retired << " frames";
+        return 1;
+    }
+    if (measured < frames)
+        MO_LOG(warning) << "Only " << measured << " of " << frames << " frames measured" << (ended ? ", end of stream reached" : "");
+
+    const double seconds  = std::max(std::chrono::duration<double>(end - start).count(), 1e-6);
+    const double cpu      = usage_end.cpu_seconds - usage_start.cpu_seconds;
+    const double cores    = cpu / seconds;
+    const double hardware = std::max(std::thread::hardware_concurrency(), 1u);
 
+    // Nodes are sorted by name so that runs diff cleanly, node names get a stream prefix with several streams
+    std::map<std::string, const NodeStats*> nodes;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        forEachNode(*streams[i]->tracker->getStream(), [&](aq::nodes::Node* node) {
+            const NodeStats* stats = streams[i]->stats->find(node->getTreeName());
+            if (stats && stats->has_outputs)
+                nodes[(streams.size() > 1 ? "stream" + std::to_string(i) + "/" : std::string()) + stats->name] = stats;
+        });
+    }
 
+    std::stringstream json;
+    json << "{\n"
+         << "  \"config\": " << jsonString(config) << ",\n"
+         << "  \"source\": " << jsonString(source_name) << ",\n"
+         << "  \"rate\": " << number(rate) << ",\n"
+         << "  \"streams\": " << streams.size() << ",\n"
+         << "  \"hardware_threads\": " << static_cast<unsigned>(hardware) << ",\n"
+         << "  \"frames\": " << measured << ",\n"
+         << "  \"seconds\": " << number(seconds) << ",\n"
+         << "  \"end_to_end\": {\"fps\": " << number(measured / seconds) << ", \"latency_ms\": " << latencyJson(latency) << "},\n"
+         << "  \"cpu\": {\"seconds\": " << number(cpu) << ", \"cores\": " << number(cores) << ", \"utilization\": " << number(cores / hardware)
+         << ", \"ms_per_frame\": " << number(1000.0 * cpu / measured) << "},\n"
+         << "  \"peak_rss_mb\": " << number(usage_end.peak_rss / (1024.0 * 1024.0)) << ",\n"
+         << "  \"nodes\": [";
+    std::map<std::string, std::pair<double, double> > node_metrics;
+    size_t                                            index = 0;
+    for (auto& node : nodes) {
+        const double fps = node.second->calls / seconds;
+        // Nodes run concurrently have no latency, a p95 of 0 never counts as a regression
+        node_metrics[node.first] = std::make_pair(fps, node.second->measured ? node.second->latency.percentile(0.95) / 1000.0 : 0.0);
+        json << (index++ ? "," : "") << "\n    {\"name\": " << jsonString(node.first) << ", \"fps\": " << number(fps)
+             << ", \"calls\": " << node.second->calls << ", \"skips\": " << node.second->skips
+             << ", \"latency_ms\": " << (node.second->measured ? latencyJson(node.second->latency) : std::string("null")) << "}";
+    }
+    json << (nodes.empty() ? "" : "\n  ") << "]\n}\n";
 
-        std::vector<cv::cuda::GpuMat> images(nodes.size());
-        std::vector<cv::cuda::Stream> streams(nodes.size());
-        while(!(*playbackNode->getParameter<bool>("End of video")->Data()))
-        {
-            for(size_t i = 0; i < nodes.size(); ++i)
-            {
-                images[i] = nodes[i]->process(images[i], streams[i]);
-            }
+    if (vm.count("output")) {
+        std::ofstream ofs(vm["output"].as<std::string>());
+        if (!ofs.is_open()) {
+            MO_LOG(error) << "Unable to write " << vm["output"].as<std::string>();
+            return 1;
         }
+        ofs << json.str();
+    } else {
+        std::cout << json.str() << std::flush;
     }
-    return 0;
-}*/
-int main()
-{
 
+    if (!vm.count("baseline"))
+        return 0;
+    boost::property_tree::ptree baseline;
+    try {
+        boost::property_tree::read_json(vm["baseline"].as<std::string>(), baseline);
+    } catch (boost::property_tree::json_parser_error& e) {
+        MO_LOG(error) << "Unable to read baseline: " << e.what();
+        return 1;
+    }
+    if (baseline.get<std::string>("source", source_name) != source_name || baseline.get<double>("rate", rate) != rate)
+        MO_LOG(warning) << "The baseline was recorded with a different source or rate";
+    // Results are compared as is, the baseline should come from the same machine class
+    std::cerr << std::left << std::setw(48) << "metric" << std::right << std::setw(14) << "baseline" << std::setw(14) << "current" << std::setw(10)
+              << "change" << "\n";
+    BaselineCheck check(baseline, vm["tolerance"].as<double>() / 100.0, vm["latency-slack"].as<double>());
+    check.higherIsBetter("end to end fps", "end_to_end.fps", measured / seconds);
+    check.lowerIsBetter("end to end p50 ms", "end_to_end.latency_ms.p50", latency.percentile(0.5) / 1000.0, true);
+    check.lowerIsBetter("end to end p95 ms", "end_to_end.latency_ms.p95", latency.percentile(0.95) / 1000.0, true);
+    check.lowerIsBetter("end to end p99 ms", "end_to_end.latency_ms.p99", latency.percentile(0.99) / 1000.0, true);
+    check.lowerIsBetter("cpu ms per frame", "cpu.ms_per_frame", 1000.0 * cpu / measured, false);
+    check.lowerIsBetter("peak rss mb", "peak_rss_mb", usage_end.peak_rss / (1024.0 * 1024.0), false);
+    check.nodes(node_metrics);
+    if (check.regressions()) {
+        std::cerr << check.regressions() << " metrics regressed by more than " << vm["tolerance"].as<double>() << "%" << std::endl;
+        return 2;
+    }
     return 0;
 }